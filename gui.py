@@ -10,6 +10,8 @@ import matplotlib.pyplot as plt
 from matplotlib.animation import FuncAnimation
 from collections import deque
 import matplotlib
+import sensor_frames
+import log_decoder
 matplotlib.use('TkAgg')
 
 class STMMonitor:
@@ -41,6 +43,13 @@ class STMMonitor:
         self.mag_y_data = deque(maxlen = mag_buffer)
         self.mag_z_data = deque(maxlen = mag_buffer)
         self.mag_time = deque(maxlen = mag_buffer)
+
+        # Orientation from quaternion frames, roll/pitch/yaw in the x/y/z deques
+        self.quat_x_data = deque(maxlen = gyro_buffer)
+        self.quat_y_data = deque(maxlen = gyro_buffer)
+        self.quat_z_data = deque(maxlen = gyro_buffer)
+        self.quat_time = deque(maxlen = gyro_buffer)
+        self.quat_sequence = None
         
         self.plot_active = False
         self.fig = None
@@ -49,6 +58,13 @@ class STMMonitor:
         self.lines = []
         self.last_update = time.time()
 
+        # v2 frames: last sequence and timestamp per sensor, for loss and sample spacing
+        self.frame_sequence = {}
+        self.frame_time = {}
+        self.frame_period = {}
+        self.frame_count = {}
+        self.log_decoder = log_decoder.LogDecoder()
+
     def setup_gui(self):
         control_frame = ttk.Frame(self.root)
         control_frame.pack(fill=tk.X, padx=5, pady=5)
@@ -75,6 +91,8 @@ class STMMonitor:
                        variable=self.selected_sensor).pack(side=tk.LEFT)
         ttk.Radiobutton(graph_control_frame, text="Magnetometer", value="mag", 
                        variable=self.selected_sensor).pack(side=tk.LEFT)
+        ttk.Radiobutton(graph_control_frame, text="Orientation", value="quat",
+                       variable=self.selected_sensor).pack(side=tk.LEFT)
         
         self.graph_button = ttk.Button(control_frame, text="Toggle Graph", command=self.toggle_graph)
         self.graph_button.pack(side=tk.LEFT, padx=5)
@@ -93,6 +111,9 @@ class STMMonitor:
         elif sensor == "acc":
             self.ax.set_ylim(-4, 4)
             self.ax.set_title('Accelerometer (g)')
+        elif sensor == "quat":
+            self.ax.set_ylim(-180, 180)
+            self.ax.set_title('Orientation (roll X, pitch Y, yaw Z, degrees)')
         else:  # mag
             self.ax.set_ylim(-1.5, 1.5)
             self.ax.set_title('Magnetometer (gauss)')
@@ -171,6 +192,11 @@ class STMMonitor:
                 data_x = self.mag_x_data
                 data_y = self.mag_y_data
                 data_z = self.mag_z_data
+            elif sensor == "quat" and len(self.quat_time) > 0:
+                time_data = self.quat_time
+                data_x = self.quat_x_data
+                data_y = self.quat_y_data
+                data_z = self.quat_z_data
             else:
                 return self.lines
 
@@ -194,71 +220,126 @@ class STMMonitor:
         
         return self.lines
 
+    def handle_sample(self, sensor, label, x, y, z, sample_time):
+        if sensor == "gyro":
+            sensitivity = 500.0 / 32768.0   # Convert raw values to ±500 DPS range (16-bit)
+            name, unit = "GYRO", "DPS"
+        elif sensor == "acc":
+            sensitivity = 4.0 / 32768.0
+            name, unit = "ACCEL", "g"
+        else:
+            sensitivity = 50.0 / 32768.0
+            name, unit = "MAG", "gauss"
+        values = {
+            'x': x * sensitivity,
+            'y': y * sensitivity,
+            'z': z * sensitivity
+        }
+        self.log_debug(f"{name} Binary #{label}: {unit}(X={values['x']:.3f}, Y={values['y']:.3f}, Z={values['z']:.3f})")
+
+        if self.plot_active:
+            getattr(self, f"{sensor}_time").append(sample_time)
+            getattr(self, f"{sensor}_x_data").append(values['x'])
+            getattr(self, f"{sensor}_y_data").append(values['y'])
+            getattr(self, f"{sensor}_z_data").append(values['z'])
+
     def handle_binary_data(self, data):
         try:
-            # Unpack binary data: header (2 bytes) + packet number and xyz values (8 bytes)
-            header = struct.unpack('<H', data[0:2])[0]
-            packet, x, y, z = struct.unpack('<Hhhh', data[2:10])
-            current_time = time.time() 
-            
-            # Gyroscope data
-            if header == 0xCCCC:
-                sensitivity = 500.0 / 32768.0   # Convert raw values to ±500 DPS range (16-bit)
-                values = {
-                    'x': x * sensitivity,
-                    'y': y * sensitivity,
-                    'z': z * sensitivity
-                }
-                self.log_debug(f"GYRO Binary #{packet}: DPS(X={values['x']:.3f}, Y={values['y']:.3f}, Z={values['z']:.3f})")
-                
-                if self.plot_active:
-                    self.gyro_time.append(current_time)
-                    self.gyro_x_data.append(values['x'])
-                    self.gyro_y_data.append(values['y'])
-                    self.gyro_z_data.append(values['z'])
-
-            # Accelerometer data
-            elif header == 0xBBBB:  # HEADER_ACC
-                sensitivity = 4.0 / 32768.0
-                values = {
-                    'x': x * sensitivity,
-                    'y': y * sensitivity,
-                    'z': z * sensitivity
-                }
-                self.log_debug(f"ACCEL Binary #{packet}: g(X={values['x']:.3f}, Y={values['y']:.3f}, Z={values['z']:.3f})")
-                
-                if self.plot_active:
-                    self.acc_time.append(current_time)
-                    self.acc_x_data.append(values['x'])
-                    self.acc_y_data.append(values['y'])
-                    self.acc_z_data.append(values['z'])
-
-            # Magnetometer data
-            elif header == 0xAAAB:
-                sensitivity = 50.0 / 32768.0 
-                values = {
-                    'x': x * sensitivity,
-                    'y': y * sensitivity,
-                    'z': z * sensitivity
-                }
-                self.log_debug(f"MAG Binary #{packet}: gauss(X={values['x']:.3f}, Y={values['y']:.3f}, Z={values['z']:.3f})")
-                
-                if self.plot_active:
-                    self.mag_time.append(current_time)
-                    self.mag_x_data.append(values['x'])
-                    self.mag_y_data.append(values['y'])
-                    self.mag_z_data.append(values['z'])
-
+            # header (2 bytes) + packet number and xyz values (8 bytes)
+            decoded = sensor_frames.decode_v1(data)
+            if decoded is not None:
+                sensor, packet, (x, y, z) = decoded
+                self.handle_sample(sensor, packet, x, y, z, time.time())
         except struct.error as e:
             self.log_debug(f"Binary parse error: {str(e)}")
 
+    def handle_frame_v2(self, frame):
+        sensor = frame['sensor']
+        sequence = frame['sequence']
+        count = len(frame['samples'])
+        timestamp = frame['timestamp_us'] / 1e6
+
+        expected = self.frame_sequence.get(sensor)
+        if expected is not None and sequence != expected:
+            self.log_debug(f"{sensor}: {(sequence - expected) & 0xFFFFFFFF} samples lost")
+        elif expected is not None and timestamp > self.frame_time[sensor]:
+            # consecutive frames: the previous frame's samples span the gap between their timestamps
+            self.frame_period[sensor] = (timestamp - self.frame_time[sensor]) / self.frame_count[sensor]
+        self.frame_sequence[sensor] = (sequence + count) & 0xFFFFFFFF
+        self.frame_time[sensor] = timestamp
+        self.frame_count[sensor] = count
+
+        period = self.frame_period.get(sensor, 0.0)
+        for n, (x, y, z) in enumerate(frame['samples']):
+            self.handle_sample(sensor, sequence + n, x, y, z, timestamp + n * period)
+
+    def handle_quaternion(self, frame):
+        sequence = frame['sequence']
+        if self.quat_sequence is not None and sequence != self.quat_sequence:
+            self.log_debug(f"quat: {(sequence - self.quat_sequence) & 0xFFFFFFFF} updates lost")
+        self.quat_sequence = (sequence + 1) & 0xFFFFFFFF
+
+        roll, pitch, yaw = sensor_frames.quaternion_to_euler(frame['q'])
+        self.log_debug(f"QUAT #{sequence}: roll={roll:.1f} pitch={pitch:.1f} yaw={yaw:.1f}")
+        if self.plot_active:
+            self.quat_time.append(frame['timestamp_us'] / 1e6)
+            self.quat_x_data.append(roll)
+            self.quat_y_data.append(pitch)
+            self.quat_z_data.append(yaw)
+
     def read_serial(self):
         buffer = bytearray()
         while self.running:
             if self.serial_port.in_waiting:
                 byte = self.serial_port.read()
                 buffer.extend(byte)
-                
+
+                # Deferred log record
+                if len(buffer) >= 2 and buffer[0] == 0x4C and buffer[1] == 0xA5:
+                    text, consumed = self.log_decoder.decode(buffer)
+                    if text is not None:
+                        self.log_debug(text)
+                    if consumed:
+                        buffer = buffer[consumed:]
+                    continue
+
+                # Batched v2 frame, checked by CRC
+                if len(buffer) >= 2 and buffer[0] == 0x5A and buffer[1] == 0xA5:
+                    frame, consumed = sensor_frames.decode_v2(buffer)
+                    if frame is not None:
+                        self.handle_frame_v2(frame)
+                    if consumed:
+                        buffer = buffer[consumed:]
+                    continue
+
+                # Orientation from the on-device filter, checked by CRC
+                if len(buffer) >= 2 and buffer[0] == 0x51 and buffer[1] == 0xA5:
+                    frame, consumed = sensor_frames.decode_quaternion(buffer)
+                    if frame is not None:
+                        self.handle_quaternion(frame)
+                    if consumed:
+                        buffer = buffer[consumed:]
+                    continue
+
+                # Window summary of one sensor, checked by CRC
+                if len(buffer) >= 2 and buffer[0] == 0x52 and buffer[1] == 0xA5:
+                    frame, consumed = sensor_frames.decode_summary(buffer)
+                    if frame is not None:
+                        self.log_debug(f"SUM {sensor_frames.format_summary(frame)}")
+                    if consumed:
+                        buffer = buffer[consumed:]
+                    continue
+
+                # Vibration spectrum report, checked by CRC
+                if len(buffer) >= 2 and buffer[0] == 0x53 and buffer[1] == 0xA5:
+                    frame, consumed = sensor_frames.decode_spectrum(buffer)
+                    if frame is not None:
+                        self.log_debug(f"SPECTRUM #{frame['sequence']} fs={frame['rate_hz']:.0f} Hz  "
+                                       f"{sensor_frames.format_spectrum_peaks(frame)}")
+                    if consumed:
+                        buffer = buffer[consumed:]
+                    continue
+
                 # Check for complete binary packet (10 bytes)
                 if len(buffer) >= 10:
                     header = (buffer[1] << 8) | buffer[0]
@@ -0,0 +1,69 @@
+"""Decoder for the deferred log frames the STM32 sends in the CDC stream.
+
+Frame: 0xA54C, id (uint16), HAL tick (uint32, ms), arg0, arg1 (uint32),
+CRC-16/CCITT-FALSE over everything before it; all little endian.
+Message formats come from stm32_modul/Core/Inc/log_ids.h, the entry index is the id.
+
+Usage: python log_decoder.py capture.bin   (decodes log frames in a raw capture)
+"""
+import os
+import re
+import struct
+import sys
+
+from sensor_frames import crc16_ccitt
+
+HEADER_LOG = 0xA54C
+LOG_FRAME_SIZE = 18
+LOG_IDS_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                            'stm32_modul', 'Core', 'Inc', 'log_ids.h')
+
+
+def load_formats(path=LOG_IDS_PATH):
+    """Returns [(name, python format string)] in id order"""
+    with open(path, encoding='utf-8') as f:
+        entries = re.findall(r'X\((\w+),\s*"((?:[^"\\]|\\.)*)"\)', f.read())
+    # printf integer specifiers -> python % formatting, long is 32 bits on the device
+    return [(name, re.sub(r'%l?([udx])', r'%\1', fmt)) for name, fmt in entries]
+
+
+class LogDecoder:
+    def __init__(self, path=LOG_IDS_PATH):
+        self.formats = load_formats(path)
+
+    def decode(self, buffer):
+        """Returns (text, bytes consumed), (None, 0) if more data is needed,
+        or (None, 1) if the buffer does not start with a valid log frame."""
+        if len(buffer) < LOG_FRAME_SIZE:
+            return None, 0
+        header, log_id, tick, arg0, arg1, crc = struct.unpack_from('<HHIIIH', buffer)
+        if header != HEADER_LOG or crc != crc16_ccitt(buffer[:LOG_FRAME_SIZE - 2]):
+            return None, 1
+        if log_id >= len(self.formats):
+            return f"[{tick / 1000:10.3f}] unknown log id {log_id} ({arg0}, {arg1})", LOG_FRAME_SIZE
+        name, fmt = self.formats[log_id]
+        kinds = [kind for kind in re.findall(r'%(%|[udx])', fmt) if kind != '%']
+        args = tuple(arg - (1 << 32) if kind == 'd' and arg & 0x80000000 else arg
+                     for kind, arg in zip(kinds, (arg0, arg1)))
+        return f"[{tick / 1000:10.3f}] {fmt % args}", LOG_FRAME_SIZE
+
+
+def main(path):
+    decoder = LogDecoder()
+    with open(path, 'rb') as f:
+        data = f.read()
+    i = 0
+    while i < len(data):
+        if data[i:i + 2] == b'\x4c\xa5':
+            text, consumed = decoder.decode(data[i:])
+            if text is not None:
+                print(text)
+            if consumed == 0:
+                break
+            i += consumed
+        else:
+            i += 1
+
+
+if __name__ == '__main__':
+    main(sys.argv[1])
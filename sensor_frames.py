@@ -0,0 +1,200 @@
+"""Encoder/decoder for the STM32 binary sample frames (BINARY_FRAME_VERSION in main.c).
+
+v1: 10 bytes per sample  - header(2) packet(2) x y z (int16, little endian)
+v2: one frame per batch  - 0xA55A, ver<<4|sensor, count, seq32, timestamp32 (us),
+                           count * (x y z), CRC-16/CCITT-FALSE over everything before it
+quaternion (MODE_QUATERNION_CDC): 0xA551, seq32, timestamp32 (us), w x y z (int16, Q14), CRC16
+summary (SUM command, binary modes): 0xA552, sensor8, seq32, start32 (us), end32 (us), count32,
+                          per axis min max (int16), mean variance rms (f32), CRC16; raw counts
+spectrum (MODE_SPECTRUM): 0xA553, seq32, timestamp32 (us), rate (f32, Hz), bands8, peaks8,
+                          per axis bands * amplitude and peaks * (frequency, amplitude) as f32, CRC16
+"""
+import math
+import struct
+
+HEADER_MAG = 0xAAAB
+HEADER_ACC = 0xBBBB
+HEADER_GYR = 0xCCCC
+V1_HEADERS = {HEADER_MAG: 'mag', HEADER_ACC: 'acc', HEADER_GYR: 'gyro'}
+V1_FRAME_SIZE = 10
+
+HEADER_FRAME_V2 = 0xA55A
+V2_HEADER_SIZE = 12
+V2_MAX_SAMPLES = (64 - V2_HEADER_SIZE - 2) // 6
+SENSORS = ['mag', 'acc', 'gyro']  # SENSOR_MAG, SENSOR_ACC, SENSOR_GYR
+
+HEADER_QUATERNION = 0xA551
+QUATERNION_FRAME_SIZE = 20
+QUATERNION_ONE = 1 << 14
+
+HEADER_SUMMARY = 0xA552
+SUMMARY_FRAME_SIZE = 19 + 3 * 16 + 2
+
+HEADER_SPECTRUM = 0xA553
+SPECTRUM_HEADER_SIZE = 16
+
+
+def crc16_ccitt(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def encode_v2(sensor, sequence, timestamp_us, samples):
+    """samples: list of (x, y, z) tuples, at most V2_MAX_SAMPLES"""
+    frame = struct.pack('<HBBII', HEADER_FRAME_V2, (2 << 4) | sensor, len(samples),
+                        sequence & 0xFFFFFFFF, timestamp_us & 0xFFFFFFFF)
+    for x, y, z in samples:
+        frame += struct.pack('<hhh', x, y, z)
+    return frame + struct.pack('<H', crc16_ccitt(frame))
+
+
+def decode_v2(buffer):
+    """Returns (frame dict, bytes consumed), (None, 0) if more data is needed,
+    or (None, 1) if the buffer does not start with a valid frame."""
+    if len(buffer) < 4:
+        return None, 0
+    header, version_sensor, count = struct.unpack_from('<HBB', buffer)
+    sensor = version_sensor & 0x0F
+    if (header != HEADER_FRAME_V2 or version_sensor >> 4 != 2 or sensor >= len(SENSORS)
+            or count == 0 or count > V2_MAX_SAMPLES):
+        return None, 1
+    size = V2_HEADER_SIZE + count * 6 + 2
+    if len(buffer) < size:
+        return None, 0
+    (crc,) = struct.unpack_from('<H', buffer, size - 2)
+    if crc != crc16_ccitt(buffer[:size - 2]):
+        return None, 1
+    sequence, timestamp_us = struct.unpack_from('<II', buffer, 4)
+    samples = [struct.unpack_from('<hhh', buffer, V2_HEADER_SIZE + 6 * n) for n in range(count)]
+    return {'sensor': SENSORS[sensor], 'sequence': sequence,
+            'timestamp_us': timestamp_us, 'samples': samples}, size
+
+
+def encode_quaternion(sequence, timestamp_us, q):
+    """q: (w, x, y, z) floats of a unit quaternion"""
+    frame = struct.pack('<HII', HEADER_QUATERNION, sequence & 0xFFFFFFFF, timestamp_us & 0xFFFFFFFF)
+    frame += struct.pack('<hhhh', *(round(c * QUATERNION_ONE) for c in q))
+    return frame + struct.pack('<H', crc16_ccitt(frame))
+
+
+def decode_quaternion(buffer):
+    """Same return convention as decode_v2"""
+    if len(buffer) < 2:
+        return None, 0
+    (header,) = struct.unpack_from('<H', buffer)
+    if header != HEADER_QUATERNION:
+        return None, 1
+    if len(buffer) < QUATERNION_FRAME_SIZE:
+        return None, 0
+    (crc,) = struct.unpack_from('<H', buffer, QUATERNION_FRAME_SIZE - 2)
+    if crc != crc16_ccitt(buffer[:QUATERNION_FRAME_SIZE - 2]):
+        return None, 1
+    sequence, timestamp_us = struct.unpack_from('<II', buffer, 2)
+    q = tuple(c / QUATERNION_ONE for c in struct.unpack_from('<hhhh', buffer, 10))
+    return {'sequence': sequence, 'timestamp_us': timestamp_us, 'q': q}, QUATERNION_FRAME_SIZE
+
+
+def encode_summary(sensor, sequence, start_us, end_us, count, axes):
+    """axes: 3 tuples of (min, max, mean, variance, rms)"""
+    frame = struct.pack('<HBIIII', HEADER_SUMMARY, sensor, sequence & 0xFFFFFFFF,
+                        start_us & 0xFFFFFFFF, end_us & 0xFFFFFFFF, count)
+    for axis in axes:
+        frame += struct.pack('<hhfff', *axis)
+    return frame + struct.pack('<H', crc16_ccitt(frame))
+
+
+def decode_summary(buffer):
+    """Same return convention as decode_v2"""
+    if len(buffer) < 3:
+        return None, 0
+    header, sensor = struct.unpack_from('<HB', buffer)
+    if header != HEADER_SUMMARY or sensor >= len(SENSORS):
+        return None, 1
+    if len(buffer) < SUMMARY_FRAME_SIZE:
+        return None, 0
+    (crc,) = struct.unpack_from('<H', buffer, SUMMARY_FRAME_SIZE - 2)
+    if crc != crc16_ccitt(buffer[:SUMMARY_FRAME_SIZE - 2]):
+        return None, 1
+    sequence, start_us, end_us, count = struct.unpack_from('<IIII', buffer, 3)
+    axes = [dict(zip(('min', 'max', 'mean', 'var', 'rms'), struct.unpack_from('<hhfff', buffer, 19 + 16 * n)))
+            for n in range(3)]
+    return {'sensor': SENSORS[sensor], 'sequence': sequence, 'start_us': start_us, 'end_us': end_us,
+            'count': count, 'axes': axes}, SUMMARY_FRAME_SIZE
+
+
+def format_summary(frame):
+    axes = '  '.join(f"{name}: {a['min']}..{a['max']} mean={a['mean']:.1f} std={a['var'] ** 0.5:.1f} rms={a['rms']:.1f}"
+                     for name, a in zip('xyz', frame['axes']))
+    return f"{frame['sensor']} #{frame['sequence']} n={frame['count']}  {axes}"
+
+
+def spectrum_frame_size(bands, peaks):
+    return SPECTRUM_HEADER_SIZE + 3 * (bands + 2 * peaks) * 4 + 2
+
+
+def encode_spectrum(sequence, timestamp_us, rate_hz, bands, peaks):
+    """bands: 3 lists of amplitudes, peaks: 3 lists of (frequency, amplitude), same length per axis"""
+    frame = struct.pack('<HIIfBB', HEADER_SPECTRUM, sequence & 0xFFFFFFFF, timestamp_us & 0xFFFFFFFF,
+                        rate_hz, len(bands[0]), len(peaks[0]))
+    for axis in range(3):
+        frame += struct.pack(f'<{len(bands[axis])}f', *bands[axis])
+        for frequency, amplitude in peaks[axis]:
+            frame += struct.pack('<ff', frequency, amplitude)
+    return frame + struct.pack('<H', crc16_ccitt(frame))
+
+
+def decode_spectrum(buffer):
+    """Same return convention as decode_v2; amplitudes are in raw counts"""
+    if len(buffer) < 2:
+        return None, 0
+    (header,) = struct.unpack_from('<H', buffer)
+    if header != HEADER_SPECTRUM:
+        return None, 1
+    if len(buffer) < SPECTRUM_HEADER_SIZE:
+        return None, 0
+    sequence, timestamp_us, rate_hz, band_count, peak_count = struct.unpack_from('<IIfBB', buffer, 2)
+    size = spectrum_frame_size(band_count, peak_count)
+    if len(buffer) < size:
+        return None, 0
+    (crc,) = struct.unpack_from('<H', buffer, size - 2)
+    if crc != crc16_ccitt(buffer[:size - 2]):
+        return None, 1
+    offset = SPECTRUM_HEADER_SIZE
+    bands, peaks = [], []
+    for _ in range(3):
+        bands.append(list(struct.unpack_from(f'<{band_count}f', buffer, offset)))
+        offset += 4 * band_count
+        peaks.append([struct.unpack_from('<ff', buffer, offset + 8 * n) for n in range(peak_count)])
+        offset += 8 * peak_count
+    return {'sequence': sequence, 'timestamp_us': timestamp_us, 'rate_hz': rate_hz,
+            'bands': bands, 'peaks': peaks}, size
+
+
+def format_spectrum_peaks(frame):
+    """One line with the peaks of every axis, strongest first, empty slots left out"""
+    axes = []
+    for name, peaks in zip('xyz', frame['peaks']):
+        found = ' '.join(f"{frequency:.1f}Hz/{amplitude:.0f}" for frequency, amplitude in peaks if amplitude > 0)
+        axes.append(f"{name}: {found or '-'}")
+    return '  '.join(axes)
+
+
+def quaternion_to_euler(q):
+    """Roll, pitch, yaw in degrees (Z-Y-X order) of a sensor to earth quaternion"""
+    w, x, y, z = q
+    roll = math.atan2(2 * (w * x + y * z), 1 - 2 * (x * x + y * y))
+    pitch = math.asin(max(-1.0, min(1.0, 2 * (w * y - z * x))))
+    yaw = math.atan2(2 * (w * z + x * y), 1 - 2 * (y * y + z * z))
+    return math.degrees(roll), math.degrees(pitch), math.degrees(yaw)
+
+
+def decode_v1(buffer):
+    """Returns (sensor, packet, (x, y, z)) or None"""
+    header, packet, x, y, z = struct.unpack_from('<HHhhh', buffer)
+    if header not in V1_HEADERS:
+        return None
+    return V1_HEADERS[header], packet, (x, y, z)
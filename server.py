@@ -1,5 +1,9 @@
+import json
+
 from flask import Flask, request
 
+import sensor_frames
+
 app = Flask(__name__)
 
 # Dodaj GET endpoint za testiranje
@@ -8,11 +12,71 @@ def test_connection():
     return "Povezava deluje!", 200
 
 # Dodaj POST endpoint za sprejemanje podatkov
+# Telo je en vzorec (objekt), paket vzorcev (JSON seznam) ali NDJSON (en objekt na vrstico).
+# Z nastavljenim oknom (ukaz SUM) so objekti povzetki okna s ključem "SUM".
 @app.route('/data', methods=['POST'])
 def receive_data():
-    data = request.json  # Prejmi podatke v JSON obliki
-    print("Prejeti podatki:", data)
-    return "Podatki prejeti!", 200
+    samples = parse_samples(request.get_data(as_text=True))
+    if samples is None:
+        return "Neveljavni podatki!", 400
+    for sample in samples:
+        if isinstance(sample, dict) and 'SUM' in sample:
+            print("Povzetek okna:", sample)
+        else:
+            print("Prejeti podatki:", sample)
+    return f"Podatki prejeti! ({len(samples)})", 200
+
+
+# Vzorci, shranjeni med izpadom povezave: v2 okvirji eden za drugim (sensor_frames.py).
+# Zaporedna številka okvirja pove, kam spadajo vzorci, tudi če pridejo z zamikom.
+@app.route('/spool', methods=['POST'])
+def receive_spool():
+    frames, skipped = parse_frames(request.get_data())
+    for frame in frames:
+        print(f"Shranjeni podatki: {frame['sensor']} seq={frame['sequence']} "
+              f"t={frame['timestamp_us']} n={len(frame['samples'])}")
+    if skipped:
+        print(f"Neveljavnih bajtov: {skipped}")
+    return f"Okvirji prejeti! ({len(frames)})", 200
+
+
+# Spekter vibracij pospeškometra (MODE_SPECTRUM): en okvir na telo (sensor_frames.py)
+@app.route('/spectrum', methods=['POST'])
+def receive_spectrum():
+    frame, _ = sensor_frames.decode_spectrum(request.get_data())
+    if frame is None:
+        return "Neveljaven spekter!", 400
+    print(f"Spekter seq={frame['sequence']} t={frame['timestamp_us']} "
+          f"fs={frame['rate_hz']:.1f} Hz  {sensor_frames.format_spectrum_peaks(frame)}")
+    return "Spekter prejet!", 200
+
+
+def parse_frames(body):
+    """Returns the v2 frames in a /spool body and the number of bytes that were not part of one"""
+    frames, skipped = [], 0
+    while body:
+        frame, consumed = sensor_frames.decode_v2(body)
+        if consumed == 0:  # truncated frame at the end
+            skipped += len(body)
+            break
+        if frame is None:
+            skipped += consumed
+        else:
+            frames.append(frame)
+        body = body[consumed:]
+    return frames, skipped
+
+
+def parse_samples(body):
+    """Returns the list of sample objects in a POST body, None if it is not valid"""
+    try:
+        data = json.loads(body)
+    except ValueError:
+        try:
+            return [json.loads(line) for line in body.splitlines() if line.strip()]
+        except ValueError:
+            return None
+    return data if isinstance(data, list) else [data]
 
 
 if __name__ == '__main__':
@@ -0,0 +1,122 @@
+"""Runs the on-device spectrum kernel (stm32_modul/Core/Src/spectrum.c) on recorded samples.
+
+spectrum.c is compiled for the host with the system C compiler ($CC, default cc)
+into a shared library and called through ctypes, so the reports are the ones
+MODE_SPECTRUM would send for the same samples. The sizes come from spectrum.h.
+
+Input is a raw capture of the CDC stream with v2 accelerometer frames
+(MODE_BINARY_CDC, sensor_frames.py) or a text file with one "x y z" sample in
+raw counts per line. The rate defaults to the one implied by the frame
+timestamps; text input needs it on the command line.
+
+Usage: python spectrum_host.py recording [rate_hz]
+"""
+import ctypes
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+
+import sensor_frames
+
+CORE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'stm32_modul', 'Core')
+SPECTRUM_SOURCE = os.path.join(CORE_PATH, 'Src', 'spectrum.c')
+SPECTRUM_HEADER = os.path.join(CORE_PATH, 'Inc', 'spectrum.h')
+
+
+def load_constants(path=SPECTRUM_HEADER):
+    with open(path, encoding='utf-8') as f:
+        return {name: int(value) for name, value in re.findall(r'#define (SPECTRUM_\w+) (\d+)', f.read())}
+
+
+def load_kernel():
+    """Returns (library, Spectrum_TypeDef, Spectrum_Report_TypeDef) with the layouts of spectrum.h"""
+    c = load_constants()
+    size, bands, peaks = c['SPECTRUM_SIZE'], c['SPECTRUM_BANDS'], c['SPECTRUM_PEAKS']
+
+    class Peak(ctypes.Structure):
+        _fields_ = [('frequency', ctypes.c_float), ('amplitude', ctypes.c_float)]
+
+    class Report(ctypes.Structure):
+        _fields_ = [('time', ctypes.c_uint32),
+                    ('bands', (ctypes.c_float * bands) * 3),
+                    ('peaks', (Peak * peaks) * 3)]
+
+    class Spectrum(ctypes.Structure):
+        _fields_ = [('block', (ctypes.c_int16 * size) * 3),
+                    ('power', (ctypes.c_float * (size // 2 + 1)) * 3),
+                    ('fill', ctypes.c_uint16),
+                    ('blocks', ctypes.c_uint8),
+                    ('time', ctypes.c_uint32)]
+
+    library_path = os.path.join(tempfile.mkdtemp(), 'spectrum.so')
+    subprocess.run([os.environ.get('CC', 'cc'), '-O2', '-shared', '-fPIC', '-I', os.path.dirname(SPECTRUM_HEADER),
+                    SPECTRUM_SOURCE, '-o', library_path, '-lm'], check=True)
+    library = ctypes.CDLL(library_path)
+    library.Spectrum_Add.restype = ctypes.c_uint8
+    library.Spectrum_Add.argtypes = [ctypes.POINTER(Spectrum), ctypes.c_int16 * 3, ctypes.c_uint32]
+    library.Spectrum_Report.argtypes = [ctypes.POINTER(Spectrum), ctypes.c_float, ctypes.POINTER(Report)]
+    return library, Spectrum, Report
+
+
+def read_capture(data):
+    """Returns [(x, y, z, timestamp_us)] of the accelerometer v2 frames in a raw capture"""
+    samples, periods, previous = [], [], None
+    i = 0
+    while i < len(data):
+        frame, consumed = sensor_frames.decode_v2(data[i:])
+        if frame is None or frame['sensor'] != 'acc':
+            i += consumed or 1
+            continue
+        if previous is not None and frame['sequence'] > previous[0]:
+            periods.append(((frame['timestamp_us'] - previous[1]) & 0xFFFFFFFF)
+                           / (frame['sequence'] - previous[0]))
+        previous = (frame['sequence'], frame['timestamp_us'])
+        period = statistics.median(periods) if periods else 0.0
+        for n, (x, y, z) in enumerate(frame['samples']):
+            samples.append((x, y, z, int(frame['timestamp_us'] + n * period) & 0xFFFFFFFF))
+        i += consumed
+    rate_hz = 1e6 / statistics.median(periods) if periods else None
+    return samples, rate_hz
+
+
+def read_text(text):
+    samples = []
+    for line in text.splitlines():
+        try:
+            x, y, z = (int(value) for value in line.replace(',', ' ').split()[:3])
+        except ValueError:
+            continue
+        samples.append((x, y, z, len(samples)))
+    return samples
+
+
+def main(path, rate_hz=None):
+    with open(path, 'rb') as f:
+        data = f.read()
+    samples, capture_rate = read_capture(data)
+    if not samples:
+        samples, capture_rate = read_text(data.decode('utf-8', errors='replace')), None
+    rate_hz = rate_hz or capture_rate
+    if not samples or not rate_hz:
+        sys.exit("no accelerometer samples, or no rate (give it as the second argument)")
+
+    library, Spectrum, Report = load_kernel()
+    spectrum, report = Spectrum(), Report()
+    library.Spectrum_Init(ctypes.byref(spectrum))
+    sequence = 0
+    for x, y, z, time in samples:
+        if library.Spectrum_Add(ctypes.byref(spectrum), (ctypes.c_int16 * 3)(x, y, z), time):
+            library.Spectrum_Report(ctypes.byref(spectrum), rate_hz, ctypes.byref(report))
+            frame = {'peaks': [[(p.frequency, p.amplitude) for p in axis] for axis in report.peaks]}
+            bands = ' | '.join(' '.join(f"{b:.0f}" for b in axis) for axis in report.bands)
+            print(f"#{sequence} t={report.time} fs={rate_hz:.1f} Hz  {sensor_frames.format_spectrum_peaks(frame)}")
+            print(f"    bands {bands}")
+            sequence += 1
+    print(f"{len(samples)} samples, {sequence} reports")
+
+
+if __name__ == '__main__':
+    main(sys.argv[1], float(sys.argv[2]) if len(sys.argv) > 2 else None)
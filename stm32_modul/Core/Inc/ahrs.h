@@ -0,0 +1,39 @@
+/**
+  ******************************************************************************
+  * @file           : ahrs.h
+  * @brief          : Orientation filter (Madgwick, gradient descent) fusing
+  *                   gyroscope, accelerometer and magnetometer samples into a
+  *                   unit quaternion. One Ahrs_Update() per gyro sample; the
+  *                   accelerometer and magnetometer only correct the drift, so
+  *                   their latest samples can be reused between updates.
+  *                   Single precision throughout for the Cortex-M4 FPU, kept
+  *                   free of HAL includes.
+  ******************************************************************************
+  */
+
+#ifndef __AHRS_H
+#define __AHRS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define AHRS_SETTLE_BETA 2.5f       // gain while settling from the identity orientation
+#define AHRS_SETTLE_UPDATES 400     // updates run with AHRS_SETTLE_BETA after Ahrs_Init()
+
+typedef struct {
+    float q[4];          // w, x, y, z; rotates the sensor frame into the earth frame
+    float beta;          // correction gain, rad/s of gyro error trusted away per update
+    uint16_t settle;     // updates left with AHRS_SETTLE_BETA
+} Ahrs_TypeDef;
+
+void Ahrs_Init(Ahrs_TypeDef *ahrs, float beta);
+void Ahrs_Update(Ahrs_TypeDef *ahrs, const float gyro[3], const float acc[3], const float mag[3], float dt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_H */
@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file           : at_parser.h
+  * @brief          : Incremental tokenizer for ESP8266 AT replies. Received
+  *                   bytes are fed once, in whatever chunks the UART delivers
+  *                   them, and complete tokens come out as typed events. Lines
+  *                   split across chunks or across Clear_RX_Buffer() are still
+  *                   recognised. Kept free of HAL includes.
+  ******************************************************************************
+  */
+
+#ifndef __AT_PARSER_H
+#define __AT_PARSER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define AT_LINE_MAX 48          // longest line prefix kept for matching
+#define AT_EVENT_QUEUE_SIZE 16  // must be a power of two
+#define AT_LINK_NONE 0xFF       // event without a link id (CIPMUX=0 replies)
+
+typedef enum {
+    AT_EVENT_OK = 0,
+    AT_EVENT_ERROR,            // ERROR or FAIL
+    AT_EVENT_SEND_OK,
+    AT_EVENT_SEND_FAIL,
+    AT_EVENT_PROMPT,           // '>' of CIPSEND
+    AT_EVENT_IPD,              // +IPD header, value = payload length
+    AT_EVENT_IPD_END,          // last payload byte of the +IPD received
+    AT_EVENT_CONNECT,          // [n,]CONNECT or ALREADY CONNECTED
+    AT_EVENT_CLOSED,           // [n,]CLOSED or [n,]CONNECT FAIL
+    AT_EVENT_STA_CONNECTED,    // a station joined our access point
+    AT_EVENT_STA_DISCONNECTED,
+    AT_EVENT_WIFI_CONNECTED,   // we joined an access point
+    AT_EVENT_WIFI_DISCONNECT,
+    AT_EVENT_WIFI_GOT_IP,
+    AT_EVENT_STATUS,           // STATUS:n of CIPSTATUS, value = n
+    AT_EVENT_BUSY,             // busy p... / busy s...
+    AT_EVENT_READY,            // module (re)booted
+    AT_EVENT_CWMODE,           // +CWMODE:n of AT+CWMODE?, value = n
+    AT_EVENT_CIPMUX,           // +CIPMUX:n of AT+CIPMUX?, value = n
+    AT_EVENT_COUNT
+} At_Event_Type_TypeDef;
+
+typedef struct {
+    uint8_t type;    // At_Event_Type_TypeDef
+    uint8_t link;    // connection id or AT_LINK_NONE
+    uint16_t value;
+} At_Event_TypeDef;
+
+void At_Parser_Reset(void);
+void At_Parser_Feed(const uint8_t *data, uint16_t length);
+uint8_t At_Parser_Next(At_Event_TypeDef *event);
+void At_Parser_Flush(void);
+uint8_t At_Parser_Seen(uint8_t type);
+uint16_t At_Parser_Value(uint8_t type);
+uint32_t At_Parser_Dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AT_PARSER_H */
@@ -0,0 +1,44 @@
+/**
+  ******************************************************************************
+  * @file           : calibration.h
+  * @brief          : Per-sensor linear calibration of raw samples,
+  *                   corrected = matrix * (raw - offset), in raw counts so the
+  *                   existing scale factors and frame formats stay valid.
+  *                   Covers gyro bias (offset only), accelerometer scale and
+  *                   offset (diagonal) and magnetometer hard iron (offset)
+  *                   and soft iron (full matrix). Applied in place to batches
+  *                   with the Cortex-M4 SIMD instructions, with a plain C
+  *                   path giving the same results elsewhere. Kept free of HAL
+  *                   includes.
+  ******************************************************************************
+  */
+
+#ifndef __CALIBRATION_H
+#define __CALIBRATION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "sample_ring.h"
+
+#define CALIBRATION_SHIFT 14
+#define CALIBRATION_ONE (1 << CALIBRATION_SHIFT)  // matrix entries are Q14
+#define CALIBRATION_ROW_MAX (2 * CALIBRATION_ONE) // sum of |entries| per row
+
+/* Stored as is in the config store, keep the layout */
+typedef struct {
+    int16_t offset[3];     // raw counts, subtracted first
+    int16_t matrix[3][3];  // Q14, rows give the corrected X, Y, Z
+} Calibration_TypeDef;
+
+void Calibration_Identity(Calibration_TypeDef *cal);
+uint8_t Calibration_Valid(const Calibration_TypeDef *cal);
+void Calibration_Apply(const Calibration_TypeDef *cal, Sample_TypeDef *samples, uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CALIBRATION_H */
@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file           : config_store.h
+  * @brief          : Wear-leveled key/value store for the device settings in
+  *                   the two flash pages reserved at the end of the linker
+  *                   script's FLASH region. Values are appended as records;
+  *                   when a page is full the live records are copied to the
+  *                   other page, so each page is erased once per fill.
+  *                   Config_Store_Init() scans the active page once and keeps
+  *                   the offset of every key in RAM, reads are then a lookup.
+  *                   Flash access goes through a port, kept free of HAL
+  *                   includes.
+  ******************************************************************************
+  */
+
+#ifndef __CONFIG_STORE_H
+#define __CONFIG_STORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define CONFIG_PAGE_SIZE 2048       // bytes, one STM32F303 flash page
+#define CONFIG_VALUE_MAX 64         // bytes per value
+
+typedef enum {
+    CONFIG_KEY_SSID = 1,
+    CONFIG_KEY_PASSWORD,
+    CONFIG_KEY_SERVER_IP,
+    CONFIG_KEY_SERVER_PORT,         // uint16_t
+    CONFIG_KEY_SENSOR_PROFILE,      // Sensor_Profile_TypeDef in main.c
+    CONFIG_KEY_CALIBRATION_MAG,     // Calibration_TypeDef, one key per sensor
+    CONFIG_KEY_CALIBRATION_ACC,     // in SENSOR_MAG, SENSOR_ACC, SENSOR_GYR order
+    CONFIG_KEY_CALIBRATION_GYR,
+    CONFIG_KEY_DECIMATION,          // uint8_t factor per sensor
+    CONFIG_KEY_SUMMARY_WINDOW,      // uint16_t ms, 0 = off
+    CONFIG_KEY_COUNT
+} Config_Key_TypeDef;
+
+typedef struct {
+    /* Erases the page starting at address; returns 0 on failure. */
+    uint8_t (*erase)(uintptr_t address);
+    /* Programs one erased halfword; returns 0 on failure. */
+    uint8_t (*program)(uintptr_t address, uint16_t value);
+} Config_Store_Port_TypeDef;
+
+void Config_Store_Init(const Config_Store_Port_TypeDef *port, uintptr_t base);
+uint8_t Config_Get(uint8_t key, void *value, uint8_t size);
+uint8_t Config_Set(uint8_t key, const void *value, uint8_t length);
+uint8_t Config_Delete(uint8_t key);
+uint16_t Config_Free(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CONFIG_STORE_H */
@@ -0,0 +1,51 @@
+/**
+  ******************************************************************************
+  * @file           : decimator.h
+  * @brief          : Anti-alias filter and decimator for one sensor's samples.
+  *                   A 6th order Butterworth low-pass, as a cascade of three
+  *                   biquads (transposed direct form II, float), runs on every
+  *                   axis of a batch; every factor-th filtered sample is kept.
+  *                   The cut-off (-3 dB) follows the factor at 0.8 of the
+  *                   output Nyquist frequency fn, the passband is flat to
+  *                   0.1 dB up to 0.5 fn. The roll-off after it is gentle
+  *                   for a decimator; measured with bench_decimator the
+  *                   gain is -12 dB at fn (-17 dB for factor 2), -21 dB at
+  *                   1.2 fn and -33 dB at 1.5 fn (-38 dB for factor 4,
+  *                   -63 dB for factor 2). Tones just above fn thus alias
+  *                   into 0.8..1 fn only 12 to 22 dB down; what aliases below
+  *                   0.5 fn is at least 33 dB down. Factor 1 passes samples
+  *                   through untouched. Kept free of HAL includes.
+  ******************************************************************************
+  */
+
+#ifndef __DECIMATOR_H
+#define __DECIMATOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "sample_ring.h"
+
+#define DECIMATOR_SECTIONS 3
+#define DECIMATOR_MAX_FACTOR 16
+#define DECIMATOR_CUTOFF 0.8f       // of the output Nyquist frequency
+#define DECIMATOR_BLOCK_MAX 32      // samples filtered per block, a float buffer on the stack
+
+typedef struct {
+    float coeffs[DECIMATOR_SECTIONS][5];    // b0 b1 b2 a1 a2 per section, a0 = 1
+    float state[3][DECIMATOR_SECTIONS][2];  // per axis
+    uint8_t factor;
+    uint8_t phase;    // filtered samples since the last one kept
+    uint8_t primed;   // state set to the steady state of the first sample
+} Decimator_TypeDef;
+
+void Decimator_Init(Decimator_TypeDef *dec, uint8_t factor);
+uint16_t Decimator_Process(Decimator_TypeDef *dec, Sample_TypeDef *samples, uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DECIMATOR_H */
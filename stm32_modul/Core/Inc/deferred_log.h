@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file           : deferred_log.h
+  * @brief          : Deferred binary logger. LOGn() stores a message ID from
+  *                   log_ids.h, the HAL tick and up to two arguments in a RAM
+  *                   ring; formatting happens on the host. Safe to call from
+  *                   interrupts, costs a few dozen cycles.
+  ******************************************************************************
+  */
+
+#ifndef __DEFERRED_LOG_H
+#define __DEFERRED_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "log_ids.h"
+
+#define LOG_ENABLE 1      // 0 compiles every LOGn() call out
+#define LOG_RING_SIZE 64  // records, must be a power of two
+
+#define LOG_ID_ENUM(id, format) id,
+typedef enum {
+    LOG_IDS(LOG_ID_ENUM)
+    LOG_ID_COUNT
+} Log_Id_TypeDef;
+#undef LOG_ID_ENUM
+
+typedef struct {
+    uint32_t time;    // HAL tick, ms
+    uint16_t id;      // Log_Id_TypeDef
+    uint16_t reserved;
+    uint32_t arg[2];
+} Log_Record_TypeDef;
+
+#if LOG_ENABLE
+#define LOG0(id)       Log_Write((id), 0, 0)
+#define LOG1(id, a)    Log_Write((id), (uint32_t)(a), 0)
+#define LOG2(id, a, b) Log_Write((id), (uint32_t)(a), (uint32_t)(b))
+#else
+#define LOG0(id)       ((void)0)
+#define LOG1(id, a)    ((void)0)
+#define LOG2(id, a, b) ((void)0)
+#endif
+
+void Log_Write(uint16_t id, uint32_t arg0, uint32_t arg1);
+uint8_t Log_Read(Log_Record_TypeDef *record);
+uint32_t Log_Take_Dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEFERRED_LOG_H */
@@ -0,0 +1,135 @@
+/**
+  ******************************************************************************
+  * @file           : esp_transport.h
+  * @brief          : Non-blocking send engine for the ESP8266 TCP link.
+  *                   Payloads are queued with Esp_Transport_Enqueue() and
+  *                   pushed through CIPSEND, '>' and SEND OK one step at a
+  *                   time, driven by AT parser events and by timeouts checked
+  *                   in Esp_Transport_Poll(). Nothing here waits, so the
+  *                   superloop keeps draining the sensors while a request is
+  *                   in flight. Requests are spread over up to ESP_LINK_COUNT
+  *                   CIPMUX links to the server, one unanswered request per
+  *                   link, so waiting for a server reply does not hold back
+  *                   the next send. The link state is kept from the module's
+  *                   own notifications (CONNECT, CLOSED, WIFI DISCONNECT),
+  *                   and a lost connection is reopened with exponential
+  *                   backoff. Kept free of HAL includes.
+  *                   For high rates the link can instead be switched to
+  *                   transparent mode (CIPMODE=1): Esp_Transport_Stream_Open()
+  *                   opens one TCP connection and Esp_Transport_Stream_Write()
+  *                   then feeds raw bytes to it until Esp_Transport_Stream_Close()
+  *                   leaves with "+++" and restores the server setup.
+  ******************************************************************************
+  */
+
+#ifndef __ESP_TRANSPORT_H
+#define __ESP_TRANSPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "at_parser.h"
+
+#define ESP_TX_QUEUE_SIZE 4         // payloads, must be a power of two
+#define ESP_TX_PAYLOAD_MAX 2048     // bytes per payload, the CIPSEND maximum
+#define ESP_LINK_ID 4               // connection id opened first, see Esp_Transport_Connect()
+#define ESP_LINK_COUNT 3            // ids ESP_LINK_ID down to ESP_LINK_ID-ESP_LINK_COUNT+1 carry requests
+/* CIPSERVER hands page clients the lowest free ids, so the server is limited
+   to the ids below the request links: an id the engine opens is never a web
+   client's, and "ALREADY CONNECTED" on it can only be an own link */
+#define ESP_SERVER_MAX_CONN 2
+#define ESP_STRINGIFY_(x) #x
+#define ESP_STRINGIFY(x) ESP_STRINGIFY_(x)
+#define ESP_SERVER_LIMIT_COMMAND "AT+CIPSERVERMAXCONN=" ESP_STRINGIFY(ESP_SERVER_MAX_CONN) "\r\n"
+
+#if ESP_LINK_ID > 4 || ESP_LINK_ID - ESP_LINK_COUNT + 1 < ESP_SERVER_MAX_CONN
+#error "the request links must lie above the page server's ids, within 0..4"
+#endif
+
+#define ESP_CONNECT_TIMEOUT 5000    // ms for the CIPSTART reply
+#define ESP_BACKOFF_MIN 500         // ms before the first reconnect after a failed one
+#define ESP_BACKOFF_MAX 32000       // ms, the backoff doubles up to this
+#define ESP_RESPONSE_TIMEOUT 3000   // ms for the server's reply before a link is reused anyway
+#define ESP_PROMPT_TIMEOUT 1000     // ms for '>' after CIPSEND
+#define ESP_PROMPT_RETRIES 3        // CIPSEND attempts per payload
+#define ESP_SEND_OK_TIMEOUT 2000    // ms for SEND OK after the payload
+#define ESP_RETRY_DELAY 1000        // ms pause after a failed payload
+
+#define ESP_STREAM_RING_SIZE 2048   // bytes buffered for transparent mode, must be a power of two
+#define ESP_ESCAPE_GUARD 1000       // ms of silence before and after "+++"
+
+typedef enum {
+    ESP_STATE_IDLE = 0,
+    ESP_STATE_WAIT_CONNECT,  // CIPSTART sent, waiting for its OK
+    ESP_STATE_WAIT_PROMPT,   // CIPSEND sent, waiting for '>'
+    ESP_STATE_WAIT_SEND_OK,  // payload sent, waiting for SEND OK
+    ESP_STATE_PAUSE,         // after a failure, until the retry delay passed
+    ESP_STATE_SCRIPT,        // running the command list that enters or leaves transparent mode
+    ESP_STATE_STREAMING,     // transparent mode, bytes go straight to the TCP connection
+    ESP_STATE_STREAM_DRAIN   // leaving transparent mode, sending what is buffered first
+} Esp_State_TypeDef;
+
+typedef enum {
+    ESP_LINK_CLOSED = 0,
+    ESP_LINK_READY,          // open, no request waiting for a reply
+    ESP_LINK_AWAITING        // request sent, the server's reply (+IPD) is due
+} Esp_Link_State_TypeDef;
+
+typedef struct {
+    /* Starts a non-blocking UART write of data, which stays valid until
+       Esp_Transport_Write_Complete(); returns 0 when the UART is busy. */
+    uint8_t (*write)(const uint8_t *data, uint16_t length);
+    /* The connection to the server was opened. */
+    void (*link_up)(void);
+    /* The module reported every TCP link as gone; the queue is kept. */
+    void (*link_lost)(void);
+    /* The payload queued as sequence left the queue: delivered when the
+       module answered SEND OK, otherwise given up on. */
+    void (*payload_done)(uint32_t sequence, uint8_t delivered);
+} Esp_Transport_Port_TypeDef;
+
+typedef struct {
+    uint32_t queued;     // payloads accepted by Esp_Transport_Enqueue()
+    uint32_t sent;       // payloads confirmed with SEND OK
+    uint32_t failed;     // payloads given up on
+    uint32_t full;       // payloads refused because the queue was full
+    uint32_t retries;    // repeated CIPSENDs
+    uint32_t last_latency; // ms from CIPSEND to SEND OK of the last payload
+    uint32_t responses;    // server replies received on the request links
+    uint32_t response_timeouts; // links reused without a reply
+    uint32_t max_in_flight;  // most links awaiting a reply at once
+    uint32_t connects;       // connections to the server opened
+    uint32_t connect_failures; // CIPSTARTs for the first link that failed
+    uint32_t stream_bytes;   // bytes accepted in transparent mode
+    uint32_t stream_full;    // writes refused because the stream ring was full
+    uint32_t stream_opens;   // transparent mode sessions started
+    uint32_t payload_bytes;  // payload bytes delivered: confirmed requests plus stream bytes sent
+} Esp_Transport_Stats_TypeDef;
+
+void Esp_Transport_Init(const Esp_Transport_Port_TypeDef *port);
+void Esp_Transport_Connect(const char *host, uint16_t port);
+void Esp_Transport_Stop_Connecting(void);
+uint8_t Esp_Transport_Enqueue(const uint8_t *payload, uint16_t length);
+uint8_t Esp_Transport_Enqueue_Parts(const uint8_t *head, uint16_t head_length,
+                                    const uint8_t *body, uint16_t body_length);
+uint32_t Esp_Transport_Last_Sequence(void);
+uint8_t Esp_Transport_On_Event(const At_Event_TypeDef *event, uint32_t now);
+void Esp_Transport_Poll(uint32_t now);
+uint8_t Esp_Transport_Busy(void);
+uint8_t Esp_Transport_Pending(void);
+void Esp_Transport_Write_Complete(void);
+
+void Esp_Transport_Stream_Open(const char *host, uint16_t port);
+void Esp_Transport_Stream_Close(void);
+uint8_t Esp_Transport_Stream_Write(const uint8_t *data, uint16_t length);
+uint8_t Esp_Transport_Streaming(void);
+
+extern Esp_Transport_Stats_TypeDef esp_transport_stats;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ESP_TRANSPORT_H */
@@ -0,0 +1,104 @@
+/**
+  ******************************************************************************
+  * @file           : log_ids.h
+  * @brief          : Message table of the deferred logger. The firmware only
+  *                   sends the index of an entry plus its arguments, the host
+  *                   decoder (log_decoder.py) parses this file to print them.
+  *                   Append new entries at the end so older captures still
+  *                   decode; the format strings take printf integer specifiers
+  *                   only (%u %d %lu %ld %x %lx).
+  ******************************************************************************
+  */
+
+#ifndef __LOG_IDS_H
+#define __LOG_IDS_H
+
+#define LOG_IDS(X) \
+    X(LOG_MAG_INIT_FAILED,          "Magnetometer communication failed (WHO_AM_I 0x%x)") \
+    X(LOG_MAG_INIT_OK,              "Magnetometer initialized") \
+    X(LOG_ACC_INIT_FAILED,          "Accelerometer communication failed (WHO_AM_I 0x%x)") \
+    X(LOG_ACC_INIT_OK,              "Accelerometer initialized") \
+    X(LOG_GYR_INIT_FAILED,          "Gyroscope communication failed (WHO_AM_I 0x%x)") \
+    X(LOG_GYR_INIT_OK,              "Gyroscope initialized") \
+    X(LOG_SEND_AT_TEST,             "Sending AT Test command") \
+    X(LOG_SEND_CONNECT_MODE,        "Sending AT set HotSpot and Connect mode command") \
+    X(LOG_SEND_MAX_CONNECTIONS,     "Sending AT set max connections command") \
+    X(LOG_SEND_START_SERVER,        "Sending AT start server command") \
+    X(LOG_SEND_HTML_HEADER,         "Sending HTML Header") \
+    X(LOG_SEND_HTML,                "Sending HTML") \
+    X(LOG_SETUP_STAGE_UNKNOWN,      "That Setup Stage not implemented yet (%u)") \
+    X(LOG_SEND_WIFI_CONNECT,        "Sending Connect to WiFi with SSID Command") \
+    X(LOG_RESPONSE_TIMEOUT,         "Response status changed to: TIMEOUT") \
+    X(LOG_RESPONSE_SUCCESS,         "Response status changed to: SUCCESS") \
+    X(LOG_RESPONSE_ERROR,           "Response status changed to: ERROR") \
+    X(LOG_RESPONSE_WAITING,         "Response status changed to: WAITING") \
+    X(LOG_RESPONSE_IDLE,            "Response status changed to: IDLE") \
+    X(LOG_STAGE_AT_TEST,            "Setup stage changed to: AT_TEST") \
+    X(LOG_STAGE_CONNECT_MODE,       "Setup stage changed to: AT_SET_CONNECT_MODE") \
+    X(LOG_STAGE_MAX_CONNECTIONS,    "Setup stage changed to: AT_SET_MAX_CONNECTIONS") \
+    X(LOG_STAGE_START_SERVER,       "Setup stage changed to: AT_START_SERVER") \
+    X(LOG_STAGE_HTML_HEADER,        "Setup stage changed to: AT_SEND_HTML_HEADER") \
+    X(LOG_STAGE_HTML,               "Setup stage changed to: AT_SEND_HTML") \
+    X(LOG_STAGE_CONNECT_REQUEST,    "Setup stage changed to: AT_SEND_CONNECT_REQUEST") \
+    X(LOG_STAGE_INVALID,            "new_stage is invalid (%u)") \
+    X(LOG_ESP_RESPONSE_TIMEOUT,     "=ESP_RESPONSE: TIMEOUT...") \
+    X(LOG_RESPONSE_NOT_IMPLEMENTED, "RESPONSE_NOT_IMPLEMENTED: Unknown Setup Stage %u") \
+    X(LOG_CLIENT_CONNECTED,         "HTTP: Client Connected") \
+    X(LOG_CLIENT_DISCONNECTED,      "HTTP: Client Disconnected") \
+    X(LOG_CLIENT_REQUEST_STARTED,   "HTTP: Client Started Requesting Page") \
+    X(LOG_CLIENT_REQUEST_STOPPED,   "HTTP: Client Stopped Requesting Page") \
+    X(LOG_RECEPTION_COMPLETE,       "===Data Reception Complete=== Buffer length: %u") \
+    X(LOG_TCP_ESTABLISHED,          "TCP connection established") \
+    X(LOG_TCP_FAILED,               "TCP connection failed") \
+    X(LOG_TCP_TIMEOUT,              "Connection attempt timed out") \
+    X(LOG_DATA_TOO_LARGE,           "Data too large to send (%u bytes)") \
+    X(LOG_CHECK_CONNECTION,         "Checking connection status...") \
+    X(LOG_CONNECTION_LOST,          "Connection lost, reconnecting...") \
+    X(LOG_SEND_CIPSEND,             "Sending CIPSEND command (%u bytes)") \
+    X(LOG_GOT_PROMPT,               "Received '>' prompt") \
+    X(LOG_CIPSEND_RETRY,            "Retrying CIPSEND (%u)...") \
+    X(LOG_CIPSEND_FAILED,           "Failed after max retries") \
+    X(LOG_SENDING_DATA,             "Sending data...") \
+    X(LOG_DATA_SENT,                "Data sent successfully in %lu ms") \
+    X(LOG_SEND_TIMEOUT,             "Send timeout") \
+    X(LOG_MODE_CHANGED,             "Mode changed to: %u (0 None, 1 Binary UART, 2 ASCII UART, 3 Binary CDC, 4 ASCII CDC, 5 Binary TCP, 6 Quaternion CDC, 7 Spectrum)") \
+    X(LOG_CONNECT_ATTEMPT,          "Attempting to connect...") \
+    X(LOG_CONNECT_OK,               "Connection successful!") \
+    X(LOG_CONNECT_RETRY,            "Connection failed, retrying...") \
+    X(LOG_RECORDS_DROPPED,          "%lu log records dropped") \
+    X(LOG_STREAM_OPENING,           "Switching the ESP to transparent mode, port %u") \
+    X(LOG_STREAM_STARTED,           "Transparent streaming started") \
+    X(LOG_STREAM_STEP_FAILED,       "Transparent mode command %u failed") \
+    X(LOG_STREAM_CLOSING,           "Leaving transparent mode, %u bytes still buffered") \
+    X(LOG_STREAM_CLOSED,            "Back in command mode") \
+    X(LOG_BAUD_PING,                "ESP link at %lu baud answered %u of 4 pings") \
+    X(LOG_BAUD_ROUND_TRIP,          "ESP AT round trip %lu us") \
+    X(LOG_BAUD_REJECTED,            "ESP rejected AT+UART_CUR=%lu") \
+    X(LOG_BAUD_UNSTABLE,            "ESP link unstable at %lu baud, falling back") \
+    X(LOG_BAUD_SET,                 "ESP link running at %lu baud") \
+    X(LOG_BAUD_LOST,                "ESP did not take the fallback from %lu baud, staying there") \
+    X(LOG_UPLINK_GOODPUT,           "ESP uplink goodput %lu B/s at %lu baud") \
+    X(LOG_CONNECT_BACKOFF,          "Connection failed, retrying in %lu ms") \
+    X(LOG_WARM_START,               "ESP ready %lu ms after reset, %lu setup commands needed") \
+    X(LOG_COLD_START,               "ESP did not answer the state queries, setup by button") \
+    X(LOG_FIRST_DELIVERY,           "First sample delivered %lu ms after reset") \
+    X(LOG_CONFIG_LOADED,            "%lu stored settings loaded in %lu us") \
+    X(LOG_CONFIG_SAVED,             "Settings saved, %lu bytes left in the config page") \
+    X(LOG_CONFIG_SAVE_FAILED,       "Saving setting %lu to flash failed") \
+    X(LOG_STORED_WIFI_JOIN,         "Joining the stored access point, result %lu") \
+    X(LOG_SPOOL_STARTED,            "Uplink down, spooling samples") \
+    X(LOG_SPOOL_FILL,               "Spool holds %lu bytes, %lu of them in flash") \
+    X(LOG_SPOOL_DRAINED,            "Spool drained, %lu bytes in %lu ms") \
+    X(LOG_CALIBRATION_SET,          "Calibration of sensor %lu replaced") \
+    X(LOG_CALIBRATION_REJECTED,     "Calibration line for sensor %lu rejected (3 = unknown sensor)") \
+    X(LOG_USB_COMMAND_UNKNOWN,      "Unknown USB command, %lu characters") \
+    X(LOG_DECIMATION_SET,           "Sensor %lu decimated by %lu") \
+    X(LOG_DECIMATION_REJECTED,      "Decimation of sensor %lu by %ld rejected (3 = unknown sensor)") \
+    X(LOG_SUMMARY_SET,              "Summary window %lu ms (0 = samples)") \
+    X(LOG_SUMMARY_REJECTED,         "Summary window %ld ms rejected") \
+    X(LOG_SEND_SERVER_LIMIT,        "Sending AT server max connections command") \
+    X(LOG_STAGE_SERVER_LIMIT,       "Setup stage changed to: AT_SET_SERVER_LIMIT") \
+    X(LOG_ACC_RATE_FAILED,          "Accelerometer CTRL_REG1_A 0x%lx not taken, stays 0x%lx") \
+    X(LOG_WIFI_CREDENTIALS,         "Wi-Fi credentials received, SSID of %lu characters")
+
+#endif /* __LOG_IDS_H */
@@ -41,7 +41,9 @@ extern "C" {
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
-
+#define USE_I2C_DMA 1 // LSM303 reads via HAL_I2C_Mem_Read_DMA instead of blocking HAL_I2C_Mem_Read
+#define USE_SPI_DMA 1 // L3GD20 reads via HAL_SPI_TransmitReceive_DMA instead of spi1_beriRegistre()
+#define USE_UART_DMA 1 // ESP8266 replies via circular DMA + idle line events instead of one IT per byte
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
@@ -0,0 +1,101 @@
+/**
+  ******************************************************************************
+  * @file           : sample_ring.h
+  * @brief          : Single-producer/single-consumer ring of timestamped sensor
+  *                   samples. The producer is an interrupt or DMA completion
+  *                   callback, the consumer is the superloop. No locking is
+  *                   needed: only the producer writes head, only the consumer
+  *                   writes tail. Kept free of HAL includes.
+  ******************************************************************************
+  */
+
+#ifndef __SAMPLE_RING_H
+#define __SAMPLE_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SAMPLE_RING_SIZE 128 // samples per sensor, must be a power of two
+
+#if (SAMPLE_RING_SIZE & (SAMPLE_RING_SIZE - 1)) != 0
+#error "SAMPLE_RING_SIZE must be a power of two"
+#endif
+
+typedef struct {
+    int16_t data[3];
+    uint32_t time; // capture time in us
+} Sample_TypeDef;
+
+typedef struct {
+    volatile uint16_t head;     // next slot to write, producer only
+    volatile uint16_t tail;     // next slot to read, consumer only
+    volatile uint32_t overruns; // samples dropped because the ring was full
+    Sample_TypeDef slots[SAMPLE_RING_SIZE];
+} Sample_Ring_TypeDef;
+
+/* Keeps the slot access and the index update in program order; a single-core
+   Cortex-M4 needs no hardware barrier for this. The host test defines its own
+   to preempt the ring at these points. */
+#ifndef SAMPLE_RING_BARRIER
+#define SAMPLE_RING_BARRIER() __asm volatile ("" ::: "memory")
+#endif
+
+static inline void Sample_Ring_Init(Sample_Ring_TypeDef *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->overruns = 0;
+}
+
+static inline uint16_t Sample_Ring_Count(const Sample_Ring_TypeDef *ring) {
+    return (uint16_t)(ring->head - ring->tail) & (SAMPLE_RING_SIZE - 1);
+}
+
+/* Producer side. One slot stays empty so a full ring is not mistaken for an empty one. */
+static inline uint8_t Sample_Ring_Push(Sample_Ring_TypeDef *ring, const int16_t *data, uint32_t time) {
+    uint16_t head = ring->head;
+    uint16_t next = (head + 1) & (SAMPLE_RING_SIZE - 1);
+
+    if (next == ring->tail) {
+        ring->overruns++;
+        return 0;
+    }
+    ring->slots[head].data[0] = data[0];
+    ring->slots[head].data[1] = data[1];
+    ring->slots[head].data[2] = data[2];
+    ring->slots[head].time = time;
+    SAMPLE_RING_BARRIER();
+    ring->head = next;
+    return 1;
+}
+
+/* Consumer side, copies up to max samples (oldest first) and returns how many */
+static inline uint16_t Sample_Ring_Pop(Sample_Ring_TypeDef *ring, Sample_TypeDef *out, uint16_t max) {
+    uint16_t tail = ring->tail;
+    uint16_t count = (uint16_t)(ring->head - tail) & (SAMPLE_RING_SIZE - 1);
+
+    if (count > max) {
+        count = max;
+    }
+    SAMPLE_RING_BARRIER();
+    for (uint16_t n = 0; n < count; n++) {
+        out[n] = ring->slots[(tail + n) & (SAMPLE_RING_SIZE - 1)];
+    }
+    SAMPLE_RING_BARRIER();
+    ring->tail = (tail + count) & (SAMPLE_RING_SIZE - 1);
+    return count;
+}
+
+/* Consumer side, drops every stored sample */
+static inline void Sample_Ring_Discard(Sample_Ring_TypeDef *ring) {
+    SAMPLE_RING_BARRIER();
+    ring->tail = ring->head;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SAMPLE_RING_H */
@@ -0,0 +1,57 @@
+/**
+  ******************************************************************************
+  * @file           : spectrum.h
+  * @brief          : Vibration spectrum of 3-axis samples. Blocks of
+  *                   SPECTRUM_SIZE samples per axis have their mean removed,
+  *                   get a Hann window and a real FFT; the power of
+  *                   SPECTRUM_AVERAGE blocks is averaged and reduced to
+  *                   SPECTRUM_BANDS equal-width band amplitudes and the
+  *                   SPECTRUM_PEAKS strongest peaks per axis. Amplitudes are
+  *                   in input units, scaled so a sine of amplitude A reads
+  *                   about A. Single precision, kept free of HAL includes.
+  ******************************************************************************
+  */
+
+#ifndef __SPECTRUM_H
+#define __SPECTRUM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SPECTRUM_SIZE 256           // FFT length, a power of two
+#define SPECTRUM_BANDS 16           // must divide SPECTRUM_SIZE / 2
+#define SPECTRUM_PEAKS 3
+#define SPECTRUM_AVERAGE 4          // blocks per report
+
+typedef struct {
+    float frequency;  // Hz, interpolated between bins
+    float amplitude;
+} Spectrum_Peak_TypeDef;
+
+typedef struct {
+    uint32_t time;    // capture time of the first sample averaged
+    float bands[3][SPECTRUM_BANDS];
+    Spectrum_Peak_TypeDef peaks[3][SPECTRUM_PEAKS];  // strongest first, 0 when fewer
+} Spectrum_Report_TypeDef;
+
+typedef struct {
+    int16_t block[3][SPECTRUM_SIZE];        // raw until full, the FFT runs in one shared float buffer
+    float power[3][SPECTRUM_SIZE / 2 + 1];  // summed over the blocks so far
+    uint16_t fill;    // samples in block
+    uint8_t blocks;   // blocks in power
+    uint32_t time;
+} Spectrum_TypeDef;
+
+void Spectrum_Init(Spectrum_TypeDef *spectrum);
+uint8_t Spectrum_Add(Spectrum_TypeDef *spectrum, const int16_t data[3], uint32_t time);
+void Spectrum_Report(Spectrum_TypeDef *spectrum, float rate_hz, Spectrum_Report_TypeDef *report);
+void Spectrum_Real_Fft(float *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPECTRUM_H */
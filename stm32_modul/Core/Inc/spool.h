@@ -0,0 +1,64 @@
+/**
+  ******************************************************************************
+  * @file           : spool.h
+  * @brief          : Store-and-forward spool for records that cannot be sent
+  *                   yet. Records go into a RAM ring; when it is full the
+  *                   oldest ones are moved to a flash region used as a ring of
+  *                   pages, so the order stays first in, first out across
+  *                   both. Spool_Peek() hands out whole records for one
+  *                   upload and Spool_Consume() drops them once it was
+  *                   delivered; until then they stay in place and a failed
+  *                   upload peeks them again. The spool starts empty after a
+  *                   reset.
+  *                   Flash access goes through a port, kept free of HAL
+  *                   includes.
+  ******************************************************************************
+  */
+
+#ifndef __SPOOL_H
+#define __SPOOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SPOOL_RAM_SIZE 4096         // bytes, must be a power of two
+#define SPOOL_FLASH_PAGE_SIZE 2048  // bytes, one STM32F303 flash page
+#define SPOOL_FLASH_PAGES 8         // pages of the SPOOL region in STM32F303VCTX_FLASH.ld
+#define SPOOL_RECORD_MAX 256        // bytes per record
+
+typedef struct {
+    /* Erases the page starting at address; returns 0 on failure. */
+    uint8_t (*erase)(uintptr_t address);
+    /* Programs one erased halfword; returns 0 on failure. */
+    uint8_t (*program)(uintptr_t address, uint16_t value);
+} Spool_Port_TypeDef;
+
+typedef struct {
+    uint32_t written;    // records accepted by Spool_Write()
+    uint32_t consumed;   // records dropped by Spool_Consume()
+    uint32_t dropped;    // records refused because RAM and flash were full
+    uint32_t spilled;    // bytes moved from RAM to flash
+    uint32_t flash_errors; // failed erases or programs
+    uint32_t peak;       // most bytes held at once
+} Spool_Stats_TypeDef;
+
+void Spool_Init(const Spool_Port_TypeDef *port, uintptr_t flash_base);
+uint8_t Spool_Write(const uint8_t *record, uint16_t length);
+uint16_t Spool_Peek(uint8_t *buffer, uint16_t size);
+void Spool_Consume(void);
+uint8_t Spool_Empty(void);
+uint8_t Spool_Waiting(void);
+uint32_t Spool_Ram_Bytes(void);
+uint32_t Spool_Flash_Bytes(void);
+uint32_t Spool_Capacity(void);
+
+extern Spool_Stats_TypeDef spool_stats;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPOOL_H */
@@ -63,7 +63,18 @@ void USB_LP_CAN_RX0_IRQHandler(void);
 void SPI1_IRQHandler(void);
 void USART2_IRQHandler(void);
 /* USER CODE BEGIN EFP */
-
+#if USE_SPI_DMA
+void DMA1_Channel2_IRQHandler(void);
+void DMA1_Channel3_IRQHandler(void);
+#endif
+#if USE_UART_DMA
+void DMA1_Channel6_IRQHandler(void);
+#endif
+#if USE_I2C_DMA
+void DMA1_Channel7_IRQHandler(void);
+void I2C1_EV_IRQHandler(void);
+void I2C1_ER_IRQHandler(void);
+#endif
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
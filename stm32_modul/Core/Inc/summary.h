@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file           : summary.h
+  * @brief          : One-pass statistics of 3-axis samples over a window:
+  *                   count, min, max and, per axis, the running mean and sum
+  *                   of squared deviations (Welford), from which variance and
+  *                   RMS follow without a second pass or a sum of squares
+  *                   that could lose precision. Values stay in the input
+  *                   units. Single precision, kept free of HAL includes.
+  ******************************************************************************
+  */
+
+#ifndef __SUMMARY_H
+#define __SUMMARY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "sample_ring.h"
+
+typedef struct {
+    uint32_t count;
+    uint32_t start;   // capture time of the first sample
+    uint32_t end;     // capture time of the last sample
+    int16_t min[3];
+    int16_t max[3];
+    float mean[3];
+    float m2[3];      // sum of squared deviations from the mean
+} Summary_TypeDef;
+
+void Summary_Reset(Summary_TypeDef *summary);
+void Summary_Add(Summary_TypeDef *summary, const Sample_TypeDef *sample);
+float Summary_Variance(const Summary_TypeDef *summary, uint8_t axis);
+float Summary_Rms(const Summary_TypeDef *summary, uint8_t axis);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SUMMARY_H */
@@ -0,0 +1,96 @@
+/**
+  ******************************************************************************
+  * @file           : ahrs.c
+  * @brief          : Madgwick orientation filter, see ahrs.h.
+  *                   The gyro rate is integrated as a quaternion derivative and
+  *                   pulled towards the orientation in which gravity and the
+  *                   horizontal part of the earth field, rotated into the
+  *                   sensor frame, match the measured directions: one step of
+  *                   gradient descent on that error, normalised and scaled by
+  *                   beta, per update.
+  ******************************************************************************
+  */
+
+#include "ahrs.h"
+#include <math.h>
+#include <stddef.h>
+
+void Ahrs_Init(Ahrs_TypeDef *ahrs, float beta) {
+    ahrs->q[0] = 1.0f;
+    ahrs->q[1] = ahrs->q[2] = ahrs->q[3] = 0.0f;
+    ahrs->beta = beta;
+    ahrs->settle = AHRS_SETTLE_UPDATES;
+}
+
+/* gyro in rad/s; acc and mag in any unit, only their directions are used.
+   mag may be NULL (or zero) for gravity only correction, which leaves the
+   heading to the gyro. dt in seconds. */
+void Ahrs_Update(Ahrs_TypeDef *ahrs, const float gyro[3], const float acc[3], const float mag[3], float dt) {
+    float q0 = ahrs->q[0], q1 = ahrs->q[1], q2 = ahrs->q[2], q3 = ahrs->q[3];
+
+    /* Rate of change of the orientation from the gyro alone */
+    float dq0 = 0.5f * (-q1 * gyro[0] - q2 * gyro[1] - q3 * gyro[2]);
+    float dq1 = 0.5f * ( q0 * gyro[0] + q2 * gyro[2] - q3 * gyro[1]);
+    float dq2 = 0.5f * ( q0 * gyro[1] - q1 * gyro[2] + q3 * gyro[0]);
+    float dq3 = 0.5f * ( q0 * gyro[2] + q1 * gyro[1] - q2 * gyro[0]);
+
+    float acc_norm = acc[0] * acc[0] + acc[1] * acc[1] + acc[2] * acc[2];
+    if (acc_norm > 0.0f) {
+        float inv = 1.0f / sqrtf(acc_norm);
+        float ax = acc[0] * inv, ay = acc[1] * inv, az = acc[2] * inv;
+
+        /* Gravity rotated into the sensor frame minus the measurement, and the
+           gradient of its squared length (Jacobian transposed times error) */
+        float f0 = 2.0f * (q1 * q3 - q0 * q2) - ax;
+        float f1 = 2.0f * (q0 * q1 + q2 * q3) - ay;
+        float f2 = 1.0f - 2.0f * (q1 * q1 + q2 * q2) - az;
+        float s0 = -2.0f * q2 * f0 + 2.0f * q1 * f1;
+        float s1 =  2.0f * q3 * f0 + 2.0f * q0 * f1 - 4.0f * q1 * f2;
+        float s2 = -2.0f * q0 * f0 + 2.0f * q3 * f1 - 4.0f * q2 * f2;
+        float s3 =  2.0f * q1 * f0 + 2.0f * q2 * f1;
+
+        float mag_norm = mag ? mag[0] * mag[0] + mag[1] * mag[1] + mag[2] * mag[2] : 0.0f;
+        if (mag_norm > 0.0f) {
+            inv = 1.0f / sqrtf(mag_norm);
+            float mx = mag[0] * inv, my = mag[1] * inv, mz = mag[2] * inv;
+
+            /* Field in the earth frame; its horizontal part is taken as north
+               so the dip angle follows the measurement */
+            float hx = mx * (1.0f - 2.0f * (q2 * q2 + q3 * q3)) + 2.0f * my * (q1 * q2 - q0 * q3) + 2.0f * mz * (q1 * q3 + q0 * q2);
+            float hy = 2.0f * mx * (q1 * q2 + q0 * q3) + my * (1.0f - 2.0f * (q1 * q1 + q3 * q3)) + 2.0f * mz * (q2 * q3 - q0 * q1);
+            float bz = 2.0f * mx * (q1 * q3 - q0 * q2) + 2.0f * my * (q2 * q3 + q0 * q1) + mz * (1.0f - 2.0f * (q1 * q1 + q2 * q2));
+            float bx = sqrtf(hx * hx + hy * hy);
+
+            float g0 = bx * (1.0f - 2.0f * (q2 * q2 + q3 * q3)) + 2.0f * bz * (q1 * q3 - q0 * q2) - mx;
+            float g1 = 2.0f * bx * (q1 * q2 - q0 * q3) + 2.0f * bz * (q0 * q1 + q2 * q3) - my;
+            float g2 = 2.0f * bx * (q0 * q2 + q1 * q3) + bz * (1.0f - 2.0f * (q1 * q1 + q2 * q2)) - mz;
+            s0 += -2.0f * bz * q2 * g0 + (-2.0f * bx * q3 + 2.0f * bz * q1) * g1 + 2.0f * bx * q2 * g2;
+            s1 +=  2.0f * bz * q3 * g0 + ( 2.0f * bx * q2 + 2.0f * bz * q0) * g1 + (2.0f * bx * q3 - 4.0f * bz * q1) * g2;
+            s2 += (-4.0f * bx * q2 - 2.0f * bz * q0) * g0 + (2.0f * bx * q1 + 2.0f * bz * q3) * g1 + (2.0f * bx * q0 - 4.0f * bz * q2) * g2;
+            s3 += (-4.0f * bx * q3 + 2.0f * bz * q1) * g0 + (-2.0f * bx * q0 + 2.0f * bz * q2) * g1 + 2.0f * bx * q1 * g2;
+        }
+
+        float step_norm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+        if (step_norm > 0.0f) {
+            float beta = ahrs->settle ? AHRS_SETTLE_BETA : ahrs->beta;
+            inv = beta / sqrtf(step_norm);
+            dq0 -= s0 * inv;
+            dq1 -= s1 * inv;
+            dq2 -= s2 * inv;
+            dq3 -= s3 * inv;
+        }
+    }
+    if (ahrs->settle) {
+        ahrs->settle--;
+    }
+
+    q0 += dq0 * dt;
+    q1 += dq1 * dt;
+    q2 += dq2 * dt;
+    q3 += dq3 * dt;
+    float inv = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    ahrs->q[0] = q0 * inv;
+    ahrs->q[1] = q1 * inv;
+    ahrs->q[2] = q2 * inv;
+    ahrs->q[3] = q3 * inv;
+}
@@ -0,0 +1,206 @@
+/**
+  ******************************************************************************
+  * @file           : at_parser.c
+  * @brief          : ESP8266 AT reply tokenizer, see at_parser.h.
+  *                   At_Parser_Feed() runs in the UART receive context and is
+  *                   the only producer of events; the superloop consumes them.
+  ******************************************************************************
+  */
+
+#include "at_parser.h"
+#include <string.h>
+
+#if (AT_EVENT_QUEUE_SIZE & (AT_EVENT_QUEUE_SIZE - 1)) != 0
+#error "AT_EVENT_QUEUE_SIZE must be a power of two"
+#endif
+
+#define AT_MATCH_EXACT 0
+#define AT_MATCH_PREFIX 1
+#define AT_MATCH_VALUE 2   // prefix followed by the number carried as the value
+
+typedef struct {
+    const char *text;
+    uint8_t type;
+    uint8_t match;
+} At_Pattern_TypeDef;
+
+/* Matched against each complete line, after an optional "<link>," prefix */
+static const At_Pattern_TypeDef at_patterns[] = {
+    { "OK",                AT_EVENT_OK,               AT_MATCH_EXACT },
+    { "ERROR",             AT_EVENT_ERROR,            AT_MATCH_EXACT },
+    { "FAIL",              AT_EVENT_ERROR,            AT_MATCH_EXACT },
+    { "SEND OK",           AT_EVENT_SEND_OK,          AT_MATCH_EXACT },
+    { "SEND FAIL",         AT_EVENT_SEND_FAIL,        AT_MATCH_EXACT },
+    { "CONNECT",           AT_EVENT_CONNECT,          AT_MATCH_EXACT },
+    { "ALREADY CONNECTED", AT_EVENT_CONNECT,          AT_MATCH_EXACT },
+    { "CLOSED",            AT_EVENT_CLOSED,           AT_MATCH_EXACT },
+    { "CONNECT FAIL",      AT_EVENT_CLOSED,           AT_MATCH_EXACT },
+    { "+STA_CONNECTED",    AT_EVENT_STA_CONNECTED,    AT_MATCH_PREFIX },
+    { "+STA_DISCONNECTED", AT_EVENT_STA_DISCONNECTED, AT_MATCH_PREFIX },
+    { "WIFI CONNECTED",    AT_EVENT_WIFI_CONNECTED,   AT_MATCH_EXACT },
+    { "WIFI DISCONNECT",   AT_EVENT_WIFI_DISCONNECT,  AT_MATCH_EXACT },
+    { "WIFI GOT IP",       AT_EVENT_WIFI_GOT_IP,      AT_MATCH_EXACT },
+    { "STATUS:",           AT_EVENT_STATUS,           AT_MATCH_VALUE },
+    { "+CWMODE:",          AT_EVENT_CWMODE,           AT_MATCH_VALUE },
+    { "+CIPMUX:",          AT_EVENT_CIPMUX,           AT_MATCH_VALUE },
+    { "busy ",             AT_EVENT_BUSY,             AT_MATCH_PREFIX },
+    { "ready",             AT_EVENT_READY,            AT_MATCH_EXACT },
+};
+
+static char at_line[AT_LINE_MAX + 1];
+static uint8_t at_line_length = 0;
+static uint32_t at_ipd_remaining = 0;  // payload bytes of the current +IPD still to come
+static uint8_t at_ipd_link = AT_LINK_NONE;
+
+static At_Event_TypeDef at_queue[AT_EVENT_QUEUE_SIZE];
+static volatile uint16_t at_queue_head = 0;
+static volatile uint16_t at_queue_tail = 0;
+static volatile uint32_t at_queue_dropped = 0;
+static volatile uint32_t at_seen = 0;  // bit per event type since the last flush
+static volatile uint16_t at_values[AT_EVENT_COUNT];
+
+static uint16_t At_Parse_Number(const char **text) {
+    uint16_t value = 0;
+    while (**text >= '0' && **text <= '9') {
+        value = value * 10 + (**text - '0');
+        (*text)++;
+    }
+    return value;
+}
+
+static void At_Emit(uint8_t type, uint8_t link, uint16_t value) {
+    uint16_t head = at_queue_head;
+    uint16_t next = (head + 1) & (AT_EVENT_QUEUE_SIZE - 1);
+
+    at_values[type] = value;
+    at_seen |= 1UL << type;
+    if (next == at_queue_tail) {
+        at_queue_dropped++;
+        return;
+    }
+    at_queue[head].type = type;
+    at_queue[head].link = link;
+    at_queue[head].value = value;
+    at_queue_head = next;
+}
+
+static void At_Classify_Line(void) {
+    const char *text = at_line;
+    uint8_t link = AT_LINK_NONE;
+
+    at_line[at_line_length] = '\0';
+    if (text[0] >= '0' && text[0] <= '9' && text[1] == ',') {
+        link = text[0] - '0';
+        text += 2;
+    }
+    for (uint8_t i = 0; i < sizeof(at_patterns) / sizeof(at_patterns[0]); i++) {
+        const At_Pattern_TypeDef *pattern = &at_patterns[i];
+        size_t length = strlen(pattern->text);
+        if (strncmp(text, pattern->text, length) != 0) {
+            continue;
+        }
+        if (pattern->match == AT_MATCH_EXACT && text[length] != '\0') {
+            continue;
+        }
+        uint16_t value = 0;
+        if (pattern->match == AT_MATCH_VALUE) {
+            const char *number = text + length;
+            value = At_Parse_Number(&number);
+        }
+        At_Emit(pattern->type, link, value);
+        return;
+    }
+}
+
+/* "+IPD,<len>:" or "+IPD,<link>,<len>:", called on the ':' */
+static void At_Start_Payload(void) {
+    const char *text = at_line + 5;
+    uint16_t first = At_Parse_Number(&text);
+
+    at_ipd_link = AT_LINK_NONE;
+    at_ipd_remaining = first;
+    if (*text == ',') {
+        text++;
+        at_ipd_link = (uint8_t)first;
+        at_ipd_remaining = At_Parse_Number(&text);
+    }
+    At_Emit(AT_EVENT_IPD, at_ipd_link, (uint16_t)at_ipd_remaining);
+    if (at_ipd_remaining == 0) {
+        At_Emit(AT_EVENT_IPD_END, at_ipd_link, 0);
+    }
+}
+
+void At_Parser_Reset(void) {
+    at_line_length = 0;
+    at_ipd_remaining = 0;
+    at_queue_tail = at_queue_head;
+    at_seen = 0;
+}
+
+void At_Parser_Feed(const uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+
+        if (at_ipd_remaining) {  // payload is not tokenized
+            if (--at_ipd_remaining == 0) {
+                At_Emit(AT_EVENT_IPD_END, at_ipd_link, 0);
+            }
+            continue;
+        }
+        if (byte == '\r') {
+            continue;
+        }
+        if (byte == '\n') {
+            if (at_line_length) {
+                At_Classify_Line();
+            }
+            at_line_length = 0;
+            continue;
+        }
+        if (byte == '>' && at_line_length == 0) {
+            At_Emit(AT_EVENT_PROMPT, AT_LINK_NONE, 0);
+            continue;
+        }
+        if (byte == ':' && at_line_length >= 5 && strncmp(at_line, "+IPD,", 5) == 0) {
+            at_line[at_line_length] = '\0';
+            At_Start_Payload();
+            at_line_length = 0;
+            continue;
+        }
+        if (at_line_length < AT_LINE_MAX) {
+            at_line[at_line_length++] = (char)byte;
+        }
+    }
+}
+
+/* Returns 1 and the oldest event, or 0 when none is queued */
+uint8_t At_Parser_Next(At_Event_TypeDef *event) {
+    uint16_t tail = at_queue_tail;
+    if (tail == at_queue_head) {
+        return 0;
+    }
+    *event = at_queue[tail];
+    at_queue_tail = (tail + 1) & (AT_EVENT_QUEUE_SIZE - 1);
+    return 1;
+}
+
+/* Forgets queued events and the seen flags, but not a partially received
+   line. Call with the UART receive interrupt excluded. */
+void At_Parser_Flush(void) {
+    at_queue_tail = at_queue_head;
+    at_seen = 0;
+}
+
+/* Whether an event of this type arrived since the last flush */
+uint8_t At_Parser_Seen(uint8_t type) {
+    return (at_seen >> type) & 1;
+}
+
+/* Value carried by the last event of this type (STATUS:n, +IPD length) */
+uint16_t At_Parser_Value(uint8_t type) {
+    return at_values[type];
+}
+
+uint32_t At_Parser_Dropped(void) {
+    return at_queue_dropped;
+}
@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file           : calibration.c
+  * @brief          : Batch calibration of raw samples, see calibration.h.
+  *                   X and Y of a sample are loaded as one word and offset
+  *                   with a saturating dual subtract (QSUB16); each output
+  *                   row is then one dual multiply-accumulate (SMLAD) for X
+  *                   and Y plus a multiply-accumulate for Z, rounded, shifted
+  *                   out of Q14 and saturated to int16. Calibration_Valid()
+  *                   bounds the row gains so the 32-bit sums cannot overflow.
+  ******************************************************************************
+  */
+
+#include "calibration.h"
+#include <string.h>
+
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "cmsis_compiler.h"
+#define CALIBRATION_SIMD 1
+#else
+#define CALIBRATION_SIMD 0
+#endif
+
+static int16_t Calibration_Saturate(int32_t value) {
+#if CALIBRATION_SIMD
+    return (int16_t)__SSAT(value, 16);
+#else
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+#endif
+}
+
+void Calibration_Identity(Calibration_TypeDef *cal) {
+    memset(cal, 0, sizeof(*cal));
+    for (uint8_t i = 0; i < 3; i++) {
+        cal->matrix[i][i] = CALIBRATION_ONE;
+    }
+}
+
+/* Rows with a gain above 2 could overflow the accumulator */
+uint8_t Calibration_Valid(const Calibration_TypeDef *cal) {
+    for (uint8_t i = 0; i < 3; i++) {
+        int32_t sum = 0;
+        for (uint8_t j = 0; j < 3; j++) {
+            sum += cal->matrix[i][j] < 0 ? -cal->matrix[i][j] : cal->matrix[i][j];
+        }
+        if (sum > CALIBRATION_ROW_MAX) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void Calibration_Apply(const Calibration_TypeDef *cal, Sample_TypeDef *samples, uint16_t count) {
+    const int32_t round = 1 << (CALIBRATION_SHIFT - 1);
+
+#if CALIBRATION_SIMD
+    uint32_t offset_xy = (uint16_t)cal->offset[0] | ((uint32_t)(uint16_t)cal->offset[1] << 16);
+    uint32_t row_xy[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        row_xy[i] = (uint16_t)cal->matrix[i][0] | ((uint32_t)(uint16_t)cal->matrix[i][1] << 16);
+    }
+    for (uint16_t n = 0; n < count; n++) {
+        uint32_t raw_xy;
+        memcpy(&raw_xy, samples[n].data, sizeof(raw_xy));
+        uint32_t xy = __QSUB16(raw_xy, offset_xy);
+        int32_t z = Calibration_Saturate((int32_t)samples[n].data[2] - cal->offset[2]);
+        for (uint8_t i = 0; i < 3; i++) {
+            int32_t sum = (int32_t)__SMLAD(row_xy[i], xy, (uint32_t)(cal->matrix[i][2] * z + round));
+            samples[n].data[i] = Calibration_Saturate(sum >> CALIBRATION_SHIFT);
+        }
+    }
+#else
+    for (uint16_t n = 0; n < count; n++) {
+        int32_t d[3];
+        for (uint8_t j = 0; j < 3; j++) {
+            d[j] = Calibration_Saturate((int32_t)samples[n].data[j] - cal->offset[j]);
+        }
+        for (uint8_t i = 0; i < 3; i++) {
+            int32_t sum = cal->matrix[i][0] * d[0] + cal->matrix[i][1] * d[1] + cal->matrix[i][2] * d[2] + round;
+            samples[n].data[i] = Calibration_Saturate(sum >> CALIBRATION_SHIFT);
+        }
+    }
+#endif
+}
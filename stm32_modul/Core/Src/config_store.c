@@ -0,0 +1,202 @@
+/**
+  ******************************************************************************
+  * @file           : config_store.c
+  * @brief          : Flash key/value store, see config_store.h.
+  *                   Page layout, in halfwords: sequence, magic, then records
+  *                   of tag (key << 8 | length), the value padded to an even
+  *                   length, and a commit mark written last. A record whose
+  *                   commit mark is missing was cut off by a reset and is
+  *                   skipped. The page header is also written last, so a
+  *                   page being compacted into only counts once it is full.
+  ******************************************************************************
+  */
+
+#include "config_store.h"
+#include <string.h>
+
+#define CONFIG_MAGIC 0xC0F5
+#define CONFIG_COMMIT 0x5AA5
+#define CONFIG_ERASED 0xFFFF
+#define CONFIG_HEADER_SIZE 4
+#define CONFIG_NONE 0                // offset of a key that has no record
+
+static const Config_Store_Port_TypeDef *config_port;
+static uintptr_t config_base = 0;
+static uint8_t config_page = 0;      // active page, 0 or 1
+static uint16_t config_sequence = 0; // of the active page
+static uint16_t config_end = CONFIG_HEADER_SIZE;  // first free byte of the active page
+static uint16_t config_offset[CONFIG_KEY_COUNT];  // latest record of each key
+
+static uintptr_t Config_Page_Address(uint8_t page) {
+    return config_base + (uintptr_t)page * CONFIG_PAGE_SIZE;
+}
+
+static uint16_t Config_Read(uint8_t page, uint16_t offset) {
+    return *(const volatile uint16_t *)(uintptr_t)(Config_Page_Address(page) + offset);
+}
+
+/* Bytes a record takes: tag, value padded to halfwords, commit mark */
+static uint16_t Config_Record_Size(uint8_t length) {
+    return 2 + ((length + 1) & ~1) + 2;
+}
+
+static uint8_t Config_Page_Valid(uint8_t page) {
+    return Config_Read(page, 2) == CONFIG_MAGIC;
+}
+
+/* Walks the records of the active page, indexing the committed ones */
+static void Config_Scan(void) {
+    uint16_t offset = CONFIG_HEADER_SIZE;
+
+    memset(config_offset, 0, sizeof(config_offset));
+    while (offset + 2 <= CONFIG_PAGE_SIZE) {
+        uint16_t tag = Config_Read(config_page, offset);
+        if (tag == CONFIG_ERASED) {
+            break;
+        }
+        uint8_t key = tag >> 8;
+        uint16_t size = Config_Record_Size(tag & 0xFF);
+        if (offset + size > CONFIG_PAGE_SIZE) {
+            break;
+        }
+        if (Config_Read(config_page, offset + size - 2) == CONFIG_COMMIT && key < CONFIG_KEY_COUNT) {
+            config_offset[key] = offset;
+        }
+        offset += size;
+    }
+    config_end = offset;
+}
+
+static uint8_t Config_Program_Record(uint8_t page, uint16_t offset, uint8_t key,
+                                     const uint8_t *value, uint8_t length) {
+    uintptr_t address = Config_Page_Address(page) + offset;
+
+    if (!config_port->program(address, (uint16_t)(key << 8 | length))) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < length; i += 2) {
+        uint16_t halfword = value[i] | (uint16_t)((i + 1 < length ? value[i + 1] : 0xFF) << 8);
+        if (!config_port->program(address + 2 + i, halfword)) {
+            return 0;
+        }
+    }
+    return config_port->program(address + Config_Record_Size(length) - 2, CONFIG_COMMIT);
+}
+
+static uint8_t Config_Format(uint8_t page, uint16_t sequence) {
+    uintptr_t address = Config_Page_Address(page);
+    return config_port->erase(address) && config_port->program(address, sequence) &&
+           config_port->program(address + 2, CONFIG_MAGIC);
+}
+
+/* Copies the latest record of every key to the other page, then makes that
+   page the active one and erases the old one. The value about to be replaced
+   is copied too, so a reset before its successor is written keeps it. */
+static uint8_t Config_Compact(void) {
+    uint8_t target = config_page ^ 1;
+    uintptr_t address = Config_Page_Address(target);
+    uint16_t offset = CONFIG_HEADER_SIZE;
+    uint8_t value[CONFIG_VALUE_MAX];
+
+    if (!config_port->erase(address)) {
+        return 0;
+    }
+    for (uint8_t key = 0; key < CONFIG_KEY_COUNT; key++) {
+        if (config_offset[key] == CONFIG_NONE) {
+            continue;
+        }
+        uint8_t length = Config_Read(config_page, config_offset[key]) & 0xFF;
+        if (length == 0) {
+            continue;  // deleted
+        }
+        memcpy(value, (const void *)(uintptr_t)(Config_Page_Address(config_page) + config_offset[key] + 2), length);
+        if (!Config_Program_Record(target, offset, key, value, length)) {
+            return 0;
+        }
+        offset += Config_Record_Size(length);
+    }
+    if (!config_port->program(address, (uint16_t)(config_sequence + 1)) ||
+        !config_port->program(address + 2, CONFIG_MAGIC)) {
+        return 0;
+    }
+    config_port->erase(Config_Page_Address(config_page));
+    config_page = target;
+    config_sequence++;
+    Config_Scan();
+    return 1;
+}
+
+/* Picks the valid page with the newer sequence, formatting page 0 when
+   neither is valid (first boot or erased flash) */
+void Config_Store_Init(const Config_Store_Port_TypeDef *port, uintptr_t base) {
+    config_port = port;
+    config_base = base;
+
+    uint8_t valid0 = Config_Page_Valid(0);
+    uint8_t valid1 = Config_Page_Valid(1);
+    if (valid0 && valid1) {  // a compaction was cut off before the old page was erased
+        int16_t newer = (int16_t)(Config_Read(1, 0) - Config_Read(0, 0));
+        config_page = newer > 0 ? 1 : 0;
+        config_port->erase(Config_Page_Address(config_page ^ 1));
+    } else if (valid0 || valid1) {
+        config_page = valid1;
+    } else {
+        config_page = 0;
+        Config_Format(0, 0);
+    }
+    config_sequence = Config_Read(config_page, 0);
+    Config_Scan();
+}
+
+/* Copies up to size bytes of the value; returns its length, 0 when unset */
+uint8_t Config_Get(uint8_t key, void *value, uint8_t size) {
+    if (key >= CONFIG_KEY_COUNT || config_offset[key] == CONFIG_NONE) {
+        return 0;
+    }
+    uint16_t offset = config_offset[key];
+    uint8_t length = Config_Read(config_page, offset) & 0xFF;
+    memcpy(value, (const void *)(uintptr_t)(Config_Page_Address(config_page) + offset + 2),
+           length < size ? length : size);
+    return length;
+}
+
+/* Appends the value unless it is already stored; returns 0 when the flash
+   refused it or the store cannot hold it. Blocks for a page erase (tens of
+   ms) when the active page is full. */
+uint8_t Config_Set(uint8_t key, const void *value, uint8_t length) {
+    if (key >= CONFIG_KEY_COUNT || length > CONFIG_VALUE_MAX) {
+        return 0;
+    }
+    if (config_offset[key] != CONFIG_NONE) {
+        uint16_t offset = config_offset[key];
+        if ((Config_Read(config_page, offset) & 0xFF) == length &&
+            memcmp(value, (const void *)(uintptr_t)(Config_Page_Address(config_page) + offset + 2), length) == 0) {
+            return 1;
+        }
+    }
+    if (config_end + Config_Record_Size(length) > CONFIG_PAGE_SIZE) {
+        if (!Config_Compact() || config_end + Config_Record_Size(length) > CONFIG_PAGE_SIZE) {
+            return 0;
+        }
+    }
+    uint16_t offset = config_end;
+    config_end += Config_Record_Size(length);  // a failed write still used the space
+    if (!Config_Program_Record(config_page, offset, key, (const uint8_t *)value, length)) {
+        return 0;
+    }
+    config_offset[key] = offset;
+    return 1;
+}
+
+/* A zero-length record hides older values; compaction drops it */
+uint8_t Config_Delete(uint8_t key) {
+    if (key >= CONFIG_KEY_COUNT || config_offset[key] == CONFIG_NONE) {
+        return 1;
+    }
+    return Config_Set(key, "", 0);
+}
+
+/* Bytes left in the active page */
+uint16_t Config_Free(void) {
+    return CONFIG_PAGE_SIZE - config_end;
+}
@@ -0,0 +1,115 @@
+/**
+  ******************************************************************************
+  * @file           : decimator.c
+  * @brief          : Biquad cascade decimator, see decimator.h.
+  *                   Coefficients come from the bilinear transform of the
+  *                   Butterworth poles (section Q 0.518, 0.707 and 1.932),
+  *                   once per Decimator_Init(). A batch is processed a block at a time:
+  *                   one axis goes through each section over the whole block
+  *                   before the next section, keeping the coefficients in
+  *                   registers, then the kept samples are written back in
+  *                   place with their capture times.
+  ******************************************************************************
+  */
+
+#include "decimator.h"
+#include <math.h>
+#include <string.h>
+
+static const float decimator_q[DECIMATOR_SECTIONS] = { 0.51763809f, 0.70710678f, 1.93185165f };
+
+void Decimator_Init(Decimator_TypeDef *dec, uint8_t factor) {
+    memset(dec, 0, sizeof(*dec));
+    dec->factor = factor < 1 ? 1 : factor > DECIMATOR_MAX_FACTOR ? DECIMATOR_MAX_FACTOR : factor;
+    if (dec->factor == 1) {
+        return;
+    }
+
+    float w0 = 3.14159265f * DECIMATOR_CUTOFF / dec->factor;
+    float cos_w0 = cosf(w0);
+    for (uint8_t s = 0; s < DECIMATOR_SECTIONS; s++) {
+        float alpha = sinf(w0) / (2.0f * decimator_q[s]);
+        float a0 = 1.0f + alpha;
+        dec->coeffs[s][0] = (1.0f - cos_w0) / 2.0f / a0;
+        dec->coeffs[s][1] = (1.0f - cos_w0) / a0;
+        dec->coeffs[s][2] = (1.0f - cos_w0) / 2.0f / a0;
+        dec->coeffs[s][3] = -2.0f * cos_w0 / a0;
+        dec->coeffs[s][4] = (1.0f - alpha) / a0;
+    }
+}
+
+/* Runs one section over a block in place */
+static void Decimator_Section(const float coeffs[5], float state[2], float *block, uint16_t count) {
+    float b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+    float s1 = state[0], s2 = state[1];
+
+    for (uint16_t n = 0; n < count; n++) {
+        float x = block[n];
+        float y = b0 * x + s1;
+        s1 = b1 * x - a1 * y + s2;
+        s2 = b2 * x - a2 * y;
+        block[n] = y;
+    }
+    state[0] = s1;
+    state[1] = s2;
+}
+
+/* Starts every section at rest on the value x, so a constant input (gravity,
+   gyro bias) does not ring through the first outputs */
+static void Decimator_Prime(Decimator_TypeDef *dec, const Sample_TypeDef *first) {
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        float x = first->data[axis];
+        for (uint8_t s = 0; s < DECIMATOR_SECTIONS; s++) {
+            dec->state[axis][s][0] = x * (1.0f - dec->coeffs[s][0]);
+            dec->state[axis][s][1] = x * (dec->coeffs[s][2] - dec->coeffs[s][4]);
+        }
+    }
+    dec->primed = 1;
+}
+
+/* Filters the batch and compacts the kept samples to its front; returns how
+   many were kept. The phase carries over between batches. */
+uint16_t Decimator_Process(Decimator_TypeDef *dec, Sample_TypeDef *samples, uint16_t count) {
+    float block[DECIMATOR_BLOCK_MAX];
+    uint16_t kept = 0;
+
+    if (dec->factor == 1 || count == 0) {
+        return count;
+    }
+    if (!dec->primed) {
+        Decimator_Prime(dec, &samples[0]);
+    }
+    for (uint16_t start = 0; start < count; start += DECIMATOR_BLOCK_MAX) {
+        uint16_t length = count - start < DECIMATOR_BLOCK_MAX ? count - start : DECIMATOR_BLOCK_MAX;
+        uint8_t phase = 0;
+        uint16_t first_kept = kept;
+
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            for (uint16_t n = 0; n < length; n++) {
+                block[n] = samples[start + n].data[axis];
+            }
+            for (uint8_t s = 0; s < DECIMATOR_SECTIONS; s++) {
+                Decimator_Section(dec->coeffs[s], dec->state[axis][s], block, length);
+            }
+            /* Kept samples never overtake the ones still to be read: the
+               write index stays at or below the read index */
+            phase = dec->phase;
+            kept = first_kept;
+            for (uint16_t n = 0; n < length; n++) {
+                if (++phase < dec->factor) {
+                    continue;
+                }
+                phase = 0;
+                float y = block[n];
+                int32_t value = (int32_t)lrintf(y);
+                samples[kept].data[axis] = value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+                if (axis == 2) {
+                    samples[kept].time = samples[start + n].time;
+                }
+                kept++;
+            }
+        }
+        dec->phase = phase;
+    }
+    return kept;
+}
@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file           : deferred_log.c
+  * @brief          : Record ring of the deferred logger, see deferred_log.h.
+  *                   Any context may write, only the superloop reads.
+  ******************************************************************************
+  */
+
+#include "main.h"
+#include "deferred_log.h"
+
+#if (LOG_RING_SIZE & (LOG_RING_SIZE - 1)) != 0
+#error "LOG_RING_SIZE must be a power of two"
+#endif
+
+static Log_Record_TypeDef log_ring[LOG_RING_SIZE];
+static volatile uint16_t log_head = 0;
+static volatile uint16_t log_tail = 0;
+static volatile uint32_t log_dropped = 0;
+
+/* Writers can be interrupts as well as the superloop, so the slot is claimed
+   and filled with interrupts masked; that is a handful of stores. */
+void Log_Write(uint16_t id, uint32_t arg0, uint32_t arg1) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint16_t head = log_head;
+    uint16_t next = (head + 1) & (LOG_RING_SIZE - 1);
+    if (next == log_tail) {
+        log_dropped++;
+    } else {
+        Log_Record_TypeDef *record = &log_ring[head];
+        record->time = HAL_GetTick();
+        record->id = id;
+        record->arg[0] = arg0;
+        record->arg[1] = arg1;
+        log_head = next;
+    }
+    __set_PRIMASK(primask);
+}
+
+/* Returns 1 and the oldest record, or 0 when the ring is empty */
+uint8_t Log_Read(Log_Record_TypeDef *record) {
+    uint16_t tail = log_tail;
+    if (tail == log_head) {
+        return 0;
+    }
+    *record = log_ring[tail];
+    __DMB();
+    log_tail = (tail + 1) & (LOG_RING_SIZE - 1);
+    return 1;
+}
+
+/* Number of records lost to a full ring since the last call */
+uint32_t Log_Take_Dropped(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t dropped = log_dropped;
+    log_dropped = 0;
+    __set_PRIMASK(primask);
+    return dropped;
+}
@@ -0,0 +1,652 @@
+/**
+  ******************************************************************************
+  * @file           : esp_transport.c
+  * @brief          : ESP8266 send engine, see esp_transport.h.
+  *                   Everything runs in the superloop: the queue, the parser
+  *                   events handed over by Check_Reception_Completion() and
+  *                   the timeouts. One payload is in flight on the UART at a
+  *                   time, while several links may wait for server replies.
+  *                   Only Esp_Transport_Write_Complete() runs in interrupt
+  *                   context.
+  ******************************************************************************
+  */
+
+#include "esp_transport.h"
+#include "deferred_log.h"
+#include <stdio.h>
+#include <string.h>
+
+#if (ESP_TX_QUEUE_SIZE & (ESP_TX_QUEUE_SIZE - 1)) != 0
+#error "ESP_TX_QUEUE_SIZE must be a power of two"
+#endif
+#if (ESP_STREAM_RING_SIZE & (ESP_STREAM_RING_SIZE - 1)) != 0
+#error "ESP_STREAM_RING_SIZE must be a power of two"
+#endif
+
+#define ESP_EVENT_NONE AT_EVENT_COUNT  // script step without a reply, it only waits its timeout
+
+/* One command of a transparent mode script */
+typedef struct {
+    const char *command;  // NULL = the CIPSTART built in esp_command
+    uint8_t expect;       // event that completes the step
+    uint8_t optional;     // the script goes on when the step fails
+    uint16_t timeout;     // ms
+} Esp_Step_TypeDef;
+
+/* Transparent mode needs a single connection, so the web server is stopped,
+   every link closed (CIPMUX=0 is refused while one is open) and CIPMUX
+   dropped to 0 for the session */
+static const Esp_Step_TypeDef esp_stream_open[] = {
+    { "AT+CIPSERVER=0\r\n", AT_EVENT_OK,     1, 1000 },
+    { "AT+CIPCLOSE=5\r\n",  AT_EVENT_OK,     1, 1000 },
+    { "AT+CIPMUX=0\r\n",    AT_EVENT_OK,     0, 1000 },
+    { NULL,                 AT_EVENT_OK,     0, 5000 },
+    { "AT+CIPMODE=1\r\n",   AT_EVENT_OK,     0, 1000 },
+    { "AT+CIPSEND\r\n",     AT_EVENT_PROMPT, 0, 2000 },
+};
+
+/* Best effort, every step is optional; a failed open starts at CIPMODE=0 */
+static const Esp_Step_TypeDef esp_stream_close[] = {
+    { "+++",                   ESP_EVENT_NONE, 1, ESP_ESCAPE_GUARD },
+    { "AT+CIPMODE=0\r\n",      AT_EVENT_OK,    1, 1000 },
+    { "AT+CIPCLOSE\r\n",       AT_EVENT_OK,    1, 1000 },
+    { "AT+CIPMUX=1\r\n",       AT_EVENT_OK,    1, 1000 },
+    { ESP_SERVER_LIMIT_COMMAND, AT_EVENT_OK,    1, 1000 },
+    { "AT+CIPSERVER=1,80\r\n", AT_EVENT_OK,    1, 1000 },
+};
+
+#define ESP_SCRIPT_LENGTH(script) (sizeof(script) / sizeof(script[0]))
+
+Esp_Transport_Stats_TypeDef esp_transport_stats;
+
+static const Esp_Transport_Port_TypeDef *esp_port;
+static uint8_t esp_queue[ESP_TX_QUEUE_SIZE][ESP_TX_PAYLOAD_MAX];
+static uint16_t esp_queue_length[ESP_TX_QUEUE_SIZE];
+static uint32_t esp_queue_sequence[ESP_TX_QUEUE_SIZE];
+static uint32_t esp_sequence = 0;   // of the last payload queued
+static uint8_t esp_queue_head = 0;
+static uint8_t esp_queue_tail = 0;
+
+static uint8_t esp_state = ESP_STATE_IDLE;
+static uint8_t esp_link_up = 0;
+static uint32_t esp_deadline = 0;    // timeout of the current state, also the end of a pause
+static uint32_t esp_started = 0;     // when the payload in flight got its first CIPSEND
+static uint8_t esp_attempt = 0;      // CIPSENDs issued for the payload in flight
+static char esp_command[64];
+static char esp_host[24];
+static uint16_t esp_host_port = 0;
+
+/* Indexed by slot; slot i is connection id ESP_LINK_ID - i, see Esp_Link_Id() */
+static uint8_t esp_links[ESP_LINK_COUNT];             // Esp_Link_State_TypeDef
+static uint32_t esp_link_deadline[ESP_LINK_COUNT];    // reply due, for ESP_LINK_AWAITING
+static uint8_t esp_link = 0;          // slot of the payload in flight or being opened
+static uint8_t esp_next_link = 0;     // round robin start
+static uint32_t esp_connect_retry = 0; // no link is opened before this tick
+static uint32_t esp_backoff = ESP_BACKOFF_MIN;
+static uint8_t esp_connect_wanted = 0; // keep a connection to esp_host open
+static volatile uint8_t esp_tx_busy = 0;  // a UART write started by the engine is still running
+
+static const Esp_Step_TypeDef *esp_script = NULL;
+static uint8_t esp_script_length = 0;
+static uint8_t esp_step = 0;
+static uint8_t esp_open_pending = 0;   // Esp_Transport_Stream_Open() waits for the current exchange
+static uint8_t esp_close_pending = 0;  // Esp_Transport_Stream_Close() arrived while opening
+
+static uint8_t esp_stream_ring[ESP_STREAM_RING_SIZE];
+static uint16_t esp_stream_head = 0;  // next byte written by Esp_Transport_Stream_Write()
+static uint16_t esp_stream_sent = 0;  // next byte handed to the UART
+static uint16_t esp_stream_tail = 0;  // first byte the UART may still be reading
+
+/* A write the UART refused, repeated from Esp_Transport_Poll() */
+static const uint8_t *esp_write_data = NULL;
+static uint16_t esp_write_length = 0;
+static uint32_t esp_write_timeout = 0;
+
+static uint8_t Esp_Expired(uint32_t now) {
+    return (int32_t)(now - esp_deadline) >= 0;
+}
+
+/* Moves to state once data is on its way; the timeout starts with the write */
+static void Esp_Write_Step(uint8_t state, const uint8_t *data, uint16_t length, uint32_t timeout, uint32_t now) {
+    esp_state = state;
+    esp_write_data = data;
+    esp_write_length = length;
+    esp_write_timeout = timeout;
+    if (esp_port->write(data, length)) {
+        esp_tx_busy = 1;
+        esp_write_data = NULL;
+        esp_deadline = now + timeout;
+    }
+}
+
+static uint8_t Esp_Link_Id(uint8_t slot) {
+    return ESP_LINK_ID - slot;
+}
+
+static void Esp_Send_Cipsend(uint32_t now) {
+    uint16_t length = esp_queue_length[esp_queue_tail];
+    int command_length = snprintf(esp_command, sizeof(esp_command), "AT+CIPSEND=%u,%u\r\n",
+                                  Esp_Link_Id(esp_link), length);
+
+    esp_attempt++;
+    LOG1(LOG_SEND_CIPSEND, length);
+    Esp_Write_Step(ESP_STATE_WAIT_PROMPT, (const uint8_t *)esp_command, command_length, ESP_PROMPT_TIMEOUT, now);
+}
+
+/* Takes the payload in flight off the queue and tells the application
+   whether the module confirmed it */
+static void Esp_Pop(uint8_t delivered) {
+    uint32_t sequence = esp_queue_sequence[esp_queue_tail];
+    esp_queue_tail = (esp_queue_tail + 1) & (ESP_TX_QUEUE_SIZE - 1);
+    esp_port->payload_done(sequence, delivered);
+}
+
+static void Esp_Pause(uint32_t now) {
+    esp_state = ESP_STATE_PAUSE;
+    esp_write_data = NULL;
+    esp_deadline = now + ESP_RETRY_DELAY;
+}
+
+/* Gives up on the payload in flight and pauses before the next one */
+static void Esp_Fail_Payload(uint32_t now) {
+    esp_transport_stats.failed++;
+    Esp_Pop(0);
+    Esp_Pause(now);
+}
+
+static void Esp_Link_Lost(void) {
+    LOG0(LOG_CONNECTION_LOST);
+    esp_link_up = 0;
+    esp_state = ESP_STATE_IDLE;
+    esp_write_data = NULL;
+    memset(esp_links, ESP_LINK_CLOSED, sizeof(esp_links));
+    esp_port->link_lost();
+}
+
+static uint8_t Esp_Links_In(uint8_t state) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < ESP_LINK_COUNT; i++) {
+        count += esp_links[i] == state;
+    }
+    return count;
+}
+
+/* A link closed; the application is told only when none is left */
+static void Esp_Close_Link(uint8_t link) {
+    esp_links[link] = ESP_LINK_CLOSED;
+    if (esp_link_up && Esp_Links_In(ESP_LINK_CLOSED) == ESP_LINK_COUNT) {
+        Esp_Link_Lost();
+    }
+}
+
+/* Next open link without an unanswered request, round robin */
+static uint8_t Esp_Find_Ready_Link(uint8_t *link) {
+    for (uint8_t i = 0; i < ESP_LINK_COUNT; i++) {
+        uint8_t candidate = (esp_next_link + i) % ESP_LINK_COUNT;
+        if (esp_links[candidate] == ESP_LINK_READY) {
+            *link = candidate;
+            esp_next_link = (candidate + 1) % ESP_LINK_COUNT;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void Esp_Start_Link(uint8_t link, uint32_t now) {
+    int length = snprintf(esp_command, sizeof(esp_command), "AT+CIPSTART=%u,\"TCP\",\"%s\",%u\r\n",
+                          Esp_Link_Id(link), esp_host, esp_host_port);
+    esp_link = link;
+    Esp_Write_Step(ESP_STATE_WAIT_CONNECT, (const uint8_t *)esp_command, length, ESP_CONNECT_TIMEOUT, now);
+}
+
+/* Opens one more request link when every open one is waiting for a reply */
+static uint8_t Esp_Open_Extra_Link(uint32_t now) {
+    if ((int32_t)(now - esp_connect_retry) < 0) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < ESP_LINK_COUNT; i++) {
+        if (esp_links[i] == ESP_LINK_CLOSED) {
+            Esp_Start_Link(i, now);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* CIPSTART answered OK, or ERROR after "ALREADY CONNECTED" */
+static void Esp_Connected(void) {
+    esp_links[esp_link] = ESP_LINK_READY;
+    esp_state = ESP_STATE_IDLE;
+    if (!esp_link_up) {
+        LOG0(LOG_TCP_ESTABLISHED);
+        esp_link_up = 1;
+        esp_backoff = ESP_BACKOFF_MIN;
+        esp_transport_stats.connects++;
+        esp_port->link_up();
+    }
+}
+
+/* A link did not come up. Extra
+   links are retried after the retry delay, the first one with a backoff
+   that doubles on every failure. */
+static void Esp_Connect_Failed(uint32_t now) {
+    esp_links[esp_link] = ESP_LINK_CLOSED;
+    esp_state = ESP_STATE_IDLE;
+    if (esp_link_up) {
+        esp_connect_retry = now + ESP_RETRY_DELAY;
+        return;
+    }
+    esp_transport_stats.connect_failures++;
+    LOG1(LOG_CONNECT_BACKOFF, esp_backoff);
+    esp_connect_retry = now + esp_backoff;
+    esp_backoff = esp_backoff * 2 > ESP_BACKOFF_MAX ? ESP_BACKOFF_MAX : esp_backoff * 2;
+}
+
+/* CIPSEND got no '>' in time or was refused: repeat it a few times, then
+   consider the link dead like the blocking sender did; the payload is
+   dropped so a bad link cannot block the queue */
+static void Esp_Prompt_Failed(uint32_t now) {
+    if (esp_attempt < ESP_PROMPT_RETRIES) {
+        esp_transport_stats.retries++;
+        LOG1(LOG_CIPSEND_RETRY, esp_attempt);
+        Esp_Send_Cipsend(now);
+        return;
+    }
+    LOG0(LOG_CIPSEND_FAILED);
+    esp_transport_stats.failed++;
+    Esp_Pop(0);
+    esp_state = ESP_STATE_IDLE;
+    Esp_Close_Link(esp_link);
+}
+
+static void Esp_Script_Step(uint32_t now) {
+    const char *command = esp_script[esp_step].command ? esp_script[esp_step].command : esp_command;
+    Esp_Write_Step(ESP_STATE_SCRIPT, (const uint8_t *)command, strlen(command), esp_script[esp_step].timeout, now);
+}
+
+static void Esp_Script_Start(const Esp_Step_TypeDef *script, uint8_t length, uint8_t first, uint32_t now) {
+    esp_script = script;
+    esp_script_length = length;
+    esp_step = first;
+    Esp_Script_Step(now);
+}
+
+static void Esp_Stream_Drain(void) {
+    LOG1(LOG_STREAM_CLOSING, (esp_stream_head - esp_stream_tail) & (ESP_STREAM_RING_SIZE - 1));
+    esp_close_pending = 0;
+    esp_state = ESP_STATE_STREAM_DRAIN;
+}
+
+/* Moves to the next step, or out of a failed open into the restore part of
+   the close script */
+static void Esp_Script_Advance(uint8_t success, uint32_t now) {
+    if (!success && !esp_script[esp_step].optional) {
+        LOG1(LOG_STREAM_STEP_FAILED, esp_step);
+        esp_close_pending = 0;
+        Esp_Script_Start(esp_stream_close, ESP_SCRIPT_LENGTH(esp_stream_close), 1, now);
+        return;
+    }
+    if (++esp_step < esp_script_length) {
+        Esp_Script_Step(now);
+        return;
+    }
+    if (esp_script == esp_stream_open) {
+        LOG0(LOG_STREAM_STARTED);
+        esp_transport_stats.stream_opens++;
+        esp_state = ESP_STATE_STREAMING;
+        if (esp_close_pending) {
+            Esp_Stream_Drain();
+        }
+    } else {
+        LOG0(LOG_STREAM_CLOSED);
+        esp_state = ESP_STATE_IDLE;
+    }
+}
+
+/* Hands the contiguous unsent part of the stream ring to the UART. The
+   previous write has finished, so everything before esp_stream_sent is free. */
+static void Esp_Stream_Send(void) {
+    if (esp_tx_busy) {
+        return;
+    }
+    esp_stream_tail = esp_stream_sent;
+    uint16_t head = esp_stream_head;
+    if (head == esp_stream_sent) {
+        return;
+    }
+    uint16_t length = (head > esp_stream_sent ? head : ESP_STREAM_RING_SIZE) - esp_stream_sent;
+    if (esp_port->write(&esp_stream_ring[esp_stream_sent], length)) {
+        esp_tx_busy = 1;
+        esp_stream_sent = (esp_stream_sent + length) & (ESP_STREAM_RING_SIZE - 1);
+        esp_transport_stats.payload_bytes += length;
+    }
+}
+
+void Esp_Transport_Init(const Esp_Transport_Port_TypeDef *port) {
+    esp_port = port;
+    esp_queue_head = 0;
+    esp_queue_tail = 0;
+    esp_state = ESP_STATE_IDLE;
+    esp_link_up = 0;
+    esp_connect_wanted = 0;
+    memset(esp_links, ESP_LINK_CLOSED, sizeof(esp_links));
+    esp_write_data = NULL;
+    esp_tx_busy = 0;
+    esp_open_pending = 0;
+    esp_close_pending = 0;
+    esp_stream_head = esp_stream_sent = esp_stream_tail = 0;
+    memset(&esp_transport_stats, 0, sizeof(esp_transport_stats));
+}
+
+/* Keeps a connection to host:port open from now on: link ESP_LINK_ID is
+   opened right away and again whenever the module reports all links closed.
+   Further links to the same server are opened as needed. */
+void Esp_Transport_Connect(const char *host, uint16_t port) {
+    strncpy(esp_host, host, sizeof(esp_host) - 1);
+    esp_host_port = port;
+    esp_connect_wanted = 1;
+    esp_backoff = ESP_BACKOFF_MIN;
+    esp_connect_retry = 0;
+}
+
+/* No more reconnects; links that are open stay usable until they close */
+void Esp_Transport_Stop_Connecting(void) {
+    esp_connect_wanted = 0;
+}
+
+/* Copies the payload into the queue; returns 0 when it is full or too long */
+uint8_t Esp_Transport_Enqueue(const uint8_t *payload, uint16_t length) {
+    return Esp_Transport_Enqueue_Parts(payload, length, NULL, 0);
+}
+
+/* Same for a payload in two pieces, e.g. an HTTP header and its body, so the
+   caller needs no buffer for the whole request */
+uint8_t Esp_Transport_Enqueue_Parts(const uint8_t *head, uint16_t head_length,
+                                    const uint8_t *body, uint16_t body_length) {
+    uint8_t next = (esp_queue_head + 1) & (ESP_TX_QUEUE_SIZE - 1);
+    uint32_t length = (uint32_t)head_length + body_length;
+
+    if (length > ESP_TX_PAYLOAD_MAX) {
+        LOG1(LOG_DATA_TOO_LARGE, length);
+        return 0;
+    }
+    if (next == esp_queue_tail) {
+        esp_transport_stats.full++;
+        return 0;
+    }
+    memcpy(esp_queue[esp_queue_head], head, head_length);
+    if (body_length) {
+        memcpy(esp_queue[esp_queue_head] + head_length, body, body_length);
+    }
+    esp_queue_length[esp_queue_head] = length;
+    esp_queue_sequence[esp_queue_head] = ++esp_sequence;
+    esp_queue_head = next;
+    esp_transport_stats.queued++;
+    return 1;
+}
+
+/* Sequence number of the payload queued last, to match it with the
+   port's payload_done() */
+uint32_t Esp_Transport_Last_Sequence(void) {
+    return esp_sequence;
+}
+
+/* Returns 1 when the event answered the engine's own command and should not
+   be seen by the rest of the reply handling */
+uint8_t Esp_Transport_On_Event(const At_Event_TypeDef *event, uint32_t now) {
+    /* Link bookkeeping, also seen by the application. Web page clients of
+       CIPSERVER only get ids below the request links. */
+    uint8_t link = ESP_LINK_ID - event->link;
+    if (esp_link_up && event->link <= ESP_LINK_ID && link < ESP_LINK_COUNT) {
+        if (event->type == AT_EVENT_IPD_END && esp_links[link] == ESP_LINK_AWAITING) {
+            esp_links[link] = ESP_LINK_READY;
+            esp_transport_stats.responses++;
+        } else if (event->type == AT_EVENT_CLOSED && esp_links[link] != ESP_LINK_CLOSED) {
+            if (link == esp_link && (esp_state == ESP_STATE_WAIT_PROMPT || esp_state == ESP_STATE_WAIT_SEND_OK)) {
+                esp_transport_stats.failed++;
+                Esp_Pop(0);
+                esp_state = ESP_STATE_IDLE;
+                esp_write_data = NULL;
+            }
+            Esp_Close_Link(link);
+        }
+        return 0;
+    }
+    if (esp_link_up && event->type == AT_EVENT_WIFI_DISCONNECT) {
+        Esp_Link_Lost();
+        return 0;
+    }
+    if (event->type == AT_EVENT_WIFI_GOT_IP && !esp_link_up) {  // worth trying again right away
+        esp_backoff = ESP_BACKOFF_MIN;
+        esp_connect_retry = now;
+        return 0;
+    }
+    if (!Esp_Transport_Busy() || esp_write_data) {
+        return 0;
+    }
+
+    switch (esp_state) {
+        case ESP_STATE_WAIT_CONNECT:
+            if (event->type == AT_EVENT_CONNECT && !esp_link_up) {
+                esp_links[esp_link] = ESP_LINK_READY;  // ERROR may follow "ALREADY CONNECTED"
+            } else if (event->type == AT_EVENT_OK ||
+                       (event->type == AT_EVENT_ERROR && esp_links[esp_link] == ESP_LINK_READY)) {
+                Esp_Connected();
+            } else if (event->type == AT_EVENT_ERROR || event->type == AT_EVENT_BUSY ||
+                       event->type == AT_EVENT_CLOSED) {
+                if (!esp_link_up) {
+                    LOG0(LOG_TCP_FAILED);
+                }
+                Esp_Connect_Failed(now);
+            } else {
+                return 0;
+            }
+            return 1;
+
+        case ESP_STATE_WAIT_PROMPT:
+            if (event->type == AT_EVENT_PROMPT) {
+                LOG0(LOG_GOT_PROMPT);
+                LOG0(LOG_SENDING_DATA);
+                Esp_Write_Step(ESP_STATE_WAIT_SEND_OK, esp_queue[esp_queue_tail], esp_queue_length[esp_queue_tail],
+                               ESP_SEND_OK_TIMEOUT, now);
+            } else if (event->type == AT_EVENT_ERROR || event->type == AT_EVENT_BUSY) {
+                Esp_Prompt_Failed(now);
+            } else if (event->type != AT_EVENT_OK) {  // CIPSEND answers OK before the '>'
+                return 0;
+            }
+            return 1;
+
+        case ESP_STATE_SCRIPT:
+            if (event->type == esp_script[esp_step].expect) {
+                Esp_Script_Advance(1, now);
+            } else if (event->type == AT_EVENT_ERROR) {
+                Esp_Script_Advance(0, now);
+            } else if (event->type != AT_EVENT_OK && event->type != AT_EVENT_PROMPT) {
+                return 0;
+            }
+            return 1;
+
+        case ESP_STATE_WAIT_SEND_OK:
+            if (event->type == AT_EVENT_SEND_OK) {
+                esp_transport_stats.sent++;
+                esp_transport_stats.payload_bytes += esp_queue_length[esp_queue_tail];
+                esp_transport_stats.last_latency = now - esp_started;
+                LOG1(LOG_DATA_SENT, esp_transport_stats.last_latency);
+                Esp_Pop(1);
+                esp_links[esp_link] = ESP_LINK_AWAITING;
+                esp_link_deadline[esp_link] = now + ESP_RESPONSE_TIMEOUT;
+                uint8_t in_flight = Esp_Links_In(ESP_LINK_AWAITING);
+                if (in_flight > esp_transport_stats.max_in_flight) {
+                    esp_transport_stats.max_in_flight = in_flight;
+                }
+                esp_state = ESP_STATE_IDLE;
+            } else if (event->type == AT_EVENT_SEND_FAIL || event->type == AT_EVENT_ERROR) {
+                LOG0(LOG_SEND_TIMEOUT);
+                Esp_Fail_Payload(now);
+            } else {
+                return 0;
+            }
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+/* Starts the next payload, repeats refused writes and handles timeouts */
+void Esp_Transport_Poll(uint32_t now) {
+    if (esp_write_data) {
+        if (!esp_port->write(esp_write_data, esp_write_length)) {
+            return;
+        }
+        esp_tx_busy = 1;
+        esp_write_data = NULL;
+        esp_deadline = now + esp_write_timeout;
+        return;
+    }
+
+    for (uint8_t i = 0; i < ESP_LINK_COUNT; i++) {
+        if (esp_links[i] == ESP_LINK_AWAITING && (int32_t)(now - esp_link_deadline[i]) >= 0) {
+            esp_links[i] = ESP_LINK_READY;
+            esp_transport_stats.response_timeouts++;
+        }
+    }
+
+    switch (esp_state) {
+        case ESP_STATE_IDLE:
+            if (esp_open_pending) {
+                esp_open_pending = 0;
+                Esp_Script_Start(esp_stream_open, ESP_SCRIPT_LENGTH(esp_stream_open), 0, now);
+            } else if (esp_link_up && esp_queue_tail != esp_queue_head) {
+                if (Esp_Find_Ready_Link(&esp_link)) {
+                    esp_started = now;
+                    esp_attempt = 0;
+                    Esp_Send_Cipsend(now);
+                } else {
+                    Esp_Open_Extra_Link(now);
+                }
+            } else if (!esp_link_up && esp_connect_wanted && (int32_t)(now - esp_connect_retry) >= 0) {
+                LOG0(LOG_CONNECT_ATTEMPT);
+                Esp_Start_Link(0, now);
+            }
+            break;
+
+        case ESP_STATE_WAIT_CONNECT:
+            if (Esp_Expired(now)) {
+                if (!esp_link_up) {
+                    LOG0(LOG_TCP_TIMEOUT);
+                }
+                Esp_Connect_Failed(now);
+            }
+            break;
+
+        case ESP_STATE_WAIT_PROMPT:
+            if (Esp_Expired(now)) {
+                Esp_Prompt_Failed(now);
+            }
+            break;
+
+        case ESP_STATE_WAIT_SEND_OK:
+            if (Esp_Expired(now)) {
+                LOG0(LOG_SEND_TIMEOUT);
+                Esp_Fail_Payload(now);
+            }
+            break;
+
+        case ESP_STATE_PAUSE:
+            if (Esp_Expired(now) || esp_open_pending) {
+                esp_state = ESP_STATE_IDLE;
+            }
+            break;
+
+        case ESP_STATE_SCRIPT:
+            if (Esp_Expired(now)) {
+                Esp_Script_Advance(esp_script[esp_step].expect == ESP_EVENT_NONE, now);
+            }
+            break;
+
+        /* "+++" only counts after ESP_ESCAPE_GUARD of silence, timed from
+           the last write while streaming too: the drain may find nothing left */
+        case ESP_STATE_STREAMING:
+        case ESP_STATE_STREAM_DRAIN:
+            Esp_Stream_Send();
+            if (esp_tx_busy || esp_stream_sent != esp_stream_head) {
+                esp_deadline = now + ESP_ESCAPE_GUARD;
+            } else if (esp_state == ESP_STATE_STREAM_DRAIN && Esp_Expired(now)) {
+                Esp_Script_Start(esp_stream_close, ESP_SCRIPT_LENGTH(esp_stream_close), 0, now);
+            }
+            break;
+    }
+}
+
+/* The engine is using the UART link (an AT exchange or transparent mode),
+   other commands must wait */
+uint8_t Esp_Transport_Busy(void) {
+    return esp_state == ESP_STATE_WAIT_CONNECT || esp_state == ESP_STATE_WAIT_PROMPT ||
+           esp_state == ESP_STATE_WAIT_SEND_OK || esp_state == ESP_STATE_SCRIPT ||
+           esp_state == ESP_STATE_STREAMING || esp_state == ESP_STATE_STREAM_DRAIN;
+}
+
+/* Payloads queued or in flight */
+uint8_t Esp_Transport_Pending(void) {
+    return (esp_queue_head - esp_queue_tail) & (ESP_TX_QUEUE_SIZE - 1);
+}
+
+/* HAL_UART_TxCpltCallback() of the port's UART */
+void Esp_Transport_Write_Complete(void) {
+    esp_tx_busy = 0;
+}
+
+/* Opens one TCP connection in transparent mode once the engine is free. The
+   request/response link is given up for the session and has to be
+   re-established after Esp_Transport_Stream_Close(). */
+void Esp_Transport_Stream_Open(const char *host, uint16_t port) {
+    LOG1(LOG_STREAM_OPENING, port);
+    snprintf(esp_command, sizeof(esp_command), "AT+CIPSTART=\"TCP\",\"%s\",%u\r\n", host, port);
+    esp_stream_head = esp_stream_sent = esp_stream_tail = 0;
+    esp_close_pending = 0;
+    esp_open_pending = 1;
+    esp_connect_wanted = 0;
+    if (esp_link_up) {
+        esp_link_up = 0;
+        memset(esp_links, ESP_LINK_CLOSED, sizeof(esp_links));
+        esp_port->link_lost();
+    }
+}
+
+/* Sends what is buffered, then leaves transparent mode with "+++" */
+void Esp_Transport_Stream_Close(void) {
+    esp_open_pending = 0;
+    if (esp_state == ESP_STATE_STREAMING) {
+        Esp_Stream_Drain();
+    } else if (esp_state == ESP_STATE_SCRIPT && esp_script == esp_stream_open) {
+        esp_close_pending = 1;
+    }
+}
+
+/* Queues bytes for the TCP connection, all or nothing; returns 0 outside
+   transparent mode or when the ring has no room */
+uint8_t Esp_Transport_Stream_Write(const uint8_t *data, uint16_t length) {
+    uint16_t used = (esp_stream_head - esp_stream_tail) & (ESP_STREAM_RING_SIZE - 1);
+
+    if (esp_state != ESP_STATE_STREAMING) {
+        return 0;
+    }
+    if (length > ESP_STREAM_RING_SIZE - 1 - used) {
+        esp_transport_stats.stream_full++;
+        return 0;
+    }
+    uint16_t first = ESP_STREAM_RING_SIZE - esp_stream_head;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(&esp_stream_ring[esp_stream_head], data, first);
+    memcpy(esp_stream_ring, data + first, length - first);
+    esp_stream_head = (esp_stream_head + length) & (ESP_STREAM_RING_SIZE - 1);
+    esp_transport_stats.stream_bytes += length;
+    return 1;
+}
+
+uint8_t Esp_Transport_Streaming(void) {
+    return esp_state == ESP_STATE_STREAMING;
+}
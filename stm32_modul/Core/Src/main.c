@@ -23,21 +23,62 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "usbd_cdc_if.h"
+#include "sample_ring.h"
+#include "deferred_log.h"
+#include "at_parser.h"
+#include "esp_transport.h"
+#include "config_store.h"
+#include "spool.h"
+#include "ahrs.h"
+#include "calibration.h"
+#include "decimator.h"
+#include "spectrum.h"
+#include "summary.h"
 #include "stm32f3xx_hal.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <math.h>  // For fabsf and fmaxf
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
 /* USER CODE BEGIN PTD */
-
+/* Per-sensor sample accounting: every sample read is either delivered to a sink,
+   rejected by a busy sink, or dropped by a full sample ring (Sample_Ring_TypeDef.overruns). */
+typedef struct {
+    uint32_t edges;      // DRDY interrupts seen
+    uint32_t coalesced;  // edges that arrived while the previous one was unhandled
+    uint32_t delivered;  // samples accepted by the active sink
+    uint32_t rejected;   // samples the sink refused (busy or rate limited)
+    uint32_t overruns;    // hardware FIFO overflows (samples overwritten in the sensor)
+    uint32_t reads;       // bus reads performed
+    uint32_t read_cycles; // CPU cycles spent on those reads (DWT->CYCCNT)
+} Sensor_Stats_TypeDef;
+
+#define FIFO_DEPTH 32 // L3GD20 and LSM303 accelerometer FIFO size
+
+/* Stored as CONFIG_KEY_SENSOR_PROFILE */
+typedef struct {
+    uint8_t sensor_mask;  // bit per SENSOR_x that is sampled
+    uint8_t boot_mode;    // transmission mode a warm start enters
+} Sensor_Profile_TypeDef;
+
+/* Settings kept in the flash config store, defaults from the defines below */
+typedef struct {
+    char ssid[33];
+    char password[65];
+    char server_ip[16];
+    uint16_t server_port;
+    Sensor_Profile_TypeDef profile;
+} Device_Config_TypeDef;
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 #define DEBUG 1
+#define LOG_ESP_RESPONSES 0 // 1 copies every ESP reply as text into the CDC stream, breaks binary captures
 
 #ifdef DEBUG
 #define LED_PIN_GYRO GPIO_PIN_11
@@ -65,10 +106,15 @@
 #define AT_SEND_HTML_HEADER 4
 #define AT_SEND_HTML 5
 #define AT_SEND_CONNECT_REQUEST 6
+#define AT_SET_SERVER_LIMIT 7
 
 #define HEADER_MAG 0xAAAB
 #define HEADER_ACC 0xBBBB
 #define HEADER_GYR 0xCCCC
+#define HEADER_FRAME_V2 0xA55A
+#define HEADER_LOG 0xA54C
+#define LOG_FRAME_SIZE 18   // header, id16, tick32, 2 x arg32, CRC16
+#define LOG_DRAIN_BATCH 4   // log frames sent per superloop pass
 #define BUFFER_SIZE 64
 
 #define ENABLE_MAGNETOMETER 1
@@ -80,8 +126,149 @@
 #define MODE_ASCII_UART 2
 #define MODE_BINARY_CDC 3
 #define MODE_ASCII_CDC 4
+#define MODE_BINARY_TCP 5  // v2 frames over one TCP connection in ESP transparent mode
+#define MODE_QUATERNION_CDC 6  // orientation from the on-device filter instead of raw samples
+#define MODE_SPECTRUM 7  // accelerometer vibration spectra over CDC and POST /spectrum
+#define MODE_COUNT 8
+
+#define IS_BINARY_MODE(mode) ((mode) == MODE_BINARY_UART || (mode) == MODE_BINARY_CDC || (mode) == MODE_BINARY_TCP)
+#define USES_SERVER(mode) ((mode) == MODE_ASCII_UART || (mode) == MODE_SPECTRUM)  // HTTP requests over the ESP
+
+#define SERVER_IP "172.20.10.11"  // default, the stored CONFIG_KEY_SERVER_IP wins
+#define SERVER_PORT 5000  // server.py, HTTP POST /data; default for CONFIG_KEY_SERVER_PORT
+#define STREAM_PORT 5001  // stream_server.py, raw binary frames
+
+/* ESP link rate: the module boots at ESP_BAUD_DEFAULT, at startup the faster
+   rates are tried in order with AT+UART_CUR (not stored in the ESP's flash)
+   and the first one that answers every ping is kept */
+#define ESP_BAUD_NEGOTIATE 1
+#define ESP_BAUD_DEFAULT 115200
+#define ESP_BAUD_CANDIDATES { 2000000, 921600, 460800, 230400 }
+#define ESP_PING_COUNT 4
+#define ESP_PING_TIMEOUT 100      // ms per AT ping
+#define ESP_BAUD_FALLBACK_TRIES 3 // AT+UART_CUR back to the default, resent at the unstable rate while lost
+#define ESP_GOODPUT_INTERVAL 5000 // ms between uplink goodput log entries
+
+/* Warm start: at boot the ESP is asked for its mode, CIPMUX and station
+   status, only the missing setup commands are sent and, when the station
+   already has an IP, sampling starts in the stored profile's boot mode
+   (WARM_START_MODE by default) without a button press. An ESP without an
+   access point joins the one stored from the web form. Without an answer
+   the button driven setup_stage walk remains. */
+#define ESP_WARM_START 1
+#define ESP_QUERY_TIMEOUT 200     // ms per state query or setup command
+#define ESP_JOIN_TIMEOUT 10000    // ms for joining the stored access point
+#define WARM_START_MODE MODE_ASCII_UART  // default of Sensor_Profile_TypeDef.boot_mode
+
+/* MODE_ASCII_UART collects the sample objects of all sensors into one JSON
+   array and posts it when the body is full or its oldest sample is
+   BATCH_MAX_AGE ms old */
+#define HTTP_HEADER_RESERVE 160 // bytes of the POST header in front of the body
+#define BATCH_MAX_BODY (ESP_TX_PAYLOAD_MAX - HTTP_HEADER_RESERVE)
+#define BATCH_MAX_AGE 250
+
+/* While MODE_ASCII_UART has no connection the samples are kept as v2 frames
+   in the spool (RAM, then flash). Once connected, the spool is uploaded to
+   POST /spool in bodies of whole frames, and new samples keep going to the
+   spool until it is empty so the server receives them in order. */
+#define SPOOL_POST_MAX (ESP_TX_PAYLOAD_MAX - HTTP_HEADER_RESERVE)
+#define SPOOL_REPORT_INTERVAL 5000 // ms between fill level log entries while spooling
+
+/* Binary modes: 1 = one 10-byte frame per sample (header, 16-bit packet number, XYZ),
+   2 = one frame per batch of samples of a single sensor:
+   [0xA55A][ver<<4|sensor][count][seq32][timestamp32 us][count * XYZ][CRC16]
+   sized so a full frame fits one CDC_DATA_FS_MAX_PACKET_SIZE USB packet */
+#define BINARY_FRAME_VERSION 2
+#define FRAME_V2_HEADER_SIZE 12
+#define FRAME_V2_MAX_SAMPLES ((CDC_DATA_FS_MAX_PACKET_SIZE - FRAME_V2_HEADER_SIZE - 2) / 6)
+#define FRAME_V2_MAX_SIZE (FRAME_V2_HEADER_SIZE + FRAME_V2_MAX_SAMPLES * 6 + 2)
+
+/* MODE_QUATERNION_CDC: every gyro sample updates the orientation filter
+   (ahrs.c) with the latest accelerometer and magnetometer samples, and each
+   update goes out as one frame:
+   [0xA551][seq32][timestamp32 us][w x y z, int16 Q14][CRC16]
+   Updates wait for the first accelerometer sample; without the magnetometer
+   in the sensor profile the heading follows the gyro alone. */
+#define HEADER_QUATERNION 0xA551
+#define QUATERNION_FRAME_SIZE 20
+#define AHRS_BETA 0.1f
+#define AHRS_MAX_GAP 4           // gyro periods; a longer gap is integrated as one period
+
+/* MODE_SPECTRUM: the accelerometer runs at SPECTRUM_ACC_CTRL1 through its
+   FIFO, the calibrated (and decimated) samples go into spectrum.c and every
+   SPECTRUM_AVERAGE * SPECTRUM_SIZE samples one report is sent:
+   [0xA553][seq32][timestamp32 us][rate f32 Hz][bands8][peaks8]
+   [per axis: bands * amplitude f32, peaks * (frequency f32, amplitude f32)][CRC16]
+   over CDC, and to POST /spectrum while the server is connected. Amplitudes
+   are in raw counts. The other sensors are read but not sent. */
+#define HEADER_SPECTRUM 0xA553
+#define SPECTRUM_ACC_CTRL1 0x97  // 1.344 kHz, a report about every 0.76 s
+#define SPECTRUM_FRAME_SIZE (16 + 3 * (SPECTRUM_BANDS + 2 * SPECTRUM_PEAKS) * 4 + 2)
+#define ACC_RATE_SWITCH_TIMEOUT 10  // ms to wait for a running accelerometer read
+#define ACC_RATE_RETRY_DELAY 100    // ms before a rate switch that failed is tried again
+
+/* Calibration, corrected = matrix * (raw - offset) in raw counts, is loaded
+   from the config store at boot and replaced with a text line over USB CDC:
+   CAL <MAG|ACC|GYR> <offset x y z> [<matrix m00 m01 m02 m10 ... m22>]
+   offsets in raw counts, matrix entries as decimals (Q14 on the device,
+   row gains up to 2); without a matrix the identity is used.
+   Decimation, after calibration: every sensor can be low-pass filtered and
+   thinned to 1/factor of its rate before any sink, also set over USB and
+   kept in the config store:
+   DEC <MAG|ACC|GYR> <factor 1..DECIMATOR_MAX_FACTOR>
+   Kept samples carry the capture time of their input sample; the filter
+   delay (about 1.5 output periods) is not taken out. */
+#define USB_COMMAND_SIZE 160  // bytes of one command line
+
+/* Summary output: with a window set, the sample modes send one record of
+   count, min, max, mean, variance and RMS per axis for every window of each
+   sensor instead of its samples (after calibration and decimation). The
+   window is set over USB and kept in the config store, 0 turns it off:
+   SUM <window ms, SUMMARY_WINDOW_MIN..SUMMARY_WINDOW_MAX | 0>
+   Binary modes send
+   [0xA552][sensor][seq32][start32 us][end32 us][count32]
+   [per axis: min16 max16, mean variance rms f32][CRC16] in raw counts,
+   ASCII modes one JSON object in the units of their samples. Windows follow
+   the capture times; the outage spool of MODE_ASCII_UART keeps samples. */
+#define HEADER_SUMMARY 0xA552
+#define SUMMARY_FRAME_SIZE (19 + 3 * 16 + 2)
+#define SUMMARY_WINDOW_MIN 100     // ms
+#define SUMMARY_WINDOW_MAX 60000   // ms
+#define SUMMARY_JSON_SIZE 320
 
 #define RX_BUFFER_SIZE 2048 * 4
+#define UART_DMA_BUFFER_SIZE 256 // circular DMA area, events at half, full and idle line
+
+#define SENSOR_MAG 0
+#define SENSOR_ACC 1
+#define SENSOR_GYR 2
+#define SENSOR_COUNT 3
+
+#define STATS_REPORT_INTERVAL 1000 // ms between sample accounting reports
+#define SAMPLE_DRAIN_BATCH 16 // samples taken from one ring per superloop pass
+
+#define GYRO_CTRL1_VALUE 0x7F // CTRL1: ODR/BW + enable XYZ (0x7F = 190 Hz, 0xBF = 380 Hz, 0xFF = 760 Hz)
+#ifndef GYRO_FIFO_MODE
+#define GYRO_FIFO_MODE 1        // L3GD20 FIFO in stream mode, drained in one burst per watermark interrupt
+#endif
+#define GYRO_FIFO_WATERMARK 16  // samples per INT2 wake-up (1..31)
+
+#define ACC_CTRL1_VALUE 0x47    // CTRL_REG1_A: ODR + enable XYZ (0x47 = 50 Hz, 0x77 = 400 Hz, 0x97 = 1.344 kHz)
+#define ACC_FIFO_MODE 1         // LSM303 accelerometer FIFO in stream mode, drained in one I2C burst per watermark
+#define ACC_FIFO_WATERMARK 16   // samples per INT1 wake-up (1..31)
+
+#if GYRO_FIFO_MODE && !USE_SPI_DMA
+#error "GYRO_FIFO_MODE needs USE_SPI_DMA"
+#endif
+#if ACC_FIFO_MODE && !USE_I2C_DMA
+#error "ACC_FIFO_MODE needs USE_I2C_DMA"
+#endif
+
+/* Bus transfer stages shared by the SPI and I2C read engines */
+#define READ_STAGE_IDLE 0
+#define READ_STAGE_SAMPLE 1     // output registers, one sample
+#define READ_STAGE_FIFO_SRC 2   // FIFO_SRC register, number of stored samples
+#define READ_STAGE_FIFO_DATA 3  // output register burst, the address wraps to OUT_X_L while the FIFO is on
 
 //#define APP_RX_DATA_SIZE 2048
 //#define APP_TX_DATA_SIZE 2048
@@ -100,18 +287,104 @@ SPI_HandleTypeDef hspi1;
 UART_HandleTypeDef huart2;
 
 /* USER CODE BEGIN PV */
+#if USE_I2C_DMA
+DMA_HandleTypeDef hdma_i2c1_rx;
+
+/* Asynchronous LSM303 reads: the EXTI callback marks a sensor pending, one DMA
+   transfer runs on the bus at a time and its completion publishes the samples. */
+typedef struct {
+    uint8_t device;
+    uint8_t reg;
+    uint8_t fifo;  // drain the FIFO instead of reading one sample
+} I2C_Read_Request_TypeDef;
+
+const I2C_Read_Request_TypeDef i2c_read_requests[SENSOR_COUNT] = {
+    [SENSOR_MAG] = { 0x1E, 0x68, 0 },
+    [SENSOR_ACC] = { 0x19, 0x28 | 0x80, ACC_FIFO_MODE },
+};
+
+volatile uint8_t i2c_pending_mask = 0;   // sensors waiting for the bus
+volatile uint8_t i2c_active_sensor = 0;  // sensor whose transfer is in flight
+volatile uint8_t i2c_stage = READ_STAGE_IDLE;
+volatile uint32_t i2c_errors = 0;
+volatile uint8_t i2c_async_enabled = 0;  // set once the blocking sensor setup is done
+uint8_t i2c_dma_buffer[FIFO_DEPTH * 6];
+uint8_t i2c_fifo_count = 0;
+uint32_t i2c_fifo_time = 0;              // when the samples being read were counted
+#endif
+
+#if USE_SPI_DMA
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
+
+/* L3GD20 reads run as full-duplex transactions: address byte + data bytes */
+uint8_t spi_tx_buffer[1 + FIFO_DEPTH * 6]; // only the address byte is ever non-zero
+uint8_t spi_rx_buffer[1 + FIFO_DEPTH * 6];
+volatile uint8_t spi_stage = READ_STAGE_IDLE;
+volatile uint8_t spi_pending = 0;
+volatile uint8_t spi_async_enabled = 0;
+uint8_t spi_fifo_count = 0;
+uint32_t spi_fifo_time = 0;         // when the samples being read were counted
+#endif
+
+/* Samples handed from the read engines to the superloop. CPU-only data, so it lives
+   in CCM RAM; the startup code does not clear that region, see Sample_Ring_Init(). */
+Sample_Ring_TypeDef sample_rings[SENSOR_COUNT] __attribute__((section(".ccmram")));
+uint32_t sample_period_us[SENSOR_COUNT];       // smoothed, seeded from the configured ODR
+uint32_t sample_last_fifo_time[SENSOR_COUNT];
+
 volatile uint8_t data_ready_mag = 0;
 volatile uint8_t data_ready_acc = 0;
 volatile uint8_t data_ready_gyr = 0;
 volatile uint16_t packet_number = 0;
+uint32_t frame_sequence[SENSOR_COUNT];  // per-sensor number of the next sample sent in a v2 frame
+
+volatile Sensor_Stats_TypeDef sensor_stats[SENSOR_COUNT];
+Ahrs_TypeDef ahrs;
+float ahrs_inputs[SENSOR_COUNT][3];  // latest sample of each sensor, in filter units
+uint8_t ahrs_seen = 0;               // bit per sensor with a sample since the mode started
+uint32_t ahrs_last_time = 0;         // of the previous gyro sample
+uint32_t quaternion_sequence = 0;
+uint32_t ahrs_updates = 0;
+uint32_t ahrs_cycles = 0;            // spent in Ahrs_Update() (DWT->CYCCNT)
+Calibration_TypeDef calibrations[SENSOR_COUNT];
+uint32_t calibrated_samples = 0;
+uint32_t calibration_cycles = 0;     // spent in Calibration_Apply() (DWT->CYCCNT)
+Decimator_TypeDef decimators[SENSOR_COUNT];
+uint8_t decimation[SENSOR_COUNT];    // factor per sensor, CONFIG_KEY_DECIMATION
+uint32_t decimated_samples = 0;      // samples into the decimators
+uint32_t decimation_cycles = 0;      // spent in Decimator_Process() (DWT->CYCCNT)
+uint8_t acc_ctrl1 = ACC_CTRL1_VALUE; // CTRL_REG1_A as written, MODE_SPECTRUM raises the ODR
+uint8_t acc_ctrl1_wanted = ACC_CTRL1_VALUE; // differs from acc_ctrl1 while a switch is retried
+uint32_t acc_rate_tick = 0;          // last Set_Acc_Rate() attempt
+Spectrum_TypeDef spectrum __attribute__((section(".ccmram")));
+uint32_t spectrum_sequence = 0;
+uint32_t spectrum_reports = 0;
+uint32_t spectrum_cycles = 0;        // spent in the FFTs and Spectrum_Report() (DWT->CYCCNT)
+Summary_TypeDef summaries[SENSOR_COUNT];
+uint16_t summary_window_ms = 0;      // CONFIG_KEY_SUMMARY_WINDOW, 0 = samples are sent
+uint32_t summary_sequence[SENSOR_COUNT];  // per-sensor number of the next record
+uint32_t summarised_samples = 0;
+uint32_t summary_cycles = 0;         // spent in Summary_Add() (DWT->CYCCNT)
+uint32_t summary_records = 0;
+uint32_t summary_dropped = 0;        // records the sink did not take
+char usb_command[USB_COMMAND_SIZE];
+uint16_t usb_command_length = 0;
 
 volatile uint8_t transmission_mode = MODE_NONE;
 
 volatile uint8_t rx_buffer[RX_BUFFER_SIZE];
-volatile uint8_t last_buffer[RX_BUFFER_SIZE];
 volatile uint16_t rx_index = 0;
 //volatile uint8_t rx_data_ready = 0;
 
+#if USE_UART_DMA
+DMA_HandleTypeDef hdma_usart2_rx;
+uint8_t uart_dma_buffer[UART_DMA_BUFFER_SIZE];
+uint16_t uart_dma_position = 0;       // first byte of uart_dma_buffer not yet handed on
+volatile uint32_t uart_rx_overflows = 0; // bytes dropped because rx_buffer was full
+volatile uint32_t uart_rx_errors = 0;
+#endif
+
 volatile uint32_t button_press_start = 0;
 volatile uint8_t button_pressed = 0;
 volatile uint8_t button_action_pending = 0;
@@ -129,6 +402,22 @@ volatile uint8_t is_client_requesting_page = 0;
 volatile uint8_t was_client_requesting_page = 0;
 
 uint8_t connection_established = 0;
+Device_Config_TypeDef device_config;
+extern uint32_t _config_start;  // STM32F303VCTX_FLASH.ld
+extern uint32_t _spool_start;
+
+uint8_t spool_post[SPOOL_POST_MAX];
+uint32_t spool_drain_started = 0; // HAL tick of the first upload after the outage
+uint32_t spool_drain_bytes = 0;   // uploaded since then
+uint8_t spool_post_pending = 0;   // a /spool upload is queued or being sent
+uint32_t spool_post_sequence = 0; // its transport sequence number
+uint16_t spool_post_length = 0;
+uint32_t esp_baud = ESP_BAUD_DEFAULT;  // current USART2 rate
+
+char batch_body[BATCH_MAX_BODY + 1];
+uint16_t batch_length = 0;    // bytes in batch_body, 0 = no batch open
+uint16_t batch_samples = 0;
+uint32_t batch_started = 0;   // HAL tick of the oldest sample in the batch
 
 //#define RX_TIMEOUT_MS 1000 // Timeout for data reception in milliseconds
 
@@ -150,25 +439,101 @@ static void MX_USART2_UART_Init(void);
 /* USER CODE BEGIN PFP */
 void Init_All_Sensors(void);
 void Pack_Data(uint8_t *binary_buffer, uint16_t header, int16_t x, int16_t y, int16_t z);
-void Transmit_Data_ASCII(const char *sensor_label, float x, float y, float z);
+uint16_t Crc16_Ccitt(const uint8_t *data, uint16_t length);
+uint16_t Pack_Frame(uint8_t *frame, uint8_t sensor, uint32_t sequence, const Sample_TypeDef *samples, uint8_t count);
+void Transmit_Frame(uint8_t sensor, const Sample_TypeDef *samples, uint8_t count);
+uint8_t Transmit_Binary(uint8_t *data, uint16_t length);
+void Set_Transmission_Mode(uint8_t mode);
+void Indicate_Transmission_Mode(uint8_t mode);
+void Drain_Log(void);
+#if USE_UART_DMA
+void Uart_Rx_Start(void);
+void Uart_Rx_Chunk(const uint8_t *data, uint16_t length);
+#endif
+uint8_t Transmit_Data_ASCII(const char *sensor_label, float x, float y, float z);
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 uint8_t Pisi_Register(uint8_t device, uint8_t reg, uint8_t value);
 void Beri_Registre(uint8_t device, uint8_t reg, uint8_t* data, uint8_t length);
+void spi1_pisiRegister(uint8_t reg, uint8_t vrednost);
 float Convert_To_Gauss(int16_t raw_value);
 void Verify_Sensors(void);
 void Clear_Interrupts(void);
+void Clear_RX_Text(void);
+void Clear_RX_Buffer(void);
+void Clear_RX_Replies(void);
 void Send_Command(const char* cmd);
+void Send_HTML_Header(void);
 void Change_Response_Status(uint8_t new_status);
-void Send_Data_To_Server(const char *json_data);
+uint8_t Send_Request(const char *path, const char *content_type, const uint8_t *body, uint16_t length);
+uint8_t Send_Data_To_Server(const char *json_data);
+uint8_t Spool_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count);
+void Spool_Poll(void);
+uint8_t Batch_Add(const char *json, uint16_t length);
+uint8_t Batch_Flush(void);
+void Batch_Poll(void);
+uint8_t Esp_Uart_Write(const uint8_t *data, uint16_t length);
+void Esp_Link_Up(void);
+void Esp_Link_Lost(void);
+void Esp_Payload_Done(uint32_t sequence, uint8_t delivered);
+uint8_t Esp_Command_Wait(const char *cmd, uint32_t timeout_ms);
+void Esp_Uart_Set_Baud(uint32_t baud);
+uint8_t Esp_Ping(void);
+uint8_t Esp_Baud_Fall_Back(uint32_t baud);
+void Esp_Negotiate_Baud(void);
+void Report_Uplink_Goodput(void);
+uint8_t Esp_Warm_Start(void);
+void Load_Device_Config(void);
+uint8_t Save_Setting(uint8_t key, const void *value, uint8_t length);
+uint8_t Flash_Erase_Page(uintptr_t address);
+size_t Form_Value(const char *start, char *value, size_t size);
+int Format_Join_Command(char *cmd, size_t size, const char *ssid, const char *password);
+uint8_t Flash_Program_Halfword(uintptr_t address, uint16_t value);
+void Report_First_Delivery(void);
+void Count_Sample(uint8_t sensor, uint8_t accepted);
+void Cycle_Counter_Init(void);
+uint32_t Get_Timestamp_Us(void);
+uint32_t Nominal_Period_Us(uint8_t sensor);
+uint8_t Fifo_Sample_Count(uint8_t sensor, uint8_t fifo_src);
+void Update_Sample_Period(uint8_t sensor, uint32_t fifo_time, uint8_t count);
+void Publish_Samples(uint8_t sensor, const uint8_t *raw, uint8_t count, uint32_t newest_time);
+void Drain_Samples(uint8_t sensor, void (*transmit)(int16_t *raw_data));
+void Fuse_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count);
+void Poll_Usb_Commands(void);
+void Handle_Usb_Command(char *line);
+uint8_t Parse_Sensor(char **arguments);
+uint8_t Set_Calibration(char *arguments);
+uint8_t Set_Decimation(char *arguments);
+uint8_t Transmit_Quaternion(uint32_t time);
+void Analyse_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count);
+uint8_t Transmit_Spectrum(void);
+uint8_t Set_Acc_Rate(uint8_t ctrl1);
+void Summarise_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count);
+uint8_t Transmit_Summary(uint8_t sensor);
+uint8_t Set_Summary_Window(char *arguments);
+#if USE_SPI_DMA
+void Gyro_Request_Read(void);
+uint8_t Gyro_Transfer(uint8_t reg, uint16_t length);
+void Gyro_Start_Read(void);
+#endif
+#if USE_I2C_DMA
+void I2C_Request_Read(uint8_t sensor);
+void I2C_Requeue_Read(uint8_t sensor);
+uint8_t I2C_Transfer(uint8_t sensor, uint8_t reg, uint16_t length);
+void I2C_Start_Next_Read(void);
+#endif
+void Report_Sample_Stats(void);
 
 #if ENABLE_MAGNETOMETER
 void Handle_Magnetometer(void);
+void Transmit_Magnetometer_Sample(int16_t *raw_data);
 #endif
 #if ENABLE_ACCELEROMETER
 void Handle_Accelerometer(void);
+void Transmit_Accelerometer_Sample(int16_t *raw_data);
 #endif
 #if ENABLE_GYROSCOPE
 void Handle_Gyroscope(void);
+void Transmit_Gyroscope_Sample(int16_t *raw_data);
 #endif
 /* USER CODE END PFP */
 
@@ -186,9 +551,16 @@ void Init_All_Sensors(void) {
     #endif
 
     #if ENABLE_ACCELEROMETER
-	Pisi_Register(0x19, 0x20, 0x47); // CTRL_REG1_A: ODR=50Hz, enable XYZ
+	Pisi_Register(0x19, 0x20, acc_ctrl1); // CTRL_REG1_A: ODR, enable XYZ
 	Pisi_Register(0x19, 0x23, 0x18); // CTRL_REG4_A: Full-scale ±4g, High resolution
+	#if ACC_FIFO_MODE
+	Pisi_Register(0x19, 0x22, 0x04); // CTRL_REG3_A: FIFO watermark on INT1
+	Pisi_Register(0x19, 0x24, 0x40); // CTRL_REG5_A: FIFO enable
+	Pisi_Register(0x19, 0x2E, 0x00); // FIFO_CTRL_REG_A: bypass, empties the FIFO
+	Pisi_Register(0x19, 0x2E, 0x80 | ACC_FIFO_WATERMARK); // FIFO_CTRL_REG_A: stream mode + watermark on INT1
+	#else
 	Pisi_Register(0x19, 0x22, 0x10); // CTRL_REG3_A: Enable INT1 for data ready
+	#endif
 	Pisi_Register(0x19, 0x30, 0x00); // INT1_CFG_A: OR combination of events
 
 	HAL_Delay(10);
@@ -198,9 +570,18 @@ void Init_All_Sensors(void) {
     // Initialize gyroscope
     spi1_pisiRegister(0x20, 0x80);  // Soft reset
     HAL_Delay(100);
-    spi1_pisiRegister(0x20, 0x7F);  // CTRL1: Enable XYZ, 200Hz
+    spi1_pisiRegister(0x20, GYRO_CTRL1_VALUE);  // CTRL1: Enable XYZ, ODR
+    #if GYRO_FIFO_MODE
+    spi1_pisiRegister(0x22, 0x04);  // CTRL3: FIFO watermark on INT2
+    #else
     spi1_pisiRegister(0x22, 0x08);  // CTRL3: Enable data ready on INT2
+    #endif
     spi1_pisiRegister(0x23, 0x10);  // CTRL4: ±500dps range
+    #if GYRO_FIFO_MODE
+    spi1_pisiRegister(0x24, 0x40);  // CTRL5: FIFO enable
+    spi1_pisiRegister(0x2E, 0x00);  // FIFO_CTRL: bypass, empties the FIFO
+    spi1_pisiRegister(0x2E, 0x40 | GYRO_FIFO_WATERMARK);  // FIFO_CTRL: stream mode + watermark
+    #endif
     HAL_Delay(10);
     #endif
 }
@@ -212,31 +593,28 @@ void Verify_Sensors(void) {
     #if ENABLE_MAGNETOMETER
     Beri_Registre(0x1E, 0x4F, &who_am_i, 1); // Read WHO_AM_I register
     if (who_am_i != 0x6E) {
-        CDC_Transmit_FS((uint8_t *)"Magnetometer communication failed\n", 34);
+        LOG1(LOG_MAG_INIT_FAILED, who_am_i);
     } else {
-        CDC_Transmit_FS((uint8_t *)"Magnetometer initialized\n", 25);
+        LOG0(LOG_MAG_INIT_OK);
     }
-    HAL_Delay(10);
     #endif
 
     #if ENABLE_ACCELEROMETER
     Beri_Registre(0x19, 0x0F, &who_am_i, 1); // Read WHO_AM_I register
     if (who_am_i != 0x33) {
-        CDC_Transmit_FS((uint8_t *)"Accelerometer communication failed\n", 36);
+        LOG1(LOG_ACC_INIT_FAILED, who_am_i);
     } else {
-        CDC_Transmit_FS((uint8_t *)"Accelerometer initialized\n", 27);
+        LOG0(LOG_ACC_INIT_OK);
     }
-    HAL_Delay(10);
     #endif
 
     #if ENABLE_GYROSCOPE
     Beri_Registre(0x6B, 0x0F, &who_am_i, 1); // Read WHO_AM_I register
     if (who_am_i != 0xD4) {
-        CDC_Transmit_FS((uint8_t *)"Gyroscope communication failed\n", 32);
+        LOG1(LOG_GYR_INIT_FAILED, who_am_i);
     } else {
-        CDC_Transmit_FS((uint8_t *)"Gyroscope initialized\n", 23);
+        LOG0(LOG_GYR_INIT_OK);
     }
-    HAL_Delay(10);
     #endif
 }
 
@@ -304,6 +682,311 @@ void spi1_beriRegistre(uint8_t reg, uint8_t* buffer, uint8_t velikost)
   pavza();
 }
 
+/* Sample period implied by the configured output data rate */
+uint32_t Nominal_Period_Us(uint8_t sensor) {
+    static const uint16_t gyro_odr_hz[4] = { 95, 190, 380, 760 };
+    static const uint16_t acc_odr_hz[16] = { 1, 1, 10, 25, 50, 100, 200, 400, 1620, 1344,
+                                             1344, 1344, 1344, 1344, 1344, 1344 };
+    if (sensor == SENSOR_GYR) {
+        return 1000000 / gyro_odr_hz[(GYRO_CTRL1_VALUE >> 6) & 0x03];
+    }
+    if (sensor == SENSOR_ACC) {
+        return 1000000 / acc_odr_hz[(acc_ctrl1 >> 4) & 0x0F];
+    }
+    return 0; // magnetometer is read one sample at a time
+}
+
+/* Decodes FIFO_SRC (same layout on the L3GD20 and the LSM303 accelerometer) */
+uint8_t Fifo_Sample_Count(uint8_t sensor, uint8_t fifo_src) {
+    uint8_t count = fifo_src & 0x1F;  // FSS
+    if (fifo_src & 0x40) {            // OVRN: all slots full, oldest samples overwritten
+        sensor_stats[sensor].overruns++;
+        count = FIFO_DEPTH;
+    }
+    if (fifo_src & 0x20) {            // EMPTY
+        count = 0;
+    }
+    return count;
+}
+
+/* The samples counted now all arrived since the previous count, which gives the
+   real ODR of the part; outliers from overruns or missed drains are ignored. */
+void Update_Sample_Period(uint8_t sensor, uint32_t fifo_time, uint8_t count) {
+    uint32_t nominal_us = Nominal_Period_Us(sensor);
+
+    if (sample_period_us[sensor] == 0) {
+        sample_period_us[sensor] = nominal_us;
+    }
+    if (sample_last_fifo_time[sensor] != 0 && count > 0) {
+        uint32_t measured_us = (fifo_time - sample_last_fifo_time[sensor]) / count;
+        if (measured_us > nominal_us / 2 && measured_us < nominal_us * 3 / 2) {
+            sample_period_us[sensor] = (sample_period_us[sensor] * 7 + measured_us) / 8;
+        }
+    }
+    sample_last_fifo_time[sensor] = fifo_time;
+}
+
+/* Pushes a burst of raw samples (oldest first) into the sensor's ring. The newest
+   sample is stamped with the time the FIFO was counted, older ones step back one
+   period each. Called from the read completion context, the only producer. */
+void Publish_Samples(uint8_t sensor, const uint8_t *raw, uint8_t count, uint32_t newest_time) {
+    uint32_t period_us = sample_period_us[sensor];
+
+    for (uint8_t n = 0; n < count; n++) {
+        int16_t data[3];
+        for (uint8_t i = 0; i < 3; i++) {
+            data[i] = (int16_t)(raw[6 * n + 2 * i] | (raw[6 * n + 2 * i + 1] << 8));
+        }
+        Sample_Ring_Push(&sample_rings[sensor], data, newest_time - (uint32_t)(count - 1 - n) * period_us);
+    }
+    sensor_stats[sensor].reads++;
+}
+
+/* Hands at most SAMPLE_DRAIN_BATCH samples to the sink so one busy sensor
+   cannot starve the others or the command handling in the superloop */
+void Drain_Samples(uint8_t sensor, void (*transmit)(int16_t *raw_data)) {
+    Sample_TypeDef batch[SAMPLE_DRAIN_BATCH];
+    uint16_t count = Sample_Ring_Pop(&sample_rings[sensor], batch, SAMPLE_DRAIN_BATCH);
+
+    if (count) {
+        uint32_t start = DWT->CYCCNT;
+        Calibration_Apply(&calibrations[sensor], batch, count);
+        calibration_cycles += DWT->CYCCNT - start;
+        calibrated_samples += count;
+
+        start = DWT->CYCCNT;
+        decimated_samples += count;
+        count = Decimator_Process(&decimators[sensor], batch, count);
+        decimation_cycles += DWT->CYCCNT - start;
+    }
+    // behind a backlog the samples queue up too; the upload in flight does not count
+    if (transmission_mode == MODE_ASCII_UART && (!connection_established || Spool_Waiting())) {
+        Spool_Samples(sensor, batch, count);
+        return;
+    }
+    if (transmission_mode == MODE_QUATERNION_CDC) {
+        Fuse_Samples(sensor, batch, count);
+        return;
+    }
+    if (transmission_mode == MODE_SPECTRUM) {
+        Analyse_Samples(sensor, batch, count);
+        return;
+    }
+    if (summary_window_ms) {
+        Summarise_Samples(sensor, batch, count);
+        return;
+    }
+#if BINARY_FRAME_VERSION == 2
+    if (IS_BINARY_MODE(transmission_mode)) {
+        for (uint16_t n = 0; n < count; n += FRAME_V2_MAX_SAMPLES) {
+            uint16_t left = count - n;
+            Transmit_Frame(sensor, &batch[n], left < FRAME_V2_MAX_SAMPLES ? left : FRAME_V2_MAX_SAMPLES);
+        }
+        return;
+    }
+#endif
+    for (uint16_t n = 0; n < count; n++) {
+        transmit(batch[n].data);
+    }
+}
+
+/* Feeds drained samples to the orientation filter. Accelerometer and
+   magnetometer samples only replace the latest reading; each gyro sample
+   runs one update over the time since the previous one and is sent. */
+void Fuse_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count) {
+    static const float scale[SENSOR_COUNT] = {
+        50.0f / 32768.0f,                           // gauss
+        4.0f / 32768.0f,                            // g
+        500.0f / 32768.0f * 3.14159265f / 180.0f    // rad/s
+    };
+    uint32_t period_us = Nominal_Period_Us(SENSOR_GYR) * decimation[SENSOR_GYR];
+
+    for (uint16_t n = 0; n < count; n++) {
+        for (uint8_t i = 0; i < 3; i++) {
+            ahrs_inputs[sensor][i] = samples[n].data[i] * scale[sensor];
+        }
+        if (sensor != SENSOR_GYR) {
+            ahrs_seen |= 1 << sensor;
+            Count_Sample(sensor, 1);
+            continue;
+        }
+        if (!(ahrs_seen & (1 << SENSOR_ACC))) {
+            Count_Sample(SENSOR_GYR, 0);  // no gravity reference yet
+            continue;
+        }
+        uint32_t elapsed_us = samples[n].time - ahrs_last_time;
+        if (!(ahrs_seen & (1 << SENSOR_GYR)) || elapsed_us > AHRS_MAX_GAP * period_us) {
+            elapsed_us = period_us;
+        }
+        ahrs_seen |= 1 << SENSOR_GYR;
+        ahrs_last_time = samples[n].time;
+
+        uint32_t start = DWT->CYCCNT;
+        Ahrs_Update(&ahrs, ahrs_inputs[SENSOR_GYR], ahrs_inputs[SENSOR_ACC],
+                    (ahrs_seen & (1 << SENSOR_MAG)) ? ahrs_inputs[SENSOR_MAG] : NULL, elapsed_us * 1e-6f);
+        ahrs_cycles += DWT->CYCCNT - start;
+        ahrs_updates++;
+        Count_Sample(SENSOR_GYR, Transmit_Quaternion(samples[n].time));
+    }
+}
+
+/* Collects accelerometer samples into the spectrum blocks; the block FFTs
+   run here as blocks fill, the report once the average is complete */
+void Analyse_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count) {
+    for (uint16_t n = 0; n < count; n++) {
+        if (sensor != SENSOR_ACC) {
+            Count_Sample(sensor, 0);
+            continue;
+        }
+        uint32_t start = DWT->CYCCNT;
+        uint8_t ready = Spectrum_Add(&spectrum, samples[n].data, samples[n].time);
+        spectrum_cycles += DWT->CYCCNT - start;
+        Count_Sample(SENSOR_ACC, 1);
+        if (ready) {
+            Transmit_Spectrum();
+        }
+    }
+}
+
+/* Accumulates samples into the sensor's window; the sample that reaches past
+   the window closes it and opens the next one */
+void Summarise_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count) {
+    Summary_TypeDef *summary = &summaries[sensor];
+    uint32_t window_us = (uint32_t)summary_window_ms * 1000;
+
+    for (uint16_t n = 0; n < count; n++) {
+        if (summary->count && samples[n].time - summary->start >= window_us) {
+            summary_records++;
+            if (!Transmit_Summary(sensor)) {
+                summary_dropped++;
+            }
+            Summary_Reset(summary);
+        }
+        uint32_t start = DWT->CYCCNT;
+        Summary_Add(summary, &samples[n]);
+        summary_cycles += DWT->CYCCNT - start;
+        Count_Sample(sensor, 1);
+    }
+    summarised_samples += count;
+}
+
+#if USE_SPI_DMA
+/* Called from INT2 context, the read starts right away when SPI1 is free */
+void Gyro_Request_Read(void) {
+    if (spi_pending) {
+        sensor_stats[SENSOR_GYR].coalesced++;
+    }
+    spi_pending = 1;
+    Gyro_Start_Read();
+}
+
+/* Starts a full-duplex transfer with CS held low for its whole length */
+uint8_t Gyro_Transfer(uint8_t reg, uint16_t length) {
+    spi_tx_buffer[0] = reg;
+    HAL_GPIO_WritePin(GPIOE, GPIO_PIN_3, GPIO_PIN_RESET);  // CS low
+    if (HAL_SPI_TransmitReceive_DMA(&hspi1, spi_tx_buffer, spi_rx_buffer, length) != HAL_OK) {
+        HAL_GPIO_WritePin(GPIOE, GPIO_PIN_3, GPIO_PIN_SET);
+        return 0;
+    }
+    return 1;
+}
+
+/* Starts the gyro read. CS is driven only at the transaction boundaries;
+   the L3GD20 needs 5 ns CS setup, far below the time of one GPIO write. */
+void Gyro_Start_Read(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!spi_async_enabled || spi_stage != READ_STAGE_IDLE || !spi_pending) {
+        __set_PRIMASK(primask);
+        return;
+    }
+    spi_pending = 0;
+    spi_stage = GYRO_FIFO_MODE ? READ_STAGE_FIFO_SRC : READ_STAGE_SAMPLE;
+    __set_PRIMASK(primask);
+
+    uint32_t start = DWT->CYCCNT;
+    spi_fifo_time = Get_Timestamp_Us();
+#if GYRO_FIFO_MODE
+    uint8_t started = Gyro_Transfer(0x2F | 0x80, 2);
+#else
+    uint8_t started = Gyro_Transfer(0x28 | 0xC0, 7);
+#endif
+    if (!started) {
+        spi_stage = READ_STAGE_IDLE;
+        spi_pending = 1;
+    }
+    sensor_stats[SENSOR_GYR].read_cycles += DWT->CYCCNT - start;
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi->Instance != SPI1) {
+        return;
+    }
+    uint32_t start = DWT->CYCCNT;
+    HAL_GPIO_WritePin(GPIOE, GPIO_PIN_3, GPIO_PIN_SET);  // CS high
+
+    if (spi_stage == READ_STAGE_FIFO_SRC) {
+        uint8_t count = Fifo_Sample_Count(SENSOR_GYR, spi_rx_buffer[1]);
+        Update_Sample_Period(SENSOR_GYR, spi_fifo_time, count);
+        if (count > 0) {
+            spi_fifo_count = count;
+            spi_stage = READ_STAGE_FIFO_DATA;
+            if (!Gyro_Transfer(0x28 | 0xC0, 1 + count * 6)) {
+                spi_stage = READ_STAGE_IDLE;
+                spi_pending = 1;
+            }
+            sensor_stats[SENSOR_GYR].read_cycles += DWT->CYCCNT - start;
+            return;
+        }
+    } else {
+        uint8_t count = (spi_stage == READ_STAGE_FIFO_DATA) ? spi_fifo_count : 1;
+        Publish_Samples(SENSOR_GYR, &spi_rx_buffer[1], count, spi_fifo_time);
+    }
+    spi_stage = READ_STAGE_IDLE;
+    sensor_stats[SENSOR_GYR].read_cycles += DWT->CYCCNT - start;
+
+#if GYRO_FIFO_MODE
+    // the watermark line is a level: if the FIFO refilled during the drain no new edge will come
+    if (HAL_GPIO_ReadPin(GPIOE, GPIO_PIN_1) == GPIO_PIN_SET) {
+        spi_pending = 1;
+    }
+#endif
+    if (spi_pending) {
+        Gyro_Start_Read();
+    }
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi->Instance == SPI1) {
+        HAL_GPIO_WritePin(GPIOE, GPIO_PIN_3, GPIO_PIN_SET);
+        spi_stage = READ_STAGE_IDLE;
+        spi_pending = 1; // INT2 stays high until the data is read
+    }
+}
+#endif
+
+/* Microsecond timestamp from the HAL tick and the SysTick down-counter,
+   wraps after ~71 minutes */
+uint32_t Get_Timestamp_Us(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t ms = HAL_GetTick();
+    uint32_t count = SysTick->VAL;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) { // tick wrapped but HAL_IncTick() has not run yet
+        ms++;
+        count = SysTick->VAL;
+    }
+    __set_PRIMASK(primask);
+    return ms * 1000 + (SysTick->LOAD - count) / (SystemCoreClock / 1000000);
+}
+
+/* DWT cycle counter, used to measure the CPU cost of each sensor read */
+void Cycle_Counter_Init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
 /* I2C helper functions */
 uint8_t Pisi_Register(uint8_t device, uint8_t reg, uint8_t value) {
     device <<= 1;
@@ -318,6 +1001,108 @@ void Beri_Registre(uint8_t device, uint8_t reg, uint8_t* data, uint8_t length) {
     HAL_I2C_Mem_Read(&hi2c1, device, reg, I2C_MEMADD_SIZE_8BIT, data, length, HAL_MAX_DELAY);
 }
 
+#if USE_I2C_DMA
+/* Called from EXTI context and from the superloop (Set_Acc_Rate()), the read
+   starts right away when the bus is free. The pending mask is shared with the
+   interrupts, so it only changes with them masked: a bit an EXTI sets between
+   the load and the store of a plain |= is lost, and as DRDY and INT1 stay high
+   until the part is read, no edge would bring it back. */
+void I2C_Request_Read(uint8_t sensor) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (i2c_pending_mask & (1 << sensor)) {
+        sensor_stats[sensor].coalesced++;
+    }
+    i2c_pending_mask |= (1 << sensor);
+    __set_PRIMASK(primask);
+    I2C_Start_Next_Read();
+}
+
+/* A transfer that did not start or failed: the sensor waits for the bus again
+   and the engine is free */
+void I2C_Requeue_Read(uint8_t sensor) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    i2c_pending_mask |= (1 << sensor);
+    i2c_stage = READ_STAGE_IDLE;
+    __set_PRIMASK(primask);
+}
+
+uint8_t I2C_Transfer(uint8_t sensor, uint8_t reg, uint16_t length) {
+    return HAL_I2C_Mem_Read_DMA(&hi2c1, i2c_read_requests[sensor].device << 1, reg, I2C_MEMADD_SIZE_8BIT,
+                                i2c_dma_buffer, length) == HAL_OK;
+}
+
+/* Starts the next pending transfer; also polled from the superloop so a request
+   that found the bus taken by a blocking call is not left behind */
+void I2C_Start_Next_Read(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!i2c_async_enabled || i2c_stage != READ_STAGE_IDLE || i2c_pending_mask == 0) {
+        __set_PRIMASK(primask);
+        return;
+    }
+    uint8_t sensor = (i2c_pending_mask & (1 << SENSOR_MAG)) ? SENSOR_MAG : SENSOR_ACC;
+    const I2C_Read_Request_TypeDef *request = &i2c_read_requests[sensor];
+    i2c_pending_mask &= ~(1 << sensor);
+    i2c_active_sensor = sensor;
+    i2c_stage = request->fifo ? READ_STAGE_FIFO_SRC : READ_STAGE_SAMPLE;
+    __set_PRIMASK(primask);
+
+    uint32_t start = DWT->CYCCNT;
+    i2c_fifo_time = Get_Timestamp_Us();
+    uint8_t started = request->fifo ? I2C_Transfer(sensor, 0x2F, 1) : I2C_Transfer(sensor, request->reg, 6);
+    if (!started) {
+        I2C_Requeue_Read(sensor);
+    }
+    sensor_stats[sensor].read_cycles += DWT->CYCCNT - start;
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+    if (hi2c->Instance != I2C1 || i2c_stage == READ_STAGE_IDLE) {
+        return;
+    }
+    uint32_t start = DWT->CYCCNT;
+    uint8_t sensor = i2c_active_sensor;
+
+    if (i2c_stage == READ_STAGE_FIFO_SRC) {
+        uint8_t count = Fifo_Sample_Count(sensor, i2c_dma_buffer[0]);
+        Update_Sample_Period(sensor, i2c_fifo_time, count);
+        if (count > 0) {
+            i2c_fifo_count = count;
+            i2c_stage = READ_STAGE_FIFO_DATA;
+            if (!I2C_Transfer(sensor, i2c_read_requests[sensor].reg, count * 6)) {
+                I2C_Requeue_Read(sensor);
+            }
+            sensor_stats[sensor].read_cycles += DWT->CYCCNT - start;
+            return;
+        }
+    } else {
+        uint8_t count = (i2c_stage == READ_STAGE_FIFO_DATA) ? i2c_fifo_count : 1;
+        Publish_Samples(sensor, i2c_dma_buffer, count, i2c_fifo_time);
+    }
+    i2c_stage = READ_STAGE_IDLE;
+    sensor_stats[sensor].read_cycles += DWT->CYCCNT - start;
+
+#if ACC_FIFO_MODE
+    // INT1 watermark is a level, see the gyro drain
+    if (sensor == SENSOR_ACC && HAL_GPIO_ReadPin(GPIOE, GPIO_PIN_4) == GPIO_PIN_SET) {
+        I2C_Requeue_Read(SENSOR_ACC);
+    }
+#endif
+    I2C_Start_Next_Read();
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+    if (hi2c->Instance == I2C1) {
+        i2c_errors++;
+        if (i2c_stage != READ_STAGE_IDLE) {
+            I2C_Requeue_Read(i2c_active_sensor); // retry, DRDY stays high until read
+        }
+    }
+}
+#endif
+
 float Convert_To_Gauss(int16_t raw_value) {
     return raw_value * (50.0f / 32768.0f);
 }
@@ -336,54 +1121,369 @@ void Pack_Data(uint8_t *binary_buffer, uint16_t header, int16_t x, int16_t y, in
     binary_buffer[9] = (z >> 8) & 0xFF;
 }
 
-/* ASCII transmission function */
-void Transmit_Data_ASCII(const char *sensor_label, float x, float y, float z) {
-	 static uint32_t last_send_time = 0;
-	 const uint32_t MIN_SEND_INTERVAL = 100;
+/* CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) */
+uint16_t Crc16_Ccitt(const uint8_t *data, uint16_t length) {
+    uint16_t crc = 0xFFFF;
+    while (length--) {
+        crc ^= (uint16_t)(*data++) << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* Packs up to FRAME_V2_MAX_SAMPLES samples of one sensor into a v2 frame, returns its length.
+   The timestamp is the capture time of the first sample. */
+uint16_t Pack_Frame(uint8_t *frame, uint8_t sensor, uint32_t sequence, const Sample_TypeDef *samples, uint8_t count) {
+    uint16_t len = 0;
+
+    frame[len++] = HEADER_FRAME_V2 & 0xFF;
+    frame[len++] = (HEADER_FRAME_V2 >> 8) & 0xFF;
+    frame[len++] = (2 << 4) | sensor;
+    frame[len++] = count;
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (sequence >> (8 * i)) & 0xFF;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (samples[0].time >> (8 * i)) & 0xFF;
+    }
+    for (uint8_t n = 0; n < count; n++) {
+        for (uint8_t i = 0; i < 3; i++) {
+            frame[len++] = samples[n].data[i] & 0xFF;
+            frame[len++] = (samples[n].data[i] >> 8) & 0xFF;
+        }
+    }
+    uint16_t crc = Crc16_Ccitt(frame, len);
+    frame[len++] = crc & 0xFF;
+    frame[len++] = (crc >> 8) & 0xFF;
+    return len;
+}
+
+/* Writes binary data to the sink of the active binary mode, returns 1 when accepted */
+uint8_t Transmit_Binary(uint8_t *data, uint16_t length) {
+    if (transmission_mode == MODE_BINARY_UART) {
+        return HAL_UART_Transmit(&huart2, data, length, HAL_MAX_DELAY) == HAL_OK;
+    } else if (transmission_mode == MODE_BINARY_TCP) {
+        return Esp_Transport_Stream_Write(data, length);
+    }
+    return CDC_Transmit_FS(data, length) == USBD_OK;
+}
+
+/* Sends one v2 frame on the active binary sink. The sequence advances even when
+   the sink refuses the frame, so the receiver sees the gap. */
+void Transmit_Frame(uint8_t sensor, const Sample_TypeDef *samples, uint8_t count) {
+    uint8_t frame[FRAME_V2_MAX_SIZE];
+    uint16_t len = Pack_Frame(frame, sensor, frame_sequence[sensor], samples, count);
+    uint8_t accepted = Transmit_Binary(frame, len);
+
+    frame_sequence[sensor] += count;
+    for (uint8_t n = 0; n < count; n++) {
+        Count_Sample(sensor, accepted);
+    }
+}
+
+/* Sends the filter's orientation as one quaternion frame over CDC, stamped
+   with the capture time of the gyro sample; the sequence counts updates */
+uint8_t Transmit_Quaternion(uint32_t time) {
+    uint8_t frame[QUATERNION_FRAME_SIZE];
+    uint16_t len = 0;
+
+    frame[len++] = HEADER_QUATERNION & 0xFF;
+    frame[len++] = (HEADER_QUATERNION >> 8) & 0xFF;
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (quaternion_sequence >> (8 * i)) & 0xFF;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (time >> (8 * i)) & 0xFF;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        int16_t component = (int16_t)lrintf(ahrs.q[i] * 16384.0f);
+        frame[len++] = component & 0xFF;
+        frame[len++] = (component >> 8) & 0xFF;
+    }
+    uint16_t crc = Crc16_Ccitt(frame, len);
+    frame[len++] = crc & 0xFF;
+    frame[len++] = (crc >> 8) & 0xFF;
+    quaternion_sequence++;
+    return CDC_Transmit_FS(frame, len) == USBD_OK;
+}
+
+static uint16_t Put_Float(uint8_t *frame, uint16_t len, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (bits >> (8 * i)) & 0xFF;
+    }
+    return len;
+}
+
+/* Reduces the averaged spectra to one report frame, sent over CDC and, with
+   the server connected, posted to /spectrum; the rate is the measured one */
+uint8_t Transmit_Spectrum(void) {
+    Spectrum_Report_TypeDef report;
+    uint8_t frame[SPECTRUM_FRAME_SIZE];
+    uint16_t len = 0;
+    uint32_t period_us = sample_period_us[SENSOR_ACC] ? sample_period_us[SENSOR_ACC] : Nominal_Period_Us(SENSOR_ACC);
+    float rate_hz = 1e6f / ((float)period_us * decimation[SENSOR_ACC]);
+
+    uint32_t start = DWT->CYCCNT;
+    Spectrum_Report(&spectrum, rate_hz, &report);
+    spectrum_cycles += DWT->CYCCNT - start;
+    spectrum_reports++;
+
+    frame[len++] = HEADER_SPECTRUM & 0xFF;
+    frame[len++] = (HEADER_SPECTRUM >> 8) & 0xFF;
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (spectrum_sequence >> (8 * i)) & 0xFF;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        frame[len++] = (report.time >> (8 * i)) & 0xFF;
+    }
+    len = Put_Float(frame, len, rate_hz);
+    frame[len++] = SPECTRUM_BANDS;
+    frame[len++] = SPECTRUM_PEAKS;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        for (uint8_t band = 0; band < SPECTRUM_BANDS; band++) {
+            len = Put_Float(frame, len, report.bands[axis][band]);
+        }
+        for (uint8_t peak = 0; peak < SPECTRUM_PEAKS; peak++) {
+            len = Put_Float(frame, len, report.peaks[axis][peak].frequency);
+            len = Put_Float(frame, len, report.peaks[axis][peak].amplitude);
+        }
+    }
+    uint16_t crc = Crc16_Ccitt(frame, len);
+    frame[len++] = crc & 0xFF;
+    frame[len++] = (crc >> 8) & 0xFF;
+    spectrum_sequence++;
+
+    uint8_t sent = CDC_Transmit_FS(frame, len) == USBD_OK;
+    if (connection_established) {
+        sent |= Send_Request("/spectrum", "application/octet-stream", frame, len);
+    }
+    return sent;
+}
+
+/* Sends the closed window of one sensor on the sink of the active mode;
+   returns 1 when it was accepted */
+uint8_t Transmit_Summary(uint8_t sensor) {
+    static const char *labels[SENSOR_COUNT] = { "MAG", "ACC", "GYR" };
+    static const float scale[SENSOR_COUNT] = { 50.0f / 32768.0f, 4.0f / 32768.0f, 500.0f / 32768.0f };
+    static const char *names[5] = { "min", "max", "mean", "var", "rms" };
+    const Summary_TypeDef *summary = &summaries[sensor];
+    uint32_t sequence = summary_sequence[sensor]++;
+
+    if (IS_BINARY_MODE(transmission_mode)) {
+        uint8_t frame[SUMMARY_FRAME_SIZE];
+        uint16_t len = 0;
+        uint32_t fields[4] = { sequence, summary->start, summary->end, summary->count };
+
+        frame[len++] = HEADER_SUMMARY & 0xFF;
+        frame[len++] = (HEADER_SUMMARY >> 8) & 0xFF;
+        frame[len++] = sensor;
+        for (uint8_t f = 0; f < 4; f++) {
+            for (uint8_t i = 0; i < 4; i++) {
+                frame[len++] = (fields[f] >> (8 * i)) & 0xFF;
+            }
+        }
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            frame[len++] = summary->min[axis] & 0xFF;
+            frame[len++] = (summary->min[axis] >> 8) & 0xFF;
+            frame[len++] = summary->max[axis] & 0xFF;
+            frame[len++] = (summary->max[axis] >> 8) & 0xFF;
+            len = Put_Float(frame, len, summary->mean[axis]);
+            len = Put_Float(frame, len, Summary_Variance(summary, axis));
+            len = Put_Float(frame, len, Summary_Rms(summary, axis));
+        }
+        uint16_t crc = Crc16_Ccitt(frame, len);
+        frame[len++] = crc & 0xFF;
+        frame[len++] = (crc >> 8) & 0xFF;
+        return Transmit_Binary(frame, len);
+    }
+    if (transmission_mode != MODE_ASCII_UART && transmission_mode != MODE_ASCII_CDC) {
+        return 0;
+    }
+
+    char json[SUMMARY_JSON_SIZE];
+    float k = scale[sensor];
+    int length = snprintf(json, sizeof(json), "{\"SUM\":\"%s\",\"seq\":%lu,\"t0\":%lu,\"t1\":%lu,\"n\":%lu",
+                          labels[sensor], sequence, summary->start, summary->end, summary->count);
+    for (uint8_t stat = 0; stat < 5 && length > 0 && length < (int)sizeof(json); stat++) {
+        float values[3];
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            values[axis] = stat == 0 ? summary->min[axis] * k :
+                           stat == 1 ? summary->max[axis] * k :
+                           stat == 2 ? summary->mean[axis] * k :
+                           stat == 3 ? Summary_Variance(summary, axis) * k * k :
+                                       Summary_Rms(summary, axis) * k;
+        }
+        length += snprintf(json + length, sizeof(json) - length, ",\"%s\":[%.5g,%.5g,%.5g]",
+                           names[stat], values[0], values[1], values[2]);
+    }
+    if (length <= 0 || length >= (int)sizeof(json) - 2) {
+        LOG1(LOG_DATA_TOO_LARGE, length);
+        return 0;
+    }
+    json[length++] = '}';
+    if (transmission_mode == MODE_ASCII_UART) {
+        return connection_established && Batch_Add(json, length);
+    }
+    json[length++] = '\n';
+    return CDC_Transmit_FS((uint8_t *)json, length) == USBD_OK;
+}
+
+/* Sends queued log records as binary frames in the CDC stream:
+   [0xA54C][id16][tick32][arg0 32][arg1 32][CRC16], decoded by log_decoder.py.
+   Runs last in the superloop and only while the CDC ring is at least half
+   empty, so logging never takes room from sensor frames. */
+void Drain_Log(void) {
+    Log_Record_TypeDef record;
+    uint32_t dropped = Log_Take_Dropped();
+
+    if (dropped) {
+        LOG1(LOG_RECORDS_DROPPED, dropped);
+    }
+    for (uint8_t n = 0; n < LOG_DRAIN_BATCH; n++) {
+        if (CDC_Tx_Free_FS() < APP_TX_DATA_SIZE / 2 || !Log_Read(&record)) {
+            return;
+        }
+        uint8_t frame[LOG_FRAME_SIZE];
+        uint16_t len = 0;
+        uint32_t fields[3] = { record.time, record.arg[0], record.arg[1] };
+
+        frame[len++] = HEADER_LOG & 0xFF;
+        frame[len++] = (HEADER_LOG >> 8) & 0xFF;
+        frame[len++] = record.id & 0xFF;
+        frame[len++] = (record.id >> 8) & 0xFF;
+        for (uint8_t f = 0; f < 3; f++) {
+            for (uint8_t i = 0; i < 4; i++) {
+                frame[len++] = (fields[f] >> (8 * i)) & 0xFF;
+            }
+        }
+        uint16_t crc = Crc16_Ccitt(frame, len);
+        frame[len++] = crc & 0xFF;
+        frame[len++] = (crc >> 8) & 0xFF;
+        CDC_Transmit_FS(frame, len);
+    }
+}
 
+/* ASCII transmission function, returns 1 when the sink accepted the sample */
+uint8_t Transmit_Data_ASCII(const char *sensor_label, float x, float y, float z) {
     char ascii_buffer[BUFFER_SIZE];
-    snprintf(ascii_buffer, BUFFER_SIZE, "{\"%s\":%d,\"X\":%.3f,\"Y\":%.3f,\"Z\":%.3f}",
-             sensor_label, packet_number, x, y, z);
+    int length = snprintf(ascii_buffer, BUFFER_SIZE, "{\"%s\":%d,\"X\":%.3f,\"Y\":%.3f,\"Z\":%.3f}",
+                          sensor_label, packet_number, x, y, z);
     if (transmission_mode == MODE_ASCII_UART) {
-    	// Pošlji na UART
-        // HAL_UART_Transmit(&huart2, (uint8_t *)ascii_buffer, strlen(ascii_buffer), HAL_MAX_DELAY);
-        // pošiljanje podatkov ESP-ju
+        // pošiljanje podatkov ESP-ju, zbrano v paketih
        	if (connection_established) {
-			// Preveri časovni interval
-			uint32_t current_time = HAL_GetTick();
-			if (current_time - last_send_time >= MIN_SEND_INTERVAL) {
-				Send_Data_To_Server(ascii_buffer);
-				last_send_time = current_time;
-			}
+            return Batch_Add(ascii_buffer, length < BUFFER_SIZE ? length : BUFFER_SIZE - 1);
        	}
     } else if (transmission_mode == MODE_ASCII_CDC) {
-        CDC_Transmit_FS((uint8_t *)ascii_buffer, strlen(ascii_buffer));
+        return CDC_Transmit_FS((uint8_t *)ascii_buffer, strlen(ascii_buffer)) == USBD_OK;
+    }
+    return 0;
+}
+
+/* Sample accounting */
+void Count_Sample(uint8_t sensor, uint8_t accepted) {
+    if (accepted) {
+        sensor_stats[sensor].delivered++;
+    } else {
+        sensor_stats[sensor].rejected++;
+    }
+}
+
+/* Length after appending snprintf()'s result to a message of size bytes.
+   snprintf() returns what it would have written, so a long line would push
+   len past the end; the length stays at the last byte instead, where every
+   further append writes only the terminator. */
+static int Append_Length(int len, int written, size_t size) {
+    if (written < 0) {
+        return len;
+    }
+    return (size_t)(len + written) < size ? len + written : (int)size - 1;
+}
+
+void Report_Sample_Stats(void) {
+    static uint32_t last_report_time = 0;
+    static const char *labels[SENSOR_COUNT] = { "MAG", "ACC", "GYR" };
+    uint32_t current_time = HAL_GetTick();
+
+    if (current_time - last_report_time < STATS_REPORT_INTERVAL) {
+        return;
     }
+    last_report_time = current_time;
+
+    char stats_msg[512];
+    int len = 0;
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        uint32_t reads = sensor_stats[i].reads;
+        len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, "%s e=%lu ok=%lu rej=%lu lost=%lu full=%lu ovr=%lu cyc=%lu | ",
+                        labels[i], sensor_stats[i].edges, sensor_stats[i].delivered,
+                        sensor_stats[i].rejected, sensor_stats[i].coalesced, sample_rings[i].overruns,
+                        sensor_stats[i].overruns,
+                        reads ? sensor_stats[i].read_cycles / reads : 0), sizeof(stats_msg));
+    }
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, "USB q=%lu tx=%lu drop=%lu",
+                    cdc_tx_stats.queued, cdc_tx_stats.sent, cdc_tx_stats.dropped), sizeof(stats_msg));
+#if USE_UART_DMA
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | UART ovf=%lu err=%lu",
+                    uart_rx_overflows, uart_rx_errors), sizeof(stats_msg));
+#endif
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | ESP q=%lu ok=%lu fail=%lu full=%lu lat=%lu rsp=%lu fly=%lu tcp=%lu tfull=%lu",
+                    esp_transport_stats.queued, esp_transport_stats.sent, esp_transport_stats.failed,
+                    esp_transport_stats.full, esp_transport_stats.last_latency,
+                    esp_transport_stats.responses, esp_transport_stats.max_in_flight,
+                    esp_transport_stats.stream_bytes, esp_transport_stats.stream_full), sizeof(stats_msg));
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | SPOOL ram=%lu flash=%lu peak=%lu drop=%lu",
+                    Spool_Ram_Bytes(), Spool_Flash_Bytes(), spool_stats.peak, spool_stats.dropped), sizeof(stats_msg));
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | AHRS n=%lu cyc=%lu",
+                    ahrs_updates, ahrs_updates ? ahrs_cycles / ahrs_updates : 0), sizeof(stats_msg));
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | CAL cyc=%lu DEC cyc=%lu",
+                    calibrated_samples ? calibration_cycles / calibrated_samples : 0,
+                    decimated_samples ? decimation_cycles / decimated_samples : 0), sizeof(stats_msg));
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | FFT n=%lu cyc=%lu",
+                    spectrum_reports, spectrum_reports ? spectrum_cycles / spectrum_reports : 0), sizeof(stats_msg));
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, " | SUM n=%lu drop=%lu cyc=%lu",
+                    summary_records, summary_dropped,
+                    summarised_samples ? summary_cycles / summarised_samples : 0), sizeof(stats_msg));
+    len = Append_Length(len, snprintf(stats_msg + len, sizeof(stats_msg) - len, "\n"), sizeof(stats_msg));
+    stats_msg[len - 1] = '\n'; // a truncated report still ends its line
+    CDC_Transmit_FS((uint8_t *)stats_msg, len);
 }
 
 #if ENABLE_MAGNETOMETER
 /* Magnetometer handler */
 void Handle_Magnetometer(void) {
-    data_ready_mag = 0;
+#if !USE_I2C_DMA
+    if (data_ready_mag) {
+        data_ready_mag = 0;
+
+        int16_t raw_data[3];
+        uint32_t start = DWT->CYCCNT;
+        uint32_t time = Get_Timestamp_Us();
+        Beri_Registre(0x1E, 0x68, (uint8_t*)raw_data, 6);
+        Clear_Interrupts(); // Clear interrupt flags
+        sensor_stats[SENSOR_MAG].read_cycles += DWT->CYCCNT - start;
+        Publish_Samples(SENSOR_MAG, (uint8_t*)raw_data, 1, time);
+    }
+#endif
+    Drain_Samples(SENSOR_MAG, Transmit_Magnetometer_Sample);
+}
 
-    int16_t raw_data[3];
-    Beri_Registre(0x1E, 0x68, (uint8_t*)raw_data, 6);
-    Clear_Interrupts(); // Clear interrupt flags
+void Transmit_Magnetometer_Sample(int16_t *raw_data) {
+    uint8_t accepted = 0;
 
-    if (transmission_mode == MODE_BINARY_UART || transmission_mode == MODE_BINARY_CDC) {
+    if (IS_BINARY_MODE(transmission_mode)) {
         uint8_t binary_buffer[10];
         Pack_Data(binary_buffer, HEADER_MAG, raw_data[0], raw_data[1], raw_data[2]);
-        if (transmission_mode == MODE_BINARY_UART) {
-            HAL_UART_Transmit(&huart2, binary_buffer, 10, HAL_MAX_DELAY);
-        } else {
-            CDC_Transmit_FS(binary_buffer, 10);
-        }
+        accepted = Transmit_Binary(binary_buffer, 10);
     } else if (transmission_mode == MODE_ASCII_UART || transmission_mode == MODE_ASCII_CDC) {
         float x = Convert_To_Gauss(raw_data[0]);
         float y = Convert_To_Gauss(raw_data[1]);
         float z = Convert_To_Gauss(raw_data[2]);
-        Transmit_Data_ASCII("MAG", x, y, z);
+        accepted = Transmit_Data_ASCII("MAG", x, y, z);
     }
+    Count_Sample(SENSOR_MAG, accepted);
     packet_number++;
 }
 #endif
@@ -391,52 +1491,74 @@ void Handle_Magnetometer(void) {
 #if ENABLE_ACCELEROMETER
 /* Accelerometer handler */
 void Handle_Accelerometer(void) {
-    data_ready_acc = 0;
+#if !USE_I2C_DMA
+    if (data_ready_acc) {
+        data_ready_acc = 0;
+
+        int16_t raw_data[3];
+        uint32_t start = DWT->CYCCNT;
+        uint32_t time = Get_Timestamp_Us();
+        Beri_Registre(0x19, 0x28 | 0x80, (uint8_t*)raw_data, 6);
+        Clear_Interrupts(); // Clear interrupt flags
+        sensor_stats[SENSOR_ACC].read_cycles += DWT->CYCCNT - start;
+        Publish_Samples(SENSOR_ACC, (uint8_t*)raw_data, 1, time);
+    }
+#endif
+    Drain_Samples(SENSOR_ACC, Transmit_Accelerometer_Sample);
+}
 
-    int16_t raw_data[3];
-    Beri_Registre(0x19, 0x28 | 0x80, (uint8_t*)raw_data, 6);
-    Clear_Interrupts(); // Clear interrupt flags
+void Transmit_Accelerometer_Sample(int16_t *raw_data) {
+    uint8_t accepted = 0;
 
-    if (transmission_mode == MODE_BINARY_UART || transmission_mode == MODE_BINARY_CDC) {
+    if (IS_BINARY_MODE(transmission_mode)) {
         uint8_t binary_buffer[10];
         Pack_Data(binary_buffer, HEADER_ACC, raw_data[0], raw_data[1], raw_data[2]);
-        if (transmission_mode == MODE_BINARY_UART) {
-            HAL_UART_Transmit(&huart2, binary_buffer, 10, HAL_MAX_DELAY);
-        } else {
-            CDC_Transmit_FS(binary_buffer, 10);
-        }
+        accepted = Transmit_Binary(binary_buffer, 10);
     } else if (transmission_mode == MODE_ASCII_UART || transmission_mode == MODE_ASCII_CDC) {
         float x = raw_data[0] * (4.0f / 32768.0f);
         float y = raw_data[1] * (4.0f / 32768.0f);
         float z = raw_data[2] * (4.0f / 32768.0f);
-        Transmit_Data_ASCII("ACC", x, y, z);
+        accepted = Transmit_Data_ASCII("ACC", x, y, z);
     }
+    Count_Sample(SENSOR_ACC, accepted);
     packet_number++;
 }
 #endif
 
 #if ENABLE_GYROSCOPE
 void Handle_Gyroscope(void) {
-    data_ready_gyr = 0;
+#if !USE_SPI_DMA
+    if (data_ready_gyr) {
+        data_ready_gyr = 0;
+
+        int16_t raw_data[3];
+        uint32_t start = DWT->CYCCNT;
+        uint32_t time = Get_Timestamp_Us();
+        spi1_beriRegistre(0x28 | 0x80, (uint8_t*)raw_data, 6);
+#if !USE_I2C_DMA
+        Clear_Interrupts(); // with DMA the LSM303 lines are released by their own reads
+#endif
+        sensor_stats[SENSOR_GYR].read_cycles += DWT->CYCCNT - start;
+        Publish_Samples(SENSOR_GYR, (uint8_t*)raw_data, 1, time);
+    }
+#endif
+    Drain_Samples(SENSOR_GYR, Transmit_Gyroscope_Sample);
+}
 
-    int16_t raw_data[3];
-    spi1_beriRegistre(0x28 | 0x80, (uint8_t*)raw_data, 6);
-    Clear_Interrupts();
+void Transmit_Gyroscope_Sample(int16_t *raw_data) {
+    uint8_t accepted = 0;
 
-    if (transmission_mode == MODE_BINARY_UART || transmission_mode == MODE_BINARY_CDC) {
+    if (IS_BINARY_MODE(transmission_mode)) {
         uint8_t binary_buffer[10];
         Pack_Data(binary_buffer, HEADER_GYR, raw_data[0], raw_data[1], raw_data[2]);
-        if (transmission_mode == MODE_BINARY_UART) {
-            HAL_UART_Transmit(&huart2, binary_buffer, 10, HAL_MAX_DELAY);
-        } else {
-            CDC_Transmit_FS(binary_buffer, 10);
-        }
+        accepted = Transmit_Binary(binary_buffer, 10);
     } else if (transmission_mode == MODE_ASCII_UART || transmission_mode == MODE_ASCII_CDC) {
         float x = raw_data[0] * (500.0f / 32768.0f);
         float y = raw_data[1] * (500.0f / 32768.0f);
         float z = raw_data[2] * (500.0f / 32768.0f);
-        Transmit_Data_ASCII("GYR", x, y, z);
+        accepted = Transmit_Data_ASCII("GYR", x, y, z);
     }
+    Count_Sample(SENSOR_GYR, accepted);
     packet_number++;
 }
 #endif
@@ -453,24 +1575,49 @@ void Change_Response_Status(uint8_t new_status) {
 	response_status = new_status;
 }
 
-void Clear_RX_Buffer() {
+/* Drops the collected response text. Events the tokenizer already queued
+   stay queued: they may belong to the send engine or to a link that closed
+   meanwhile, and Check_Reception_Completion() still has to apply them. */
+void Clear_RX_Text() {
+#if USE_UART_DMA
+    // the DMA keeps running, only the collected response is dropped
+    __disable_irq();
+    rx_index = 0;
+    rx_buffer[0] = '\0';
+    __enable_irq();
+#else
     HAL_UART_AbortReceive_IT(&huart2);  // Stop any ongoing reception
     memset((void*)rx_buffer, 0, RX_BUFFER_SIZE);
     rx_index = 0;
     HAL_UART_Receive_IT(&huart2, &rx_buffer[0], 1);
+#endif
 #ifdef DEBUG
     //CDC_Transmit_FS((uint8_t*)"Cleaned Buffer\r\n", 16);
     //HAL_Delay(10);
 #endif
 }
 
+/* Drops the text and the queued events too. Only for the blocking startup
+   exchanges (Esp_Command_Wait() and the baud switch), which read the
+   tokenizer's seen flags and run before the superloop applies events. */
+void Clear_RX_Buffer() {
+    Clear_RX_Text();
+    __disable_irq();
+    At_Parser_Flush();
+    __enable_irq();
+}
+
 void Send_Command(const char* cmd) {
+#if !USE_UART_DMA
 	HAL_UART_AbortReceive_IT(&huart2);
-    Clear_RX_Buffer();
+#endif
+    Clear_RX_Text();
     tick_when_sent = HAL_GetTick();
 	Change_Response_Status(WAITING);
     HAL_UART_Transmit(&huart2, (uint8_t*)cmd, strlen(cmd), HAL_MAX_DELAY);
+#if !USE_UART_DMA
     HAL_UART_Receive_IT(&huart2, &rx_buffer[rx_index], 1);
+#endif
 }
 
 uint8_t Is_Timedout(uint32_t timeout_ms) {
@@ -485,106 +1632,148 @@ uint8_t Is_Timedout(uint32_t timeout_ms) {
 void Configure_ESP_As_Access_Point(void) {
     switch(setup_stage) {
         case AT_TEST: // AT Test
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"Sending AT Test command\r\n", 25);
-            HAL_Delay(10);
-#endif
+            LOG0(LOG_SEND_AT_TEST);
             Send_Command("AT\r\n\0");
             break;
 
         case AT_SET_CONNECT_MODE:
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"Sending AT set HotSpot and Connect mode command\r\n", 49);
-            HAL_Delay(10);
-#endif
+            LOG0(LOG_SEND_CONNECT_MODE);
             Send_Command("AT+CWMODE=3\r\n\0");
             break;
 
         case AT_SET_MAX_CONNECTIONS:
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"Sending AT set max connections command\r\n", 40);
-            HAL_Delay(10);
-#endif
+            LOG0(LOG_SEND_MAX_CONNECTIONS);
             Send_Command("AT+CIPMUX=1\r\n\0");
             break;
 
+        case AT_SET_SERVER_LIMIT:
+            LOG0(LOG_SEND_SERVER_LIMIT);
+            Send_Command(ESP_SERVER_LIMIT_COMMAND);
+            break;
+
         case AT_START_SERVER:
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"Sending AT start server command\r\n", 33);
-            HAL_Delay(10);
-#endif
+            LOG0(LOG_SEND_START_SERVER);
             Send_Command("AT+CIPSERVER=1,80\r\n\0");
             break;
 
         case AT_SEND_HTML_HEADER:
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"Sending HTML Header\r\n", 21);
-            HAL_Delay(10);
-#endif
+            LOG0(LOG_SEND_HTML_HEADER);
             Send_HTML_Header();
             break;
 
         case AT_SEND_HTML:
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"Sending HTML\r\n", 14);
-            HAL_Delay(10);
-#endif
+            LOG0(LOG_SEND_HTML);
             Send_Command(html_page2);
             break;
 
         default:
-#ifdef DEBUG
-            CDC_Transmit_FS((uint8_t *)"That Setup Stage not implemented yet\r\n", 38);
-            HAL_Delay(10);
-#endif
+            LOG1(LOG_SETUP_STAGE_UNKNOWN, setup_stage);
             break;
     }
     HAL_Delay(10);
 }
 
-void Send_HTML_Header() {
+void Send_HTML_Header(void) {
     Send_Command("AT+CIPSEND=0,334\r\n");
 }
 
-void Send_Connect_Request(char *ssid, char *password) {
-    char cmd[128];
-    snprintf(cmd, sizeof(cmd), "AT+CWJAP=\"%s\",\"%s\"\r\n", ssid, password);
-    Send_Command(cmd);
-}
+/* Copies the query string value at start, up to the next '&' or the end of
+   the request line, into value and decodes it like the browser encoded the
+   form: '+' is a space and %XX a byte. Cut to size - 1 characters; returns
+   the decoded length. */
+size_t Form_Value(const char *start, char *value, size_t size) {
+    size_t length = 0;
+
+    while (*start && !strchr("& \r\n", *start) && length + 1 < size) {
+        if (*start == '+') {
+            value[length++] = ' ';
+            start++;
+        } else if (start[0] == '%' && isxdigit((unsigned char)start[1]) && isxdigit((unsigned char)start[2])) {
+            char hex[3] = { start[1], start[2], '\0' };
+            value[length++] = (char)strtoul(hex, NULL, 16);
+            start += 3;
+        } else {
+            value[length++] = *start++;
+        }
+    }
+    value[length] = '\0';
+    return length;
+}
+
+/* AT+CWJAP with the quotes, commas and backslashes of a decoded network name
+   or password escaped by a backslash, as the AT firmware expects them */
+int Format_Join_Command(char *cmd, size_t size, const char *ssid, const char *password) {
+    const char *fields[2] = { ssid, password };
+    int length = snprintf(cmd, size, "AT+CWJAP=");
+
+    for (uint8_t i = 0; i < 2; i++) {
+        cmd[length++] = '"';
+        for (const char *c = fields[i]; *c && length + 8 < (int)size; c++) {
+            if (*c == '"' || *c == ',' || *c == '\\') {
+                cmd[length++] = '\\';
+            }
+            cmd[length++] = *c;
+        }
+        cmd[length++] = '"';
+        cmd[length++] = i == 0 ? ',' : '\r';
+    }
+    cmd[length++] = '\n';
+    cmd[length] = '\0';
+    return length;
+}
+
+void Send_Connect_Request(char *ssid, char *password) {
+    char cmd[256];
+    Format_Join_Command(cmd, sizeof(cmd), ssid, password);
+    Send_Command(cmd);
+}
 
 void Handle_Client_Request(void) {
     if (strstr((char *)rx_buffer, "GET /?ssid=")) {
         char *ssid_start = strstr((char *)rx_buffer, "ssid=") + 5;
-        char *password_start = strstr((char *)rx_buffer, "password=") + 9;
+        char *password_start = strstr((char *)rx_buffer, "password=");
 
-        char ssid[32] = {0};
-        char password[64] = {0};
+        char ssid[sizeof(device_config.ssid)] = {0};
+        char password[sizeof(device_config.password)] = {0};
 
-        char *end_ssid = strstr(ssid_start, "&");
-        if (end_ssid) {
-            strncpy(ssid, ssid_start, end_ssid - ssid_start);
+        Form_Value(ssid_start, ssid, sizeof(ssid));
+        if (password_start) {
+            password_start += 9;
+            Form_Value(password_start, password, sizeof(password)); // server= and port= may follow
         } else {
-            strncpy(ssid, ssid_start, sizeof(ssid) - 1);
+            password_start = ssid_start;
         }
 
-        char *end_password = strstr(password_start, " ");
-        if (end_password) {
-            strncpy(password, password_start, end_password - password_start);
-        } else {
-            strncpy(password, password_start, sizeof(password) - 1);
+        /* Kept in flash, the next boot joins this network without the form */
+        strcpy(device_config.ssid, ssid);
+        strcpy(device_config.password, password);
+        Save_Setting(CONFIG_KEY_SSID, ssid, strlen(ssid));
+        Save_Setting(CONFIG_KEY_PASSWORD, password, strlen(password));
+
+        /* Optional, not on the form: GET /?ssid=..&password=..&server=a.b.c.d&port=n */
+        char *server_start = strstr(password_start, "server=");
+        if (server_start) {
+            char server_ip[sizeof(device_config.server_ip) + 1];
+            size_t server_length = Form_Value(server_start + 7, server_ip, sizeof(server_ip));
+            if (server_length > 0 && server_length < sizeof(device_config.server_ip)) {
+                strcpy(device_config.server_ip, server_ip);
+                Save_Setting(CONFIG_KEY_SERVER_IP, device_config.server_ip, server_length);
+            }
+        }
+        char *port_start = strstr(password_start, "port=");
+        if (port_start) {
+            uint32_t port = strtoul(port_start + 5, NULL, 10);
+            if (port > 0 && port <= 0xFFFF) {
+                device_config.server_port = port;
+                Save_Setting(CONFIG_KEY_SERVER_PORT, &device_config.server_port, sizeof(device_config.server_port));
+            }
         }
 
-        #ifdef DEBUG // Debug: Print extracted SSID and password
-        char debug_msg[128];
-        snprintf(debug_msg, sizeof(debug_msg), "SSID: %s, Password: %s\r\n", ssid, password);
-        CDC_Transmit_FS((uint8_t *)debug_msg, strlen(debug_msg));
-        HAL_Delay(10);
-        #endif
+        LOG1(LOG_WIFI_CREDENTIALS, strlen(ssid)); // the length only, the password never leaves the board
 
-        CDC_Transmit_FS("Sending Connect to WiFi with SSID Command\r\n", 43);
-        HAL_Delay(10);
+        LOG0(LOG_SEND_WIFI_CONNECT);
 
-        Clear_RX_Buffer(); // Clear the buffer after handling
+        Clear_RX_Text(); // Clear the buffer after handling
 
         Send_Connect_Request(ssid, password);
     }
@@ -592,26 +1781,22 @@ void Handle_Client_Request(void) {
 
 void Log_Response_Status_Change() {
 	if (response_status == TIMEOUT)
-		CDC_Transmit_FS((uint8_t *)"Response status changed to: TIMEOUT\r\n\r\n", 39);
+		LOG0(LOG_RESPONSE_TIMEOUT);
 	else if (response_status == SUCCESS)
-		CDC_Transmit_FS((uint8_t *)"Response status changed to: SUCCESS\r\n", 37);
+		LOG0(LOG_RESPONSE_SUCCESS);
 	else if (response_status == ERROR)
-		CDC_Transmit_FS((uint8_t *)"Response status changed to: ERROR\r\n", 35);
+		LOG0(LOG_RESPONSE_ERROR);
 	else if (response_status == WAITING)
-		CDC_Transmit_FS((uint8_t *)"Response status changed to: WAITING\r\n", 37);
+		LOG0(LOG_RESPONSE_WAITING);
 	else if (response_status == IDLE)
-		CDC_Transmit_FS((uint8_t *)"Response status changed to: IDLE\r\n\r\n", 36);
-
-    HAL_Delay(10);
+		LOG0(LOG_RESPONSE_IDLE);
 }
 
 uint8_t Has_Response_Finished(){
-#ifdef DEBUG
 	if (has_response_changed == 1){
 		Log_Response_Status_Change();
 		has_response_changed = 0;
 	}
-#endif
 	if (response_status >= TIMEOUT && response_status < WAITING) {
 		return 1;
 	}
@@ -620,45 +1805,37 @@ uint8_t Has_Response_Finished(){
 
 void Log_Setup_Stage_Change() {
 	if (setup_stage == AT_TEST)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_TEST\r\n", 33);
+		LOG0(LOG_STAGE_AT_TEST);
 	else if (setup_stage == AT_SET_CONNECT_MODE)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_SET_CONNECT_MODE\r\n", 45);
-	else if (response_status == AT_SET_MAX_CONNECTIONS)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_SET_MAX_CONNECTIONS\r\n", 48);
-	else if (response_status == AT_START_SERVER)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_START_SERVER\r\n", 41);
-	else if (response_status == AT_SEND_HTML_HEADER)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_SEND_HTML_HEADER\r\n", 45);
-	else if (response_status == AT_SEND_HTML)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_SEND_HTML\r\n", 38);
-	else if (response_status == AT_SEND_CONNECT_REQUEST)
-		CDC_Transmit_FS((uint8_t *)"Setup stage changed to: AT_SEND_CONNECT_REQUEST\r\n", 49);
-
-    HAL_Delay(10);
+		LOG0(LOG_STAGE_CONNECT_MODE);
+	else if (setup_stage == AT_SET_MAX_CONNECTIONS)
+		LOG0(LOG_STAGE_MAX_CONNECTIONS);
+	else if (setup_stage == AT_SET_SERVER_LIMIT)
+		LOG0(LOG_STAGE_SERVER_LIMIT);
+	else if (setup_stage == AT_START_SERVER)
+		LOG0(LOG_STAGE_START_SERVER);
+	else if (setup_stage == AT_SEND_HTML_HEADER)
+		LOG0(LOG_STAGE_HTML_HEADER);
+	else if (setup_stage == AT_SEND_HTML)
+		LOG0(LOG_STAGE_HTML);
+	else if (setup_stage == AT_SEND_CONNECT_REQUEST)
+		LOG0(LOG_STAGE_CONNECT_REQUEST);
 }
 
 void Set_Setup_Stage(uint8_t new_stage) {
-	if (new_stage < 0 || new_stage > 6) {
-#ifdef DEBUG
-	    CDC_Transmit_FS((uint8_t *)"new_stage is invalid...\r\n", 25);
-	    HAL_Delay(10);
-#endif
+	if (new_stage < 0 || new_stage > 7) {
+	    LOG1(LOG_STAGE_INVALID, new_stage);
 	    return;
 	}
 	setup_stage = new_stage;
-#ifdef DEBUG
 	Log_Setup_Stage_Change();
-#endif
 }
 
 void Log_Uart_Response() {
-#ifdef DEBUG
+#if LOG_ESP_RESPONSES
     CDC_Transmit_FS((uint8_t *)"===ESP_RESPONSE===\r\n", 20);
-    HAL_Delay(10);
     CDC_Transmit_FS((uint8_t *)rx_buffer, strlen((char *)rx_buffer));
-    HAL_Delay(10);
     CDC_Transmit_FS((uint8_t *)"===ESP_RESPONSE_END===\r\n", 24);
-    HAL_Delay(10);
 #endif
 }
 
@@ -673,15 +1850,12 @@ void Handle_Response() {
     	else //if (response_status == ERROR) {
     		CDC_Transmit_FS((uint8_t *)"=ESP_RESPONSE: ERROR...\r\n", 25);*/
 	} else {
-		CDC_Transmit_FS((uint8_t *)"=ESP_RESPONSE: TIMEOUT...\r\n", 27);
-
+		LOG0(LOG_ESP_RESPONSE_TIMEOUT);
 	}
-	HAL_Delay(10);
-
 #endif
 
     if (response_status != SUCCESS) {
-        Clear_RX_Buffer();
+        Clear_RX_Text();
         Change_Response_Status(IDLE);
         return;
     }
@@ -694,6 +1868,9 @@ void Handle_Response() {
             Set_Setup_Stage(AT_SET_MAX_CONNECTIONS);
             break;
         case AT_SET_MAX_CONNECTIONS:
+            Set_Setup_Stage(AT_SET_SERVER_LIMIT);
+            break;
+        case AT_SET_SERVER_LIMIT:
             Set_Setup_Stage(AT_START_SERVER);
             break;
         case AT_START_SERVER:
@@ -715,12 +1892,11 @@ void Handle_Response() {
             break;*/
 
         default:
-            CDC_Transmit_FS((uint8_t *)"RESPONSE_NOT_IMPLEMENTED: Unknown Setup Stage\r\n", 47);
-            HAL_Delay(10);
+            LOG1(LOG_RESPONSE_NOT_IMPLEMENTED, setup_stage);
             break;
     }
 
-    Clear_RX_Buffer(); // Then clear it after we’re done
+    Clear_RX_Text(); // Then clear it after we’re done
     Change_Response_Status(IDLE);
 }
 
@@ -728,87 +1904,171 @@ void Log_Client_Status_Change() {
 	if (was_client_connected == is_client_connected)
 		return;
 	was_client_connected = is_client_connected;
-#ifdef DEBUG
-
 	if (is_client_connected) {
-		CDC_Transmit_FS((uint8_t *)"HTTP: Client Connected\r\n", 24);
+		LOG0(LOG_CLIENT_CONNECTED);
 	} else {
-		CDC_Transmit_FS((uint8_t *)"HTTP: Client Disconnected\r\n", 27);
+		LOG0(LOG_CLIENT_DISCONNECTED);
 	}
-        HAL_Delay(10);
-#endif
 }
 
 void Log_Client_Request_Change() {
 	if (was_client_requesting_page == is_client_requesting_page)
 		return;
 	was_client_requesting_page = is_client_requesting_page;
-#ifdef DEBUG
-
 	if (is_client_requesting_page) {
-		CDC_Transmit_FS((uint8_t *)"HTTP: Client Started Requesting Page\r\n", 38);
+		LOG0(LOG_CLIENT_REQUEST_STARTED);
 	} else {
-		CDC_Transmit_FS((uint8_t *)"HTTP: Client Stopped Requesting Page\r\n", 38);
+		LOG0(LOG_CLIENT_REQUEST_STOPPED);
 	}
-        HAL_Delay(10);
-#endif
 }
 
+/* Applies the events the AT tokenizer produced since the last call. A reply
+   block is complete with its final OK/ERROR or with the last byte of a +IPD;
+   events the send engine takes never complete one. */
 void Check_Reception_Completion() {
-    if (strstr((char *)rx_buffer, "\r\n\r\n")) {
-        // Timeout expired since the last received byte
-        receiving_data = 0; // Mark that reception is complete
-
-        #ifdef DEBUG
-        CDC_Transmit_FS((uint8_t *)"===Data Reception Complete===\r\n", 31);
-        HAL_Delay(10);
-
-        char debug_info[50]; // Print buffer length and content
-        snprintf(debug_info, sizeof(debug_info), "Buffer length: %d\r\n", strlen((char *)rx_buffer));
-        CDC_Transmit_FS((uint8_t *)debug_info, strlen(debug_info));
-        HAL_Delay(10);
-
-        if (strlen((char *)rx_buffer) > 0) {
-            Log_Uart_Response(); // Print the actual buffer content
-            HAL_Delay(10);
-        } else {
-            CDC_Transmit_FS((uint8_t *)"<Empty Buffer>\r\n", 16);
-            HAL_Delay(10);
+    At_Event_TypeDef event;
+    uint8_t block_complete = 0;
+    uint8_t transport_reply = 0;
+
+    while (At_Parser_Next(&event)) {
+        if (Esp_Transport_On_Event(&event, HAL_GetTick())) {
+            // the send engine's own replies do not end a block: a page request
+            // may be half received behind them
+            transport_reply = 1;
+            continue;
+        }
+        switch (event.type) {
+            case AT_EVENT_STA_CONNECTED:
+                is_client_connected = 1;
+                break;
+            case AT_EVENT_STA_DISCONNECTED:
+                is_client_connected = 0;
+                break;
+            case AT_EVENT_CONNECT:
+                if (event.link == 0) {
+                    is_client_requesting_page = 1;
+                }
+                break;
+            case AT_EVENT_CLOSED:
+                if (event.link == 0) {
+                    is_client_requesting_page = 0;
+                }
+                break;
+            case AT_EVENT_OK:
+                Change_Response_Status(SUCCESS);
+                block_complete = 1;
+                break;
+            case AT_EVENT_ERROR:
+                Change_Response_Status(ERROR);
+                block_complete = 1;
+                break;
+            case AT_EVENT_IPD_END:
+                block_complete = 1;
+                break;
+            default:
+                break;
         }
+    }
+
+    if (block_complete) {
+        receiving_data = 0; // Mark that reception is complete
 
+        LOG1(LOG_RECEPTION_COMPLETE, strlen((char *)rx_buffer));
+        #if LOG_ESP_RESPONSES
+        Log_Uart_Response(); // Print the actual buffer content
         #endif
 
         if (strstr((char *)rx_buffer, "GET /?ssid=")) {
             Handle_Client_Request();
         }
 
-        if (strstr((char *)rx_buffer, "+STA_CONNECTED")) {
-        	is_client_connected = 1;
-        } else if (strstr((char *)rx_buffer, "+STA_DISCONNECTED")) {
-        	is_client_connected = 0;
-        }
+        // Clear the buffer for the next reception
+        Clear_RX_Text();
+    } else if (transport_reply) {
+        Clear_RX_Replies();
+    }
+}
 
-        if (strstr((char *)rx_buffer, "0,CONNECT")) {
-        	is_client_requesting_page = 1;
-        } else if (strstr((char *)rx_buffer, "0,CLOSED")) {
-            is_client_requesting_page = 0;
-        }
+/* Drops the send engine's reply text before it fills rx_buffer, unless a
+   +IPD is being collected: its end completes a block and is handled then.
+   Any '+' counts, it may be the start of a "+IPD," still arriving. */
+void Clear_RX_Replies(void) {
+#if USE_UART_DMA
+    __disable_irq();
+    if (strchr((char *)rx_buffer, '+') == NULL) {
+        rx_index = 0;
+        rx_buffer[0] = '\0';
+    }
+    __enable_irq();
+#else
+    if (strchr((char *)rx_buffer, '+') == NULL) {
+        Clear_RX_Text();
+    }
+#endif
+}
 
-        if (strstr((char *)rx_buffer, "OK")){
-            Change_Response_Status(SUCCESS);
-        } else if (strstr((char *)rx_buffer, "ERROR")){
-        	Change_Response_Status(ERROR);
-        }
+#if USE_UART_DMA
+/* (Re)starts the circular reception, also after errors that stop the DMA */
+void Uart_Rx_Start(void) {
+    uart_dma_position = 0;
+    if (HAL_UARTEx_ReceiveToIdle_DMA(&huart2, uart_dma_buffer, UART_DMA_BUFFER_SIZE) != HAL_OK) {
+        uart_rx_errors++;
+    }
+}
 
-        // Clear the buffer for the next reception
-        Clear_RX_Buffer();
+/* Appends received bytes to rx_buffer for the response parser and keeps it
+   NUL terminated. A full buffer drops the excess instead of wrapping over the
+   response being collected. */
+void Uart_Rx_Chunk(const uint8_t *data, uint16_t length) {
+    uint16_t room = (RX_BUFFER_SIZE - 1) - rx_index;
+
+    At_Parser_Feed(data, length);
+
+    if (length > room) {
+        uart_rx_overflows += length - room;
+        length = room;
     }
+    memcpy((uint8_t *)&rx_buffer[rx_index], data, length);
+    rx_index += length;
+    rx_buffer[rx_index] = '\0';
 }
 
+/* Half transfer, transfer complete and idle line all land here; Size is where
+   the DMA currently writes, so everything since the last event is handed on,
+   in two pieces when the DMA wrapped in between. */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size) {
+    if (huart->Instance != USART2) {
+        return;
+    }
+    if (Size != uart_dma_position) {
+        if (Size > uart_dma_position) {
+            Uart_Rx_Chunk(&uart_dma_buffer[uart_dma_position], Size - uart_dma_position);
+        } else {
+            Uart_Rx_Chunk(&uart_dma_buffer[uart_dma_position], UART_DMA_BUFFER_SIZE - uart_dma_position);
+            Uart_Rx_Chunk(&uart_dma_buffer[0], Size);
+        }
+        uart_dma_position = (Size == UART_DMA_BUFFER_SIZE) ? 0 : Size;
+    }
+#ifdef DEBUG
+    HAL_GPIO_TogglePin(GPIOE, LED_PIN_UART);
+#endif
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance == USART2) {
+        uart_rx_errors++;
+        if (huart->RxState == HAL_UART_STATE_READY) { // overrun and DMA errors abort the reception
+            Uart_Rx_Start();
+        }
+    }
+}
+#else
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
     if (huart->Instance == USART2) // Check if it's USART2
     {
+        At_Parser_Feed((uint8_t *)&rx_buffer[rx_index], 1);
+
         // Store next byte at next position
         if (rx_index < RX_BUFFER_SIZE - 2) { // Leave room for next byte and null terminator
             rx_index++;
@@ -830,6 +2090,7 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 #endif
     }
 }
+#endif
 
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
     if (GPIO_Pin == GPIO_PIN_0) { // Button press
@@ -851,7 +2112,15 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
 
     #if ENABLE_MAGNETOMETER
     if (GPIO_Pin == GPIO_PIN_2) {
+        sensor_stats[SENSOR_MAG].edges++;
+#if USE_I2C_DMA
+        I2C_Request_Read(SENSOR_MAG);
+#else
+        if (data_ready_mag) {
+            sensor_stats[SENSOR_MAG].coalesced++;
+        }
         data_ready_mag = 1;
+#endif
 #ifdef DEBUG
         HAL_GPIO_TogglePin(GPIOE, LED_PIN_MAGNET);
 #endif
@@ -859,7 +2128,15 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
     #endif
     #if ENABLE_ACCELEROMETER
     if (GPIO_Pin == GPIO_PIN_4) { // INT1 for accelerometer
+        sensor_stats[SENSOR_ACC].edges++;
+#if USE_I2C_DMA
+        I2C_Request_Read(SENSOR_ACC);
+#else
+        if (data_ready_acc) {
+            sensor_stats[SENSOR_ACC].coalesced++;
+        }
         data_ready_acc = 1;
+#endif
 #ifdef DEBUG
         HAL_GPIO_TogglePin(GPIOE, LED_PIN_ACCEL);
 #endif
@@ -867,7 +2144,15 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
     #endif
     #if ENABLE_GYROSCOPE
     if (GPIO_Pin == GPIO_PIN_1) { // INT2 for gyroscope
+        sensor_stats[SENSOR_GYR].edges++;
+#if USE_SPI_DMA
+        Gyro_Request_Read();
+#else
+        if (data_ready_gyr) {
+            sensor_stats[SENSOR_GYR].coalesced++;
+        }
         data_ready_gyr = 1;
+#endif
 #ifdef DEBUG
         HAL_GPIO_TogglePin(GPIOE, LED_PIN_GYRO);
 #endif
@@ -876,172 +2161,663 @@ void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
 }
 
 
-void Establish_Connection(const char *server_ip, uint16_t port) {
-    char cmd[128];
+/* Wraps the body into an HTTP POST and queues it for the send engine;
+   returns 1 when it was queued, the outcome is counted in esp_transport_stats */
+uint8_t Send_Request(const char *path, const char *content_type, const uint8_t *body, uint16_t body_length) {
+    char header[HTTP_HEADER_RESERVE];
 
-    // Zapri obstoječo povezavo, če obstaja
-    Send_Command("AT+CIPCLOSE=0\r\n");
-    HAL_Delay(100); // Kratek zamik za zaprtje povezave
-    Clear_RX_Buffer();
+    // Format HTTP POST request
+    int length = snprintf(header, sizeof(header),
+             "POST %s HTTP/1.1\r\n"
+             "Host: %s\r\n"
+             "Content-Type: %s\r\n"
+             "Content-Length: %u\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             path, device_config.server_ip, content_type, body_length);
+
+    if (length < 0 || length >= (int)sizeof(header)) {
+        LOG1(LOG_DATA_TOO_LARGE, length);
+        return 0;
+    }
+    return Esp_Transport_Enqueue_Parts((uint8_t *)header, length, body, body_length);
+}
 
-    // Pošlji ukaz za vzpostavitev TCP povezave
-    snprintf(cmd, sizeof(cmd), "AT+CIPSTART=0,\"TCP\",\"%s\",%d\r\n", server_ip, port);
-    Send_Command(cmd);
+uint8_t Send_Data_To_Server(const char *json_data) {
+    return Send_Request("/data", "application/json", (const uint8_t *)json_data, strlen(json_data));
+}
 
-    // Preverjaj odziv za omejen čas
-    uint32_t start_time = HAL_GetTick();
-    while ((HAL_GetTick() - start_time) < 5000) { // 5 sekund timeout
-        if (strstr((char *)rx_buffer, "CONNECT")) {
-            CDC_Transmit_FS((uint8_t *)"TCP connection established\n", 26);
-            Change_Response_Status(SUCCESS);
-            Clear_RX_Buffer();
-            return;
-        } else if (strstr((char *)rx_buffer, "ERROR") || strstr((char *)rx_buffer, "CLOSED")) {
-            CDC_Transmit_FS((uint8_t *)"TCP connection failed\n", 23);
-            Change_Response_Status(ERROR);
-            Clear_RX_Buffer();
-            return;
+/* Keeps samples as v2 frames while the uplink cannot take them; the frame
+   sequence lets the server put them in place after the outage */
+uint8_t Spool_Samples(uint8_t sensor, const Sample_TypeDef *samples, uint16_t count) {
+    uint8_t frame[FRAME_V2_MAX_SIZE];
+    uint8_t accepted = 1;
+
+    if (count && Spool_Empty()) {
+        LOG0(LOG_SPOOL_STARTED);
+    }
+    for (uint16_t n = 0; n < count; n += FRAME_V2_MAX_SAMPLES) {
+        uint16_t left = count - n;
+        uint8_t frame_count = left < FRAME_V2_MAX_SAMPLES ? left : FRAME_V2_MAX_SAMPLES;
+        uint16_t len = Pack_Frame(frame, sensor, frame_sequence[sensor], &samples[n], frame_count);
+        uint8_t stored = Spool_Write(frame, len);
+
+        frame_sequence[sensor] += frame_count;
+        for (uint8_t i = 0; i < frame_count; i++) {
+            Count_Sample(sensor, stored);
         }
+        accepted &= stored;
     }
-
-    // Če ni odgovora v določenem času
-    CDC_Transmit_FS((uint8_t *)"Connection attempt timed out\n", 29);
-    Change_Response_Status(TIMEOUT);
-    Clear_RX_Buffer();
+    return accepted;
 }
 
-void Send_Data_To_Server(const char *json_data) {
-    static uint32_t last_send_time = 0;
-    const uint32_t MIN_INTERVAL = 500; // Minimum 500ms between sends
+/* Uploads the spool in bodies as large as a request takes while the link is
+   up, one at a time so that a failed upload is resent before anything newer,
+   and logs the fill level during the outage and the drain time after it */
+void Spool_Poll(void) {
+    static uint32_t last_report_time = 0;
     uint32_t current_time = HAL_GetTick();
 
-    // Check if enough time has passed since last send
-    if (current_time - last_send_time < MIN_INTERVAL) {
+    if (Spool_Empty()) {
+        if (spool_drain_bytes) {
+            LOG2(LOG_SPOOL_DRAINED, spool_drain_bytes, current_time - spool_drain_started);
+            spool_drain_bytes = 0;
+        }
         return;
     }
+    if (!connection_established) {
+        if (current_time - last_report_time >= SPOOL_REPORT_INTERVAL) {
+            LOG2(LOG_SPOOL_FILL, Spool_Ram_Bytes() + Spool_Flash_Bytes(), Spool_Flash_Bytes());
+            last_report_time = current_time;
+        }
+        return;
+    }
+    if (spool_post_pending) {
+        return;
+    }
+    uint16_t length = Spool_Peek(spool_post, sizeof(spool_post));
+    if (length == 0 || !Send_Request("/spool", "application/octet-stream", spool_post, length)) {
+        return;
+    }
+    spool_post_pending = 1;
+    spool_post_sequence = Esp_Transport_Last_Sequence();
+    spool_post_length = length;
+    if (spool_drain_bytes == 0) {
+        spool_drain_started = current_time;
+    }
+}
 
-    char request[512];
-    char cmd[128];
-    uint32_t start_time;
-
-    // Format HTTP POST request
-    snprintf(request, sizeof(request),
-             "POST /data HTTP/1.1\r\n"
-             "Host: 172.20.10.11\r\n"
-             "Content-Type: application/json\r\n"
-             "Content-Length: %d\r\n"
-             "Connection: keep-alive\r\n\r\n"
-             "%s",
-             strlen(json_data), json_data);
-
-    if (strlen(request) > 512) {
-        CDC_Transmit_FS((uint8_t *)"Data too large to send\n", 23);
+/* The transport is done with a payload. The spooled records of an upload are
+   dropped only once the module confirmed it; after a failure they stay at
+   the front of the spool and the next Spool_Poll() sends them again. */
+void Esp_Payload_Done(uint32_t sequence, uint8_t delivered) {
+    if (!spool_post_pending || sequence != spool_post_sequence) {
         return;
     }
+    spool_post_pending = 0;
+    if (delivered) {
+        Spool_Consume();
+        spool_drain_bytes += spool_post_length;
+    }
+}
 
-    // Add more debug output
-    CDC_Transmit_FS((uint8_t *)"Checking connection status...\n", 29);
+/* Appends one JSON object to the open batch. Returns 0 only when the batch is
+   full and the transport queue cannot take it yet, the sample is then lost. */
+uint8_t Batch_Add(const char *json, uint16_t length) {
+    if (batch_length + 1 + length + 1 > BATCH_MAX_BODY && !Batch_Flush()) {
+        return 0;
+    }
+    if (batch_length == 0) {
+        batch_body[batch_length++] = '[';
+        batch_started = HAL_GetTick();
+    } else {
+        batch_body[batch_length++] = ',';
+    }
+    memcpy(&batch_body[batch_length], json, length);
+    batch_length += length;
+    batch_samples++;
+    return 1;
+}
 
-    // Check connection status
-    Send_Command("AT+CIPSTATUS\r\n");
-    HAL_Delay(100);
+/* Closes the array and queues it as one POST; keeps the batch when the
+   transport queue is full */
+uint8_t Batch_Flush(void) {
+    if (batch_length == 0) {
+        return 1;
+    }
+    batch_body[batch_length] = ']';
+    batch_body[batch_length + 1] = '\0';
+    if (!Send_Data_To_Server(batch_body)) {
+        return 0;
+    }
+    batch_length = 0;
+    batch_samples = 0;
+    return 1;
+}
 
-    if (strstr((char *)rx_buffer, "STATUS:4") || strstr((char *)rx_buffer, "STATUS:5")) {
-        CDC_Transmit_FS((uint8_t *)"Connection lost, reconnecting...\n", 32);
-        Clear_RX_Buffer();
-        connection_established = 0;
-        return;
+void Batch_Poll(void) {
+    if (batch_length && HAL_GetTick() - batch_started >= BATCH_MAX_AGE) {
+        Batch_Flush();
     }
+}
 
-    Clear_RX_Buffer();
-    CDC_Transmit_FS((uint8_t *)"Sending CIPSEND command...\n", 27);
+/* Send engine port: requests and CIPSEND commands go out interrupt driven */
+uint8_t Esp_Uart_Write(const uint8_t *data, uint16_t length) {
+    return HAL_UART_Transmit_IT(&huart2, data, length) == HAL_OK;
+}
 
-    // Send CIPSEND command
-    snprintf(cmd, sizeof(cmd), "AT+CIPSEND=0,%d\r\n", strlen(request));
-    Send_Command(cmd);
-    HAL_Delay(200);  // Wait for ESP to process command
-
-    // Wait for '>' prompt with better debug output
-    start_time = HAL_GetTick();
-    uint8_t got_prompt = 0;
-    uint8_t retries = 0;
-    const uint8_t MAX_RETRIES = 3;
-
-	while (retries < MAX_RETRIES) {
-		while ((HAL_GetTick() - start_time) < 1000) {
-			if (strstr((char *)rx_buffer, ">")) {
-				got_prompt = 1;
-				CDC_Transmit_FS((uint8_t *)"Received '>' prompt\n", 20);
-				HAL_Delay(50);
-				break;
-			}
-			HAL_Delay(10);
-		}
-
-		if (got_prompt) break;
-
-		// Če nismo dobili prompta, poskusi ponovno
-		retries++;
-		if (retries < MAX_RETRIES) {
-			CDC_Transmit_FS((uint8_t *)"Retrying CIPSEND...\n", 20);
-			Clear_RX_Buffer();
-			Send_Command(cmd);
-			HAL_Delay(200);
-			start_time = HAL_GetTick();
-		}
-	}
+void Esp_Link_Up(void) {
+    LOG0(LOG_CONNECT_OK);
+    connection_established = 1; // Povezava vzpostavljena
+}
 
-	if (!got_prompt) {
-		CDC_Transmit_FS((uint8_t *)"Failed after max retries\n", 25);
-		Clear_RX_Buffer();
-		connection_established = 0; // Resetiraj povezavo
-		return;
-	}
+void Esp_Link_Lost(void) {
+    connection_established = 0;
+}
 
+/* Sends an AT command and waits for its final reply; returns 1 on OK.
+   Blocking, only used at startup. */
+uint8_t Esp_Command_Wait(const char *cmd, uint32_t timeout_ms) {
     Clear_RX_Buffer();
-    CDC_Transmit_FS((uint8_t *)"Sending data...\n", 16);
+    HAL_UART_Transmit(&huart2, (uint8_t *)cmd, strlen(cmd), HAL_MAX_DELAY);
 
-    // Send data
-    HAL_UART_Transmit(&huart2, (uint8_t *)request, strlen(request), HAL_MAX_DELAY);
+    uint32_t start = HAL_GetTick();
+    while ((HAL_GetTick() - start) < timeout_ms) {
+        if (At_Parser_Seen(AT_EVENT_OK)) {
+            return 1;
+        }
+        if (At_Parser_Seen(AT_EVENT_ERROR)) {
+            return 0;
+        }
+    }
+    return 0;
+}
 
-    // Wait for "SEND OK" with timeout
-    start_time = HAL_GetTick();
-    uint8_t send_ok = 0;
+/* Reprograms USART2 and restarts reception. Above PCLK1/16 the divider needs
+   8x oversampling (2 Mbaud = 24 MHz * 2 / 24). */
+void Esp_Uart_Set_Baud(uint32_t baud) {
+    HAL_UART_AbortReceive(&huart2);
+    huart2.Init.BaudRate = baud;
+    huart2.Init.OverSampling = (baud > HAL_RCC_GetPCLK1Freq() / 16) ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+    if (HAL_UART_Init(&huart2) != HAL_OK) {
+        Error_Handler();
+    }
+    esp_baud = baud;
+    At_Parser_Reset();  // whatever arrived during the switch is line noise
+#if USE_UART_DMA
+    Uart_Rx_Start();
+#endif
+    Clear_RX_Buffer();
+}
 
-    while ((HAL_GetTick() - start_time) < 2000) {
-        if (strstr((char *)rx_buffer, "SEND OK")) {
-            send_ok = 1;
-            CDC_Transmit_FS((uint8_t *)"Data sent successfully\n", 23);
-            last_send_time = HAL_GetTick(); // Update last send time
-            break;
+/* The link counts as stable when every ping is answered */
+uint8_t Esp_Ping(void) {
+    uint8_t answered = 0;
+    uint32_t round_trip = 0;
+
+    for (uint8_t i = 0; i < ESP_PING_COUNT; i++) {
+        uint32_t start = Get_Timestamp_Us();
+        if (Esp_Command_Wait("AT\r\n", ESP_PING_TIMEOUT)) {
+            round_trip += Get_Timestamp_Us() - start;
+            answered++;
         }
-        HAL_Delay(10);
     }
+    LOG2(LOG_BAUD_PING, esp_baud, answered);
+    if (answered) {
+        LOG1(LOG_BAUD_ROUND_TRIP, round_trip / answered);
+    }
+    Clear_RX_Buffer();
+    return answered == ESP_PING_COUNT;
+}
 
-    if (!send_ok) {
-        CDC_Transmit_FS((uint8_t *)"Send timeout - Response:\n", 25);
-        CDC_Transmit_FS(rx_buffer, strlen((char *)rx_buffer));
+#if ESP_BAUD_NEGOTIATE
+/* Talks the module back down to ESP_BAUD_DEFAULT from baud, where its replies
+   got lost. The command can be lost the same way, and the module then still
+   listens at baud, so USART2 goes back there to send it again. Returns 1 at
+   ESP_BAUD_DEFAULT; else the link stays at baud, the rate the module is at. */
+uint8_t Esp_Baud_Fall_Back(uint32_t baud) {
+    char cmd[40];
+
+    snprintf(cmd, sizeof(cmd), "AT+UART_CUR=%lu,8,1,0,0\r\n", (uint32_t)ESP_BAUD_DEFAULT);
+    for (uint8_t i = 0; i < ESP_BAUD_FALLBACK_TRIES; i++) {
+        if (esp_baud != baud) {
+            Esp_Uart_Set_Baud(baud);
+        }
+        HAL_UART_Transmit(&huart2, (uint8_t *)cmd, strlen(cmd), HAL_MAX_DELAY);
+        HAL_Delay(5);
+        Esp_Uart_Set_Baud(ESP_BAUD_DEFAULT);
+        if (Esp_Ping()) {
+            return 1;
+        }
     }
+    Esp_Uart_Set_Baud(baud);
+    return 0;
+}
+
+void Esp_Negotiate_Baud(void) {
+    static const uint32_t candidates[] = ESP_BAUD_CANDIDATES;
+    char cmd[40];
 
+    if (!Esp_Ping()) {
+        return; // no module or still booting, stay at the default rate
+    }
+    for (uint8_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        snprintf(cmd, sizeof(cmd), "AT+UART_CUR=%lu,8,1,0,0\r\n", candidates[i]);
+        if (!Esp_Command_Wait(cmd, ESP_PING_TIMEOUT * 2)) {
+            LOG1(LOG_BAUD_REJECTED, candidates[i]);
+            continue;
+        }
+        HAL_Delay(5); // the OK still went out at the old rate, the ESP switches after it
+        Esp_Uart_Set_Baud(candidates[i]);
+        if (Esp_Ping()) {
+            LOG1(LOG_BAUD_SET, esp_baud);
+            return;
+        }
+        LOG1(LOG_BAUD_UNSTABLE, candidates[i]);
+        if (!Esp_Baud_Fall_Back(candidates[i])) {
+            LOG1(LOG_BAUD_LOST, candidates[i]);
+            return;
+        }
+    }
+    LOG1(LOG_BAUD_SET, esp_baud);
+}
+#endif
+
+#if ESP_WARM_START
+/* Brings the ESP into the state the setup stages would leave it in, sending
+   only what is missing; returns 1 when the module answered. CWMODE is kept
+   in the ESP's flash, CIPMUX and the server are not, so CIPMUX:1 means the
+   module was not reset since we started the server. */
+uint8_t Esp_Warm_Start(void) {
+    uint8_t commands = 0;
+
+    if (!Esp_Command_Wait("AT+CWMODE?\r\n", ESP_QUERY_TIMEOUT)) {
+        LOG0(LOG_COLD_START);
+        return 0;
+    }
+    uint16_t wifi_mode = At_Parser_Value(AT_EVENT_CWMODE);
+    uint16_t mux = Esp_Command_Wait("AT+CIPMUX?\r\n", ESP_QUERY_TIMEOUT) ? At_Parser_Value(AT_EVENT_CIPMUX) : 0;
+    uint16_t status = Esp_Command_Wait("AT+CIPSTATUS\r\n", ESP_QUERY_TIMEOUT) ? At_Parser_Value(AT_EVENT_STATUS) : 5;
+    char cmd[256];
+
+    if (wifi_mode != 3) {
+        LOG0(LOG_SEND_CONNECT_MODE);
+        commands++;
+        if (!Esp_Command_Wait("AT+CWMODE=3\r\n", ESP_QUERY_TIMEOUT)) {
+            return 0;
+        }
+    }
+    if (mux != 1) {
+        LOG0(LOG_SEND_MAX_CONNECTIONS);
+        LOG0(LOG_SEND_SERVER_LIMIT);
+        LOG0(LOG_SEND_START_SERVER);
+        commands += 3;
+        if (!Esp_Command_Wait("AT+CIPMUX=1\r\n", ESP_QUERY_TIMEOUT) ||
+            !Esp_Command_Wait(ESP_SERVER_LIMIT_COMMAND, ESP_QUERY_TIMEOUT) ||
+            !Esp_Command_Wait("AT+CIPSERVER=1,80\r\n", ESP_QUERY_TIMEOUT)) {
+            return 0;
+        }
+    }
+    if (status == 5 && device_config.ssid[0]) { // no access point, but one was provisioned before
+        Format_Join_Command(cmd, sizeof(cmd), device_config.ssid, device_config.password);
+        commands++;
+        if (Esp_Command_Wait(cmd, ESP_JOIN_TIMEOUT)) {
+            status = 2;
+        }
+        LOG1(LOG_STORED_WIFI_JOIN, status);
+    }
     Clear_RX_Buffer();
+    Set_Setup_Stage(AT_SEND_HTML_HEADER); // the button now serves the page, as after AT_START_SERVER
+    LOG2(LOG_WARM_START, HAL_GetTick(), commands);
+
+    if (status >= 2 && status <= 4) { // the station has an IP
+        Set_Transmission_Mode(device_config.profile.boot_mode);
+    }
+    return 1;
+}
+#endif
+
+/* Flash port of the config store and the spool; the CPU stalls on flash
+   reads while a page is erased or programmed, DMA transfers keep running */
+uint8_t Flash_Erase_Page(uintptr_t address) {
+    FLASH_EraseInitTypeDef erase = { FLASH_TYPEERASE_PAGES, (uint32_t)address, 1 };
+    uint32_t page_error = 0;
+
+    HAL_FLASH_Unlock();
+    HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &page_error);
+    HAL_FLASH_Lock();
+    return status == HAL_OK;
+}
+
+uint8_t Flash_Program_Halfword(uintptr_t address, uint16_t value) {
+    HAL_FLASH_Unlock();
+    HAL_StatusTypeDef status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, (uint32_t)address, value);
+    HAL_FLASH_Lock();
+    return status == HAL_OK;
+}
+
+const Config_Store_Port_TypeDef config_store_port = { Flash_Erase_Page, Flash_Program_Halfword };
+const Spool_Port_TypeDef spool_port = { Flash_Erase_Page, Flash_Program_Halfword };
+
+/* Copies a stored string setting into a zero terminated buffer */
+static uint8_t Load_String(uint8_t key, char *text, uint8_t size) {
+    uint8_t length = Config_Get(key, text, size - 1);
+    if (length == 0 || length >= size) {
+        return 0;
+    }
+    text[length] = '\0';
+    return 1;
+}
+
+/* Fills device_config from the flash store, defaults where nothing is stored */
+void Load_Device_Config(void) {
+    uint32_t start = Get_Timestamp_Us();
+    uint8_t loaded = 0;
+
+    Config_Store_Init(&config_store_port, (uintptr_t)&_config_start);
+    memset(&device_config, 0, sizeof(device_config));
+    strcpy(device_config.server_ip, SERVER_IP);
+    device_config.server_port = SERVER_PORT;
+    device_config.profile.sensor_mask = (1 << SENSOR_COUNT) - 1;
+    device_config.profile.boot_mode = WARM_START_MODE;
+
+    loaded += Load_String(CONFIG_KEY_SSID, device_config.ssid, sizeof(device_config.ssid));
+    loaded += Load_String(CONFIG_KEY_PASSWORD, device_config.password, sizeof(device_config.password));
+    loaded += Load_String(CONFIG_KEY_SERVER_IP, device_config.server_ip, sizeof(device_config.server_ip));
+    if (Config_Get(CONFIG_KEY_SERVER_PORT, &device_config.server_port, sizeof(device_config.server_port)) ==
+        sizeof(device_config.server_port)) {
+        loaded++;
+    }
+    Sensor_Profile_TypeDef profile;
+    if (Config_Get(CONFIG_KEY_SENSOR_PROFILE, &profile, sizeof(profile)) == sizeof(profile) &&
+        profile.boot_mode < MODE_COUNT) {
+        device_config.profile = profile;
+        loaded++;
+    }
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        if (Config_Get(CONFIG_KEY_CALIBRATION_MAG + i, &calibrations[i], sizeof(calibrations[i])) ==
+                sizeof(calibrations[i]) && Calibration_Valid(&calibrations[i])) {
+            loaded++;
+        } else {
+            Calibration_Identity(&calibrations[i]);
+        }
+    }
+    memset(decimation, 1, sizeof(decimation));
+    uint8_t factors[SENSOR_COUNT];
+    if (Config_Get(CONFIG_KEY_DECIMATION, factors, sizeof(factors)) == sizeof(factors)) {
+        memcpy(decimation, factors, sizeof(decimation));
+        loaded++;
+    }
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        Decimator_Init(&decimators[i], decimation[i]);
+        decimation[i] = decimators[i].factor;  // clamped
+    }
+    uint16_t window;
+    if (Config_Get(CONFIG_KEY_SUMMARY_WINDOW, &window, sizeof(window)) == sizeof(window) &&
+        (window == 0 || (window >= SUMMARY_WINDOW_MIN && window <= SUMMARY_WINDOW_MAX))) {
+        summary_window_ms = window;
+        loaded++;
+    }
+    LOG2(LOG_CONFIG_LOADED, loaded, Get_Timestamp_Us() - start);
+}
+
+uint8_t Save_Setting(uint8_t key, const void *value, uint8_t length) {
+    if (!Config_Set(key, value, length)) {
+        LOG1(LOG_CONFIG_SAVE_FAILED, key);
+        return 0;
+    }
+    LOG1(LOG_CONFIG_SAVED, Config_Free());
+    return 1;
+}
+
+/* Collects CDC bytes into lines and runs each complete one */
+void Poll_Usb_Commands(void) {
+    uint8_t byte;
+
+    while (CDC_Read_FS(&byte, 1)) {
+        if (byte == '\r' || byte == '\n') {
+            if (usb_command_length) {
+                usb_command[usb_command_length] = '\0';
+                Handle_Usb_Command(usb_command);
+            }
+            usb_command_length = 0;
+        } else if (usb_command_length < USB_COMMAND_SIZE - 1) {
+            usb_command[usb_command_length++] = byte;
+        }
+    }
+}
+
+void Handle_Usb_Command(char *line) {
+    if (strncmp(line, "CAL ", 4) == 0) {
+        Set_Calibration(line + 4);
+    } else if (strncmp(line, "DEC ", 4) == 0) {
+        Set_Decimation(line + 4);
+    } else if (strncmp(line, "SUM ", 4) == 0) {
+        Set_Summary_Window(line + 4);
+    } else {
+        LOG1(LOG_USB_COMMAND_UNKNOWN, strlen(line));
+    }
+}
+
+/* Reads a sensor label and steps past it; returns SENSOR_COUNT for none */
+uint8_t Parse_Sensor(char **arguments) {
+    static const char *labels[SENSOR_COUNT] = { "MAG", "ACC", "GYR" };
+    uint8_t sensor = 0;
+
+    while (sensor < SENSOR_COUNT && strncmp(*arguments, labels[sensor], 3) != 0) {
+        sensor++;
+    }
+    if (sensor < SENSOR_COUNT) {
+        *arguments += 3;
+    }
+    return sensor;
+}
+
+/* Parses "<sensor> <offsets> [<matrix>]", applies it from the next drained
+   batch on and stores it; returns 0 when the line was rejected */
+uint8_t Set_Calibration(char *arguments) {
+    Calibration_TypeDef cal;
+    uint8_t sensor = Parse_Sensor(&arguments);
+    char *end;
+
+    if (sensor == SENSOR_COUNT) {
+        LOG1(LOG_CALIBRATION_REJECTED, SENSOR_COUNT);
+        return 0;
+    }
+    Calibration_Identity(&cal);
+    for (uint8_t i = 0; i < 3; i++) {
+        long offset = strtol(arguments, &end, 10);
+        if (end == arguments || offset < INT16_MIN || offset > INT16_MAX) {
+            LOG1(LOG_CALIBRATION_REJECTED, sensor);
+            return 0;
+        }
+        cal.offset[i] = (int16_t)offset;
+        arguments = end;
+    }
+    for (uint8_t i = 0; i < 9; i++) {
+        float entry = strtof(arguments, &end);
+        if (end == arguments && i == 0) {
+            break;  // offsets only
+        }
+        if (end == arguments || !(fabsf(entry) < 2.0f)) {
+            LOG1(LOG_CALIBRATION_REJECTED, sensor);
+            return 0;
+        }
+        cal.matrix[i / 3][i % 3] = (int16_t)lrintf(entry * CALIBRATION_ONE);
+        arguments = end;
+    }
+    if (!Calibration_Valid(&cal)) {
+        LOG1(LOG_CALIBRATION_REJECTED, sensor);
+        return 0;
+    }
+    calibrations[sensor] = cal;
+    LOG1(LOG_CALIBRATION_SET, sensor);
+    return Save_Setting(CONFIG_KEY_CALIBRATION_MAG + sensor, &cal, sizeof(cal));
+}
+
+/* Parses "<sensor> <factor>"; the filter restarts, settling on the next
+   sample, and the factors of all sensors are stored */
+uint8_t Set_Decimation(char *arguments) {
+    uint8_t sensor = Parse_Sensor(&arguments);
+    char *end;
+    long factor = strtol(arguments, &end, 10);
+
+    if (sensor == SENSOR_COUNT || end == arguments || factor < 1 || factor > DECIMATOR_MAX_FACTOR) {
+        LOG2(LOG_DECIMATION_REJECTED, sensor, factor);
+        return 0;
+    }
+    decimation[sensor] = (uint8_t)factor;
+    Decimator_Init(&decimators[sensor], decimation[sensor]);
+    LOG2(LOG_DECIMATION_SET, sensor, factor);
+    return Save_Setting(CONFIG_KEY_DECIMATION, decimation, sizeof(decimation));
 }
 
+/* Parses "<window ms>", 0 for samples again; open windows are dropped so
+   every record covers one whole window of the new length */
+uint8_t Set_Summary_Window(char *arguments) {
+    char *end;
+    long window = strtol(arguments, &end, 10);
+
+    if (end == arguments || (window != 0 && (window < SUMMARY_WINDOW_MIN || window > SUMMARY_WINDOW_MAX))) {
+        LOG1(LOG_SUMMARY_REJECTED, window);
+        return 0;
+    }
+    summary_window_ms = (uint16_t)window;
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        Summary_Reset(&summaries[i]);
+    }
+    LOG1(LOG_SUMMARY_SET, summary_window_ms);
+    return Save_Setting(CONFIG_KEY_SUMMARY_WINDOW, &summary_window_ms, sizeof(summary_window_ms));
+}
+
+/* Logs once how long it took from reset until the ESP link delivered the
+   first sample, the number warm start is meant to bring down */
+void Report_First_Delivery(void) {
+    static uint8_t reported = 0;
+
+    if (!reported && esp_transport_stats.payload_bytes) {
+        LOG1(LOG_FIRST_DELIVERY, HAL_GetTick());
+        reported = 1;
+    }
+}
+
+/* Payload bytes the ESP link actually delivered, requests and stream alike */
+void Report_Uplink_Goodput(void) {
+    static uint32_t last_report_time = 0;
+    static uint32_t last_bytes = 0;
+    uint32_t current_time = HAL_GetTick();
+
+    if (current_time - last_report_time < ESP_GOODPUT_INTERVAL) {
+        return;
+    }
+    uint32_t bytes = esp_transport_stats.payload_bytes - last_bytes;
+    if (bytes) {
+        LOG2(LOG_UPLINK_GOODPUT, bytes * 1000 / (current_time - last_report_time), esp_baud);
+    }
+    last_bytes = esp_transport_stats.payload_bytes;
+    last_report_time = current_time;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart->Instance == USART2) {
+        Esp_Transport_Write_Complete();
+    }
+}
+
+const Esp_Transport_Port_TypeDef esp_transport_port = { Esp_Uart_Write, Esp_Link_Up, Esp_Link_Lost, Esp_Payload_Done };
+
 void Test_HTTP_GET_Request() {
-    const char *get_request = "GET / HTTP/1.1\r\nHost: 172.20.10.11\r\n\r\n";
+    char get_request[64];
+    snprintf(get_request, sizeof(get_request), "GET / HTTP/1.1\r\nHost: %s\r\n\r\n", device_config.server_ip);
     Send_Data_To_Server(get_request);
 }
 
+/* Entering MODE_BINARY_TCP switches the ESP to transparent mode, leaving it
+   goes back to command mode; both run in the background */
+void Set_Transmission_Mode(uint8_t mode) {
+    if (transmission_mode == MODE_BINARY_TCP && mode != MODE_BINARY_TCP) {
+        Esp_Transport_Stream_Close();
+    } else if (mode == MODE_BINARY_TCP && transmission_mode != MODE_BINARY_TCP) {
+        Esp_Transport_Stream_Open(device_config.server_ip, STREAM_PORT);
+    }
+    /* The send engine keeps the server connection open while requests are the uplink */
+    if (USES_SERVER(mode) && !USES_SERVER(transmission_mode)) {
+        Esp_Transport_Connect(device_config.server_ip, device_config.server_port);
+    } else if (USES_SERVER(transmission_mode) && !USES_SERVER(mode)) {
+        Esp_Transport_Stop_Connecting();
+    }
+    /* Spectra need the accelerometer well above its streaming rate; a switch
+       the part did not take is retried from the superloop */
+    if (mode == MODE_SPECTRUM && transmission_mode != MODE_SPECTRUM) {
+        Spectrum_Init(&spectrum);
+        Set_Acc_Rate(SPECTRUM_ACC_CTRL1);
+    } else if (transmission_mode == MODE_SPECTRUM && mode != MODE_SPECTRUM) {
+        Set_Acc_Rate(ACC_CTRL1_VALUE);
+    }
+    /* The filter restarts from the identity orientation and settles within seconds */
+    if (mode == MODE_QUATERNION_CDC && transmission_mode != MODE_QUATERNION_CDC) {
+        Ahrs_Init(&ahrs, AHRS_BETA);
+        ahrs_seen = 0;
+    }
+    transmission_mode = mode;
+    Indicate_Transmission_Mode(mode);
+}
+
+/* Rewrites the accelerometer ODR while the FIFO keeps streaming. The DMA
+   reads are held off around the blocking writes; when a read is still
+   running after ACC_RATE_SWITCH_TIMEOUT or the part does not take the write,
+   the old rate stays, 0 is returned and the superloop tries again. The
+   samples of the old rate are dropped (FIFO emptied through bypass mode,
+   ring discarded), the period estimate, the decimator and the spectrum
+   start over at the new rate. */
+uint8_t Set_Acc_Rate(uint8_t ctrl1) {
+#if ENABLE_ACCELEROMETER
+    uint8_t bus_free = 1;
+
+    acc_ctrl1_wanted = ctrl1;
+    acc_rate_tick = HAL_GetTick();
+    if (ctrl1 == acc_ctrl1) {
+        return 1;
+    }
+#if USE_I2C_DMA
+    uint32_t start = HAL_GetTick();
+    i2c_async_enabled = 0;
+    while (i2c_stage != READ_STAGE_IDLE && HAL_GetTick() - start < ACC_RATE_SWITCH_TIMEOUT) {
+    }
+    bus_free = i2c_stage == READ_STAGE_IDLE;  // else the write would be refused as busy
+#endif
+    uint8_t written = bus_free && Pisi_Register(0x19, 0x20, ctrl1) == HAL_OK; // CTRL_REG1_A: ODR, enable XYZ
+    if (written) {
+        acc_ctrl1 = ctrl1;
+#if ACC_FIFO_MODE
+        Pisi_Register(0x19, 0x2E, 0x00); // FIFO_CTRL_REG_A: bypass, empties the FIFO
+        Pisi_Register(0x19, 0x2E, 0x80 | ACC_FIFO_WATERMARK); // FIFO_CTRL_REG_A: stream mode + watermark on INT1
+#endif
+        Sample_Ring_Discard(&sample_rings[SENSOR_ACC]); // no read runs, so the producer is idle
+        sample_period_us[SENSOR_ACC] = 0;
+        sample_last_fifo_time[SENSOR_ACC] = 0;
+        Decimator_Init(&decimators[SENSOR_ACC], decimation[SENSOR_ACC]);
+        Spectrum_Init(&spectrum);
+    } else {
+        LOG2(LOG_ACC_RATE_FAILED, ctrl1, acc_ctrl1);
+    }
+#if USE_I2C_DMA
+    i2c_async_enabled = 1;
+#if ACC_FIFO_MODE
+    I2C_Request_Read(SENSOR_ACC); // the watermark edge may have come while reads were held
+#endif
+#endif
+    return written;
+#else
+    (void)ctrl1;
+    return 1;
+#endif
+}
+
 void Indicate_Transmission_Mode(uint8_t mode) {
     #ifdef DEBUG
-    const char *modes[] = {
-        "None", "Binary UART", "ASCII UART",
-        "Binary CDC", "ASCII CDC"
-    };
-    char debug_msg[50];
     HAL_GPIO_TogglePin(GPIOE, LED_PIN_SEND_MODE); // Signal prek LED
-    snprintf(debug_msg, sizeof(debug_msg), "Mode changed to: %s\n", modes[mode]);
-    CDC_Transmit_FS((uint8_t *)debug_msg, strlen(debug_msg));
     #endif
+    LOG1(LOG_MODE_CHANGED, mode);
 }
 
 /* USER CODE END 0 */
@@ -1071,12 +2847,40 @@ int main(void)
   MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
   //HAL_Delay(2000);
+  Cycle_Counter_Init();
+  for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+      Sample_Ring_Init(&sample_rings[i]);
+  }
   Init_All_Sensors();
   Verify_Sensors(); // Verify all sensor communication
   Clear_Interrupts(); // Clear interrupt flags
+#if USE_I2C_DMA
+  i2c_async_enabled = 1;
+#if ACC_FIFO_MODE
+  I2C_Request_Read(SENSOR_ACC); // the watermark line may already be high
+#endif
+#endif
+#if USE_SPI_DMA
+  spi_async_enabled = 1;
+  Gyro_Request_Read(); // INT2 may already be high from before the reset
+#endif
   Log_Response_Status_Change();
+  Load_Device_Config();
+  Spool_Init(&spool_port, (uintptr_t)&_spool_start);
+  Esp_Transport_Init(&esp_transport_port);
+#if USE_UART_DMA
+  Clear_RX_Buffer();
+  Uart_Rx_Start();
+#else
     rx_index = 0;
   HAL_UART_Receive_IT(&huart2, &rx_buffer[0], 1);
+#endif
+#if ESP_BAUD_NEGOTIATE
+  Esp_Negotiate_Baud();
+#endif
+#if ESP_WARM_START
+  Esp_Warm_Start();
+#endif
   /* USER CODE END 2 */
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
@@ -1085,6 +2889,9 @@ int main(void)
         Log_Client_Request_Change();
 
     Check_Reception_Completion();
+    Batch_Poll();
+    Spool_Poll();
+    Esp_Transport_Poll(HAL_GetTick());
 
       if (Has_Response_Finished() == 1) {
           Handle_Response();
@@ -1094,56 +2901,58 @@ int main(void)
           Change_Response_Status(TIMEOUT);
       }
 
-      if (response_status == SEND_REQUEST) {
+      if (response_status == SEND_REQUEST && !Esp_Transport_Busy()) {
           Configure_ESP_As_Access_Point();
       }
 
+#if ENABLE_ACCELEROMETER
+      /* A rate switch the accelerometer did not take is tried again */
+      if (acc_ctrl1 != acc_ctrl1_wanted && HAL_GetTick() - acc_rate_tick >= ACC_RATE_RETRY_DELAY) {
+          Set_Acc_Rate(acc_ctrl1_wanted);
+      }
+#endif
+
       if (button_action_pending) { // Handle button actions
           if (button_action_type == 0) { // Short press - send AT command
               Change_Response_Status(SEND_REQUEST);
           } else { // Long press - change transmission mode
-              transmission_mode = (transmission_mode + 1) % 5;
-              Indicate_Transmission_Mode(transmission_mode);
+              Set_Transmission_Mode((transmission_mode + 1) % MODE_COUNT);
           }
           button_action_pending = 0;
       }
 
-      if (!connection_established && transmission_mode == MODE_ASCII_UART)
-	  {
-		  CDC_Transmit_FS((uint8_t *)"Attempting to connect...\n", 25);
-		  Establish_Connection("172.20.10.11", 5000);
-
-		  /* Preveri status povezave */
-		  if (response_status == SUCCESS)
-		  {
-			  CDC_Transmit_FS((uint8_t *)"Connection successful!\n", 24);
-			  connection_established = 1; // Povezava vzpostavljena
-		  }
-		  else if (response_status == TIMEOUT || response_status == ERROR)
-		  {
-			  CDC_Transmit_FS((uint8_t *)"Connection failed, retrying...\n", 31);
-			  HAL_Delay(1000); // Počakaj pred ponovnim poskusom
-		  }
-	  }
+#if USE_I2C_DMA
+	  I2C_Start_Next_Read();
+#endif
+#if USE_SPI_DMA
+	  Gyro_Start_Read();
+#endif
 
-	  /* Tukaj obdeluj podatke le, če je povezava vzpostavljena */
-	  if (connection_established)
+	  /* Tukaj obdeluj podatke le, če je povezava vzpostavljena; brez nje gre ASCII UART v spool,
+	     spekter in kvaternioni gredo le po USB */
+	  if (connection_established || Esp_Transport_Streaming() || transmission_mode == MODE_ASCII_UART ||
+	      transmission_mode == MODE_SPECTRUM || transmission_mode == MODE_QUATERNION_CDC)
 	  {
 		  //Test_HTTP_GET_Request();
 
 		  #if ENABLE_MAGNETOMETER
-		  if (data_ready_mag)
-			  Handle_Magnetometer();
+		  if (device_config.profile.sensor_mask & (1 << SENSOR_MAG)) Handle_Magnetometer();
 		  #endif
 		  #if ENABLE_ACCELEROMETER
-		  if (data_ready_acc)
-			  Handle_Accelerometer();
+		  if (device_config.profile.sensor_mask & (1 << SENSOR_ACC)) Handle_Accelerometer();
 		  #endif
 		  #if ENABLE_GYROSCOPE
-		  if (data_ready_gyr)
-			  Handle_Gyroscope();
+		  if (device_config.profile.sensor_mask & (1 << SENSOR_GYR)) Handle_Gyroscope();
 		  #endif
 	  }
+
+#ifdef DEBUG
+	  Report_Sample_Stats();
+#endif
+	  Report_Uplink_Goodput();
+	  Report_First_Delivery();
+	  Poll_Usb_Commands();
+	  Drain_Log();
   }
   /* USER CODE END 3 */
 }
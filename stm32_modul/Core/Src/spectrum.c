@@ -0,0 +1,201 @@
+/**
+  ******************************************************************************
+  * @file           : spectrum.c
+  * @brief          : Block spectra, see spectrum.h.
+  *                   The real FFT of N samples runs as an N/2 point complex
+  *                   radix-2 FFT on the even/odd pairs, followed by a split
+  *                   step; the result is packed like CMSIS-DSP
+  *                   arm_rfft_fast_f32: X[0] and X[N/2] (both real) first,
+  *                   then X[1] .. X[N/2 - 1] as re, im pairs. One table of
+  *                   N/2 twiddles serves both steps and the window.
+  ******************************************************************************
+  */
+
+#include "spectrum.h"
+#include <math.h>
+#include <string.h>
+
+#if (SPECTRUM_SIZE & (SPECTRUM_SIZE - 1)) != 0 || (SPECTRUM_SIZE / 2) % SPECTRUM_BANDS != 0
+#error "SPECTRUM_SIZE must be a power of two and a multiple of 2 * SPECTRUM_BANDS"
+#endif
+
+#define SPECTRUM_HALF (SPECTRUM_SIZE / 2)
+#define SPECTRUM_HANN_ENBW 1.5f     // noise bandwidth of the Hann window, in bins
+
+static float spectrum_cos[SPECTRUM_HALF];  // cos(2 pi k / N)
+static float spectrum_sin[SPECTRUM_HALF];  // sin(2 pi k / N)
+static float spectrum_work[SPECTRUM_SIZE];
+static uint8_t spectrum_tables = 0;
+
+static void Spectrum_Tables(void) {
+    for (uint16_t k = 0; k < SPECTRUM_HALF; k++) {
+        spectrum_cos[k] = cosf(2.0f * 3.14159265f * k / SPECTRUM_SIZE);
+        spectrum_sin[k] = sinf(2.0f * 3.14159265f * k / SPECTRUM_SIZE);
+    }
+    spectrum_tables = 1;
+}
+
+void Spectrum_Init(Spectrum_TypeDef *spectrum) {
+    if (!spectrum_tables) {
+        Spectrum_Tables();
+    }
+    memset(spectrum, 0, sizeof(*spectrum));
+}
+
+/* In-place complex FFT of SPECTRUM_HALF points stored as re, im pairs */
+static void Spectrum_Complex_Fft(float *z) {
+    const uint16_t m = SPECTRUM_HALF;
+
+    for (uint16_t i = 1, j = 0; i < m; i++) {
+        uint16_t bit = m >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            float re = z[2 * i], im = z[2 * i + 1];
+            z[2 * i] = z[2 * j];
+            z[2 * i + 1] = z[2 * j + 1];
+            z[2 * j] = re;
+            z[2 * j + 1] = im;
+        }
+    }
+    for (uint16_t size = 2; size <= m; size <<= 1) {
+        uint16_t half = size / 2;
+        uint16_t step = 2 * (m / size);  // twiddle stride in the N point table
+        for (uint16_t j = 0; j < half; j++) {
+            float c = spectrum_cos[j * step], s = spectrum_sin[j * step];
+            for (uint16_t i = j; i < m; i += size) {
+                float *a = &z[2 * i], *b = &z[2 * (i + half)];
+                float tr = c * b[0] + s * b[1];
+                float ti = c * b[1] - s * b[0];
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+/* In-place real FFT of SPECTRUM_SIZE samples, packed as described above */
+void Spectrum_Real_Fft(float *data) {
+    const uint16_t m = SPECTRUM_HALF;
+
+    if (!spectrum_tables) {
+        Spectrum_Tables();
+    }
+    Spectrum_Complex_Fft(data);
+
+    float re0 = data[0], im0 = data[1];
+    data[0] = re0 + im0;
+    data[1] = re0 - im0;
+    for (uint16_t k = 1; k <= m / 2; k++) {
+        float *a = &data[2 * k], *b = &data[2 * (m - k)];
+        float even_re = 0.5f * (a[0] + b[0]), even_im = 0.5f * (a[1] - b[1]);
+        float odd_re = 0.5f * (a[1] + b[1]), odd_im = -0.5f * (a[0] - b[0]);
+        float c = spectrum_cos[k], s = spectrum_sin[k];
+        float wr = c * odd_re + s * odd_im;
+        float wi = c * odd_im - s * odd_re;
+        a[0] = even_re + wr;
+        a[1] = even_im + wi;
+        b[0] = even_re - wr;   // X[N/2 - k] = conj(even - W odd)
+        b[1] = wi - even_im;
+    }
+}
+
+/* Mean removal, Hann window, FFT and power of one full block per axis */
+static void Spectrum_Block(Spectrum_TypeDef *spectrum) {
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        const int16_t *block = spectrum->block[axis];
+        float *x = spectrum_work;
+        float *power = spectrum->power[axis];
+        int32_t sum = 0;
+
+        for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+            sum += block[n];
+        }
+        float mean = (float)sum / SPECTRUM_SIZE;
+        for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+            float c = spectrum_cos[n < SPECTRUM_HALF ? n : SPECTRUM_SIZE - n];
+            x[n] = (block[n] - mean) * (0.5f - 0.5f * c);
+        }
+        Spectrum_Real_Fft(x);
+        power[0] += x[0] * x[0];
+        power[SPECTRUM_HALF] += x[1] * x[1];
+        for (uint16_t k = 1; k < SPECTRUM_HALF; k++) {
+            power[k] += x[2 * k] * x[2 * k] + x[2 * k + 1] * x[2 * k + 1];
+        }
+    }
+    spectrum->blocks++;
+}
+
+/* Adds one sample; returns 1 once SPECTRUM_AVERAGE blocks are in, then
+   Spectrum_Report() should be called before the next sample */
+uint8_t Spectrum_Add(Spectrum_TypeDef *spectrum, const int16_t data[3], uint32_t time) {
+    if (spectrum->fill == 0 && spectrum->blocks == 0) {
+        spectrum->time = time;
+    }
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        spectrum->block[axis][spectrum->fill] = data[axis];
+    }
+    if (++spectrum->fill < SPECTRUM_SIZE) {
+        return 0;
+    }
+    spectrum->fill = 0;
+    Spectrum_Block(spectrum);
+    return spectrum->blocks >= SPECTRUM_AVERAGE;
+}
+
+/* Reduces the averaged power to bands and peaks and starts a new average.
+   The DC bin is left out, the Nyquist bin belongs to the last band. */
+void Spectrum_Report(Spectrum_TypeDef *spectrum, float rate_hz, Spectrum_Report_TypeDef *report) {
+    const uint16_t band_bins = SPECTRUM_HALF / SPECTRUM_BANDS;
+    /* |X| of a sine of amplitude A under the Hann window is A * N / 4 */
+    const float scale = 4.0f / SPECTRUM_SIZE;
+    float blocks = spectrum->blocks ? spectrum->blocks : 1;
+
+    memset(report, 0, sizeof(*report));
+    report->time = spectrum->time;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        float *power = spectrum->power[axis];
+
+        for (uint16_t k = 0; k <= SPECTRUM_HALF; k++) {
+            power[k] /= blocks;
+        }
+        for (uint8_t band = 0; band < SPECTRUM_BANDS; band++) {
+            float sum = 0.0f;
+            for (uint16_t k = 1 + band * band_bins; k <= (band + 1) * band_bins; k++) {
+                sum += power[k];
+            }
+            report->bands[axis][band] = sqrtf(sum / SPECTRUM_HANN_ENBW) * scale;
+        }
+
+        Spectrum_Peak_TypeDef *peaks = report->peaks[axis];
+        for (uint16_t k = 1; k < SPECTRUM_HALF; k++) {
+            if (power[k] <= power[k - 1] || power[k] < power[k + 1]) {
+                continue;
+            }
+            /* The three bins hold the window's main lobe, their sum does not
+               depend on where the tone falls between bins */
+            float amplitude = sqrtf((power[k - 1] + power[k] + power[k + 1]) / SPECTRUM_HANN_ENBW) * scale;
+            uint8_t slot = SPECTRUM_PEAKS;
+            while (slot > 0 && peaks[slot - 1].amplitude < amplitude) {
+                if (slot < SPECTRUM_PEAKS) {
+                    peaks[slot] = peaks[slot - 1];
+                }
+                slot--;
+            }
+            if (slot == SPECTRUM_PEAKS) {
+                continue;
+            }
+            float a = sqrtf(power[k - 1]), b = sqrtf(power[k]), c = sqrtf(power[k + 1]);
+            float denominator = a - 2.0f * b + c;
+            float offset = denominator != 0.0f ? 0.5f * (a - c) / denominator : 0.0f;
+            peaks[slot].frequency = (k + offset) * rate_hz / SPECTRUM_SIZE;
+            peaks[slot].amplitude = amplitude;
+        }
+    }
+    memset(spectrum->power, 0, sizeof(spectrum->power));
+    spectrum->blocks = 0;
+}
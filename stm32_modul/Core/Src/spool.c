@@ -0,0 +1,204 @@
+/**
+  ******************************************************************************
+  * @file           : spool.c
+  * @brief          : RAM ring spilling into a flash page ring, see spool.h.
+  *                   Both rings hold records as a halfword length followed by
+  *                   the data padded to an even length, so every record moves
+  *                   to flash with halfword programs. Positions are free
+  *                   running byte counters. A flash page is erased when the
+  *                   write position enters it; one page always stays free so
+  *                   that page never holds unread records. Everything runs in
+  *                   the superloop.
+  ******************************************************************************
+  */
+
+#include "spool.h"
+#include <string.h>
+
+#if (SPOOL_RAM_SIZE & (SPOOL_RAM_SIZE - 1)) != 0
+#error "SPOOL_RAM_SIZE must be a power of two"
+#endif
+
+#define SPOOL_FLASH_SIZE ((uint32_t)SPOOL_FLASH_PAGE_SIZE * SPOOL_FLASH_PAGES)
+#define SPOOL_FLASH_USABLE (SPOOL_FLASH_SIZE - SPOOL_FLASH_PAGE_SIZE)
+
+Spool_Stats_TypeDef spool_stats;
+
+static const Spool_Port_TypeDef *spool_port;
+static uintptr_t spool_flash_base = 0;
+static uint8_t spool_flash_failed = 0;  // after a flash error only the RAM ring is used
+
+static uint8_t spool_ram[SPOOL_RAM_SIZE];
+static uint32_t spool_ram_head = 0;
+static uint32_t spool_ram_tail = 0;
+static uint32_t spool_flash_head = 0;
+static uint32_t spool_flash_tail = 0;
+
+static uint32_t spool_peek_records = 0; // records handed out by the last peek
+
+/* Bytes a record takes in either ring */
+static uint32_t Spool_Record_Size(uint16_t length) {
+    return 2 + ((length + 1u) & ~1u);
+}
+
+static void Spool_Ram_Read(uint32_t position, uint8_t *data, uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        data[i] = spool_ram[(position + i) & (SPOOL_RAM_SIZE - 1)];
+    }
+}
+
+static void Spool_Flash_Read(uint32_t position, uint8_t *data, uint32_t length) {
+    uint32_t offset = position % SPOOL_FLASH_SIZE;
+    uint32_t first = SPOOL_FLASH_SIZE - offset;
+
+    if (first > length) {
+        first = length;
+    }
+    memcpy(data, (const void *)(spool_flash_base + offset), first);
+    memcpy(data + first, (const void *)spool_flash_base, length - first);
+}
+
+static uint16_t Spool_Record_Length(uint8_t from_flash, uint32_t position) {
+    uint8_t prefix[2];
+    if (from_flash) {
+        Spool_Flash_Read(position, prefix, 2);
+    } else {
+        Spool_Ram_Read(position, prefix, 2);
+    }
+    return prefix[0] | (uint16_t)(prefix[1] << 8);
+}
+
+/* Moves the oldest RAM record to the flash ring; returns 0 when it does not
+   fit or the flash failed */
+static uint8_t Spool_Spill_One(void) {
+    uint32_t size = Spool_Record_Size(Spool_Record_Length(0, spool_ram_tail));
+
+    if (spool_flash_failed || spool_flash_head - spool_flash_tail + size > SPOOL_FLASH_USABLE) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < size; i += 2) {
+        uint32_t offset = (spool_flash_head + i) % SPOOL_FLASH_SIZE;
+        uint8_t halfword[2];
+        Spool_Ram_Read(spool_ram_tail + i, halfword, 2);
+        if (offset % SPOOL_FLASH_PAGE_SIZE == 0 && !spool_port->erase(spool_flash_base + offset)) {
+            spool_flash_failed = 1;
+        } else if (!spool_port->program(spool_flash_base + offset, halfword[0] | (uint16_t)(halfword[1] << 8))) {
+            spool_flash_failed = 1;
+        }
+        if (spool_flash_failed) {
+            spool_stats.flash_errors++;
+            return 0;
+        }
+    }
+    spool_flash_head += size;
+    spool_ram_tail += size;
+    spool_stats.spilled += size;
+    return 1;
+}
+
+void Spool_Init(const Spool_Port_TypeDef *port, uintptr_t flash_base) {
+    spool_port = port;
+    spool_flash_base = flash_base;
+    spool_flash_failed = 0;
+    spool_ram_head = spool_ram_tail = 0;
+    spool_flash_head = spool_flash_tail = 0;
+    spool_peek_records = 0;
+    memset(&spool_stats, 0, sizeof(spool_stats));
+}
+
+/* Appends one record, spilling the oldest RAM records to flash when the RAM
+   ring is full; returns 0 when neither has room. Spilling blocks for the
+   flash programs and, once per page, an erase. */
+uint8_t Spool_Write(const uint8_t *record, uint16_t length) {
+    uint32_t size = Spool_Record_Size(length);
+
+    if (length > SPOOL_RECORD_MAX) {
+        spool_stats.dropped++;
+        return 0;
+    }
+    while (SPOOL_RAM_SIZE - (spool_ram_head - spool_ram_tail) < size) {
+        if (!Spool_Spill_One()) {
+            spool_stats.dropped++;
+            return 0;
+        }
+    }
+    uint8_t prefix[2] = { length & 0xFF, length >> 8 };
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t byte = i < 2 ? prefix[i] : (i - 2 < length ? record[i - 2] : 0xFF);
+        spool_ram[(spool_ram_head + i) & (SPOOL_RAM_SIZE - 1)] = byte;
+    }
+    spool_ram_head += size;
+    spool_stats.written++;
+
+    uint32_t held = Spool_Ram_Bytes() + Spool_Flash_Bytes();
+    if (held > spool_stats.peak) {
+        spool_stats.peak = held;
+    }
+    return 1;
+}
+
+/* Copies the oldest whole records, back to back without their lengths, into
+   buffer; returns the bytes copied. Flash records come first, one peek never
+   mixes flash and RAM. Records may be written while the upload is in flight;
+   peeking again hands out the same records until they are consumed. */
+uint16_t Spool_Peek(uint8_t *buffer, uint16_t size) {
+    uint8_t from_flash = spool_flash_head != spool_flash_tail;
+    uint32_t position = from_flash ? spool_flash_tail : spool_ram_tail;
+    uint32_t head = from_flash ? spool_flash_head : spool_ram_head;
+    uint16_t copied = 0;
+
+    spool_peek_records = 0;
+    while (position != head) {
+        uint16_t length = Spool_Record_Length(from_flash, position);
+        if (copied + length > size) {
+            break;
+        }
+        if (from_flash) {
+            Spool_Flash_Read(position + 2, buffer + copied, length);
+        } else {
+            Spool_Ram_Read(position + 2, buffer + copied, length);
+        }
+        copied += length;
+        position += Spool_Record_Size(length);
+        spool_peek_records++;
+    }
+    return copied;
+}
+
+/* Drops the records returned by the last Spool_Peek(). Writes since then
+   may have spilled some of them to flash, but they are still the oldest, so
+   they are counted off the front: flash first, then RAM. */
+void Spool_Consume(void) {
+    while (spool_peek_records) {
+        if (spool_flash_head != spool_flash_tail) {
+            spool_flash_tail += Spool_Record_Size(Spool_Record_Length(1, spool_flash_tail));
+        } else {
+            spool_ram_tail += Spool_Record_Size(Spool_Record_Length(0, spool_ram_tail));
+        }
+        spool_peek_records--;
+        spool_stats.consumed++;
+    }
+}
+
+/* Whether records are held that the last peek did not hand out, i.e. the
+   spool is not drained even once the upload in flight is delivered */
+uint8_t Spool_Waiting(void) {
+    return spool_stats.written - spool_stats.consumed > spool_peek_records;
+}
+
+uint8_t Spool_Empty(void) {
+    return spool_ram_head == spool_ram_tail && spool_flash_head == spool_flash_tail;
+}
+
+uint32_t Spool_Ram_Bytes(void) {
+    return spool_ram_head - spool_ram_tail;
+}
+
+uint32_t Spool_Flash_Bytes(void) {
+    return spool_flash_head - spool_flash_tail;
+}
+
+/* Bytes the spool can hold, record overhead included */
+uint32_t Spool_Capacity(void) {
+    return SPOOL_RAM_SIZE + SPOOL_FLASH_USABLE;
+}
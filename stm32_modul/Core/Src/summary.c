@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file           : summary.c
+  * @brief          : Window statistics, see summary.h.
+  *                   Each sample costs one division, shared by the three
+  *                   axes, and a few multiply-adds per axis. The variance is
+  *                   the population variance of the window; the mean square
+  *                   is mean^2 + variance, so the RMS needs no accumulator
+  *                   of its own.
+  ******************************************************************************
+  */
+
+#include "summary.h"
+#include <math.h>
+#include <string.h>
+
+void Summary_Reset(Summary_TypeDef *summary) {
+    memset(summary, 0, sizeof(*summary));
+}
+
+void Summary_Add(Summary_TypeDef *summary, const Sample_TypeDef *sample) {
+    if (summary->count == 0) {
+        summary->start = sample->time;
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            summary->min[axis] = sample->data[axis];
+            summary->max[axis] = sample->data[axis];
+        }
+    }
+    summary->count++;
+    summary->end = sample->time;
+
+    float inverse = 1.0f / summary->count;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        int16_t value = sample->data[axis];
+        if (value < summary->min[axis]) {
+            summary->min[axis] = value;
+        } else if (value > summary->max[axis]) {
+            summary->max[axis] = value;
+        }
+        float delta = value - summary->mean[axis];
+        summary->mean[axis] += delta * inverse;
+        summary->m2[axis] += delta * (value - summary->mean[axis]);
+    }
+}
+
+float Summary_Variance(const Summary_TypeDef *summary, uint8_t axis) {
+    return summary->count ? summary->m2[axis] / summary->count : 0.0f;
+}
+
+float Summary_Rms(const Summary_TypeDef *summary, uint8_t axis) {
+    float mean = summary->mean[axis];
+    return sqrtf(mean * mean + Summary_Variance(summary, axis));
+}
@@ -0,0 +1,330 @@
+/**
+  ******************************************************************************
+  * @file           : bench_ahrs.c
+  * @brief          : Accuracy and cost of the orientation filter (ahrs.c) on
+  *                   a generated trace: two minutes of the board turned about
+  *                   every axis, sampled as in MODE_QUATERNION_CDC (gyro at
+  *                   190 Hz, accelerometer 50 Hz and magnetometer 100 Hz held
+  *                   between their samples) with the parts' noise and a gyro
+  *                   bias. Ahrs_Update() is compared with
+  *                   - the true orientation of the trace, with and without
+  *                     the magnetometer, after the settling gain is spent,
+  *                   - a double precision Madgwick step whose gradient comes
+  *                     from finite differences of the error function, so the
+  *                     hand expanded Jacobians and the single precision of
+  *                     ahrs.c are checked apart from the filter's own error.
+  *                   Then prints ns per update on this machine; the cycles on
+  *                   the target are in the debug stats line (AHRS cyc=).
+  ******************************************************************************
+  */
+
+#include "ahrs.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define GYRO_HZ 190
+#define ACC_HZ 50.0
+#define MAG_HZ 100.0
+#define SECONDS 120
+#define UPDATES (SECONDS * GYRO_HZ)
+#define SETTLED (5 * GYRO_HZ)                 // updates before the errors count
+#define SUBSTEPS 20                           // truth integration steps per gyro period
+#define BETA 0.1f                             // AHRS_BETA of main.c
+#define DIP_DEG 63.0                          // field inclination in Ljubljana
+#define GYRO_BIAS_DPS 0.8
+#define GYRO_NOISE_DPS 0.3                    // L3GD20, 0.03 dps/sqrt(Hz) over ~95 Hz
+#define ACC_NOISE_G 0.004
+#define MAG_NOISE 0.005                       // of the field strength
+#define ROUNDS 2000000
+
+typedef struct {
+    double gyro[UPDATES][3];   // rad/s
+    double acc[UPDATES][3];    // g, latest sample at the gyro sample's time
+    double mag[UPDATES][3];    // field units, likewise
+    double truth[UPDATES][4];  // orientation at the gyro sample
+} Trace_TypeDef;
+
+static Trace_TypeDef trace;
+
+static double Now_Ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Gaussian noise from a fixed seed, so every run sees the same trace */
+static double Noise(double sigma) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sigma * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* Turning rate of the board in its own frame, rad/s: slow swings up to
+   about 100 deg/s on each axis at unrelated frequencies */
+static void Rate(double t, double w[3]) {
+    w[0] = 1.2 * sin(0.31 * t) + 0.5 * sin(1.7 * t + 1.0);
+    w[1] = 0.9 * sin(0.23 * t + 2.0) + 0.4 * sin(2.3 * t);
+    w[2] = 1.0 * sin(0.17 * t + 0.5) + 0.6 * sin(1.1 * t + 3.0);
+}
+
+static void Normalise(double q[4]) {
+    double inv = 1.0 / sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    for (uint8_t i = 0; i < 4; i++) {
+        q[i] *= inv;
+    }
+}
+
+/* q = q * (0, w) / 2 integrated over dt, as a rotation by |w| dt */
+static void Rotate_Body(double q[4], const double w[3], double dt) {
+    double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * dt;
+    double s = angle > 0 ? sin(angle / 2) / angle * dt : dt / 2;
+    double r[4] = { cos(angle / 2), w[0] * s, w[1] * s, w[2] * s };
+    double p[4] = {
+        q[0] * r[0] - q[1] * r[1] - q[2] * r[2] - q[3] * r[3],
+        q[0] * r[1] + q[1] * r[0] + q[2] * r[3] - q[3] * r[2],
+        q[0] * r[2] - q[1] * r[3] + q[2] * r[0] + q[3] * r[1],
+        q[0] * r[3] + q[1] * r[2] - q[2] * r[1] + q[3] * r[0]
+    };
+    for (uint8_t i = 0; i < 4; i++) {
+        q[i] = p[i];
+    }
+    Normalise(q);
+}
+
+/* An earth frame vector seen in the sensor frame of orientation q, in the
+   form of Madgwick's error function (rotation matrix transposed, with its
+   diagonal written as 1 - 2(..)) */
+static void Earth_To_Sensor(const double q[4], const double v[3], double out[3]) {
+    double q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    out[0] = v[0] * (1 - 2 * (q2 * q2 + q3 * q3)) + v[1] * 2 * (q1 * q2 + q0 * q3) + v[2] * 2 * (q1 * q3 - q0 * q2);
+    out[1] = v[0] * 2 * (q1 * q2 - q0 * q3) + v[1] * (1 - 2 * (q1 * q1 + q3 * q3)) + v[2] * 2 * (q0 * q1 + q2 * q3);
+    out[2] = v[0] * 2 * (q0 * q2 + q1 * q3) + v[1] * 2 * (q2 * q3 - q0 * q1) + v[2] * (1 - 2 * (q1 * q1 + q2 * q2));
+}
+
+static void Sensor_To_Earth(const double q[4], const double v[3], double out[3]) {
+    double conjugate[4] = { q[0], -q[1], -q[2], -q[3] };
+    Earth_To_Sensor(conjugate, v, out);
+}
+
+static void Make_Trace(void) {
+    const double dip = DIP_DEG * M_PI / 180.0;
+    const double gravity[3] = { 0, 0, 1 }, field[3] = { cos(dip), 0, -sin(dip) };
+    const double dt = 1.0 / GYRO_HZ;
+    double q[4] = { cos(0.6), sin(0.6) * 0.48, sin(0.6) * -0.6, sin(0.6) * 0.64 };  // far from the identity
+    double bias[3] = { GYRO_BIAS_DPS, -GYRO_BIAS_DPS, GYRO_BIAS_DPS / 2 };
+    double acc[3] = { 0 }, mag[3] = { 0 };
+    uint32_t acc_samples = 0, mag_samples = 0;
+
+    srand(21);
+    for (uint32_t k = 0; k < UPDATES; k++) {
+        double t = k * dt, w[3];
+        if (k > 0) {
+            for (uint8_t s = 0; s < SUBSTEPS; s++) {
+                Rate(t - dt + (s + 0.5) * dt / SUBSTEPS, w);
+                Rotate_Body(q, w, dt / SUBSTEPS);
+            }
+        }
+        /* The slower parts sample on their own clocks; the filter gets the
+           latest of each */
+        while (acc_samples <= t * ACC_HZ) {
+            Earth_To_Sensor(q, gravity, acc);
+            for (uint8_t i = 0; i < 3; i++) {
+                acc[i] += Noise(ACC_NOISE_G);
+            }
+            acc_samples++;
+        }
+        while (mag_samples <= t * MAG_HZ) {
+            Earth_To_Sensor(q, field, mag);
+            for (uint8_t i = 0; i < 3; i++) {
+                mag[i] += Noise(MAG_NOISE);
+            }
+            mag_samples++;
+        }
+        Rate(t, w);
+        for (uint8_t i = 0; i < 3; i++) {
+            trace.gyro[k][i] = w[i] + (bias[i] + Noise(GYRO_NOISE_DPS)) * M_PI / 180.0;
+            trace.acc[k][i] = acc[i];
+            trace.mag[k][i] = mag[i];
+        }
+        for (uint8_t i = 0; i < 4; i++) {
+            trace.truth[k][i] = q[i];
+        }
+    }
+}
+
+/* Angle in degrees of the rotation between two orientations */
+static double Error_Deg(const double a[4], const double b[4]) {
+    double dot = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+    return 2.0 * acos(dot > 1.0 ? 1.0 : dot) * 180.0 / M_PI;
+}
+
+/* Angle in degrees between where two orientations put the earth's
+   vertical in the sensor frame: the tilt error, without the heading */
+static double Tilt_Error_Deg(const double a[4], const double b[4]) {
+    static const double up[3] = { 0, 0, 1 };
+    double va[3], vb[3];
+    Earth_To_Sensor(a, up, va);
+    Earth_To_Sensor(b, up, vb);
+    double dot = va[0] * vb[0] + va[1] * vb[1] + va[2] * vb[2];
+    return acos(dot > 1.0 ? 1.0 : dot) * 180.0 / M_PI;
+}
+
+/* Madgwick's error: the references rotated into the sensor frame minus the
+   measured directions, half its squared length */
+static double Error_Function(const double q[4], const double a[3], const double m[3], const double b[3]) {
+    static const double gravity[3] = { 0, 0, 1 };
+    double g[3], e = 0;
+    Earth_To_Sensor(q, gravity, g);
+    for (uint8_t i = 0; i < 3; i++) {
+        e += (g[i] - a[i]) * (g[i] - a[i]);
+    }
+    if (m != NULL) {
+        Earth_To_Sensor(q, b, g);
+        for (uint8_t i = 0; i < 3; i++) {
+            e += (g[i] - m[i]) * (g[i] - m[i]);
+        }
+    }
+    return e / 2;
+}
+
+/* One filter step in double precision with the gradient by central
+   differences; the same step ahrs.c takes with its derived Jacobians */
+static void Reference_Update(double q[4], uint16_t *settle, const double gyro[3], const double acc[3],
+                             const double mag[3], double beta, double dt) {
+    double dq[4] = {
+        0.5 * (-q[1] * gyro[0] - q[2] * gyro[1] - q[3] * gyro[2]),
+        0.5 * ( q[0] * gyro[0] + q[2] * gyro[2] - q[3] * gyro[1]),
+        0.5 * ( q[0] * gyro[1] - q[1] * gyro[2] + q[3] * gyro[0]),
+        0.5 * ( q[0] * gyro[2] + q[1] * gyro[1] - q[2] * gyro[0])
+    };
+    double a[3], m[3], b[3] = { 0 }, gradient[4], norm = 0;
+    double acc_norm = sqrt(acc[0] * acc[0] + acc[1] * acc[1] + acc[2] * acc[2]);
+    double mag_norm = mag ? sqrt(mag[0] * mag[0] + mag[1] * mag[1] + mag[2] * mag[2]) : 0;
+
+    for (uint8_t i = 0; i < 3; i++) {
+        a[i] = acc[i] / acc_norm;
+        m[i] = mag_norm > 0 ? mag[i] / mag_norm : 0;
+    }
+    if (mag_norm > 0) {
+        double h[3];
+        Sensor_To_Earth(q, m, h);
+        b[0] = sqrt(h[0] * h[0] + h[1] * h[1]);
+        b[2] = h[2];
+    }
+    for (uint8_t j = 0; j < 4; j++) {
+        double up[4] = { q[0], q[1], q[2], q[3] }, down[4] = { q[0], q[1], q[2], q[3] };
+        up[j] += 1e-6;
+        down[j] -= 1e-6;
+        gradient[j] = (Error_Function(up, a, mag_norm > 0 ? m : NULL, b) -
+                       Error_Function(down, a, mag_norm > 0 ? m : NULL, b)) / 2e-6;
+        norm += gradient[j] * gradient[j];
+    }
+    double gain = (*settle ? AHRS_SETTLE_BETA : beta) / sqrt(norm);
+    for (uint8_t j = 0; j < 4; j++) {
+        q[j] += (dq[j] - gradient[j] * gain) * dt;
+    }
+    Normalise(q);
+    if (*settle) {
+        (*settle)--;
+    }
+}
+
+typedef struct {
+    double mean_deg, max_deg, reference_max_deg;
+    uint32_t settled_at;   // first update within 5 deg of the truth
+} Accuracy_TypeDef;
+
+static Accuracy_TypeDef Run(uint8_t use_mag, uint8_t tilt_only) {
+    Accuracy_TypeDef result = { 0, 0, 0, UPDATES };
+    Ahrs_TypeDef ahrs;
+    double reference[4] = { 1, 0, 0, 0 };
+    uint16_t reference_settle = AHRS_SETTLE_UPDATES;
+    float gyro[3], acc[3], mag[3];
+
+    Ahrs_Init(&ahrs, BETA);
+    for (uint32_t k = 0; k < UPDATES; k++) {
+        for (uint8_t i = 0; i < 3; i++) {
+            gyro[i] = (float)trace.gyro[k][i];
+            acc[i] = (float)trace.acc[k][i];
+            mag[i] = (float)trace.mag[k][i];
+        }
+        Ahrs_Update(&ahrs, gyro, acc, use_mag ? mag : NULL, 1.0f / (float)GYRO_HZ);
+        double filter[4] = { ahrs.q[0], ahrs.q[1], ahrs.q[2], ahrs.q[3] };
+        double gyro_d[3] = { gyro[0], gyro[1], gyro[2] }, acc_d[3] = { acc[0], acc[1], acc[2] };
+        double mag_d[3] = { mag[0], mag[1], mag[2] };
+        Reference_Update(reference, &reference_settle, gyro_d, acc_d, use_mag ? mag_d : NULL, BETA,
+                         (float)(1.0 / GYRO_HZ));
+
+        /* Without the magnetometer only the tilt is observable, the
+           heading drifts with the gyro bias */
+        double error = tilt_only ? Tilt_Error_Deg(filter, trace.truth[k]) : Error_Deg(filter, trace.truth[k]);
+        if (result.settled_at == UPDATES && error < 5.0) {
+            result.settled_at = k;
+        }
+        if (k >= SETTLED) {
+            result.mean_deg += error / (UPDATES - SETTLED);
+            result.max_deg = fmax(result.max_deg, error);
+        }
+        result.reference_max_deg = fmax(result.reference_max_deg,
+                                        tilt_only ? Tilt_Error_Deg(filter, reference) : Error_Deg(filter, reference));
+    }
+    return result;
+}
+
+int main(void) {
+    int failures = 0;
+
+    Make_Trace();
+    printf("ahrs: %u s trace, gyro %u Hz (bias %.1f deg/s, noise %.1f deg/s), acc %.0f Hz, mag %.0f Hz,"
+           " beta %.2f\n", SECONDS, GYRO_HZ, GYRO_BIAS_DPS, GYRO_NOISE_DPS, ACC_HZ, MAG_HZ, BETA);
+
+    Accuracy_TypeDef marg = Run(1, 0);
+    printf("  with mag:    within 5 deg after %.2f s, then error mean %.2f deg, max %.2f deg;"
+           " %.4f deg from the reference\n", (double)marg.settled_at / GYRO_HZ, marg.mean_deg, marg.max_deg,
+           marg.reference_max_deg);
+    Accuracy_TypeDef imu = Run(0, 1);
+    printf("  without mag: within 5 deg tilt after %.2f s, then tilt error mean %.2f deg, max %.2f deg;"
+           " %.4f deg from the reference\n", (double)imu.settled_at / GYRO_HZ, imu.mean_deg, imu.max_deg,
+           imu.reference_max_deg);
+    /* The settling gain has to bring it in before it runs out. Near the
+       optimum the normalised gradient turns with rounding, so single and
+       double precision part by about beta * dt per update, 0.03 deg; a
+       wrong Jacobian term puts them degrees apart. */
+    if (marg.settled_at >= AHRS_SETTLE_UPDATES || marg.mean_deg > 1.0 || marg.max_deg > 3.0 ||
+        marg.reference_max_deg > 0.3) {
+        printf("  with mag: out of limits\n");
+        failures++;
+    }
+    if (imu.settled_at >= AHRS_SETTLE_UPDATES || imu.mean_deg > 1.0 || imu.max_deg > 3.0 ||
+        imu.reference_max_deg > 0.3) {
+        printf("  without mag: out of limits\n");
+        failures++;
+    }
+
+    /* Cost per update over a short stretch of the trace, replayed */
+    float gyro[64][3], acc[64][3], mag[64][3];
+    for (uint8_t k = 0; k < 64; k++) {
+        for (uint8_t i = 0; i < 3; i++) {
+            gyro[k][i] = (float)trace.gyro[SETTLED + k][i];
+            acc[k][i] = (float)trace.acc[SETTLED + k][i];
+            mag[k][i] = (float)trace.mag[SETTLED + k][i];
+        }
+    }
+    for (uint8_t use_mag = 0; use_mag < 2; use_mag++) {
+        Ahrs_TypeDef ahrs;
+        Ahrs_Init(&ahrs, BETA);
+        double start = Now_Ns();
+        for (uint32_t round = 0; round < ROUNDS; round++) {
+            Ahrs_Update(&ahrs, gyro[round % 64], acc[round % 64], use_mag ? mag[round % 64] : NULL,
+                        1.0f / (float)GYRO_HZ);
+        }
+        double ns = (Now_Ns() - start) / ROUNDS;
+        printf("  Ahrs_Update %s: %.1f ns per update on this machine, q = (%.3f %.3f %.3f %.3f)\n",
+               use_mag ? "with mag   " : "without mag", ns, ahrs.q[0], ahrs.q[1], ahrs.q[2], ahrs.q[3]);
+        if (!isfinite(ahrs.q[0])) {
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file           : bench_at_parser.c
+  * @brief          : Throughput of the AT tokenizer on the recorded ESP8266
+  *                   transcript, fed in DMA-sized chunks with the queue
+  *                   drained after each. Prints ns per byte on this machine
+  *                   and how many times faster than each ESP UART rate that
+  *                   is; compare runs on the same machine.
+  ******************************************************************************
+  */
+
+#include "at_parser.h"
+#include "esp_transcript.h"
+#include <stdio.h>
+#include <time.h>
+
+#define ROUNDS 20000
+#define CHUNK 32
+
+static double Now_Ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+int main(void) {
+    static const uint32_t bauds[] = { 115200, 921600, 2000000 };
+    const uint8_t *data = (const uint8_t *)esp_transcript;
+    size_t length = sizeof(esp_transcript) - 1;
+    uint32_t events = 0;
+    At_Event_TypeDef event;
+
+    At_Parser_Reset();
+    double start = Now_Ns();
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        for (size_t offset = 0; offset < length; offset += CHUNK) {
+            At_Parser_Feed(data + offset, length - offset < CHUNK ? length - offset : CHUNK);
+            while (At_Parser_Next(&event)) {
+                events++;
+            }
+        }
+    }
+    double elapsed = Now_Ns() - start;
+    double ns_per_byte = elapsed / ((double)ROUNDS * length);
+
+    printf("at_parser: %zu bytes x %u rounds, %u events, %.2f ns/byte, %.1f MB/s\n", length, ROUNDS, events,
+           ns_per_byte, 1e3 / ns_per_byte);
+    for (uint8_t i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+        double bytes_per_s = bauds[i] / 10.0;
+        printf("  %7u baud: %.0fx the line rate\n", bauds[i], 1e9 / ns_per_byte / bytes_per_s);
+    }
+    return events == ROUNDS * ESP_TRANSCRIPT_EVENTS ? 0 : 1;
+}
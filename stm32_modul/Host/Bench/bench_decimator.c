@@ -0,0 +1,150 @@
+/**
+  ******************************************************************************
+  * @file           : bench_decimator.c
+  * @brief          : Frequency response of the decimator, measured through
+  *                   Decimator_Process() with sines on every axis, and its
+  *                   cost per 3-axis input sample in blocks of the firmware's
+  *                   batch size. The gain at each frequency is the power of
+  *                   a quadrature pair on X and Y in the kept samples, so
+  *                   aliased tones are measured too. Fails if
+  *                   the response leaves the limits stated in decimator.h or
+  *                   the output depends on how the input is split.
+  ******************************************************************************
+  */
+
+#include "decimator.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define AMPLITUDE 12000.0
+#define SETTLE 2048        // input samples before the fit starts
+#define MEASURE 16384      // input samples fitted
+#define BATCH 32           // samples per Decimator_Process(), a ring drain batch
+#define ROUNDS 2000
+
+static double Now_Ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/* Gain in dB of the decimator for a sine at ratio times the output Nyquist
+   frequency. X gets the cosine and Y the sine of the same tone, so X + jY of
+   each kept sample has the filtered amplitude whatever its phase, also for
+   tones that alias at the output rate. */
+static double Gain_Db(uint8_t factor, double ratio) {
+    static Sample_TypeDef batch[BATCH];
+    Decimator_TypeDef dec;
+    double w = M_PI * ratio / factor;   // rad per input sample
+    double power = 0;
+    uint32_t count = 0;
+
+    Decimator_Init(&dec, factor);
+    for (uint32_t start = 0; start < SETTLE + MEASURE; start += BATCH) {
+        for (uint16_t n = 0; n < BATCH; n++) {
+            batch[n].data[0] = (int16_t)lrint(AMPLITUDE * cos(w * (start + n)));
+            batch[n].data[1] = (int16_t)lrint(AMPLITUDE * sin(w * (start + n)));
+            batch[n].data[2] = 0;
+            batch[n].time = start + n;
+        }
+        uint16_t kept = Decimator_Process(&dec, batch, BATCH);
+        for (uint16_t k = 0; k < kept; k++) {
+            if (batch[k].time >= SETTLE) {
+                power += (double)batch[k].data[0] * batch[k].data[0] + (double)batch[k].data[1] * batch[k].data[1];
+                count++;
+            }
+        }
+    }
+    return 10.0 * log10(power / count / (AMPLITUDE * AMPLITUDE) + 1e-12);
+}
+
+/* The same input in batches of 1..BATCH samples gives the same output as
+   in full batches */
+static int Split_Invariant(uint8_t factor) {
+    static Sample_TypeDef whole[1024], split[1024], out_whole[1024], out_split[1024];
+    Decimator_TypeDef a, b;
+    uint16_t count_whole = 0, count_split = 0, length;
+
+    for (uint16_t n = 0; n < 1024; n++) {
+        whole[n].data[0] = (int16_t)(8000 * sin(0.05 * n) + 3000);
+        whole[n].data[1] = (int16_t)(n * 13);
+        whole[n].data[2] = (int16_t)(-n * 7);
+        whole[n].time = n;
+    }
+    memcpy(split, whole, sizeof(split));
+    Decimator_Init(&a, factor);
+    Decimator_Init(&b, factor);
+    for (uint16_t start = 0; start < 1024; start += BATCH) {
+        uint16_t kept = Decimator_Process(&a, &whole[start], BATCH);  // compacted to the batch's front
+        memcpy(&out_whole[count_whole], &whole[start], kept * sizeof(Sample_TypeDef));
+        count_whole += kept;
+    }
+    for (uint16_t start = 0; start < 1024; start += length) {
+        length = start % BATCH + 1 < 1024 - start ? start % BATCH + 1 : 1024 - start;
+        uint16_t kept = Decimator_Process(&b, &split[start], length);
+        memcpy(&out_split[count_split], &split[start], kept * sizeof(Sample_TypeDef));
+        count_split += kept;
+    }
+    return count_whole == count_split &&
+           memcmp(out_whole, out_split, count_whole * sizeof(Sample_TypeDef)) == 0;
+}
+
+int main(void) {
+    static const uint8_t factors[] = { 2, 4, 8, 16 };
+    static const double ratios[] = { 0.25, 0.5, 0.8, 1.0, 1.2, 1.5, 1.9 };
+    /* Limits in dB for each ratio: passband, -3 dB at the cut-off, then the
+       stopband attenuation decimator.h states, wide enough for every factor */
+    static const double low[] = { -0.1, -0.1, -3.3, -18.0, -35.0, -70.0, -300.0 };
+    static const double high[] = { 0.1, 0.1, -2.7, -11.5, -20.5, -32.5, -44.5 };
+    int failures = 0;
+
+    printf("decimator gain in dB at multiples of the output Nyquist frequency fn\n");
+    printf("factor");
+    for (uint8_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+        printf("  %5.2f fn", ratios[r]);
+    }
+    printf("\n");
+    for (uint8_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        printf("%6u", factors[f]);
+        for (uint8_t r = 0; r < sizeof(ratios) / sizeof(ratios[0]); r++) {
+            double gain = Gain_Db(factors[f], ratios[r]);
+            printf("  %8.1f", gain);
+            if (gain < low[r] || gain > high[r]) {
+                printf("!");
+                failures++;
+            }
+        }
+        printf("\n");
+        if (!Split_Invariant(factors[f])) {
+            printf("factor %u: output depends on the batch split\n", factors[f]);
+            failures++;
+        }
+    }
+
+    /* Cost per 3-axis input sample, batches of BATCH as the drain hands them over */
+    static Sample_TypeDef batch[BATCH];
+    for (uint8_t f = 0; f < sizeof(factors) / sizeof(factors[0]); f++) {
+        Decimator_TypeDef dec;
+        Decimator_Init(&dec, factors[f]);
+        uint32_t kept = 0;
+        double start = Now_Ns();
+        for (uint32_t round = 0; round < ROUNDS; round++) {
+            for (uint16_t n = 0; n < BATCH; n++) {
+                batch[n].data[0] = (int16_t)(round * 31 + n);
+                batch[n].data[1] = (int16_t)(n * 17);
+                batch[n].data[2] = (int16_t)(round ^ n);
+                batch[n].time = round * BATCH + n;
+            }
+            kept += Decimator_Process(&dec, batch, BATCH);
+        }
+        double elapsed = Now_Ns() - start;
+        printf("factor %2u: %.1f ns per 3-axis input sample, %u kept\n", factors[f],
+               elapsed / ((double)ROUNDS * BATCH), kept);
+        if (kept != ROUNDS * BATCH / factors[f]) {
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
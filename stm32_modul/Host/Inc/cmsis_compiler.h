@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file           : cmsis_compiler.h
+  * @brief          : Host versions of the Cortex-M4 DSP intrinsics used by
+  *                   calibration.c. Each one computes what the instruction
+  *                   does (ARMv7-M ARM, A7.7), so building calibration.c with
+  *                   __ARM_FEATURE_DSP=1 on the host runs the SIMD path
+  *                   bit for bit.
+  ******************************************************************************
+  */
+
+#ifndef __CMSIS_COMPILER_H
+#define __CMSIS_COMPILER_H
+
+#include <stdint.h>
+
+static inline int32_t Sim_Saturate(int64_t value, uint32_t bits) {
+    const int64_t max = ((int64_t)1 << (bits - 1)) - 1;
+    const int64_t min = -((int64_t)1 << (bits - 1));
+    return (int32_t)(value > max ? max : value < min ? min : value);
+}
+
+/* SSAT: signed saturation to 1..32 bits */
+static inline int32_t __SSAT(int32_t value, uint32_t bits) {
+    return Sim_Saturate(value, bits);
+}
+
+/* QSUB16: both halfwords subtracted with signed saturation */
+static inline uint32_t __QSUB16(uint32_t op1, uint32_t op2) {
+    int32_t low = Sim_Saturate((int64_t)(int16_t)op1 - (int16_t)op2, 16);
+    int32_t high = Sim_Saturate((int64_t)(int16_t)(op1 >> 16) - (int16_t)(op2 >> 16), 16);
+    return (uint16_t)low | ((uint32_t)(uint16_t)high << 16);
+}
+
+/* SMLAD: both signed halfword products added to the accumulator, modulo 2^32 */
+static inline uint32_t __SMLAD(uint32_t op1, uint32_t op2, uint32_t op3) {
+    int32_t low = (int32_t)(int16_t)op1 * (int16_t)op2;
+    int32_t high = (int32_t)(int16_t)(op1 >> 16) * (int16_t)(op2 >> 16);
+    return op3 + (uint32_t)low + (uint32_t)high;
+}
+
+#endif /* __CMSIS_COMPILER_H */
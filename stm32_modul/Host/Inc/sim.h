@@ -0,0 +1,188 @@
+/**
+  ******************************************************************************
+  * @file           : sim.h
+  * @brief          : Host simulation of the STM32F3 Discovery board the
+  *                   firmware runs on: a virtual microsecond clock with an
+  *                   event timeline, PRIMASK and interrupt dispatch, the
+  *                   LSM303AGR and L3GD20 with their FIFOs and DRDY lines at
+  *                   configurable output data rates, an ESP8266 that answers
+  *                   AT commands and stands in for the HTTP and stream
+  *                   servers, the USB CDC link and the flash pages of the
+  *                   SPOOL and CONFIG regions.
+  *                   main() of the firmware is built as App_Main() and runs
+  *                   in its own context; Sim_App_Run() lets its superloop run
+  *                   for a stretch of virtual time and returns to the test.
+  ******************************************************************************
+  */
+
+#ifndef __SIM_H
+#define __SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* Virtual clock -------------------------------------------------------------*/
+#define SIM_CPU_HZ 48000000U
+#define SIM_TICK_COST_US 1        // thread time charged per HAL_GetTick() call
+
+typedef enum {
+    SIM_IRQ_EXTI0 = 0,            // in NVIC order, lower runs first
+    SIM_IRQ_EXTI1,
+    SIM_IRQ_EXTI2,
+    SIM_IRQ_EXTI3,
+    SIM_IRQ_EXTI4,
+    SIM_IRQ_SPI1_DMA,
+    SIM_IRQ_USART2_DMA,
+    SIM_IRQ_I2C1_DMA,
+    SIM_IRQ_USB,
+    SIM_IRQ_USART2,
+    SIM_IRQ_COUNT
+} Sim_Irq_TypeDef;
+
+uint64_t Sim_Now_Us(void);
+void Sim_Advance(uint32_t us);
+void Sim_Stall(uint32_t us);
+void Sim_At(uint64_t time_us, void (*handler)(void *context), void *context);
+void Sim_Irq_Pend(uint8_t irq, void (*handler)(void));
+uint8_t Sim_In_Isr(void);
+
+/* Runs App_Main() (the firmware's main) for ms of virtual time; the first
+   call starts it from reset. Returns early only if App_Main() returns. */
+void Sim_App_Run(uint32_t ms);
+/* Lets the models run for ms without firmware thread code, e.g. for tests
+   that call firmware functions directly */
+void Sim_Idle(uint32_t ms);
+
+/* GPIO ----------------------------------------------------------------------*/
+#define SIM_PORT_A 0
+#define SIM_PORT_E 4
+
+void Sim_Gpio_Drive(uint8_t port, uint8_t pin, uint8_t level);
+void Sim_Button_Press(uint32_t ms);
+uint32_t Sim_Gpio_Toggles(uint8_t port, uint8_t pin);
+
+/* Sensors -------------------------------------------------------------------*/
+#define SIM_SENSOR_MAG 0          // same order as SENSOR_x in main.c
+#define SIM_SENSOR_ACC 1
+#define SIM_SENSOR_GYR 2
+#define SIM_SENSOR_COUNT 3
+#define SIM_FIFO_DEPTH 32
+
+typedef struct {
+    uint32_t produced;     // samples the part converted
+    uint32_t read;         // samples taken out over the bus
+    uint32_t overwritten;  // lost in the part: FIFO full or output register not read in time
+    uint32_t fifo_peak;    // most samples stored at once
+} Sim_Sensor_Stats_TypeDef;
+
+/* Generates sample n of a sensor; the default writes n into X, -n into Y and
+   the sensor number into Z, so the order of delivered samples can be checked */
+typedef void (*Sim_Sensor_Source_TypeDef)(uint8_t sensor, uint32_t n, uint64_t time_us, int16_t data[3]);
+
+void Sim_Sensor_Set_Odr(uint8_t sensor, float hz);   // 0 = the rate the firmware configured
+void Sim_Sensor_Set_Source(Sim_Sensor_Source_TypeDef source);
+float Sim_Sensor_Odr(uint8_t sensor);
+const Sim_Sensor_Stats_TypeDef *Sim_Sensor_Stats(uint8_t sensor);
+uint8_t Sim_Sensor_Register(uint8_t sensor, uint8_t reg);
+uint8_t Sim_Sensor_Fifo_Level(uint8_t sensor);
+void Sim_I2C_Fail_Next(uint8_t count);   // the next DMA reads end in HAL_I2C_ErrorCallback()
+void Sim_I2C_Refuse_Next(uint8_t count, void (*hook)(void));   // the next DMA starts get HAL_BUSY, see sim_bus.c
+uint32_t Sim_I2C_Busy_Refusals(void);    // HAL_BUSY returned while a DMA read ran
+void Sim_I2C_Hold(uint8_t held);         // the DMA read in flight waits until released
+uint32_t Sim_Spi_Blocking_Transfers(void);   // HAL_SPI_Transmit/Receive/TransmitReceive calls
+uint32_t Sim_Spi_Dma_Transfers(void);        // HAL_SPI_TransmitReceive_DMA starts taken
+uint32_t Sim_Spi_Selects(void);              // times CS went low
+
+/* ESP8266 -------------------------------------------------------------------*/
+#define SIM_ESP_LINKS 5
+#define SIM_ESP_TRANSCRIPT_SIZE 16384
+#define SIM_HTTP_REQUESTS_MAX 4096
+
+typedef struct {
+    uint8_t present;        // answers at all
+    uint8_t echo;           // ATE1, commands are echoed
+    uint8_t wifi_mode;      // AT+CWMODE, kept in the module's flash
+    uint8_t mux;            // AT+CIPMUX, lost on reset
+    uint8_t station_status; // STATUS:n of CIPSTATUS, 2 = got IP, 5 = no access point
+    uint32_t baud;          // module UART rate
+    uint32_t max_baud;      // AT+UART_CUR above this answers ERROR
+    uint32_t unstable_baud; // at and above this rate replies are garbled (0 = never)
+    uint8_t unstable_misses; // writes lost on the way in at such a rate before one gets through
+    char ap_ssid[33];       // network CWJAP succeeds with, empty = any
+    uint8_t server_up;      // the TCP server accepts connections
+    uint8_t server_replies; // the HTTP server answers each request
+    uint32_t server_reply_ms;
+    uint32_t connect_ms;    // CIPSTART to CONNECT
+    uint32_t join_ms;       // CWJAP to WIFI GOT IP
+    uint32_t send_ms;       // payload received to SEND OK
+} Sim_Esp_Config_TypeDef;
+
+typedef struct {
+    uint64_t time_us;
+    char text[80];          // the command line, or "<n bytes>" for CIPSEND payloads
+} Sim_Esp_Command_TypeDef;
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t link;
+    char path[32];
+    uint16_t length;        // body bytes
+    uint8_t *body;
+} Sim_Http_Request_TypeDef;
+
+extern Sim_Esp_Config_TypeDef sim_esp;
+
+/* Replaces the reply to commands starting with prefix for the next times
+   commands (-1 = always); delay_ms after the command is received */
+void Sim_Esp_Rule(const char *prefix, const char *reply, uint32_t delay_ms, int32_t times);
+void Sim_Esp_Inject(const char *text);
+int Sim_Esp_Web_Request(const char *request);   // returns the link id or -1
+void Sim_Esp_Close_Link(uint8_t link);
+void Sim_Esp_Wifi_Lost(void);
+void Sim_Esp_Wifi_Back(void);
+uint8_t Sim_Esp_Link_Owner(uint8_t link);       // 0 closed, 1 firmware to server, 2 web client
+uint8_t Sim_Esp_Transparent(void);
+uint32_t Sim_Esp_Count(const char *prefix);     // commands received starting with prefix, "+++" included
+uint32_t Sim_Esp_Command_Count(void);
+const Sim_Esp_Command_TypeDef *Sim_Esp_Command(uint32_t index);
+void Sim_Esp_Print_Transcript(FILE *out);
+uint32_t Sim_Http_Request_Count(void);
+const Sim_Http_Request_TypeDef *Sim_Http_Request(uint32_t index);
+const uint8_t *Sim_Esp_Stream(size_t *length);  // bytes received in transparent mode
+const uint8_t *Sim_Esp_Web_Reply(size_t *length); // bytes sent to web clients
+uint32_t Sim_Uart_Garbled(void);                // bytes lost to a baud mismatch
+
+/* USB CDC -------------------------------------------------------------------*/
+#define SIM_USB_CAPTURE_SIZE (8u << 20)
+
+const uint8_t *Sim_Usb_Captured(size_t *length);
+void Sim_Usb_Clear(void);
+void Sim_Usb_Send(const char *text);
+void Sim_Usb_Stall(uint8_t stalled);
+uint32_t Sim_Usb_Transfers(void);
+
+/* Flash ---------------------------------------------------------------------*/
+#define SIM_FLASH_BASE 0x0803B000u   // SPOOL and CONFIG of STM32F303VCTX_FLASH.ld
+#define SIM_FLASH_SIZE (20u << 10)
+#define SIM_FLASH_PAGE 2048u
+#define SIM_FLASH_ERASE_US 30000u
+#define SIM_FLASH_PROGRAM_US 50u
+
+uint32_t Sim_Flash_Erases(uintptr_t address);
+/* Called from the thread before each halfword is programmed, e.g. to let
+   something happen while the firmware is busy writing; NULL removes it */
+void Sim_Flash_On_Program(void (*hook)(uintptr_t address));
+
+/* Between the models --------------------------------------------------------*/
+void Sim_Spi_Select(uint8_t level);     // L3GD20 CS, from HAL_GPIO_WritePin()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SIM_H */
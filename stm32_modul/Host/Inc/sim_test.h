@@ -0,0 +1,49 @@
+/**
+  ******************************************************************************
+  * @file           : sim_test.h
+  * @brief          : Checks for the host tests. A failed check is printed
+  *                   with its location and the test goes on; the exit code
+  *                   tells ctest whether any failed.
+  ******************************************************************************
+  */
+
+#ifndef __SIM_TEST_H
+#define __SIM_TEST_H
+
+#include <stdio.h>
+
+static int sim_test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        sim_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+    long long actual_value = (long long)(actual), expected_value = (long long)(expected); \
+    if (actual_value != expected_value) { \
+        fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, \
+                actual_value, expected_value); \
+        sim_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_NEAR(actual, expected, tolerance) do { \
+    double actual_value = (double)(actual), expected_value = (double)(expected); \
+    if (!(actual_value - expected_value <= (tolerance) && expected_value - actual_value <= (tolerance))) { \
+        fprintf(stderr, "%s:%d: %s is %g, expected %g +- %g\n", __FILE__, __LINE__, #actual, \
+                actual_value, expected_value, (double)(tolerance)); \
+        sim_test_failures++; \
+    } \
+} while (0)
+
+#define TEST_EXIT() do { \
+    if (sim_test_failures) { \
+        fprintf(stderr, "%d check(s) failed\n", sim_test_failures); \
+    } \
+    return sim_test_failures ? 1 : 0; \
+} while (0)
+
+#endif /* __SIM_TEST_H */
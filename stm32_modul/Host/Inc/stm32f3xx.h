@@ -0,0 +1,110 @@
+/**
+  ******************************************************************************
+  * @file           : stm32f3xx.h
+  * @brief          : Host build stand-in for the CMSIS device header. Only
+  *                   what the firmware touches is declared: the peripheral
+  *                   instances it compares handles against and the core
+  *                   registers it reads (SysTick, SCB, DWT, CoreDebug), which
+  *                   sim_hal.c keeps in step with the virtual clock.
+  ******************************************************************************
+  */
+
+#ifndef __STM32F3xx_H
+#define __STM32F3xx_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO volatile
+#define __I volatile const
+#define __O volatile
+
+typedef enum {
+    EXTI0_IRQn = 6,
+    EXTI1_IRQn = 7,
+    EXTI2_TSC_IRQn = 8,
+    EXTI4_IRQn = 10,
+    DMA1_Channel3_IRQn = 13,
+    DMA1_Channel6_IRQn = 16,
+    DMA1_Channel7_IRQn = 17,
+    USB_LP_CAN_RX0_IRQn = 20,
+    SPI1_IRQn = 35,
+    USART2_IRQn = 38,
+} IRQn_Type;
+
+typedef struct {
+    __IO uint32_t IDR;   // input levels, driven by the sensor and button models
+    __IO uint32_t ODR;   // output levels written by HAL_GPIO_WritePin()
+} GPIO_TypeDef;
+
+typedef struct { uint32_t unused; } I2C_TypeDef;
+typedef struct { uint32_t unused; } SPI_TypeDef;
+typedef struct { uint32_t unused; } USART_TypeDef;
+typedef struct { uint32_t unused; } DMA_Channel_TypeDef;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t LOAD;
+    __IO uint32_t VAL;
+    __I uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct {
+    __IO uint32_t ICSR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern GPIO_TypeDef sim_gpio[6];
+extern I2C_TypeDef sim_i2c1;
+extern SPI_TypeDef sim_spi1;
+extern USART_TypeDef sim_usart2;
+extern SysTick_Type sim_systick;
+extern SCB_Type sim_scb;
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+extern uint32_t SystemCoreClock;
+
+#define GPIOA (&sim_gpio[0])
+#define GPIOB (&sim_gpio[1])
+#define GPIOC (&sim_gpio[2])
+#define GPIOD (&sim_gpio[3])
+#define GPIOE (&sim_gpio[4])
+#define GPIOF (&sim_gpio[5])
+#define I2C1 (&sim_i2c1)
+#define SPI1 (&sim_spi1)
+#define USART2 (&sim_usart2)
+#define SysTick (&sim_systick)
+#define SCB (&sim_scb)
+#define DWT (&sim_dwt)
+#define CoreDebug (&sim_core_debug)
+
+#define SCB_ICSR_PENDSTSET_Msk (1UL << 26)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+/* PRIMASK and the interrupt dispatch of the simulated core, see sim_hal.c */
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+
+/* One core, one thread of execution: a compiler barrier is enough */
+#define __DMB() __asm__ volatile("" ::: "memory")
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F3xx_H */
@@ -0,0 +1,334 @@
+/**
+  ******************************************************************************
+  * @file           : stm32f3xx_hal.h
+  * @brief          : Host build stand-in for the STM32F3 HAL. Declares the
+  *                   subset of types, constants and calls the firmware uses;
+  *                   sim_hal.c, sim_bus.c, sim_uart.c and sim_usb.c implement
+  *                   them against the device models and the virtual clock.
+  *                   Blocking calls advance the clock by the time the
+  *                   transfer takes on the real bus, the DMA and IT variants
+  *                   complete from the simulated interrupts.
+  ******************************************************************************
+  */
+
+#ifndef __STM32F3xx_HAL_H
+#define __STM32F3xx_HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stm32f3xx.h"
+#include <stdio.h>
+
+/* The firmware prints uint32_t with %lu, right for arm-none-eabi where it is
+   unsigned long. On an LP64 host the argument is an int, so the formats go
+   through Sim_Snprintf(), which drops the length modifier. */
+int Sim_Snprintf(char *buffer, size_t size, const char *format, ...);
+#define snprintf Sim_Snprintf
+
+#define UNUSED(X) (void)X
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+typedef enum {
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+/* GPIO */
+typedef enum {
+    GPIO_PIN_RESET = 0U,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Pull;
+    uint32_t Speed;
+    uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define GPIO_MODE_OUTPUT_PP 0x00000001U
+#define GPIO_MODE_IT_RISING 0x10110000U
+#define GPIO_MODE_IT_FALLING 0x10210000U
+#define GPIO_MODE_IT_RISING_FALLING 0x10310000U
+#define GPIO_MODE_EVT_RISING 0x10120000U
+#define GPIO_NOPULL 0x00000000U
+#define GPIO_SPEED_FREQ_LOW 0x00000000U
+#define GPIO_SPEED_FREQ_HIGH 0x00000003U
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+#define __HAL_RCC_GPIOA_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_GPIOC_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_GPIOE_CLK_ENABLE() do { } while (0)
+#define __HAL_RCC_GPIOF_CLK_ENABLE() do { } while (0)
+
+/* RCC */
+typedef struct {
+    uint32_t PLLState;
+    uint32_t PLLSource;
+    uint32_t PLLMUL;
+} RCC_PLLInitTypeDef;
+
+typedef struct {
+    uint32_t OscillatorType;
+    uint32_t HSEState;
+    uint32_t HSEPredivValue;
+    uint32_t LSEState;
+    uint32_t HSIState;
+    uint32_t HSICalibrationValue;
+    uint32_t LSIState;
+    RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+
+typedef struct {
+    uint32_t ClockType;
+    uint32_t SYSCLKSource;
+    uint32_t AHBCLKDivider;
+    uint32_t APB1CLKDivider;
+    uint32_t APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+typedef struct {
+    uint32_t PeriphClockSelection;
+    uint32_t Usart2ClockSelection;
+    uint32_t I2c1ClockSelection;
+    uint32_t USBClockSelection;
+} RCC_PeriphCLKInitTypeDef;
+
+#define RCC_OSCILLATORTYPE_HSE 0x00000001U
+#define RCC_OSCILLATORTYPE_HSI 0x00000002U
+#define RCC_HSE_BYPASS 0x00050000U
+#define RCC_HSE_PREDIV_DIV1 0x00000000U
+#define RCC_HSI_ON 0x00000001U
+#define RCC_HSICALIBRATION_DEFAULT 0x10U
+#define RCC_PLL_ON 0x00000002U
+#define RCC_PLLSOURCE_HSE 0x00010000U
+#define RCC_PLL_MUL6 0x00100000U
+#define RCC_CLOCKTYPE_SYSCLK 0x00000001U
+#define RCC_CLOCKTYPE_HCLK 0x00000002U
+#define RCC_CLOCKTYPE_PCLK1 0x00000004U
+#define RCC_CLOCKTYPE_PCLK2 0x00000008U
+#define RCC_SYSCLKSOURCE_PLLCLK 0x00000002U
+#define RCC_SYSCLK_DIV1 0x00000000U
+#define RCC_HCLK_DIV1 0x00000000U
+#define RCC_HCLK_DIV2 0x00000400U
+#define RCC_PERIPHCLK_USART2 0x00000002U
+#define RCC_PERIPHCLK_I2C1 0x00000020U
+#define RCC_PERIPHCLK_USB 0x00020000U
+#define RCC_USART2CLKSOURCE_PCLK1 0x00000000U
+#define RCC_I2C1CLKSOURCE_HSI 0x00000000U
+#define RCC_USBCLKSOURCE_PLL 0x00400000U
+#define FLASH_LATENCY_1 0x00000001U
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency);
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig(RCC_PeriphCLKInitTypeDef *PeriphClkInit);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+
+/* Cortex */
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+
+/* DMA */
+typedef struct {
+    DMA_Channel_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+/* I2C */
+typedef struct {
+    uint32_t Timing;
+    uint32_t OwnAddress1;
+    uint32_t AddressingMode;
+    uint32_t DualAddressMode;
+    uint32_t OwnAddress2;
+    uint32_t OwnAddress2Masks;
+    uint32_t GeneralCallMode;
+    uint32_t NoStretchMode;
+} I2C_InitTypeDef;
+
+typedef struct {
+    I2C_TypeDef *Instance;
+    I2C_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmarx;
+    DMA_HandleTypeDef *hdmatx;
+    __IO uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+#define I2C_ADDRESSINGMODE_7BIT 0x00000001U
+#define I2C_DUALADDRESS_DISABLE 0x00000000U
+#define I2C_OA2_NOMASK 0x00U
+#define I2C_GENERALCALL_DISABLE 0x00000000U
+#define I2C_NOSTRETCH_DISABLE 0x00000000U
+#define I2C_ANALOGFILTER_ENABLE 0x00000000U
+#define I2C_MEMADD_SIZE_8BIT 0x00000001U
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef *hi2c, uint32_t AnalogFilter);
+HAL_StatusTypeDef HAL_I2CEx_ConfigDigitalFilter(I2C_HandleTypeDef *hi2c, uint32_t DigitalFilter);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                    uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                   uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                       uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+/* SPI */
+typedef struct {
+    uint32_t Mode;
+    uint32_t Direction;
+    uint32_t DataSize;
+    uint32_t CLKPolarity;
+    uint32_t CLKPhase;
+    uint32_t NSS;
+    uint32_t BaudRatePrescaler;
+    uint32_t FirstBit;
+    uint32_t TIMode;
+    uint32_t CRCCalculation;
+    uint32_t CRCPolynomial;
+    uint32_t CRCLength;
+    uint32_t NSSPMode;
+} SPI_InitTypeDef;
+
+typedef struct {
+    SPI_TypeDef *Instance;
+    SPI_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmarx;
+    DMA_HandleTypeDef *hdmatx;
+    __IO uint32_t ErrorCode;
+} SPI_HandleTypeDef;
+
+#define SPI_MODE_MASTER 0x00000104U
+#define SPI_DIRECTION_2LINES 0x00000000U
+#define SPI_DATASIZE_8BIT 0x00000700U
+#define SPI_POLARITY_HIGH 0x00000002U
+#define SPI_PHASE_2EDGE 0x00000001U
+#define SPI_NSS_SOFT 0x00000200U
+#define SPI_BAUDRATEPRESCALER_8 0x00000010U
+#define SPI_FIRSTBIT_MSB 0x00000000U
+#define SPI_TIMODE_DISABLE 0x00000000U
+#define SPI_CRCCALCULATION_DISABLE 0x00000000U
+#define SPI_CRC_LENGTH_DATASIZE 0x00000000U
+#define SPI_NSS_PULSE_DISABLE 0x00000000U
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData,
+                                          uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData,
+                                              uint16_t Size);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+/* UART */
+typedef enum {
+    HAL_UART_STATE_RESET = 0x00U,
+    HAL_UART_STATE_READY = 0x20U,
+    HAL_UART_STATE_BUSY_TX = 0x21U,
+    HAL_UART_STATE_BUSY_RX = 0x22U
+} HAL_UART_StateTypeDef;
+
+typedef struct {
+    uint32_t BaudRate;
+    uint32_t WordLength;
+    uint32_t StopBits;
+    uint32_t Parity;
+    uint32_t Mode;
+    uint32_t HwFlowCtl;
+    uint32_t OverSampling;
+    uint32_t OneBitSampling;
+} UART_InitTypeDef;
+
+typedef struct {
+    uint32_t AdvFeatureInit;
+} UART_AdvFeatureInitTypeDef;
+
+typedef struct {
+    USART_TypeDef *Instance;
+    UART_InitTypeDef Init;
+    UART_AdvFeatureInitTypeDef AdvancedInit;
+    DMA_HandleTypeDef *hdmarx;
+    DMA_HandleTypeDef *hdmatx;
+    __IO HAL_UART_StateTypeDef gState;
+    __IO HAL_UART_StateTypeDef RxState;
+    __IO uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+#define UART_WORDLENGTH_8B 0x00000000U
+#define UART_STOPBITS_1 0x00000000U
+#define UART_PARITY_NONE 0x00000000U
+#define UART_MODE_TX_RX 0x0000000CU
+#define UART_HWCONTROL_NONE 0x00000000U
+#define UART_OVERSAMPLING_16 0x00000000U
+#define UART_OVERSAMPLING_8 0x00008000U
+#define UART_ONE_BIT_SAMPLE_DISABLE 0x00000000U
+#define UART_ADVFEATURE_NO_INIT 0x00000000U
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_AbortReceive_IT(UART_HandleTypeDef *huart);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+
+/* FLASH */
+typedef struct {
+    uint32_t TypeErase;
+    uint32_t PageAddress;
+    uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_PAGES 0x00U
+#define FLASH_TYPEPROGRAM_HALFWORD 0x01U
+#define FLASH_PAGE_SIZE 0x800U
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError);
+
+/* Core */
+HAL_StatusTypeDef HAL_Init(void);
+void HAL_IncTick(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STM32F3xx_HAL_H */
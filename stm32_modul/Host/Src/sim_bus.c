@@ -0,0 +1,554 @@
+/**
+  ******************************************************************************
+  * @file           : sim_bus.c
+  * @brief          : I2C1 and SPI1 of the HAL stand-in with the sensors on
+  *                   them: the LSM303AGR accelerometer (0x19) and
+  *                   magnetometer (0x1E) and the L3GD20 gyro (SPI, CS on
+  *                   PE3, also answering at 0x6B). Each part converts at the
+  *                   rate written to its control register (or the one forced
+  *                   with Sim_Sensor_Set_Odr()), into its output registers or
+  *                   its 32 sample FIFO, and drives its interrupt line from
+  *                   the data ready or watermark condition the firmware
+  *                   enabled. Bus transfers take the time they take on the
+  *                   wire; DMA transfers read the part when they start and
+  *                   complete from the DMA interrupt.
+  ******************************************************************************
+  */
+
+#include "sim.h"
+#include "stm32f3xx_hal.h"
+#include <string.h>
+
+#define SIM_I2C_BYTE_NS 22500      // 9 clocks at 400 kHz
+#define SIM_SPI_BYTE_NS 1333       // 8 clocks at 6 MHz (PCLK2 48 MHz / 8)
+
+#define SIM_FIFO_BYPASS 0
+#define SIM_FIFO_FIFO 1
+#define SIM_FIFO_STREAM 2
+
+typedef struct {
+    uint8_t address;        // I2C address, 7 bit
+    uint8_t int_port_pin;   // line the part drives, on port E
+    uint8_t out_reg;        // first output register (X low)
+    uint8_t regs[128];
+    int16_t out[3];         // output registers outside FIFO mode
+    uint8_t fresh;          // out holds a sample not read yet
+    int16_t fifo[SIM_FIFO_DEPTH][3];
+    uint8_t fifo_start;
+    uint8_t fifo_count;
+    uint8_t overrun;        // FIFO_SRC OVRN, a sample was overwritten since the last read
+    int16_t last_popped[3]; // what an empty FIFO returns
+    uint8_t line;           // level of the interrupt line
+    float odr_override;
+    uint32_t generation;    // bumped on every rate change, stale conversion events are ignored
+    double next_us;
+    Sim_Sensor_Stats_TypeDef stats;
+} Sim_Sensor_TypeDef;
+
+static Sim_Sensor_TypeDef sim_sensors[SIM_SENSOR_COUNT] = {
+    [SIM_SENSOR_MAG] = { .address = 0x1E, .int_port_pin = 2, .out_reg = 0x68 },
+    [SIM_SENSOR_ACC] = { .address = 0x19, .int_port_pin = 4, .out_reg = 0x28 },
+    [SIM_SENSOR_GYR] = { .address = 0x6B, .int_port_pin = 1, .out_reg = 0x28 },
+};
+
+static void Sim_Default_Source(uint8_t sensor, uint32_t n, uint64_t time_us, int16_t data[3]) {
+    (void)time_us;
+    data[0] = (int16_t)n;
+    data[1] = (int16_t)-n;
+    data[2] = sensor;
+}
+
+static Sim_Sensor_Source_TypeDef sim_source = Sim_Default_Source;
+
+/* Sensors -------------------------------------------------------------------*/
+
+static float Sim_Configured_Odr(uint8_t sensor) {
+    static const float acc_hz[16] = { 0, 1, 10, 25, 50, 100, 200, 400, 1620, 1344,
+                                      1344, 1344, 1344, 1344, 1344, 1344 };
+    static const float mag_hz[4] = { 10, 20, 50, 100 };
+    static const float gyro_hz[4] = { 95, 190, 380, 760 };
+    const uint8_t *regs = sim_sensors[sensor].regs;
+
+    switch (sensor) {
+        case SIM_SENSOR_ACC:
+            return (regs[0x20] & 0x07) ? acc_hz[regs[0x20] >> 4] : 0;
+        case SIM_SENSOR_MAG:
+            return (regs[0x60] & 0x03) == 0 ? mag_hz[(regs[0x60] >> 2) & 0x03] : 0;  // continuous mode
+        default:
+            return (regs[0x20] & 0x08) ? gyro_hz[regs[0x20] >> 6] : 0;               // PD = normal mode
+    }
+}
+
+float Sim_Sensor_Odr(uint8_t sensor) {
+    float configured = Sim_Configured_Odr(sensor);
+    return configured > 0 && sim_sensors[sensor].odr_override > 0 ? sim_sensors[sensor].odr_override : configured;
+}
+
+static uint8_t Sim_Fifo_Mode(const Sim_Sensor_TypeDef *part, uint8_t sensor) {
+    if (sensor == SIM_SENSOR_MAG || !(part->regs[0x24] & 0x40)) {  // CTRL5 FIFO_EN
+        return SIM_FIFO_BYPASS;
+    }
+    uint8_t mode = sensor == SIM_SENSOR_ACC ? part->regs[0x2E] >> 6 : part->regs[0x2E] >> 5;
+    return mode == 0 ? SIM_FIFO_BYPASS : mode == 1 ? SIM_FIFO_FIFO : SIM_FIFO_STREAM;
+}
+
+static uint8_t Sim_Watermark(const Sim_Sensor_TypeDef *part) {
+    return part->fifo_count >= (part->regs[0x2E] & 0x1F);
+}
+
+/* The interrupt line follows the enabled condition as a level */
+static void Sim_Update_Line(uint8_t sensor) {
+    Sim_Sensor_TypeDef *part = &sim_sensors[sensor];
+    uint8_t fifo = Sim_Fifo_Mode(part, sensor) != SIM_FIFO_BYPASS;
+    uint8_t level = 0;
+
+    switch (sensor) {
+        case SIM_SENSOR_MAG:
+            level = (part->regs[0x62] & 0x01) && part->fresh;
+            break;
+        case SIM_SENSOR_ACC:  // CTRL3: I1_WTM bit 2, I1_DRDY1 bit 4
+            level = ((part->regs[0x22] & 0x04) && fifo && Sim_Watermark(part)) ||
+                    ((part->regs[0x22] & 0x10) && (fifo ? part->fifo_count > 0 : part->fresh));
+            break;
+        default:              // CTRL3: I2_WTM bit 2, I2_DRDY bit 3
+            level = ((part->regs[0x22] & 0x04) && fifo && Sim_Watermark(part)) ||
+                    ((part->regs[0x22] & 0x08) && (fifo ? part->fifo_count > 0 : part->fresh));
+            break;
+    }
+    if (level != part->line) {
+        part->line = level;
+        Sim_Gpio_Drive(SIM_PORT_E, part->int_port_pin, level);
+    }
+}
+
+static void Sim_Convert(void *context);
+
+static void Sim_Schedule(uint8_t sensor) {
+    Sim_Sensor_TypeDef *part = &sim_sensors[sensor];
+    float hz = Sim_Sensor_Odr(sensor);
+
+    part->generation++;
+    if (hz <= 0) {
+        return;
+    }
+    part->next_us = (double)Sim_Now_Us() + 1e6 / hz;
+    Sim_At((uint64_t)part->next_us, Sim_Convert, (void *)(((uintptr_t)part->generation << 2) | sensor));
+}
+
+/* One conversion: into the FIFO or the output registers */
+static void Sim_Convert(void *context) {
+    uint8_t sensor = (uintptr_t)context & 0x03;
+    Sim_Sensor_TypeDef *part = &sim_sensors[sensor];
+    int16_t data[3];
+
+    if ((uintptr_t)context >> 2 != (part->generation & (UINTPTR_MAX >> 2))) {
+        return;
+    }
+    sim_source(sensor, part->stats.produced++, Sim_Now_Us(), data);
+
+    switch (Sim_Fifo_Mode(part, sensor)) {
+        case SIM_FIFO_BYPASS:
+            if (part->fresh) {
+                part->stats.overwritten++;
+            }
+            memcpy(part->out, data, sizeof(part->out));
+            part->fresh = 1;
+            break;
+        case SIM_FIFO_FIFO:
+            if (part->fifo_count == SIM_FIFO_DEPTH) {
+                part->stats.overwritten++;  // FIFO mode stops collecting, the sample is lost
+                part->overrun = 1;
+                break;
+            }
+            memcpy(part->fifo[(part->fifo_start + part->fifo_count++) % SIM_FIFO_DEPTH], data, sizeof(data));
+            break;
+        default:
+            if (part->fifo_count == SIM_FIFO_DEPTH) {
+                part->stats.overwritten++;
+                part->overrun = 1;
+                part->fifo_start = (part->fifo_start + 1) % SIM_FIFO_DEPTH;
+                part->fifo_count--;
+            }
+            memcpy(part->fifo[(part->fifo_start + part->fifo_count++) % SIM_FIFO_DEPTH], data, sizeof(data));
+            break;
+    }
+    if (part->fifo_count > part->stats.fifo_peak) {
+        part->stats.fifo_peak = part->fifo_count;
+    }
+    Sim_Update_Line(sensor);
+
+    part->next_us += 1e6 / Sim_Sensor_Odr(sensor);
+    Sim_At((uint64_t)part->next_us, Sim_Convert, context);
+}
+
+static void Sim_Sensor_Write(uint8_t sensor, uint8_t reg, uint8_t value) {
+    Sim_Sensor_TypeDef *part = &sim_sensors[sensor];
+    float old_hz = Sim_Sensor_Odr(sensor);
+
+    reg &= 0x7F;
+    part->regs[reg] = value;
+    if (reg == 0x2E && Sim_Fifo_Mode(part, sensor) == SIM_FIFO_BYPASS) {
+        part->fifo_count = 0;  // bypass empties the FIFO
+        part->overrun = 0;
+    }
+    if (Sim_Sensor_Odr(sensor) != old_hz) {
+        Sim_Schedule(sensor);
+    }
+    Sim_Update_Line(sensor);
+}
+
+/* One register read with the side effects of the part: the last output
+   byte pops the FIFO or marks the sample read */
+static uint8_t Sim_Sensor_Read(uint8_t sensor, uint8_t reg) {
+    Sim_Sensor_TypeDef *part = &sim_sensors[sensor];
+    uint8_t fifo = Sim_Fifo_Mode(part, sensor) != SIM_FIFO_BYPASS;
+
+    if (reg == 0x0F && sensor != SIM_SENSOR_MAG) {
+        return sensor == SIM_SENSOR_ACC ? 0x33 : 0xD4;
+    }
+    if (reg == 0x4F && sensor == SIM_SENSOR_MAG) {
+        return 0x6E;
+    }
+    if (reg == 0x2F && sensor != SIM_SENSOR_MAG) {  // FIFO_SRC
+        return (Sim_Watermark(part) ? 0x80 : 0) | (part->overrun || part->fifo_count == SIM_FIFO_DEPTH ? 0x40 : 0) |
+               (part->fifo_count == 0 ? 0x20 : 0) | (part->fifo_count & 0x1F);
+    }
+    if (reg < part->out_reg || reg >= part->out_reg + 6) {
+        return part->regs[reg];
+    }
+    uint8_t index = reg - part->out_reg;
+    const int16_t *sample = fifo ? (part->fifo_count ? part->fifo[part->fifo_start] : part->last_popped) : part->out;
+    uint8_t value = (uint8_t)((uint16_t)sample[index / 2] >> (index % 2 ? 8 : 0));
+
+    if (index == 5) {
+        if (fifo && part->fifo_count) {
+            memcpy(part->last_popped, part->fifo[part->fifo_start], sizeof(part->last_popped));
+            part->fifo_start = (part->fifo_start + 1) % SIM_FIFO_DEPTH;
+            part->fifo_count--;
+            part->overrun = 0;
+            part->stats.read++;
+        } else if (!fifo && part->fresh) {
+            part->fresh = 0;
+            part->stats.read++;
+        }
+        Sim_Update_Line(sensor);
+    }
+    return value;
+}
+
+/* Next address of a burst; the output registers wrap while the FIFO is on */
+static uint8_t Sim_Next_Reg(uint8_t sensor, uint8_t reg) {
+    const Sim_Sensor_TypeDef *part = &sim_sensors[sensor];
+    if (reg == part->out_reg + 5 && Sim_Fifo_Mode(part, sensor) != SIM_FIFO_BYPASS) {
+        return part->out_reg;
+    }
+    return (reg + 1) & 0x7F;
+}
+
+static int Sim_Sensor_At(uint16_t address) {
+    for (uint8_t i = 0; i < SIM_SENSOR_COUNT; i++) {
+        if (sim_sensors[i].address == address) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Register auto-increment: bit 7 of the sub-address on the accelerometer and
+   the gyro, always on the magnetometer */
+static void Sim_Sensor_Burst_Read(uint8_t sensor, uint8_t sub, uint8_t *data, uint16_t size) {
+    uint8_t increment = sensor == SIM_SENSOR_MAG || (sub & 0x80);
+    uint8_t reg = sub & 0x7F;
+    for (uint16_t i = 0; i < size; i++) {
+        data[i] = Sim_Sensor_Read(sensor, reg);
+        if (increment) {
+            reg = Sim_Next_Reg(sensor, reg);
+        }
+    }
+}
+
+void Sim_Sensor_Set_Odr(uint8_t sensor, float hz) {
+    sim_sensors[sensor].odr_override = hz;
+    Sim_Schedule(sensor);
+}
+
+void Sim_Sensor_Set_Source(Sim_Sensor_Source_TypeDef source) {
+    sim_source = source ? source : Sim_Default_Source;
+}
+
+const Sim_Sensor_Stats_TypeDef *Sim_Sensor_Stats(uint8_t sensor) {
+    return &sim_sensors[sensor].stats;
+}
+
+uint8_t Sim_Sensor_Register(uint8_t sensor, uint8_t reg) {
+    return sim_sensors[sensor].regs[reg & 0x7F];
+}
+
+uint8_t Sim_Sensor_Fifo_Level(uint8_t sensor) {
+    return sim_sensors[sensor].fifo_count;
+}
+
+/* I2C1 ----------------------------------------------------------------------*/
+
+static uint8_t sim_i2c_busy = 0;      // a DMA read is on the bus
+static uint8_t sim_i2c_fail = 0;
+static uint8_t sim_i2c_failing = 0;   // the read in flight ends in an error
+static uint8_t sim_i2c_hold = 0;      // DMA reads do not complete while set
+static uint8_t sim_i2c_held = 0;      // a read finished on the bus while held
+static uint32_t sim_i2c_refusals = 0;
+static uint8_t sim_i2c_refuse = 0;    // DMA reads still to turn down
+static void (*sim_i2c_refuse_hook)(void);
+static I2C_HandleTypeDef *sim_i2c_handle;
+
+static uint32_t Sim_I2C_Time_Us(uint32_t bytes) {
+    return (bytes * SIM_I2C_BYTE_NS + 999) / 1000;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c) {
+    (void)hi2c;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef *hi2c, uint32_t AnalogFilter) {
+    (void)hi2c;
+    (void)AnalogFilter;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigDigitalFilter(I2C_HandleTypeDef *hi2c, uint32_t DigitalFilter) {
+    (void)hi2c;
+    (void)DigitalFilter;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                    uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    (void)hi2c;
+    (void)MemAddSize;
+    (void)Timeout;
+    if (sim_i2c_busy) {
+        sim_i2c_refusals++;
+        return HAL_BUSY;
+    }
+    int sensor = Sim_Sensor_At(DevAddress >> 1);
+    if (sensor < 0) {
+        Sim_Advance(Sim_I2C_Time_Us(1));  // address not acknowledged
+        return HAL_ERROR;
+    }
+    Sim_Advance(Sim_I2C_Time_Us(2 + Size));
+    uint8_t reg = MemAddress & 0x7F;
+    for (uint16_t i = 0; i < Size; i++) {
+        Sim_Sensor_Write(sensor, reg, pData[i]);
+        if (MemAddress & 0x80) {
+            reg = (reg + 1) & 0x7F;
+        }
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                   uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    (void)hi2c;
+    (void)MemAddSize;
+    (void)Timeout;
+    if (sim_i2c_busy) {
+        sim_i2c_refusals++;
+        return HAL_BUSY;
+    }
+    int sensor = Sim_Sensor_At(DevAddress >> 1);
+    if (sensor < 0) {
+        Sim_Advance(Sim_I2C_Time_Us(1));
+        return HAL_ERROR;
+    }
+    Sim_Advance(Sim_I2C_Time_Us(3 + Size));
+    Sim_Sensor_Burst_Read(sensor, MemAddress, pData, Size);
+    return HAL_OK;
+}
+
+static void Sim_I2C_Irq(void) {
+    sim_i2c_busy = 0;
+    if (sim_i2c_failing) {
+        sim_i2c_handle->ErrorCode = 0x04;  // HAL_I2C_ERROR_AF
+        HAL_I2C_ErrorCallback(sim_i2c_handle);
+    } else {
+        HAL_I2C_MemRxCpltCallback(sim_i2c_handle);
+    }
+}
+
+static void Sim_I2C_Done(void *context) {
+    (void)context;
+    if (sim_i2c_hold) {
+        sim_i2c_held = 1;
+        return;
+    }
+    Sim_Irq_Pend(SIM_IRQ_I2C1_DMA, Sim_I2C_Irq);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                       uint16_t MemAddSize, uint8_t *pData, uint16_t Size) {
+    (void)MemAddSize;
+    if (sim_i2c_busy) {
+        sim_i2c_refusals++;
+        return HAL_BUSY;
+    }
+    if (sim_i2c_refuse > 0) {
+        sim_i2c_refuse--;
+        if (sim_i2c_refuse_hook) {
+            sim_i2c_refuse_hook();
+        }
+        return HAL_BUSY;
+    }
+    int sensor = Sim_Sensor_At(DevAddress >> 1);
+    if (sensor < 0) {
+        return HAL_ERROR;
+    }
+    sim_i2c_busy = 1;
+    sim_i2c_handle = hi2c;
+    sim_i2c_failing = sim_i2c_fail > 0;
+    if (sim_i2c_failing) {
+        sim_i2c_fail--;
+    } else {
+        Sim_Sensor_Burst_Read(sensor, MemAddress, pData, Size);
+    }
+    Sim_At(Sim_Now_Us() + Sim_I2C_Time_Us(3 + Size), Sim_I2C_Done, NULL);
+    return HAL_OK;
+}
+
+void Sim_I2C_Fail_Next(uint8_t count) {
+    sim_i2c_fail = count;
+}
+
+/* The handle is taken, as by a blocking call the DMA start came into; the
+   hook runs in the caller's context before HAL_BUSY is returned, without
+   time moving, so an interrupt it raises is taken at the firmware's next
+   chance */
+void Sim_I2C_Refuse_Next(uint8_t count, void (*hook)(void)) {
+    sim_i2c_refuse = count;
+    sim_i2c_refuse_hook = hook;
+}
+
+/* A held bus does not finish the DMA read in flight until it is released,
+   like a sensor stretching the clock */
+void Sim_I2C_Hold(uint8_t held) {
+    sim_i2c_hold = held;
+    if (!held && sim_i2c_held) {
+        sim_i2c_held = 0;
+        Sim_Irq_Pend(SIM_IRQ_I2C1_DMA, Sim_I2C_Irq);
+    }
+}
+
+uint32_t Sim_I2C_Busy_Refusals(void) {
+    return sim_i2c_refusals;
+}
+
+/* SPI1 ----------------------------------------------------------------------*/
+
+static uint8_t sim_spi_selected = 0;
+static uint16_t sim_spi_byte = 0;      // bytes since CS went low
+static uint8_t sim_spi_address = 0;    // address byte of the transaction
+static uint8_t sim_spi_reg = 0;
+static uint8_t sim_spi_busy = 0;
+static SPI_HandleTypeDef *sim_spi_handle;
+static uint32_t sim_spi_blocking = 0;  // blocking calls, the ones the firmware wraps in pavza()
+static uint32_t sim_spi_dma = 0;
+static uint32_t sim_spi_selects = 0;
+
+void Sim_Spi_Select(uint8_t level) {
+    sim_spi_selected = !level;
+    sim_spi_selects += !level;
+    sim_spi_byte = 0;
+}
+
+/* One byte on the wire; the gyro answers while CS is low */
+static uint8_t Sim_Spi_Exchange(uint8_t out) {
+    if (!sim_spi_selected) {
+        return 0xFF;
+    }
+    if (sim_spi_byte++ == 0) {
+        sim_spi_address = out;
+        sim_spi_reg = out & 0x3F;
+        return 0xFF;
+    }
+    uint8_t in = 0xFF;
+    if (sim_spi_address & 0x80) {
+        in = Sim_Sensor_Read(SIM_SENSOR_GYR, sim_spi_reg);
+    } else {
+        Sim_Sensor_Write(SIM_SENSOR_GYR, sim_spi_reg, out);
+    }
+    if (sim_spi_address & 0x40) {  // MS bit: auto-increment
+        sim_spi_reg = Sim_Next_Reg(SIM_SENSOR_GYR, sim_spi_reg);
+    }
+    return in;
+}
+
+static uint32_t Sim_Spi_Time_Us(uint32_t bytes) {
+    return (bytes * SIM_SPI_BYTE_NS + 999) / 1000;
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData,
+                                          uint16_t Size, uint32_t Timeout) {
+    (void)hspi;
+    (void)Timeout;
+    if (sim_spi_busy) {
+        return HAL_BUSY;
+    }
+    sim_spi_blocking++;
+    Sim_Advance(Sim_Spi_Time_Us(Size));
+    for (uint16_t i = 0; i < Size; i++) {
+        uint8_t in = Sim_Spi_Exchange(pTxData ? pTxData[i] : 0x00);
+        if (pRxData) {
+            pRxData[i] = in;
+        }
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    return HAL_SPI_TransmitReceive(hspi, pData, NULL, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    return HAL_SPI_TransmitReceive(hspi, NULL, pData, Size, Timeout);
+}
+
+static void Sim_Spi_Irq(void) {
+    sim_spi_busy = 0;
+    HAL_SPI_TxRxCpltCallback(sim_spi_handle);
+}
+
+static void Sim_Spi_Done(void *context) {
+    (void)context;
+    Sim_Irq_Pend(SIM_IRQ_SPI1_DMA, Sim_Spi_Irq);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData,
+                                              uint16_t Size) {
+    if (sim_spi_busy) {
+        return HAL_BUSY;
+    }
+    for (uint16_t i = 0; i < Size; i++) {
+        pRxData[i] = Sim_Spi_Exchange(pTxData[i]);
+    }
+    sim_spi_busy = 1;
+    sim_spi_handle = hspi;
+    sim_spi_dma++;
+    Sim_At(Sim_Now_Us() + Sim_Spi_Time_Us(Size), Sim_Spi_Done, NULL);
+    return HAL_OK;
+}
+
+uint32_t Sim_Spi_Blocking_Transfers(void) {
+    return sim_spi_blocking;
+}
+
+uint32_t Sim_Spi_Dma_Transfers(void) {
+    return sim_spi_dma;
+}
+
+uint32_t Sim_Spi_Selects(void) {
+    return sim_spi_selects;
+}
@@ -0,0 +1,503 @@
+/**
+  ******************************************************************************
+  * @file           : sim_hal.c
+  * @brief          : Virtual clock, event timeline and interrupt dispatch of
+  *                   the host simulation, plus the core parts of the HAL
+  *                   stand-in: tick, delay, GPIO and EXTI, RCC and NVIC
+  *                   stubs and the flash pages, see sim.h.
+  *                   Time only moves when the firmware spends it: every
+  *                   HAL_GetTick() costs SIM_TICK_COST_US, blocking transfers
+  *                   and delays cost their bus time. Pending interrupts run
+  *                   whenever time moves with PRIMASK clear, and as soon as
+  *                   it is cleared.
+  ******************************************************************************
+  */
+
+#define _GNU_SOURCE
+#include "sim.h"
+#include "stm32f3xx_hal.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#define SIM_EVENTS_MAX 512
+#define SIM_APP_STACK_SIZE (1u << 20)
+
+typedef struct {
+    uint64_t time_us;
+    uint64_t order;       // insertion order, events at the same time run first in first out
+    void (*handler)(void *context);
+    void *context;
+} Sim_Event_TypeDef;
+
+GPIO_TypeDef sim_gpio[6];
+I2C_TypeDef sim_i2c1;
+SPI_TypeDef sim_spi1;
+USART_TypeDef sim_usart2;
+SysTick_Type sim_systick;
+SCB_Type sim_scb;
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+uint32_t SystemCoreClock = SIM_CPU_HZ;
+
+static uint64_t sim_now = 0;
+static Sim_Event_TypeDef sim_events[SIM_EVENTS_MAX];
+static uint16_t sim_event_count = 0;
+static uint64_t sim_event_order = 0;
+static uint8_t sim_in_event = 0;   // a model's event handler is running, no firmware code may
+static uint8_t sim_stalled = 0;
+
+static uint32_t sim_primask = 0;
+static uint8_t sim_isr_depth = 0;
+static uint32_t sim_irq_pending = 0;
+static void (*sim_irq_handlers[SIM_IRQ_COUNT])(void);
+
+static ucontext_t sim_test_context;
+static ucontext_t sim_app_context;
+static uint8_t sim_app_started = 0;
+static uint8_t sim_app_inside = 0;
+static uint8_t sim_app_finished = 0;
+static uint64_t sim_app_deadline = 0;
+
+static uint8_t sim_exti_port[16];        // port wired to each EXTI line
+static uint16_t sim_exti_rising = 0;
+static uint16_t sim_exti_falling = 0;
+static uint32_t sim_gpio_toggles[6][16];
+
+static uint32_t sim_flash_erases[SIM_FLASH_SIZE / SIM_FLASH_PAGE];
+
+int App_Main(void);
+
+/* Virtual clock -------------------------------------------------------------*/
+
+static void Sim_Set_Now(uint64_t now) {
+    sim_now = now;
+    sim_systick.VAL = sim_systick.LOAD - (uint32_t)((now % 1000) * (SIM_CPU_HZ / 1000000));
+    if (sim_dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+        sim_dwt.CYCCNT = (uint32_t)(now * (SIM_CPU_HZ / 1000000));
+    }
+}
+
+uint64_t Sim_Now_Us(void) {
+    return sim_now;
+}
+
+void Sim_At(uint64_t time_us, void (*handler)(void *context), void *context) {
+    if (sim_event_count == SIM_EVENTS_MAX) {
+        fprintf(stderr, "sim: event timeline full\n");
+        abort();
+    }
+    Sim_Event_TypeDef *event = &sim_events[sim_event_count++];
+    event->time_us = time_us < sim_now ? sim_now : time_us;
+    event->order = sim_event_order++;
+    event->handler = handler;
+    event->context = context;
+}
+
+/* Index of the earliest event due by target, or -1 */
+static int Sim_Next_Event(uint64_t target) {
+    int next = -1;
+    for (int i = 0; i < sim_event_count; i++) {
+        const Sim_Event_TypeDef *event = &sim_events[i];
+        if (event->time_us > target) {
+            continue;
+        }
+        if (next < 0 || event->time_us < sim_events[next].time_us ||
+            (event->time_us == sim_events[next].time_us && event->order < sim_events[next].order)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+static void Sim_Dispatch(void) {
+    if (sim_primask || sim_isr_depth || sim_stalled || sim_in_event) {
+        return;
+    }
+    while (sim_irq_pending) {
+        uint8_t irq = 0;
+        while (!(sim_irq_pending & (1u << irq))) {
+            irq++;
+        }
+        sim_irq_pending &= ~(1u << irq);
+        sim_isr_depth++;
+        sim_irq_handlers[irq]();
+        sim_isr_depth--;
+        if (sim_primask) {  // an ISR that returns with interrupts masked keeps them masked
+            return;
+        }
+    }
+}
+
+static void Sim_Run_Until(uint64_t target) {
+    int next;
+    while ((next = Sim_Next_Event(target)) >= 0) {
+        Sim_Event_TypeDef event = sim_events[next];
+        sim_events[next] = sim_events[--sim_event_count];
+        if (event.time_us > sim_now) {
+            Sim_Set_Now(event.time_us);
+        }
+        sim_in_event++;
+        event.handler(event.context);
+        sim_in_event--;
+        Sim_Dispatch();
+    }
+    if (target > sim_now) {
+        Sim_Set_Now(target);
+    }
+    Sim_Dispatch();
+}
+
+/* The CPU spends us; hardware keeps running and interrupts are taken */
+void Sim_Advance(uint32_t us) {
+    if (sim_in_event) {
+        fprintf(stderr, "sim: a model event handler called into the clock\n");
+        abort();
+    }
+    Sim_Run_Until(sim_now + us);
+    if (sim_app_inside && !sim_isr_depth && sim_now >= sim_app_deadline) {
+        swapcontext(&sim_app_context, &sim_test_context);
+    }
+}
+
+/* The CPU is stalled (flash erase or program): hardware runs, interrupts wait */
+void Sim_Stall(uint32_t us) {
+    sim_stalled++;
+    Sim_Run_Until(sim_now + us);
+    sim_stalled--;
+    Sim_Dispatch();
+}
+
+void Sim_Irq_Pend(uint8_t irq, void (*handler)(void)) {
+    sim_irq_handlers[irq] = handler;
+    sim_irq_pending |= 1u << irq;
+}
+
+uint8_t Sim_In_Isr(void) {
+    return sim_isr_depth != 0;
+}
+
+void __disable_irq(void) {
+    sim_primask = 1;
+}
+
+void __enable_irq(void) {
+    sim_primask = 0;
+    Sim_Dispatch();
+}
+
+uint32_t __get_PRIMASK(void) {
+    return sim_primask;
+}
+
+void __set_PRIMASK(uint32_t primask) {
+    sim_primask = primask & 1;
+    Sim_Dispatch();
+}
+
+/* Firmware context ----------------------------------------------------------*/
+
+__attribute__((weak)) int App_Main(void) {
+    return 0;
+}
+
+static void Sim_App_Entry(void) {
+    App_Main();
+    sim_app_finished = 1;
+    swapcontext(&sim_app_context, &sim_test_context);
+}
+
+void Sim_App_Run(uint32_t ms) {
+    if (sim_app_finished) {
+        Sim_Idle(ms);
+        return;
+    }
+    sim_app_deadline = sim_now + (uint64_t)ms * 1000;
+    if (!sim_app_started) {
+        getcontext(&sim_app_context);
+        sim_app_context.uc_stack.ss_sp = malloc(SIM_APP_STACK_SIZE);
+        sim_app_context.uc_stack.ss_size = SIM_APP_STACK_SIZE;
+        sim_app_context.uc_link = NULL;
+        makecontext(&sim_app_context, Sim_App_Entry, 0);
+        sim_app_started = 1;
+    }
+    sim_app_inside = 1;
+    swapcontext(&sim_test_context, &sim_app_context);
+    sim_app_inside = 0;
+}
+
+void Sim_Idle(uint32_t ms) {
+    uint64_t target = sim_now + (uint64_t)ms * 1000;
+    while (sim_now < target) {
+        Sim_Run_Until(target);
+    }
+}
+
+/* Core HAL ------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_Init(void) {
+    sim_systick.LOAD = SIM_CPU_HZ / 1000 - 1;
+    Sim_Set_Now(sim_now);
+    return HAL_OK;
+}
+
+void HAL_IncTick(void) {
+}
+
+uint32_t HAL_GetTick(void) {
+    Sim_Advance(SIM_TICK_COST_US);
+    return (uint32_t)(sim_now / 1000);
+}
+
+/* Waits at least Delay ms, like the HAL: the tick it starts in does not count */
+void HAL_Delay(uint32_t Delay) {
+    uint32_t start = HAL_GetTick();
+    uint32_t wait = Delay < HAL_MAX_DELAY ? Delay + 1 : Delay;
+    while (HAL_GetTick() - start < wait) {
+        Sim_Advance(50);
+    }
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct) {
+    (void)RCC_OscInitStruct;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency) {
+    (void)RCC_ClkInitStruct;
+    (void)FLatency;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCCEx_PeriphCLKConfig(RCC_PeriphCLKInitTypeDef *PeriphClkInit) {
+    (void)PeriphClkInit;
+    return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+    return SIM_CPU_HZ / 2;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority) {
+    (void)IRQn;
+    (void)PreemptPriority;
+    (void)SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+    (void)IRQn;
+}
+
+/* The firmware formats uint32_t with %lu and %lx, see stm32f3xx_hal.h */
+int Sim_Snprintf(char *buffer, size_t size, const char *format, ...) {
+    char host_format[512];
+    size_t length = 0;
+    va_list arguments;
+
+    for (const char *c = format; *c && length < sizeof(host_format) - 1; c++) {
+        host_format[length++] = *c;
+        if (*c != '%') {
+            continue;
+        }
+        while (c[1] && strchr("-+ #0123456789.*", c[1]) && length < sizeof(host_format) - 1) {
+            host_format[length++] = *++c;
+        }
+        if (c[1] == 'l' && c[2] && strchr("diuxX", c[2])) {
+            c++;  // drop the length modifier
+        }
+    }
+    host_format[length] = '\0';
+    va_start(arguments, format);
+    int result = vsnprintf(buffer, size, host_format, arguments);
+    va_end(arguments);
+    return result;
+}
+
+/* GPIO and EXTI -------------------------------------------------------------*/
+
+static uint8_t Sim_Port_Index(const GPIO_TypeDef *port) {
+    return (uint8_t)(port - sim_gpio);
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        if (!(GPIO_Init->Pin & (1u << pin))) {
+            continue;
+        }
+        if (GPIO_Init->Mode == GPIO_MODE_IT_RISING || GPIO_Init->Mode == GPIO_MODE_IT_RISING_FALLING ||
+            GPIO_Init->Mode == GPIO_MODE_IT_FALLING) {
+            sim_exti_port[pin] = Sim_Port_Index(GPIOx);
+            sim_exti_rising = (sim_exti_rising & ~(1u << pin)) |
+                              (GPIO_Init->Mode != GPIO_MODE_IT_FALLING ? 1u << pin : 0);
+            sim_exti_falling = (sim_exti_falling & ~(1u << pin)) |
+                               (GPIO_Init->Mode != GPIO_MODE_IT_RISING ? 1u << pin : 0);
+        }
+    }
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+    return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+    uint32_t previous = GPIOx->ODR;
+    GPIOx->ODR = PinState == GPIO_PIN_SET ? previous | GPIO_Pin : previous & ~(uint32_t)GPIO_Pin;
+    if (GPIOx == GPIOE && (GPIO_Pin & GPIO_PIN_3) && ((previous ^ GPIOx->ODR) & GPIO_PIN_3)) {
+        Sim_Spi_Select(PinState == GPIO_PIN_SET);
+    }
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+    GPIOx->ODR ^= GPIO_Pin;
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        if (GPIO_Pin & (1u << pin)) {
+            sim_gpio_toggles[Sim_Port_Index(GPIOx)][pin]++;
+        }
+    }
+}
+
+uint32_t Sim_Gpio_Toggles(uint8_t port, uint8_t pin) {
+    return sim_gpio_toggles[port][pin];
+}
+
+#define SIM_EXTI_HANDLER(line) \
+    static void Sim_Exti##line##_Handler(void) { HAL_GPIO_EXTI_Callback(1u << line); }
+SIM_EXTI_HANDLER(0)
+SIM_EXTI_HANDLER(1)
+SIM_EXTI_HANDLER(2)
+SIM_EXTI_HANDLER(3)
+SIM_EXTI_HANDLER(4)
+
+static void (*const sim_exti_handlers[5])(void) = {
+    Sim_Exti0_Handler, Sim_Exti1_Handler, Sim_Exti2_Handler, Sim_Exti3_Handler, Sim_Exti4_Handler
+};
+
+/* An input changes level; an enabled edge sets the line's pending bit */
+void Sim_Gpio_Drive(uint8_t port, uint8_t pin, uint8_t level) {
+    uint32_t mask = 1u << pin;
+    uint8_t previous = (sim_gpio[port].IDR & mask) != 0;
+
+    if (level) {
+        sim_gpio[port].IDR |= mask;
+    } else {
+        sim_gpio[port].IDR &= ~mask;
+    }
+    if (previous == level || pin > 4 || sim_exti_port[pin] != port) {
+        return;
+    }
+    if ((level && (sim_exti_rising & mask)) || (!level && (sim_exti_falling & mask))) {
+        Sim_Irq_Pend(SIM_IRQ_EXTI0 + pin, sim_exti_handlers[pin]);
+    }
+}
+
+static void Sim_Button_Release(void *context) {
+    (void)context;
+    Sim_Gpio_Drive(SIM_PORT_A, 0, 0);
+}
+
+void Sim_Button_Press(uint32_t ms) {
+    Sim_Gpio_Drive(SIM_PORT_A, 0, 1);
+    Sim_At(sim_now + (uint64_t)ms * 1000, Sim_Button_Release, NULL);
+}
+
+/* Flash ---------------------------------------------------------------------*/
+
+/* The SPOOL and CONFIG regions live at their real addresses, so the
+   firmware's uint32_t casts of flash addresses stay valid on the host */
+__attribute__((constructor)) static void Sim_Flash_Map(void) {
+    void *flash = mmap((void *)(uintptr_t)SIM_FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != (void *)(uintptr_t)SIM_FLASH_BASE) {
+        perror("sim: cannot map the flash pages");
+        abort();
+    }
+    memset(flash, 0xFF, SIM_FLASH_SIZE);
+}
+
+static uint8_t Sim_Flash_Contains(uint32_t address, uint32_t length) {
+    return address >= SIM_FLASH_BASE && address + length <= SIM_FLASH_BASE + SIM_FLASH_SIZE;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *PageError) {
+    *PageError = 0xFFFFFFFFU;
+    for (uint32_t i = 0; i < pEraseInit->NbPages; i++) {
+        uint32_t page = pEraseInit->PageAddress + i * SIM_FLASH_PAGE;
+        if (page % SIM_FLASH_PAGE || !Sim_Flash_Contains(page, SIM_FLASH_PAGE)) {
+            *PageError = page;
+            return HAL_ERROR;
+        }
+        memset((void *)(uintptr_t)page, 0xFF, SIM_FLASH_PAGE);
+        sim_flash_erases[(page - SIM_FLASH_BASE) / SIM_FLASH_PAGE]++;
+        Sim_Stall(SIM_FLASH_ERASE_US);
+    }
+    return HAL_OK;
+}
+
+/* Like the F3 flash interface: a halfword that is not erased can only be
+   programmed to zero, anything else is a programming error */
+static void (*sim_flash_hook)(uintptr_t address) = NULL;
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+    if (TypeProgram != FLASH_TYPEPROGRAM_HALFWORD || Address % 2 || !Sim_Flash_Contains(Address, 2)) {
+        return HAL_ERROR;
+    }
+    volatile uint16_t *halfword = (volatile uint16_t *)(uintptr_t)Address;
+    if (*halfword != 0xFFFF && (uint16_t)Data != 0) {
+        return HAL_ERROR;
+    }
+    if (sim_flash_hook != NULL) {
+        sim_flash_hook(Address);
+    }
+    *halfword = (uint16_t)Data;
+    Sim_Stall(SIM_FLASH_PROGRAM_US);
+    return HAL_OK;
+}
+
+void Sim_Flash_On_Program(void (*hook)(uintptr_t address)) {
+    sim_flash_hook = hook;
+}
+
+uint32_t Sim_Flash_Erases(uintptr_t address) {
+    return sim_flash_erases[(address - SIM_FLASH_BASE) / SIM_FLASH_PAGE];
+}
+
+/* HAL callbacks the firmware does not define, as __weak in the HAL ----------*/
+
+__attribute__((weak)) void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+    (void)GPIO_Pin;
+}
+__attribute__((weak)) void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+    (void)hi2c;
+}
+__attribute__((weak)) void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+    (void)hi2c;
+}
+__attribute__((weak)) void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+}
+__attribute__((weak)) void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    (void)hspi;
+}
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    (void)huart;
+}
+__attribute__((weak)) void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+    (void)huart;
+}
+__attribute__((weak)) void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    (void)huart;
+}
+__attribute__((weak)) void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size) {
+    (void)huart;
+    (void)Size;
+}
@@ -0,0 +1,813 @@
+/**
+  ******************************************************************************
+  * @file           : sim_uart.c
+  * @brief          : USART2 of the HAL stand-in and the ESP8266 behind it.
+  *                   Bytes take 10 bit times at the rate each side is set to;
+  *                   when the two rates differ nothing gets through. Received
+  *                   bytes go into the circular DMA area of
+  *                   HAL_UARTEx_ReceiveToIdle_DMA() with the half, full and
+  *                   idle line events of the real peripheral.
+  *                   The ESP model answers the AT command set the firmware
+  *                   uses, keeps CIPMUX, the server and five link ids, and
+  *                   stands in for both ends of its TCP links: server.py
+  *                   (every CIPSEND payload on a link the firmware opened is
+  *                   parsed as an HTTP request, recorded and answered) and
+  *                   web page clients of CIPSERVER, injected by the test.
+  *                   Transparent mode ends on "+++" written alone after a
+  *                   pause; like the module, lines sent within a second of
+  *                   it are lost. The escape is kept in the transcript.
+  ******************************************************************************
+  */
+
+#include "sim.h"
+#include "stm32f3xx_hal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_UART_SLICE 16            // bytes the ESP output is delivered in
+#define SIM_UART_EVENTS 64
+#define SIM_ESP_OUT_SIZE (1u << 16)
+#define SIM_ESP_LINE_MAX 256
+#define SIM_ESP_RULES 16
+#define SIM_ESP_REPLIES 16
+#define SIM_ESP_ESCAPE_GAP_US 20000       // "+++" needs this much silence before it
+#define SIM_ESP_ESCAPE_SETTLE_US 1000000  // lines sent this soon after "+++" are lost
+
+#define SIM_ESP_COMMAND 0
+#define SIM_ESP_DATA 1               // collecting a CIPSEND payload
+#define SIM_ESP_TRANSPARENT 2
+
+#define SIM_LINK_CLOSED 0
+#define SIM_LINK_FIRMWARE 1
+#define SIM_LINK_WEB 2
+
+typedef struct {
+    char prefix[48];
+    char reply[256];
+    uint32_t delay_ms;
+    int32_t times;
+} Sim_Esp_Rule_TypeDef;
+
+typedef struct {
+    uint8_t used;
+    uint8_t command;      // the reply of a command, the module is busy until it went out
+    char text[512];
+    void (*then)(int argument);
+    int argument;
+} Sim_Esp_Reply_TypeDef;
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t size;
+} Sim_Capture_TypeDef;
+
+Sim_Esp_Config_TypeDef sim_esp = {
+    .present = 1,
+    .echo = 1,
+    .wifi_mode = 3,
+    .mux = 0,
+    .station_status = 2,
+    .baud = 115200,
+    .max_baud = 4000000,
+    .unstable_baud = 0,
+    .server_up = 1,
+    .server_replies = 1,
+    .server_reply_ms = 20,
+    .connect_ms = 40,
+    .join_ms = 3000,
+    .send_ms = 10,
+};
+
+/* UART side */
+static UART_HandleTypeDef *sim_uart_handle;
+static uint32_t sim_uart_baud = 0;
+static uint8_t *sim_rx_area = NULL;
+static uint16_t sim_rx_size = 0;
+static uint16_t sim_rx_position = 0;
+static uint8_t sim_rx_active = 0;
+static uint16_t sim_rx_events[SIM_UART_EVENTS];
+static uint8_t sim_rx_event_head = 0;
+static uint8_t sim_rx_event_tail = 0;
+static uint32_t sim_rx_generation = 0;    // bytes delivered, an idle line check is stale when it moved
+static uint32_t sim_garbled = 0;
+static const uint8_t *sim_tx_data;
+static uint16_t sim_tx_length;
+
+/* ESP side */
+static uint8_t sim_out[SIM_ESP_OUT_SIZE];
+static uint32_t sim_out_head = 0;
+static uint32_t sim_out_tail = 0;
+static uint8_t sim_out_running = 0;
+static uint32_t sim_pending_baud = 0;     // AT+UART_CUR, applied once the OK went out
+static uint8_t sim_esp_state = SIM_ESP_COMMAND;
+static char sim_line[SIM_ESP_LINE_MAX];
+static uint16_t sim_line_length = 0;
+static uint8_t sim_busy = 0;              // command replies not yet sent
+static uint8_t sim_server_running = 0;
+static uint8_t sim_max_connections = SIM_ESP_LINKS;
+static uint8_t sim_cipmode = 0;
+static uint8_t sim_links[SIM_ESP_LINKS];
+static uint8_t sim_send_link = 0;
+static uint16_t sim_send_expected = 0;
+static uint8_t sim_send_buffer[4096];
+static uint16_t sim_send_length = 0;
+static uint64_t sim_stream_last_us = 0;   // last write in transparent mode
+static uint64_t sim_escape_us = 0;        // when "+++" left transparent mode
+static uint8_t sim_escaped = 0;
+
+static Sim_Esp_Rule_TypeDef sim_rules[SIM_ESP_RULES];
+static Sim_Esp_Reply_TypeDef sim_replies[SIM_ESP_REPLIES];
+static Sim_Esp_Command_TypeDef *sim_transcript = NULL;
+static uint32_t sim_transcript_count = 0;
+static Sim_Http_Request_TypeDef *sim_requests = NULL;
+static uint32_t sim_request_count = 0;
+static Sim_Capture_TypeDef sim_stream;
+static Sim_Capture_TypeDef sim_web_reply;
+
+static uint32_t Sim_Byte_Ns(uint32_t baud) {
+    return (uint32_t)(10000000000ull / baud);
+}
+
+static void Sim_Capture(Sim_Capture_TypeDef *capture, const uint8_t *data, size_t length) {
+    if (capture->length + length > capture->size) {
+        capture->size = (capture->length + length) * 2 + 4096;
+        capture->data = realloc(capture->data, capture->size);
+    }
+    memcpy(capture->data + capture->length, data, length);
+    capture->length += length;
+}
+
+/* Receiver ------------------------------------------------------------------*/
+
+static void Sim_Rx_Irq(void) {
+    while (sim_rx_event_tail != sim_rx_event_head) {
+        uint16_t size = sim_rx_events[sim_rx_event_tail];
+        sim_rx_event_tail = (sim_rx_event_tail + 1) % SIM_UART_EVENTS;
+        HAL_UARTEx_RxEventCallback(sim_uart_handle, size);
+    }
+}
+
+static void Sim_Rx_Event(uint16_t size) {
+    sim_rx_events[sim_rx_event_head] = size;
+    sim_rx_event_head = (sim_rx_event_head + 1) % SIM_UART_EVENTS;
+    Sim_Irq_Pend(SIM_IRQ_USART2_DMA, Sim_Rx_Irq);
+}
+
+static void Sim_Rx_Byte(uint8_t byte) {
+    if (sim_esp.baud != sim_uart_baud || (sim_esp.unstable_baud && sim_esp.baud >= sim_esp.unstable_baud)) {
+        sim_garbled++;
+        return;
+    }
+    if (!sim_rx_active) {
+        return;
+    }
+    sim_rx_area[sim_rx_position++] = byte;
+    if (sim_rx_position == sim_rx_size / 2) {
+        Sim_Rx_Event(sim_rx_position);
+    } else if (sim_rx_position == sim_rx_size) {
+        Sim_Rx_Event(sim_rx_size);
+        sim_rx_position = 0;
+    }
+}
+
+static void Sim_Rx_Idle(void *context) {
+    if ((uintptr_t)context != sim_rx_generation || !sim_rx_active) {
+        return;
+    }
+    if (sim_rx_position > 0 && sim_rx_position < sim_rx_size) {
+        Sim_Rx_Event(sim_rx_position);
+    }
+}
+
+/* Next slice of the ESP output, one event per SIM_UART_SLICE bytes */
+static void Sim_Out_Slice(void *context) {
+    (void)context;
+    uint32_t count = 0;
+    while (sim_out_tail != sim_out_head && count < SIM_UART_SLICE) {
+        Sim_Rx_Byte(sim_out[sim_out_tail]);
+        sim_out_tail = (sim_out_tail + 1) % SIM_ESP_OUT_SIZE;
+        count++;
+    }
+    sim_rx_generation++;
+    uint32_t pending = (sim_out_head - sim_out_tail) % SIM_ESP_OUT_SIZE;
+    if (pending) {
+        uint32_t next = pending < SIM_UART_SLICE ? pending : SIM_UART_SLICE;
+        Sim_At(Sim_Now_Us() + (next * Sim_Byte_Ns(sim_esp.baud) + 999) / 1000, Sim_Out_Slice, NULL);
+        return;
+    }
+    sim_out_running = 0;
+    if (sim_pending_baud) {
+        sim_esp.baud = sim_pending_baud;
+        sim_pending_baud = 0;
+    }
+    Sim_At(Sim_Now_Us() + (Sim_Byte_Ns(sim_uart_baud ? sim_uart_baud : sim_esp.baud) + 999) / 1000, Sim_Rx_Idle,
+           (void *)(uintptr_t)sim_rx_generation);
+}
+
+static void Sim_Esp_Output(const char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if ((sim_out_head + 1) % SIM_ESP_OUT_SIZE == sim_out_tail) {
+            fprintf(stderr, "sim: ESP output queue full\n");
+            abort();
+        }
+        sim_out[sim_out_head] = (uint8_t)text[i];
+        sim_out_head = (sim_out_head + 1) % SIM_ESP_OUT_SIZE;
+    }
+    if (!sim_out_running && length) {
+        sim_out_running = 1;
+        uint32_t first = length < SIM_UART_SLICE ? (uint32_t)length : SIM_UART_SLICE;
+        Sim_At(Sim_Now_Us() + (first * Sim_Byte_Ns(sim_esp.baud) + 999) / 1000, Sim_Out_Slice, NULL);
+    }
+}
+
+static void Sim_Esp_Print(const char *text) {
+    Sim_Esp_Output(text, strlen(text));
+}
+
+/* Replies -------------------------------------------------------------------*/
+
+static void Sim_Reply_Due(void *context) {
+    Sim_Esp_Reply_TypeDef *reply = context;
+    Sim_Esp_Print(reply->text);
+    if (reply->command) {
+        sim_busy--;
+    }
+    reply->used = 0;
+    if (reply->then) {
+        reply->then(reply->argument);
+    }
+}
+
+static void Sim_Reply(uint32_t delay_ms, uint8_t command, const char *text, void (*then)(int), int argument) {
+    for (uint8_t i = 0; i < SIM_ESP_REPLIES; i++) {
+        Sim_Esp_Reply_TypeDef *reply = &sim_replies[i];
+        if (reply->used) {
+            continue;
+        }
+        reply->used = 1;
+        reply->command = command;
+        snprintf(reply->text, sizeof(reply->text), "%s", text);
+        reply->then = then;
+        reply->argument = argument;
+        sim_busy += command;
+        Sim_At(Sim_Now_Us() + (uint64_t)delay_ms * 1000, Sim_Reply_Due, reply);
+        return;
+    }
+    fprintf(stderr, "sim: too many ESP replies pending\n");
+    abort();
+}
+
+static void Sim_Answer(const char *text) {
+    Sim_Reply(0, 1, text, NULL, 0);
+}
+
+/* HTTP server and links -----------------------------------------------------*/
+
+static void Sim_Record(const char *text) {
+    if (!sim_transcript) {
+        sim_transcript = calloc(SIM_ESP_TRANSCRIPT_SIZE, sizeof(*sim_transcript));
+    }
+    if (sim_transcript_count < SIM_ESP_TRANSCRIPT_SIZE) {
+        Sim_Esp_Command_TypeDef *entry = &sim_transcript[sim_transcript_count];
+        entry->time_us = Sim_Now_Us();
+        snprintf(entry->text, sizeof(entry->text), "%s", text);
+    }
+    sim_transcript_count++;
+}
+
+static void Sim_Server_Reply(int link) {
+    char reply[160];
+    static const char body[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+
+    if (sim_links[link] != SIM_LINK_FIRMWARE || !sim_esp.server_replies) {
+        return;
+    }
+    snprintf(reply, sizeof(reply), "\r\n+IPD,%d,%u:%s", link, (unsigned)strlen(body), body);
+    Sim_Esp_Print(reply);
+}
+
+/* server.py receives a request: method and path from the request line, the
+   body after the blank line */
+static void Sim_Server_Receive(uint8_t link, const uint8_t *data, uint16_t length) {
+    if (!sim_requests) {
+        sim_requests = calloc(SIM_HTTP_REQUESTS_MAX, sizeof(*sim_requests));
+    }
+    if (sim_request_count == SIM_HTTP_REQUESTS_MAX) {
+        return;
+    }
+    Sim_Http_Request_TypeDef *request = &sim_requests[sim_request_count++];
+    const char *space = memchr(data, ' ', length);
+    const uint8_t *body = NULL;
+
+    request->time_us = Sim_Now_Us();
+    request->link = link;
+    if (space) {
+        size_t path_length = strcspn(space + 1, " \r\n");
+        if (path_length >= sizeof(request->path)) {
+            path_length = sizeof(request->path) - 1;
+        }
+        memcpy(request->path, space + 1, path_length);
+    }
+    for (uint16_t i = 0; i + 3 < length; i++) {
+        if (memcmp(&data[i], "\r\n\r\n", 4) == 0) {
+            body = &data[i + 4];
+            break;
+        }
+    }
+    request->length = body ? (uint16_t)(data + length - body) : 0;
+    request->body = malloc(request->length + 1);
+    memcpy(request->body, body ? body : data, request->length);
+    request->body[request->length] = '\0';
+}
+
+static void Sim_Send_Done(int link) {
+    if (sim_links[link] == SIM_LINK_FIRMWARE && sim_esp.server_replies) {
+        Sim_Reply(sim_esp.server_reply_ms, 0, "", Sim_Server_Reply, link);
+    }
+}
+
+static void Sim_Open_Link(int link) {
+    sim_links[link] = SIM_LINK_FIRMWARE;
+}
+
+static uint8_t Sim_Has_Ip(void) {
+    return sim_esp.station_status >= 2 && sim_esp.station_status <= 4;
+}
+
+static uint8_t Sim_Links_Open(void) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < SIM_ESP_LINKS; i++) {
+        count += sim_links[i] != SIM_LINK_CLOSED;
+    }
+    return count;
+}
+
+/* Commands ------------------------------------------------------------------*/
+
+static void Sim_Cipstart(const char *arguments) {
+    char text[96];
+    int link = 0;
+
+    if (arguments[0] >= '0' && arguments[0] <= '9') {
+        if (!sim_esp.mux) {
+            Sim_Answer("\r\nERROR\r\n");
+            return;
+        }
+        link = arguments[0] - '0';
+    } else if (sim_esp.mux) {
+        Sim_Answer("\r\nERROR\r\n");
+        return;
+    }
+    if (link >= SIM_ESP_LINKS) {
+        Sim_Answer("\r\nERROR\r\n");
+        return;
+    }
+    if (!Sim_Has_Ip()) {
+        Sim_Answer("\r\nno ip\r\n\r\nERROR\r\n");
+        return;
+    }
+    if (sim_links[link] != SIM_LINK_CLOSED) {
+        Sim_Answer("\r\nALREADY CONNECTED\r\n\r\nERROR\r\n");
+        return;
+    }
+    if (!sim_esp.server_up) {
+        snprintf(text, sizeof(text), sim_esp.mux ? "\r\n%d,CLOSED\r\n\r\nERROR\r\n" : "\r\nCLOSED\r\n\r\nERROR\r\n",
+                 link);
+        Sim_Reply(sim_esp.connect_ms, 1, text, NULL, 0);
+        return;
+    }
+    snprintf(text, sizeof(text), sim_esp.mux ? "\r\n%d,CONNECT\r\n\r\nOK\r\n" : "\r\nCONNECT\r\n\r\nOK\r\n", link);
+    sim_links[link] = SIM_LINK_WEB;  // taken now, owned once the connection is up
+    Sim_Reply(sim_esp.connect_ms, 1, text, Sim_Open_Link, link);
+}
+
+static void Sim_Cipsend(const char *arguments) {
+    int link = 0;
+    int length = 0;
+
+    if (arguments == NULL) {  // transparent mode
+        if (!sim_cipmode || sim_esp.mux || sim_links[0] != SIM_LINK_FIRMWARE) {
+            Sim_Answer("\r\nERROR\r\n");
+            return;
+        }
+        sim_esp_state = SIM_ESP_TRANSPARENT;
+        sim_stream_last_us = Sim_Now_Us();
+        Sim_Answer("\r\nOK\r\n\r\n>");
+        return;
+    }
+    if (sim_esp.mux ? sscanf(arguments, "%d,%d", &link, &length) != 2 : sscanf(arguments, "%d", &length) != 1) {
+        Sim_Answer("\r\nERROR\r\n");
+        return;
+    }
+    if (link < 0 || link >= SIM_ESP_LINKS || sim_links[link] == SIM_LINK_CLOSED) {
+        Sim_Answer("\r\nlink is not valid\r\n\r\nERROR\r\n");
+        return;
+    }
+    if (length <= 0 || length > 2048) {
+        Sim_Answer("\r\nERROR\r\n");
+        return;
+    }
+    sim_send_link = link;
+    sim_send_expected = length;
+    sim_send_length = 0;
+    sim_esp_state = SIM_ESP_DATA;
+    Sim_Answer("\r\nOK\r\n> ");
+}
+
+static void Sim_Cipclose(const char *arguments) {
+    char text[64];
+    int link = arguments ? atoi(arguments) : 0;
+
+    if (sim_esp.mux && link == SIM_ESP_LINKS) {  // all of them
+        size_t length = 0;
+        for (uint8_t i = 0; i < SIM_ESP_LINKS; i++) {
+            if (sim_links[i] != SIM_LINK_CLOSED) {
+                sim_links[i] = SIM_LINK_CLOSED;
+                length += snprintf(&text[length], sizeof(text) - length, "%u,CLOSED\r\n", i);
+            }
+        }
+        snprintf(&text[length], sizeof(text) - length, "\r\nOK\r\n");
+        Sim_Answer(text);
+        return;
+    }
+    if (link < 0 || link >= SIM_ESP_LINKS || sim_links[link] == SIM_LINK_CLOSED) {
+        Sim_Answer("\r\nUNLINK\r\n\r\nERROR\r\n");
+        return;
+    }
+    sim_links[link] = SIM_LINK_CLOSED;
+    snprintf(text, sizeof(text), sim_esp.mux ? "\r\n%d,CLOSED\r\n\r\nOK\r\n" : "\r\nCLOSED\r\n\r\nOK\r\n", link);
+    Sim_Answer(text);
+}
+
+static void Sim_Esp_Execute(char *line) {
+    char text[128];
+    const char *arguments = strchr(line, '=');
+
+    arguments = arguments ? arguments + 1 : NULL;
+    if (strcmp(line, "AT") == 0) {
+        Sim_Answer("\r\nOK\r\n");
+    } else if (strcmp(line, "ATE0") == 0 || strcmp(line, "ATE1") == 0) {
+        sim_esp.echo = line[3] == '1';
+        Sim_Answer("\r\nOK\r\n");
+    } else if (strcmp(line, "AT+CWMODE?") == 0) {
+        snprintf(text, sizeof(text), "+CWMODE:%u\r\n\r\nOK\r\n", sim_esp.wifi_mode);
+        Sim_Answer(text);
+    } else if (strncmp(line, "AT+CWMODE=", 10) == 0) {
+        sim_esp.wifi_mode = atoi(arguments);
+        Sim_Answer("\r\nOK\r\n");
+    } else if (strcmp(line, "AT+CIPMUX?") == 0) {
+        snprintf(text, sizeof(text), "+CIPMUX:%u\r\n\r\nOK\r\n", sim_esp.mux);
+        Sim_Answer(text);
+    } else if (strncmp(line, "AT+CIPMUX=", 10) == 0) {
+        if (sim_server_running || Sim_Links_Open()) {
+            Sim_Answer("\r\nERROR\r\n");
+        } else {
+            sim_esp.mux = atoi(arguments);
+            Sim_Answer("\r\nOK\r\n");
+        }
+    } else if (strncmp(line, "AT+CIPSERVERMAXCONN=", 20) == 0) {
+        int limit = atoi(arguments);
+        if (sim_server_running || limit < 1 || limit > SIM_ESP_LINKS) {
+            Sim_Answer("\r\nERROR\r\n");
+        } else {
+            sim_max_connections = limit;
+            Sim_Answer("\r\nOK\r\n");
+        }
+    } else if (strncmp(line, "AT+CIPSERVER=1", 14) == 0) {
+        if (!sim_esp.mux) {
+            Sim_Answer("\r\nERROR\r\n");
+        } else {
+            sim_server_running = 1;
+            Sim_Answer("\r\nOK\r\n");
+        }
+    } else if (strcmp(line, "AT+CIPSERVER=0") == 0) {
+        sim_server_running = 0;
+        Sim_Answer("\r\nOK\r\n");
+    } else if (strcmp(line, "AT+CIPSTATUS") == 0) {
+        uint8_t status = !Sim_Has_Ip() ? sim_esp.station_status : Sim_Links_Open() ? 3 : sim_esp.station_status;
+        snprintf(text, sizeof(text), "STATUS:%u\r\n\r\nOK\r\n", status);
+        Sim_Answer(text);
+    } else if (strncmp(line, "AT+CWJAP=", 9) == 0) {
+        char ssid[33] = { 0 };
+        sscanf(arguments, "\"%32[^\"]\"", ssid);
+        if (sim_esp.ap_ssid[0] == '\0' || strcmp(ssid, sim_esp.ap_ssid) == 0) {
+            sim_esp.station_status = 2;
+            Sim_Reply(sim_esp.join_ms, 1, "WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n", NULL, 0);
+        } else {
+            Sim_Reply(sim_esp.join_ms, 1, "+CWJAP:3\r\n\r\nFAIL\r\n", NULL, 0);
+        }
+    } else if (strncmp(line, "AT+UART_CUR=", 12) == 0) {
+        uint32_t baud = strtoul(arguments, NULL, 10);
+        if (baud == 0 || baud > sim_esp.max_baud) {
+            Sim_Answer("\r\nERROR\r\n");
+        } else {
+            sim_pending_baud = baud;
+            Sim_Answer("\r\nOK\r\n");
+        }
+    } else if (strncmp(line, "AT+CIPSTART=", 12) == 0) {
+        Sim_Cipstart(arguments);
+    } else if (strncmp(line, "AT+CIPMODE=", 11) == 0) {
+        int mode = atoi(arguments);
+        if (mode == 1 && sim_esp.mux) {
+            Sim_Answer("\r\nERROR\r\n");
+        } else {
+            sim_cipmode = mode;
+            Sim_Answer("\r\nOK\r\n");
+        }
+    } else if (strcmp(line, "AT+CIPSEND") == 0) {
+        Sim_Cipsend(NULL);
+    } else if (strncmp(line, "AT+CIPSEND=", 11) == 0) {
+        Sim_Cipsend(arguments);
+    } else if (strcmp(line, "AT+CIPCLOSE") == 0 || strncmp(line, "AT+CIPCLOSE=", 12) == 0) {
+        Sim_Cipclose(arguments);
+    } else {
+        Sim_Answer("\r\nERROR\r\n");
+    }
+}
+
+static void Sim_Esp_Line(void) {
+    sim_line[sim_line_length] = '\0';
+    sim_line_length = 0;
+    if (sim_line[0] == '\0') {
+        return;
+    }
+    Sim_Record(sim_line);
+    if (sim_escaped && Sim_Now_Us() - sim_escape_us < SIM_ESP_ESCAPE_SETTLE_US) {
+        return;
+    }
+    if (sim_esp.echo) {
+        Sim_Esp_Print(sim_line);
+        Sim_Esp_Print("\r\r\n");
+    }
+    if (sim_busy) {
+        Sim_Esp_Print("busy p...\r\n");
+        return;
+    }
+    for (uint8_t i = 0; i < SIM_ESP_RULES; i++) {
+        Sim_Esp_Rule_TypeDef *rule = &sim_rules[i];
+        if (rule->times != 0 && strncmp(sim_line, rule->prefix, strlen(rule->prefix)) == 0) {
+            if (rule->times > 0) {
+                rule->times--;
+            }
+            Sim_Reply(rule->delay_ms, 1, rule->reply, NULL, 0);
+            return;
+        }
+    }
+    Sim_Esp_Execute(sim_line);
+}
+
+static void Sim_Payload_Done(void) {
+    char text[48];
+    uint8_t link = sim_send_link;
+
+    snprintf(text, sizeof(text), "<%u bytes>", sim_send_length);
+    Sim_Record(text);
+    sim_esp_state = SIM_ESP_COMMAND;
+    if (sim_links[link] == SIM_LINK_FIRMWARE) {
+        Sim_Server_Receive(link, sim_send_buffer, sim_send_length);
+    } else {
+        Sim_Capture(&sim_web_reply, sim_send_buffer, sim_send_length);
+    }
+    snprintf(text, sizeof(text), "\r\nRecv %u bytes\r\n", sim_send_length);
+    Sim_Esp_Print(text);
+    Sim_Reply(sim_esp.send_ms, 1, "\r\nSEND OK\r\n", Sim_Send_Done, link);
+}
+
+/* One write of the firmware arrives at the ESP */
+static void Sim_Esp_Receive(const uint8_t *data, uint16_t length) {
+    if (!sim_esp.present) {
+        return;
+    }
+    if (sim_uart_baud != sim_esp.baud) {
+        sim_garbled += length;
+        return;
+    }
+    if (sim_esp.unstable_baud && sim_esp.baud >= sim_esp.unstable_baud && sim_esp.unstable_misses > 0) {
+        sim_esp.unstable_misses--;
+        sim_garbled += length;
+        return;
+    }
+    if (sim_esp_state == SIM_ESP_TRANSPARENT) {
+        /* The escape is a write of its own after a pause, else it is data */
+        if (length == 3 && memcmp(data, "+++", 3) == 0 &&
+            Sim_Now_Us() - sim_stream_last_us >= SIM_ESP_ESCAPE_GAP_US) {
+            Sim_Record("+++");
+            sim_esp_state = SIM_ESP_COMMAND;
+            sim_escape_us = Sim_Now_Us();
+            sim_escaped = 1;
+            return;
+        }
+        Sim_Capture(&sim_stream, data, length);
+        sim_stream_last_us = Sim_Now_Us();
+        return;
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        if (sim_esp_state == SIM_ESP_DATA) {
+            sim_send_buffer[sim_send_length++] = data[i];
+            if (sim_send_length == sim_send_expected) {
+                Sim_Payload_Done();
+            }
+            continue;
+        }
+        if (data[i] == '\n') {
+            Sim_Esp_Line();
+        } else if (data[i] != '\r' && sim_line_length < SIM_ESP_LINE_MAX - 1) {
+            sim_line[sim_line_length++] = (char)data[i];
+        }
+    }
+}
+
+/* USART2 HAL ----------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart) {
+    sim_uart_handle = huart;
+    sim_uart_baud = huart->Init.BaudRate;
+    sim_rx_active = 0;
+    huart->gState = HAL_UART_STATE_READY;
+    huart->RxState = HAL_UART_STATE_READY;
+    huart->ErrorCode = 0;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+    (void)Timeout;
+    if (huart->gState != HAL_UART_STATE_READY) {
+        return HAL_BUSY;
+    }
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    Sim_Advance((uint32_t)(((uint64_t)Size * Sim_Byte_Ns(sim_uart_baud) + 999) / 1000));
+    huart->gState = HAL_UART_STATE_READY;
+    Sim_Esp_Receive(pData, Size);
+    return HAL_OK;
+}
+
+static void Sim_Tx_Irq(void) {
+    sim_uart_handle->gState = HAL_UART_STATE_READY;
+    HAL_UART_TxCpltCallback(sim_uart_handle);
+}
+
+static void Sim_Tx_Done(void *context) {
+    (void)context;
+    Sim_Esp_Receive(sim_tx_data, sim_tx_length);
+    Sim_Irq_Pend(SIM_IRQ_USART2, Sim_Tx_Irq);
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size) {
+    if (huart->gState != HAL_UART_STATE_READY) {
+        return HAL_BUSY;
+    }
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    sim_tx_data = pData;
+    sim_tx_length = Size;
+    Sim_At(Sim_Now_Us() + ((uint64_t)Size * Sim_Byte_Ns(sim_uart_baud) + 999) / 1000, Sim_Tx_Done, NULL);
+    return HAL_OK;
+}
+
+/* Only the DMA reception is modelled (USE_UART_DMA) */
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+    (void)huart;
+    (void)pData;
+    (void)Size;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size) {
+    if (huart->RxState != HAL_UART_STATE_READY) {
+        return HAL_BUSY;
+    }
+    sim_uart_handle = huart;
+    sim_rx_area = pData;
+    sim_rx_size = Size;
+    sim_rx_position = 0;
+    sim_rx_active = 1;
+    huart->RxState = HAL_UART_STATE_BUSY_RX;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart) {
+    sim_rx_active = 0;
+    sim_rx_event_tail = sim_rx_event_head;
+    huart->RxState = HAL_UART_STATE_READY;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive_IT(UART_HandleTypeDef *huart) {
+    return HAL_UART_AbortReceive(huart);
+}
+
+/* Test interface ------------------------------------------------------------*/
+
+void Sim_Esp_Rule(const char *prefix, const char *reply, uint32_t delay_ms, int32_t times) {
+    for (uint8_t i = 0; i < SIM_ESP_RULES; i++) {
+        Sim_Esp_Rule_TypeDef *rule = &sim_rules[i];
+        if (rule->times == 0 || strcmp(rule->prefix, prefix) == 0) {
+            snprintf(rule->prefix, sizeof(rule->prefix), "%s", prefix);
+            snprintf(rule->reply, sizeof(rule->reply), "%s", reply);
+            rule->delay_ms = delay_ms;
+            rule->times = times;
+            return;
+        }
+    }
+    fprintf(stderr, "sim: too many ESP rules\n");
+    abort();
+}
+
+void Sim_Esp_Inject(const char *text) {
+    Sim_Esp_Print(text);
+}
+
+/* A browser connects to the page server and sends request */
+int Sim_Esp_Web_Request(const char *request) {
+    char text[64];
+
+    if (!sim_server_running) {
+        return -1;
+    }
+    for (uint8_t link = 0; link < sim_max_connections; link++) {
+        if (sim_links[link] == SIM_LINK_CLOSED) {
+            sim_links[link] = SIM_LINK_WEB;
+            snprintf(text, sizeof(text), "%u,CONNECT\r\n\r\n+IPD,%u,%u:", link, link, (unsigned)strlen(request));
+            Sim_Esp_Print(text);
+            Sim_Esp_Print(request);
+            return link;
+        }
+    }
+    return -1;
+}
+
+void Sim_Esp_Close_Link(uint8_t link) {
+    char text[32];
+    if (sim_links[link] == SIM_LINK_CLOSED) {
+        return;
+    }
+    sim_links[link] = SIM_LINK_CLOSED;
+    snprintf(text, sizeof(text), sim_esp.mux ? "%u,CLOSED\r\n" : "CLOSED\r\n", link);
+    Sim_Esp_Print(text);
+}
+
+void Sim_Esp_Wifi_Lost(void) {
+    for (uint8_t link = 0; link < SIM_ESP_LINKS; link++) {
+        Sim_Esp_Close_Link(link);
+    }
+    sim_esp.station_status = 5;
+    Sim_Esp_Print("WIFI DISCONNECT\r\n");
+}
+
+void Sim_Esp_Wifi_Back(void) {
+    sim_esp.station_status = 2;
+    Sim_Esp_Print("WIFI CONNECTED\r\nWIFI GOT IP\r\n");
+}
+
+uint8_t Sim_Esp_Link_Owner(uint8_t link) {
+    return sim_links[link];
+}
+
+uint8_t Sim_Esp_Transparent(void) {
+    return sim_esp_state == SIM_ESP_TRANSPARENT;
+}
+
+uint32_t Sim_Esp_Count(const char *prefix) {
+    uint32_t count = 0;
+    uint32_t stored = sim_transcript_count < SIM_ESP_TRANSCRIPT_SIZE ? sim_transcript_count : SIM_ESP_TRANSCRIPT_SIZE;
+    for (uint32_t i = 0; i < stored; i++) {
+        count += strncmp(sim_transcript[i].text, prefix, strlen(prefix)) == 0;
+    }
+    return count;
+}
+
+uint32_t Sim_Esp_Command_Count(void) {
+    return sim_transcript_count < SIM_ESP_TRANSCRIPT_SIZE ? sim_transcript_count : SIM_ESP_TRANSCRIPT_SIZE;
+}
+
+const Sim_Esp_Command_TypeDef *Sim_Esp_Command(uint32_t index) {
+    return &sim_transcript[index];
+}
+
+void Sim_Esp_Print_Transcript(FILE *out) {
+    for (uint32_t i = 0; i < Sim_Esp_Command_Count(); i++) {
+        fprintf(out, "%10.3f ms  %s\n", sim_transcript[i].time_us / 1000.0, sim_transcript[i].text);
+    }
+}
+
+uint32_t Sim_Http_Request_Count(void) {
+    return sim_request_count;
+}
+
+const Sim_Http_Request_TypeDef *Sim_Http_Request(uint32_t index) {
+    return &sim_requests[index];
+}
+
+const uint8_t *Sim_Esp_Stream(size_t *length) {
+    *length = sim_stream.length;
+    return sim_stream.data;
+}
+
+const uint8_t *Sim_Esp_Web_Reply(size_t *length) {
+    *length = sim_web_reply.length;
+    return sim_web_reply.data;
+}
+
+uint32_t Sim_Uart_Garbled(void) {
+    return sim_garbled;
+}
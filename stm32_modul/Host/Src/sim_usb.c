@@ -0,0 +1,143 @@
+/**
+  ******************************************************************************
+  * @file           : sim_usb.c
+  * @brief          : USB device stand-in for the CDC interface of
+  *                   usbd_cdc_if.c: the CDC class handle with its TxState,
+  *                   USBD_CDC_TransmitPacket() completing after the time the
+  *                   host takes to poll the IN endpoint, and OUT packets
+  *                   handed to the interface's Receive callback. Everything
+  *                   the firmware sends is captured for the tests; the host
+  *                   side can be stalled to fill the transmit ring.
+  ******************************************************************************
+  */
+
+#include "sim.h"
+#include "usb_device.h"
+#include "usbd_cdc_if.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_USB_POLL_US 50          // IN token to the first byte
+#define SIM_USB_BYTE_NS 1000        // about 1 MB/s of bulk throughput at full speed
+#define SIM_USB_RX_SIZE 4096
+
+USBD_HandleTypeDef hUsbDeviceFS;
+static USBD_CDC_HandleTypeDef sim_cdc;
+
+static uint8_t *sim_captured = NULL;
+static size_t sim_captured_length = 0;
+static uint8_t sim_stalled = 0;
+static uint8_t sim_tx_ready = 0;     // the IN transfer ended, TransmitCplt is due
+static uint8_t sim_tx_held = 0;      // the IN transfer waits for the host to poll again
+static uint32_t sim_transfers = 0;
+static uint8_t sim_rx[SIM_USB_RX_SIZE];
+static size_t sim_rx_length = 0;
+
+static USBD_CDC_ItfTypeDef *Sim_Fops(void) {
+    return (USBD_CDC_ItfTypeDef *)hUsbDeviceFS.pUserData;
+}
+
+static void Sim_Usb_Irq(void) {
+    if (sim_tx_ready) {
+        uint32_t length = sim_cdc.TxLength;
+        sim_tx_ready = 0;
+        sim_cdc.TxState = 0;
+        Sim_Fops()->TransmitCplt(sim_cdc.TxBuffer, &length, 1);
+    }
+    size_t offset = 0;
+    while (offset < sim_rx_length) {
+        uint32_t length = sim_rx_length - offset < CDC_DATA_FS_MAX_PACKET_SIZE ? sim_rx_length - offset
+                                                                               : CDC_DATA_FS_MAX_PACKET_SIZE;
+        Sim_Fops()->Receive(&sim_rx[offset], &length);
+        offset += length;
+    }
+    sim_rx_length = 0;
+}
+
+static void Sim_Usb_Complete(void *context) {
+    (void)context;
+    if (sim_stalled) {
+        sim_tx_held = 1;
+        return;
+    }
+    if (sim_captured == NULL) {
+        sim_captured = malloc(SIM_USB_CAPTURE_SIZE);
+    }
+    uint32_t length = sim_cdc.TxLength;
+    if (sim_captured_length + length > SIM_USB_CAPTURE_SIZE) {
+        length = SIM_USB_CAPTURE_SIZE - sim_captured_length;
+    }
+    memcpy(sim_captured + sim_captured_length, sim_cdc.TxBuffer, length);
+    sim_captured_length += length;
+    sim_transfers++;
+    sim_tx_ready = 1;
+    Sim_Irq_Pend(SIM_IRQ_USB, Sim_Usb_Irq);
+}
+
+void MX_USB_DEVICE_Init(void) {
+    hUsbDeviceFS.pClassData = &sim_cdc;
+    hUsbDeviceFS.pUserData = &USBD_Interface_fops_FS;
+    Sim_Fops()->Init();
+}
+
+uint8_t USBD_CDC_SetTxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff, uint16_t length) {
+    USBD_CDC_HandleTypeDef *hcdc = pdev->pClassData;
+    hcdc->TxBuffer = pbuff;
+    hcdc->TxLength = length;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_SetRxBuffer(USBD_HandleTypeDef *pdev, uint8_t *pbuff) {
+    USBD_CDC_HandleTypeDef *hcdc = pdev->pClassData;
+    hcdc->RxBuffer = pbuff;
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef *pdev) {
+    USBD_CDC_HandleTypeDef *hcdc = pdev->pClassData;
+    if (hcdc->TxState != 0) {
+        return USBD_BUSY;
+    }
+    hcdc->TxState = 1;
+    Sim_At(Sim_Now_Us() + SIM_USB_POLL_US + (hcdc->TxLength * SIM_USB_BYTE_NS) / 1000, Sim_Usb_Complete, NULL);
+    return USBD_OK;
+}
+
+uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef *pdev) {
+    (void)pdev;
+    return USBD_OK;
+}
+
+const uint8_t *Sim_Usb_Captured(size_t *length) {
+    *length = sim_captured_length;
+    return sim_captured;
+}
+
+void Sim_Usb_Clear(void) {
+    sim_captured_length = 0;
+}
+
+/* The host sends text on the OUT endpoint */
+void Sim_Usb_Send(const char *text) {
+    size_t length = strlen(text);
+    if (sim_rx_length + length > SIM_USB_RX_SIZE) {
+        length = SIM_USB_RX_SIZE - sim_rx_length;
+    }
+    memcpy(&sim_rx[sim_rx_length], text, length);
+    sim_rx_length += length;
+    Sim_Irq_Pend(SIM_IRQ_USB, Sim_Usb_Irq);
+}
+
+/* A stalled host stops polling the IN endpoint: the transfer in flight does
+   not complete until it is released */
+void Sim_Usb_Stall(uint8_t stalled) {
+    sim_stalled = stalled;
+    if (!stalled && sim_tx_held) {
+        sim_tx_held = 0;
+        Sim_At(Sim_Now_Us() + SIM_USB_POLL_US, Sim_Usb_Complete, NULL);
+    }
+}
+
+uint32_t Sim_Usb_Transfers(void) {
+    return sim_transfers;
+}
@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file           : esp_script.h
+  * @brief          : Checks on the AT transcript the simulated ESP keeps,
+  *                   for the tests that script a session against it. A
+  *                   script is the command lines the module must receive
+  *                   back to back; a line ending in '*' matches any command
+  *                   starting with the rest. On a mismatch the transcript is
+  *                   printed.
+  ******************************************************************************
+  */
+
+#ifndef __ESP_SCRIPT_H
+#define __ESP_SCRIPT_H
+
+#include "sim.h"
+#include "sim_test.h"
+#include <string.h>
+
+#define ESP_SCRIPT_LINES(script) (sizeof(script) / sizeof(script[0]))
+
+static inline uint8_t Esp_Script_Line_Matches(const char *text, const char *line) {
+    size_t length = strlen(line);
+    if (length > 0 && line[length - 1] == '*') {
+        return strncmp(text, line, length - 1) == 0;
+    }
+    return strcmp(text, line) == 0;
+}
+
+/* Index of the first command at or after from that matches line, or the
+   command count when there is none */
+static inline uint32_t Esp_Script_Find(uint32_t from, const char *line) {
+    uint32_t count = Sim_Esp_Command_Count();
+    while (from < count && !Esp_Script_Line_Matches(Sim_Esp_Command(from)->text, line)) {
+        from++;
+    }
+    return from;
+}
+
+/* The commands from index first on have to be the script, nothing between
+   its lines; returns the index after the last one */
+static inline uint32_t Esp_Script_Expect(uint32_t first, const char *const *script, uint32_t lines) {
+    uint32_t index = first;
+    for (uint32_t i = 0; i < lines; i++, index++) {
+        const char *text = index < Sim_Esp_Command_Count() ? Sim_Esp_Command(index)->text : "(nothing)";
+        if (!Esp_Script_Line_Matches(text, script[i])) {
+            fprintf(stderr, "command %u: expected %s, got %s\n", index, script[i], text);
+            Sim_Esp_Print_Transcript(stderr);
+            sim_test_failures++;
+            return index;
+        }
+    }
+    return index;
+}
+
+static inline double Esp_Script_Time_S(uint32_t index) {
+    return index < Sim_Esp_Command_Count() ? Sim_Esp_Command(index)->time_us / 1e6 : -1;
+}
+
+#endif /* __ESP_SCRIPT_H */
@@ -0,0 +1,77 @@
+/**
+  ******************************************************************************
+  * @file           : esp_transcript.h
+  * @brief          : Bytes an ESP8266 (AT firmware 1.7, echo on) sent during
+  *                   a warm start, a request on a CIPMUX link with the
+  *                   server's reply, a page request from a browser and the
+  *                   usual unsolicited lines, with the events at_parser.c
+  *                   has to produce from them. Shared by the replay test and
+  *                   the parser benchmark.
+  ******************************************************************************
+  */
+
+#ifndef __ESP_TRANSCRIPT_H
+#define __ESP_TRANSCRIPT_H
+
+#include "at_parser.h"
+
+static const char esp_transcript[] =
+    "AT\r\n\r\nOK\r\n"
+    "AT+CWMODE?\r\n+CWMODE:3\r\n\r\nOK\r\n"
+    "AT+CIPSTATUS\r\nSTATUS:2\r\n+CIPSTATUS:0,\"TCP\",\"172.20.10.11\",5000,4321,0\r\n\r\nOK\r\n"
+    "AT+CIPSTART=4,\"TCP\",\"172.20.10.11\",5000\r\n4,CONNECT\r\n\r\nOK\r\n"
+    "AT+CIPSEND=4,5\r\n\r\nOK\r\n> "
+    "\r\nRecv 5 bytes\r\n\r\nSEND OK\r\n"
+    // the body's OK line is payload, not a reply
+    "\r\n+IPD,4,42:HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nOK\r\n"
+    "4,CLOSED\r\n"
+    "AT+CIPSEND=3,5\r\nbusy p...\r\n"
+    "WIFI DISCONNECT\r\nWIFI CONNECTED\r\nWIFI GOT IP\r\n"
+    "+STA_CONNECTED:\"aa:bb:cc:dd:ee:ff\"\r\n"
+    "0,CONNECT\r\n\r\n+IPD,0,43:GET /?ssid=Lab&password=secret HTTP/1.1\r\n\r\n"
+    "AT+CIPSTART=3,\"TCP\",\"172.20.10.11\",5000\r\nALREADY CONNECTED\r\n\r\nERROR\r\n"
+    "AT+CIPSEND=3,5\r\n\r\nOK\r\n> \r\nRecv 5 bytes\r\n\r\nSEND FAIL\r\n"
+    "2,CONNECT FAIL\r\n"
+    "+STA_DISCONNECTED:\"aa:bb:cc:dd:ee:ff\"\r\n"
+    "\r\nFAIL\r\n"
+    "AT+CIPMUX?\r\n+CIPMUX:1\r\n\r\nOK\r\n"
+    "\r\n ets Jan  8 2013,rst cause:2, boot mode:(3,6)\r\n\r\nready\r\n";
+
+static const At_Event_TypeDef esp_transcript_events[] = {
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_CWMODE, AT_LINK_NONE, 3 },
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_STATUS, AT_LINK_NONE, 2 },
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_CONNECT, 4, 0 },
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_PROMPT, AT_LINK_NONE, 0 },
+    { AT_EVENT_SEND_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_IPD, 4, 42 },
+    { AT_EVENT_IPD_END, 4, 0 },
+    { AT_EVENT_CLOSED, 4, 0 },
+    { AT_EVENT_BUSY, AT_LINK_NONE, 0 },
+    { AT_EVENT_WIFI_DISCONNECT, AT_LINK_NONE, 0 },
+    { AT_EVENT_WIFI_CONNECTED, AT_LINK_NONE, 0 },
+    { AT_EVENT_WIFI_GOT_IP, AT_LINK_NONE, 0 },
+    { AT_EVENT_STA_CONNECTED, AT_LINK_NONE, 0 },
+    { AT_EVENT_CONNECT, 0, 0 },
+    { AT_EVENT_IPD, 0, 43 },
+    { AT_EVENT_IPD_END, 0, 0 },
+    { AT_EVENT_CONNECT, AT_LINK_NONE, 0 },
+    { AT_EVENT_ERROR, AT_LINK_NONE, 0 },
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_PROMPT, AT_LINK_NONE, 0 },
+    { AT_EVENT_SEND_FAIL, AT_LINK_NONE, 0 },
+    { AT_EVENT_CLOSED, 2, 0 },
+    { AT_EVENT_STA_DISCONNECTED, AT_LINK_NONE, 0 },
+    { AT_EVENT_ERROR, AT_LINK_NONE, 0 },
+    { AT_EVENT_CIPMUX, AT_LINK_NONE, 1 },
+    { AT_EVENT_OK, AT_LINK_NONE, 0 },
+    { AT_EVENT_READY, AT_LINK_NONE, 0 },
+};
+
+#define ESP_TRANSCRIPT_EVENTS (sizeof(esp_transcript_events) / sizeof(esp_transcript_events[0]))
+
+#endif /* __ESP_TRANSCRIPT_H */
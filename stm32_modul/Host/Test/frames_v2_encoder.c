@@ -0,0 +1,110 @@
+/**
+  ******************************************************************************
+  * @file           : frames_v2_encoder.c
+  * @brief          : Encoder side of test_frames_v2.py. Pushes a fixed
+  *                   pattern of samples through the firmware's drain path in
+  *                   MODE_BINARY_CDC and writes what reached the USB host to
+  *                   the file named on the command line. The batches vary in
+  *                   size so frames are cut at every length, the sequences
+  *                   start just below the 32-bit wrap and the timestamps
+  *                   wrap too. Then times Pack_Frame() alone.
+  *                   The sample pattern and batch sizes are repeated in
+  *                   test_frames_v2.py, keep them in step.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include <time.h>
+
+#define BATCHES 120
+#define SEQUENCE_START 0xFFFFFF00u
+#define TIME_START 0xFFFF0000u
+#define PACK_ROUNDS 1000000
+
+static void Sample(uint8_t sensor, uint32_t k, Sample_TypeDef *sample) {
+    sample->data[0] = (int16_t)(k * 37 + sensor * 1000);
+    sample->data[1] = (int16_t)(-(int32_t)k * 101);
+    sample->data[2] = k % 3 == 0 ? INT16_MIN : k % 3 == 1 ? INT16_MAX : (int16_t)k;
+    sample->time = TIME_START + k * 1250;
+}
+
+static uint16_t Batch_Size(uint32_t batch) {
+    return batch % 40 + 1;
+}
+
+static void Unused_Sink(int16_t *raw_data) {
+    (void)raw_data;
+}
+
+static double Now_Ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    uint32_t next[SENSOR_COUNT] = { 0 };
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output file>\n", argv[0]);
+        return 2;
+    }
+    MX_USB_DEVICE_Init();
+    for (uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+        Sample_Ring_Init(&sample_rings[sensor]);
+        Calibration_Identity(&calibrations[sensor]);
+        decimation[sensor] = 1;
+        Decimator_Init(&decimators[sensor], 1);
+        frame_sequence[sensor] = SEQUENCE_START + sensor;
+    }
+    transmission_mode = MODE_BINARY_CDC;
+
+    /* Batch b goes to sensor b % 3 and is drained the way the superloop
+       does it, SAMPLE_DRAIN_BATCH samples at a time */
+    for (uint32_t batch = 0; batch < BATCHES; batch++) {
+        uint8_t sensor = batch % SENSOR_COUNT;
+        for (uint16_t n = 0; n < Batch_Size(batch); n++) {
+            Sample_TypeDef sample;
+            Sample(sensor, next[sensor]++, &sample);
+            Sample_Ring_Push(&sample_rings[sensor], sample.data, sample.time);
+        }
+        while (Sample_Ring_Count(&sample_rings[sensor]) > 0) {
+            Drain_Samples(sensor, Unused_Sink);
+            while (CDC_Tx_Free_FS() < APP_TX_DATA_SIZE / 2) {
+                Sim_Idle(1);
+            }
+        }
+    }
+    Sim_Idle(10);
+
+    size_t length;
+    const uint8_t *usb = Sim_Usb_Captured(&length);
+    FILE *out = fopen(argv[1], "wb");
+    if (out == NULL || fwrite(usb, 1, length, out) != length || fclose(out) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    printf("%zu bytes in %u USB transfers, %u bytes dropped\n", length, Sim_Usb_Transfers(),
+           (unsigned)cdc_tx_stats.dropped);
+
+    /* Encoder cost per full frame, without the sink */
+    Sample_TypeDef samples[FRAME_V2_MAX_SAMPLES];
+    uint8_t frame[FRAME_V2_MAX_SIZE];
+    uint32_t check = 0;
+    for (uint8_t n = 0; n < FRAME_V2_MAX_SAMPLES; n++) {
+        Sample(SENSOR_GYR, n, &samples[n]);
+    }
+    double start = Now_Ns();
+    for (uint32_t round = 0; round < PACK_ROUNDS; round++) {
+        samples[0].time = round;
+        check += Pack_Frame(frame, SENSOR_GYR, round, samples, FRAME_V2_MAX_SAMPLES) + frame[FRAME_V2_MAX_SIZE - 1];
+    }
+    double ns = (Now_Ns() - start) / PACK_ROUNDS;
+    printf("Pack_Frame: %.0f ns per %u-sample frame (%.1f ns/sample) in this build, check %u\n", ns,
+           FRAME_V2_MAX_SAMPLES, ns / FRAME_V2_MAX_SAMPLES, check);
+    return cdc_tx_stats.dropped == 0 ? 0 : 1;
+}
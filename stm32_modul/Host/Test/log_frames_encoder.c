@@ -0,0 +1,102 @@
+/**
+  ******************************************************************************
+  * @file           : log_frames_encoder.c
+  * @brief          : Encoder side of test_log_decoder.py. Logs every entry of
+  *                   log_ids.h once through LOG2(), sends the records out with
+  *                   Drain_Log() the way the superloop does and writes what
+  *                   reached the USB host to the first file named on the
+  *                   command line. The second file gets the text the device
+  *                   would print for each record (32-bit long, signed %d and
+  *                   %ld), one line per id, for the decoder to match.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+
+#define LOG_BURST 16   // records per burst, well below LOG_RING_SIZE
+
+#define LOG_FORMAT(id, format) format,
+static const char *const formats[LOG_ID_COUNT] = { LOG_IDS(LOG_FORMAT) };
+#undef LOG_FORMAT
+
+/* Negative as %d, past 16 bits as %u, letters as %x */
+static uint32_t Argument(uint16_t id, uint8_t n) {
+    return (uint32_t)-(int32_t)(n == 0 ? id + 1u : 0x10000u * id + 0xA5u);
+}
+
+/* printf of a log_ids.h format with int and long both 32 bits wide */
+static void Format_Like_Device(FILE *out, const char *format, const uint32_t args[2]) {
+    uint8_t used = 0;
+
+    for (const char *c = format; *c; c++) {
+        if (*c != '%') {
+            fputc(*c, out);
+            continue;
+        }
+        c++;
+        if (*c == '%') {
+            fputc('%', out);
+            continue;
+        }
+        if (*c == 'l') {
+            c++;
+        }
+        uint32_t value = used < 2 ? args[used++] : 0;
+        if (*c == 'd') {
+            fprintf(out, "%d", (int)(int32_t)value);
+        } else {
+            fprintf(out, *c == 'x' ? "%x" : "%u", (unsigned)value);
+        }
+    }
+    fputc('\n', out);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <capture file> <expected text file>\n", argv[0]);
+        return 2;
+    }
+    MX_USB_DEVICE_Init();
+
+    FILE *expected = fopen(argv[2], "w");
+    if (expected == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    for (uint16_t id = 0; id < LOG_ID_COUNT; id++) {
+        uint32_t args[2] = { Argument(id, 0), Argument(id, 1) };
+        LOG2(id, args[0], args[1]);
+        Format_Like_Device(expected, formats[id], args);
+        if ((id + 1) % LOG_BURST == 0 || id + 1 == LOG_ID_COUNT) {
+            size_t sent;
+            for (uint32_t pass = 0; Sim_Usb_Captured(&sent), sent < (size_t)(id + 1) * LOG_FRAME_SIZE; pass++) {
+                if (pass == LOG_BURST) {
+                    fprintf(stderr, "id %u: the drain stopped at %zu bytes\n", id, sent);
+                    return 1;
+                }
+                Drain_Log();
+                Sim_Idle(1);
+            }
+        }
+    }
+    if (fclose(expected) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    Sim_Idle(10);
+
+    size_t length;
+    const uint8_t *usb = Sim_Usb_Captured(&length);
+    FILE *out = fopen(argv[1], "wb");
+    if (out == NULL || fwrite(usb, 1, length, out) != length || fclose(out) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    printf("%u log ids, %zu bytes in %u USB transfers, %u bytes dropped\n", LOG_ID_COUNT, length,
+           Sim_Usb_Transfers(), (unsigned)cdc_tx_stats.dropped);
+    return cdc_tx_stats.dropped == 0 ? 0 : 1;
+}
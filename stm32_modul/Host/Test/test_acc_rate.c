@@ -0,0 +1,96 @@
+/**
+  ******************************************************************************
+  * @file           : test_acc_rate.c
+  * @brief          : Entering and leaving MODE_SPECTRUM while an I2C read
+  *                   is stuck on the bus. The accelerometer has to keep its
+  *                   old rate until the switch can be written, the switch
+  *                   is retried once the bus is free, and the first
+  *                   spectrum after it holds only samples of the new rate:
+  *                   a 200 Hz vibration, which aliases at the streaming rate,
+  *                   is the strongest peak of every report.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <math.h>
+#include <string.h>
+
+#define TONE_HZ 200.0
+
+static void Vibration(uint8_t sensor, uint32_t n, uint64_t time_us, int16_t data[3]) {
+    data[0] = (int16_t)(2000.0 * sin(2.0 * M_PI * TONE_HZ * (double)time_us * 1e-6));
+    data[1] = (int16_t)n;
+    data[2] = sensor;
+}
+
+static float Get_Float(const uint8_t *bytes) {
+    uint32_t bits = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Long press of the button: the next transmission mode */
+static void Next_Mode(void) {
+    button_action_type = 1;
+    button_action_pending = 1;
+}
+
+int main(void) {
+    Sim_Sensor_Set_Source(Vibration);
+    Sim_App_Run(1000);
+    CHECK_EQ(Sim_Sensor_Register(SIM_SENSOR_ACC, 0x20), ACC_CTRL1_VALUE);
+
+    /* A read gets stuck on the bus, then the mode changes */
+    Sim_I2C_Hold(1);
+    Sim_App_Run(100);
+    transmission_mode = MODE_SPECTRUM - 1;
+    Next_Mode();
+    Sim_App_Run(300);
+    CHECK_EQ(transmission_mode, MODE_SPECTRUM);
+    CHECK_EQ(Sim_Sensor_Register(SIM_SENSOR_ACC, 0x20), ACC_CTRL1_VALUE);
+    CHECK_EQ(acc_ctrl1, ACC_CTRL1_VALUE);
+    CHECK_EQ(acc_ctrl1_wanted, SPECTRUM_ACC_CTRL1);
+
+    /* Freed, the switch goes through on a retry */
+    Sim_Usb_Clear();
+    Sim_I2C_Hold(0);
+    Sim_App_Run(ACC_RATE_RETRY_DELAY + 50);
+    CHECK_EQ(Sim_Sensor_Register(SIM_SENSOR_ACC, 0x20), SPECTRUM_ACC_CTRL1);
+    CHECK_EQ(acc_ctrl1, SPECTRUM_ACC_CTRL1);
+    Sim_App_Run(3000);
+
+    size_t length;
+    const uint8_t *usb = Sim_Usb_Captured(&length);
+    uint32_t reports = 0;
+    for (size_t i = 0; i + SPECTRUM_FRAME_SIZE <= length; i++) {
+        if (usb[i] != (HEADER_SPECTRUM & 0xFF) || usb[i + 1] != HEADER_SPECTRUM >> 8) {
+            continue;
+        }
+        const uint8_t *frame = &usb[i];
+        uint16_t crc = frame[SPECTRUM_FRAME_SIZE - 2] | frame[SPECTRUM_FRAME_SIZE - 1] << 8;
+        if (Crc16_Ccitt(frame, SPECTRUM_FRAME_SIZE - 2) != crc) {
+            continue;
+        }
+        float rate_hz = Get_Float(&frame[10]);
+        float peak_hz = Get_Float(&frame[16 + SPECTRUM_BANDS * 4]);  // X, strongest peak
+        printf("report %u: %.1f Hz sampling, X peak at %.1f Hz\n", reports, rate_hz, peak_hz);
+        CHECK_NEAR(rate_hz * decimation[SENSOR_ACC], Sim_Sensor_Odr(SIM_SENSOR_ACC), 20);
+        CHECK_NEAR(peak_hz, TONE_HZ, 3);
+        reports++;
+        i += SPECTRUM_FRAME_SIZE - 1;
+    }
+    CHECK(reports >= 2);
+
+    /* Leaving the mode restores the streaming rate */
+    Next_Mode();
+    Sim_App_Run(100);
+    CHECK_EQ(Sim_Sensor_Register(SIM_SENSOR_ACC, 0x20), ACC_CTRL1_VALUE);
+    CHECK_EQ(acc_ctrl1, acc_ctrl1_wanted);
+    TEST_EXIT();
+}
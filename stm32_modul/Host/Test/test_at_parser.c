@@ -0,0 +1,123 @@
+/**
+  ******************************************************************************
+  * @file           : test_at_parser.c
+  * @brief          : Replays a recorded ESP8266 transcript through the AT
+  *                   tokenizer in the chunk sizes the UART DMA can deliver
+  *                   (single bytes up to whole idle-line bursts, and random
+  *                   splits), and checks that every split gives the same
+  *                   events. Also that At_Parser_Flush() keeps a line it
+  *                   is in the middle of.
+  ******************************************************************************
+  */
+
+#include "at_parser.h"
+#include "esp_transcript.h"
+#include "sim_test.h"
+#include <string.h>
+
+#define MAX_EVENTS 64
+
+static At_Event_TypeDef events[MAX_EVENTS];
+static uint32_t event_count;
+
+static void Drain(void) {
+    At_Event_TypeDef event;
+    while (At_Parser_Next(&event)) {
+        if (event_count < MAX_EVENTS) {
+            events[event_count] = event;
+        }
+        event_count++;
+    }
+}
+
+static uint32_t random_state = 12345;
+
+static uint16_t Random_Chunk(uint16_t max) {
+    random_state = random_state * 1103515245u + 12345u;
+    return 1 + (random_state >> 16) % max;
+}
+
+/* Feeds the transcript in chunks of chunk bytes, or random ones up to 64
+   when chunk is 0, and drains the queue after each as the superloop would */
+static void Replay(uint16_t chunk) {
+    const uint8_t *data = (const uint8_t *)esp_transcript;
+    size_t length = sizeof(esp_transcript) - 1;
+    size_t offset = 0;
+
+    At_Parser_Reset();
+    event_count = 0;
+    while (offset < length) {
+        uint16_t size = chunk ? chunk : Random_Chunk(64);
+        if (size > length - offset) {
+            size = length - offset;
+        }
+        At_Parser_Feed(data + offset, size);
+        offset += size;
+        Drain();
+    }
+}
+
+static void Check_Events(uint16_t chunk) {
+    if (event_count != ESP_TRANSCRIPT_EVENTS) {
+        fprintf(stderr, "chunk %u: %u events, expected %u\n", chunk, event_count, (unsigned)ESP_TRANSCRIPT_EVENTS);
+        sim_test_failures++;
+        return;
+    }
+    for (uint32_t i = 0; i < event_count; i++) {
+        const At_Event_TypeDef *expected = &esp_transcript_events[i];
+        if (events[i].type != expected->type || events[i].link != expected->link ||
+            events[i].value != expected->value) {
+            fprintf(stderr, "chunk %u: event %u is %u/%u/%u, expected %u/%u/%u\n", chunk, i, events[i].type,
+                    events[i].link, events[i].value, expected->type, expected->link, expected->value);
+            sim_test_failures++;
+            return;
+        }
+    }
+}
+
+int main(void) {
+    static const uint16_t chunks[] = { 1, 2, 3, 5, 7, 16, 31, 64, 128 };
+
+    for (uint8_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        Replay(chunks[i]);
+        Check_Events(chunks[i]);
+    }
+    for (uint8_t round = 0; round < 50; round++) {
+        Replay(0);
+        Check_Events(0);
+    }
+
+    /* A flush in the middle of a line keeps the part already received */
+    At_Parser_Reset();
+    At_Parser_Feed((const uint8_t *)"\r\nSEND ", 7);
+    At_Parser_Flush();
+    At_Parser_Feed((const uint8_t *)"OK\r\n", 4);
+    event_count = 0;
+    Drain();
+    CHECK_EQ(event_count, 1);
+    CHECK_EQ(events[0].type, AT_EVENT_SEND_OK);
+
+    /* ... and inside a +IPD payload */
+    At_Parser_Reset();
+    At_Parser_Feed((const uint8_t *)"+IPD,1,6:OK", 11);
+    At_Parser_Flush();
+    At_Parser_Feed((const uint8_t *)"\r\n\r\nOK\r\n", 8);
+    event_count = 0;
+    Drain();
+    CHECK_EQ(event_count, 2);
+    CHECK_EQ(events[0].type, AT_EVENT_IPD_END);
+    CHECK_EQ(events[0].link, 1);
+    CHECK_EQ(events[1].type, AT_EVENT_OK);
+
+    /* A full queue drops the newest events and counts them */
+    At_Parser_Reset();
+    uint32_t dropped = At_Parser_Dropped();
+    for (uint8_t i = 0; i < AT_EVENT_QUEUE_SIZE + 4; i++) {
+        At_Parser_Feed((const uint8_t *)"OK\r\n", 4);
+    }
+    event_count = 0;
+    Drain();
+    CHECK_EQ(event_count, AT_EVENT_QUEUE_SIZE - 1);
+    CHECK_EQ(At_Parser_Dropped() - dropped, 5);
+    TEST_EXIT();
+}
@@ -0,0 +1,171 @@
+/**
+  ******************************************************************************
+  * @file           : test_batching.c
+  * @brief          : The batched HTTP uplink of MODE_ASCII_UART against the
+  *                   simulated ESP and server, from reset at the rates the
+  *                   sensors are set up with, then decimated. Every POST
+  *                   /data has to carry a JSON array of sample objects no
+  *                   larger than BATCH_MAX_BODY, in one CIPSEND. At full
+  *                   rate the posts are cut by size and come well within
+  *                   BATCH_MAX_AGE; decimated to a few samples a second
+  *                   they are cut by age, no sooner and not much later. The
+  *                   packet numbers across all of them have to run on
+  *                   without a gap up to the batch still open: nothing the
+  *                   sensors delivered after the link came up is dropped.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include "esp_script.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RUN_MS 6000
+#define LATENCY_MS 50    // flush to the server: CIPSEND, prompt, payload at the link rate
+#define SLOW_SPACING_MS 100   // longest wait for the next sample at the decimated rates
+
+typedef struct {
+    uint32_t objects;
+    uint32_t per_sensor[SENSOR_COUNT];
+    uint16_t next_packet;      // packet number the next object must carry
+    uint8_t started;
+    uint32_t gaps;
+} Uplink_TypeDef;
+
+/* Parses one body as [{"<label>":<packet>,"X":..,"Y":..,"Z":..},...] and
+   follows the packet numbers; returns the objects, 0 for a malformed body */
+static uint32_t Parse_Body(const Sim_Http_Request_TypeDef *request, Uplink_TypeDef *uplink) {
+    static const char *labels[SENSOR_COUNT] = { "MAG", "ACC", "GYR" };
+    static char body[BATCH_MAX_BODY + 2];
+    uint32_t objects = 0;
+
+    if (request->length < 2 || request->length > BATCH_MAX_BODY) {
+        return 0;
+    }
+    memcpy(body, request->body, request->length);
+    body[request->length] = '\0';
+    if (body[0] != '[' || body[request->length - 1] != ']') {
+        return 0;
+    }
+    for (const char *p = body + 1;; p++) {
+        char label[4];
+        unsigned packet;
+        float x, y, z;
+        int used = 0;
+        if (sscanf(p, "{\"%3[A-Z]\":%u,\"X\":%f,\"Y\":%f,\"Z\":%f}%n", label, &packet, &x, &y, &z, &used) != 5 ||
+            used == 0) {
+            return 0;
+        }
+        uint8_t sensor = 0;
+        while (sensor < SENSOR_COUNT && strcmp(label, labels[sensor]) != 0) {
+            sensor++;
+        }
+        if (sensor == SENSOR_COUNT) {
+            return 0;
+        }
+        if (uplink->started && (uint16_t)packet != uplink->next_packet) {
+            if (uplink->gaps++ < 5) {
+                fprintf(stderr, "%.3f s: packet %u, expected %u\n", request->time_us / 1e6, packet,
+                        uplink->next_packet);
+            }
+        }
+        uplink->started = 1;
+        uplink->next_packet = (uint16_t)(packet + 1);
+        uplink->per_sensor[sensor]++;
+        objects++;
+        p += used;
+        if (*p == ']') {
+            break;
+        }
+        if (*p != ',') {
+            return 0;
+        }
+    }
+    uplink->objects += objects;
+    return objects;
+}
+
+/* Stops where nothing is queued, so every flushed batch reached the server
+   and only the open one is still on the device */
+static void Run_Until_Settled(uint32_t ms) {
+    Sim_App_Run(ms);
+    for (ms = 0; ms < 1000 && Esp_Transport_Pending(); ms++) {
+        Sim_App_Run(1);
+    }
+    CHECK_EQ(Esp_Transport_Pending(), 0);
+}
+
+/* Checks the posts from request first on, their spacing in ms between
+   shortest and longest; returns the index after them */
+static uint32_t Check_Posts(const char *phase, uint32_t first, Uplink_TypeDef *uplink, uint32_t min_per_post,
+                            uint32_t shortest, uint32_t longest) {
+    uint32_t posts = 0, objects = uplink->objects, largest = 0, index = first;
+    double last_post = -1, shortest_gap = 1e9, longest_gap = 0;
+
+    for (; index < Sim_Http_Request_Count(); index++) {
+        const Sim_Http_Request_TypeDef *request = Sim_Http_Request(index);
+        if (strcmp(request->path, "/data") != 0) {
+            continue;
+        }
+        if (Parse_Body(request, uplink) == 0) {
+            fprintf(stderr, "%.3f s: body of %u bytes is no JSON array of samples\n", request->time_us / 1e6,
+                    request->length);
+            sim_test_failures++;
+        }
+        double now = request->time_us / 1e6;
+        if (last_post >= 0) {
+            shortest_gap = now - last_post < shortest_gap ? now - last_post : shortest_gap;
+            longest_gap = now - last_post > longest_gap ? now - last_post : longest_gap;
+        }
+        last_post = now;
+        largest = request->length > largest ? request->length : largest;
+        posts++;
+    }
+    objects = uplink->objects - objects;
+    printf("%s: %u posts, %u samples, %.1f per post, largest body %u bytes, %.0f to %.0f ms apart,"
+           " %u samples in the open batch\n", phase, posts, objects, posts ? (double)objects / posts : 0.0, largest,
+           shortest_gap * 1000, longest_gap * 1000, (unsigned)batch_samples);
+    CHECK(posts > 2);
+    CHECK(objects >= min_per_post * posts);
+    CHECK(shortest_gap * 1000 >= shortest);
+    CHECK(longest_gap * 1000 <= longest);
+    CHECK_EQ(uplink->gaps, 0);
+    CHECK_EQ((uint16_t)(packet_number - uplink->next_packet), batch_samples);
+    return index;
+}
+
+int main(void) {
+    Uplink_TypeDef uplink = { 0 };
+    char slow[] = "DEC MAG 10\nDEC ACC 10\nDEC GYR 16\n";
+
+    /* The sensors at full rate: the posts are cut by size */
+    Run_Until_Settled(RUN_MS);
+    CHECK_EQ(transmission_mode, MODE_ASCII_UART);
+    uint32_t next = Check_Posts("full rate", 0, &uplink, 20, 0, BATCH_MAX_AGE + LATENCY_MS);
+    for (uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+        CHECK(uplink.per_sensor[sensor] > 0);
+    }
+
+    /* A few samples per second: the posts are cut by age */
+    Sim_Usb_Send(slow);
+    Run_Until_Settled(RUN_MS);
+    Check_Posts("decimated", next, &uplink, 3, BATCH_MAX_AGE - LATENCY_MS,
+                BATCH_MAX_AGE + SLOW_SPACING_MS + LATENCY_MS);
+
+    /* Each payload fits one CIPSEND */
+    for (uint32_t i = Esp_Script_Find(0, "AT+CIPSEND=*"); i < Sim_Esp_Command_Count();
+         i = Esp_Script_Find(i + 1, "AT+CIPSEND=*")) {
+        const char *comma = strrchr(Sim_Esp_Command(i)->text, ',');
+        CHECK(comma != NULL && atoi(comma + 1) <= ESP_TX_PAYLOAD_MAX);
+    }
+    for (uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+        CHECK_EQ(sensor_stats[sensor].rejected, 0);
+    }
+    CHECK_EQ(esp_transport_stats.failed, 0);
+    TEST_EXIT();
+}
@@ -0,0 +1,105 @@
+/**
+  ******************************************************************************
+  * @file           : test_baud.c
+  * @brief          : ESP link rate negotiation at boot against the simulated
+  *                   module, one module per run, named on the command line.
+  *                   The AT+UART_CUR commands the module received have to be
+  *                   the expected ones in order, and USART2 has to end at the
+  *                   rate the module is at. A module that answers ERROR above
+  *                   its top rate gets the next candidate, one whose replies
+  *                   get lost at a rate is talked back to ESP_BAUD_DEFAULT
+  *                   before the next candidate, also when that fallback is
+  *                   lost on the way in and has to be sent again at the
+  *                   unstable rate. Where the link settles, the warm start
+  *                   has to run and the first request reach the server. A
+  *                   module that never takes the fallback is kept at its
+  *                   rate rather than left behind at the default.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include "esp_script.h"
+#include <string.h>
+
+#define RUN_MS 6000
+#define UART_CUR(baud) "AT+UART_CUR=" #baud ",8,1,0,0"
+
+static const char *const to_top[] = { UART_CUR(2000000) };
+static const char *const rejected[] = { UART_CUR(2000000), UART_CUR(921600), UART_CUR(460800) };
+static const char *const unstable[] = {
+    UART_CUR(2000000), UART_CUR(115200), UART_CUR(921600), UART_CUR(115200), UART_CUR(460800)
+};
+
+typedef struct {
+    const char *name;
+    uint32_t max_baud;
+    uint32_t unstable_baud;
+    uint8_t unstable_misses;
+    const char *const *script;    // the AT+UART_CUR commands the module takes
+    uint32_t lines;
+    uint32_t baud;                // where the link settles
+    uint8_t connects;
+} Scenario_TypeDef;
+
+static const Scenario_TypeDef scenarios[] = {
+    { "top", 4000000, 0, 0, to_top, ESP_SCRIPT_LINES(to_top), 2000000, 1 },
+    { "rejected", 460800, 0, 0, rejected, ESP_SCRIPT_LINES(rejected), 460800, 1 },
+    { "unstable", 4000000, 921600, 0, unstable, ESP_SCRIPT_LINES(unstable), 460800, 1 },
+    /* the pings at 2 Mbaud and two fallbacks are lost, the third gets through */
+    { "fallback_lost", 4000000, 921600, ESP_PING_COUNT + ESP_BAUD_FALLBACK_TRIES - 1, unstable,
+      ESP_SCRIPT_LINES(unstable), 460800, 1 },
+    { "never_back", 4000000, 921600, 255, to_top, ESP_SCRIPT_LINES(to_top), 2000000, 0 },
+};
+
+/* The AT+UART_CUR commands the module got, in order, have to be the script */
+static void Check_Rates(const Scenario_TypeDef *scenario) {
+    uint32_t index = Esp_Script_Find(0, "AT+UART_CUR=*");
+    for (uint32_t i = 0; i < scenario->lines; i++, index = Esp_Script_Find(index + 1, "AT+UART_CUR=*")) {
+        const char *text = index < Sim_Esp_Command_Count() ? Sim_Esp_Command(index)->text : "(nothing)";
+        if (strcmp(text, scenario->script[i]) != 0) {
+            fprintf(stderr, "rate command %u: expected %s, got %s\n", i, scenario->script[i], text);
+            Sim_Esp_Print_Transcript(stderr);
+            sim_test_failures++;
+            return;
+        }
+    }
+    CHECK_EQ(index, Sim_Esp_Command_Count());   // no more of them
+}
+
+static void Test_Scenario(const Scenario_TypeDef *scenario) {
+    sim_esp.max_baud = scenario->max_baud;
+    sim_esp.unstable_baud = scenario->unstable_baud;
+    sim_esp.unstable_misses = scenario->unstable_misses;
+    Sim_App_Run(RUN_MS);
+
+    Check_Rates(scenario);
+    printf("%s: link at %lu baud, module at %u, %u bytes garbled\n", scenario->name, (unsigned long)esp_baud,
+           sim_esp.baud, Sim_Uart_Garbled());
+    CHECK_EQ(esp_baud, scenario->baud);
+    CHECK_EQ(sim_esp.baud, scenario->baud);
+    if (!scenario->connects) {
+        CHECK_EQ(Sim_Esp_Count("AT+CWMODE?"), 0);
+        return;
+    }
+    CHECK_EQ(Sim_Esp_Count("AT+CWMODE?"), 1);
+    CHECK(connection_established);
+    CHECK(Sim_Http_Request_Count() > 0);
+}
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "top";
+
+    for (uint8_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (strcmp(name, scenarios[i].name) == 0) {
+            Test_Scenario(&scenarios[i]);
+            TEST_EXIT();
+        }
+    }
+    fprintf(stderr, "usage: %s [top|rejected|unstable|fallback_lost|never_back]\n", argv[0]);
+    return 2;
+}
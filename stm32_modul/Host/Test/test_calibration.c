@@ -0,0 +1,189 @@
+/**
+  ******************************************************************************
+  * @file           : test_calibration.c
+  * @brief          : Calibration of raw samples: the SIMD path (QSUB16,
+  *                   SMLAD, SSAT, built here a second time with
+  *                   __ARM_FEATURE_DSP=1 against the intrinsics of
+  *                   cmsis_compiler.h) and the C path the host library
+  *                   links must give the same samples, and both must match
+  *                   a 64-bit reference of matrix * (raw - offset), rounded
+  *                   half up and saturated. Random valid calibrations and
+  *                   samples are run, with the extremes that saturate the
+  *                   offset subtraction and the output, in batches of every
+  *                   length the drain hands over. Calibration_Valid() has to
+  *                   take row gains up to 2 and no more.
+  ******************************************************************************
+  */
+
+/* The SIMD path, under its own names */
+#define __ARM_FEATURE_DSP 1
+#define Calibration_Identity Simd_Calibration_Identity
+#define Calibration_Valid Simd_Calibration_Valid
+#define Calibration_Apply Simd_Calibration_Apply
+#define Calibration_Saturate Simd_Calibration_Saturate
+#include "calibration.c"
+#undef Calibration_Identity
+#undef Calibration_Valid
+#undef Calibration_Apply
+#undef Calibration_Saturate
+#undef __ARM_FEATURE_DSP
+
+#include "sim_test.h"
+#include <stdlib.h>
+
+/* The C path, from the host library */
+void Calibration_Identity(Calibration_TypeDef *cal);
+uint8_t Calibration_Valid(const Calibration_TypeDef *cal);
+void Calibration_Apply(const Calibration_TypeDef *cal, Sample_TypeDef *samples, uint16_t count);
+
+#define CALIBRATIONS 2000
+#define BATCH_MAX 32       // a full FIFO drain
+
+static const int16_t extremes[] = { INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX - 1, INT16_MAX };
+
+/* Mostly readings a part gives in use, some across the whole range and
+   some at its ends */
+static int16_t Random_Int16(void) {
+    switch (rand() % 8) {
+    case 0:
+        return extremes[rand() % (sizeof(extremes) / sizeof(extremes[0]))];
+    case 1:
+    case 2:
+        return (int16_t)(rand() & 0xFFFF);
+    default:
+        return (int16_t)(rand() % 16001 - 8000);
+    }
+}
+
+static uint8_t Same_Sample(const Sample_TypeDef *a, const Sample_TypeDef *b) {
+    return a->data[0] == b->data[0] && a->data[1] == b->data[1] && a->data[2] == b->data[2] && a->time == b->time;
+}
+
+static int16_t Reference_Saturate(int64_t value) {
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+}
+
+/* What calibration.h promises, in 64 bits without any of the tricks */
+static void Reference_Apply(const Calibration_TypeDef *cal, const Sample_TypeDef *in, Sample_TypeDef *out) {
+    int64_t d[3];
+    for (uint8_t j = 0; j < 3; j++) {
+        d[j] = Reference_Saturate((int64_t)in->data[j] - cal->offset[j]);
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        int64_t sum = 0;
+        for (uint8_t j = 0; j < 3; j++) {
+            sum += (int64_t)cal->matrix[i][j] * d[j];
+        }
+        /* floor(x / 2^14 + 1/2) */
+        int64_t rounded = sum + CALIBRATION_ONE / 2;
+        rounded = rounded >= 0 ? rounded / CALIBRATION_ONE : -((-rounded + CALIBRATION_ONE - 1) / CALIBRATION_ONE);
+        out->data[i] = Reference_Saturate(rounded);
+    }
+    out->time = in->time;
+}
+
+/* Diagonal, offset only or full matrices, with row gains up to 2 */
+static void Random_Calibration(Calibration_TypeDef *cal, uint32_t index) {
+    Calibration_Identity(cal);
+    for (uint8_t j = 0; j < 3; j++) {
+        cal->offset[j] = index % 4 == 0 ? Random_Int16() : (int16_t)(rand() % 4001 - 2000);
+    }
+    if (index % 3 == 0) {
+        return;   // gyro bias
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        int32_t left = CALIBRATION_ROW_MAX;
+        for (uint8_t j = 0; j < 3; j++) {
+            uint8_t j_shuffled = (i + j + index) % 3;
+            if (index % 3 == 1 && j_shuffled != i) {
+                cal->matrix[i][j_shuffled] = 0;   // accelerometer scale
+                continue;
+            }
+            int32_t entry = index % 5 == 0 ? left : rand() % (left + 1);
+            cal->matrix[i][j_shuffled] = (int16_t)(rand() % 2 ? -entry : entry);
+            left -= entry;
+        }
+    }
+}
+
+static void Test_Against_Reference(void) {
+    Sample_TypeDef raw[BATCH_MAX], c_path[BATCH_MAX], simd_path[BATCH_MAX], expected;
+    uint32_t samples = 0, saturated = 0, mismatched = 0;
+
+    srand(22);
+    for (uint32_t index = 0; index < CALIBRATIONS; index++) {
+        Calibration_TypeDef cal;
+        Random_Calibration(&cal, index);
+        CHECK(Calibration_Valid(&cal));
+        CHECK(Simd_Calibration_Valid(&cal));
+
+        uint16_t count = index % (BATCH_MAX + 1);   // 0 too, an empty drain
+        for (uint16_t n = 0; n < count; n++) {
+            for (uint8_t j = 0; j < 3; j++) {
+                raw[n].data[j] = Random_Int16();
+            }
+            raw[n].time = index * BATCH_MAX + n;
+        }
+        memcpy(c_path, raw, sizeof(raw));
+        memcpy(simd_path, raw, sizeof(raw));
+        Calibration_Apply(&cal, c_path, count);
+        Simd_Calibration_Apply(&cal, simd_path, count);
+
+        for (uint16_t n = 0; n < count; n++) {
+            Reference_Apply(&cal, &raw[n], &expected);
+            if (!Same_Sample(&c_path[n], &expected) || !Same_Sample(&simd_path[n], &expected)) {
+                if (mismatched++ < 5) {
+                    fprintf(stderr, "calibration %u sample %u: raw %d %d %d, reference %d %d %d, C %d %d %d,"
+                            " SIMD %d %d %d\n", index, n, raw[n].data[0], raw[n].data[1], raw[n].data[2],
+                            expected.data[0], expected.data[1], expected.data[2], c_path[n].data[0],
+                            c_path[n].data[1], c_path[n].data[2], simd_path[n].data[0], simd_path[n].data[1],
+                            simd_path[n].data[2]);
+                }
+            }
+            for (uint8_t i = 0; i < 3; i++) {
+                saturated += expected.data[i] == INT16_MAX || expected.data[i] == INT16_MIN;
+            }
+            samples++;
+        }
+        /* Samples past the batch are left alone */
+        if (count < BATCH_MAX) {
+            CHECK(Same_Sample(&c_path[count], &raw[count]));
+            CHECK(Same_Sample(&simd_path[count], &raw[count]));
+        }
+    }
+    printf("%u calibrations, %u samples, %u outputs saturated, %u differ\n", CALIBRATIONS, samples, saturated,
+           mismatched);
+    CHECK_EQ(mismatched, 0);
+    CHECK(saturated > 100);
+}
+
+static void Test_Identity_And_Valid(void) {
+    Calibration_TypeDef cal;
+    Sample_TypeDef samples[3] = { { { INT16_MIN, -1, INT16_MAX }, 7 }, { { 0, 1, -2 }, 8 }, { { 123, -456, 789 }, 9 } };
+    Sample_TypeDef copy[3];
+
+    Calibration_Identity(&cal);
+    memcpy(copy, samples, sizeof(copy));
+    Calibration_Apply(&cal, copy, 3);
+    Simd_Calibration_Apply(&cal, &copy[1], 2);   // twice through the identity
+    for (uint8_t n = 0; n < 3; n++) {
+        CHECK(Same_Sample(&copy[n], &samples[n]));
+    }
+
+    /* A row gain of exactly 2 in any mix of signs is taken, one LSB more is not */
+    cal.matrix[1][0] = -CALIBRATION_ONE / 2;
+    cal.matrix[1][1] = CALIBRATION_ONE;
+    cal.matrix[1][2] = CALIBRATION_ONE / 2;
+    CHECK(Calibration_Valid(&cal));
+    cal.matrix[1][2]++;
+    CHECK(!Calibration_Valid(&cal));
+    CHECK(!Simd_Calibration_Valid(&cal));
+    cal.matrix[1][2] = -CALIBRATION_ONE / 2 - 1;
+    CHECK(!Calibration_Valid(&cal));
+}
+
+int main(void) {
+    Test_Identity_And_Valid();
+    Test_Against_Reference();
+    TEST_EXIT();
+}
@@ -0,0 +1,155 @@
+/**
+  ******************************************************************************
+  * @file           : test_config_store.c
+  * @brief          : Config store on the simulated flash of the CONFIG
+  *                   region: values kept across a reboot, rewrites that
+  *                   wear both pages evenly through compaction, deletes,
+  *                   and power cuts in the middle of a record and of a
+  *                   compaction, which must leave the last committed values.
+  ******************************************************************************
+  */
+
+#include "config_store.h"
+#include "sim.h"
+#include "sim_test.h"
+#include "stm32f3xx_hal.h"
+#include <string.h>
+
+#define CONFIG_BASE 0x0803F000u    // _config_start
+#define REWRITES 2000
+#define NO_CUT -1
+
+static int32_t halfwords_left = NO_CUT;   // programs until the power cut
+
+static uint8_t Erase(uintptr_t address) {
+    FLASH_EraseInitTypeDef erase = { FLASH_TYPEERASE_PAGES, (uint32_t)address, 1 };
+    uint32_t page_error = 0;
+    if (halfwords_left == 0) {
+        return 0;
+    }
+    return HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK;
+}
+
+/* Once the cut is reached nothing more reaches the flash, as after a reset */
+static uint8_t Program(uintptr_t address, uint16_t value) {
+    if (halfwords_left == 0) {
+        return 0;
+    }
+    if (halfwords_left > 0) {
+        halfwords_left--;
+    }
+    return HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, (uint32_t)address, value) == HAL_OK;
+}
+
+static const Config_Store_Port_TypeDef port = { Erase, Program };
+
+static void Reboot(void) {
+    halfwords_left = NO_CUT;
+    Config_Store_Init(&port, CONFIG_BASE);
+}
+
+static void Check_String(uint8_t key, const char *expected) {
+    char value[CONFIG_VALUE_MAX + 1] = {0};
+    uint8_t length = Config_Get(key, value, CONFIG_VALUE_MAX);
+    CHECK_EQ(length, strlen(expected));
+    if (strcmp(value, expected) != 0) {
+        fprintf(stderr, "key %u is \"%s\", expected \"%s\"\n", key, value, expected);
+        sim_test_failures++;
+    }
+}
+
+static void Check_Port(uint16_t expected) {
+    uint16_t port_value = 0;
+    CHECK_EQ(Config_Get(CONFIG_KEY_SERVER_PORT, &port_value, sizeof(port_value)), sizeof(port_value));
+    CHECK_EQ(port_value, expected);
+}
+
+int main(void) {
+    char ssid[16];
+
+    /* Erased flash: page 0 is formatted, nothing is set */
+    Reboot();
+    CHECK_EQ(Config_Get(CONFIG_KEY_SSID, ssid, sizeof(ssid)), 0);
+    CHECK_EQ(Config_Free(), CONFIG_PAGE_SIZE - 4);
+
+    CHECK(Config_Set(CONFIG_KEY_SSID, "Lab", 3));
+    CHECK(Config_Set(CONFIG_KEY_PASSWORD, "secret", 6));
+    uint16_t server_port = 5000;
+    CHECK(Config_Set(CONFIG_KEY_SERVER_PORT, &server_port, sizeof(server_port)));
+    uint16_t free_bytes = Config_Free();
+    CHECK(Config_Set(CONFIG_KEY_SSID, "Lab", 3));   // unchanged, not written again
+    CHECK_EQ(Config_Free(), free_bytes);
+    CHECK(!Config_Set(CONFIG_KEY_COUNT, "x", 1));
+    CHECK(!Config_Set(CONFIG_KEY_SSID, ssid, CONFIG_VALUE_MAX + 1));
+
+    Reboot();
+    Check_String(CONFIG_KEY_SSID, "Lab");
+    Check_String(CONFIG_KEY_PASSWORD, "secret");
+    Check_Port(5000);
+
+    /* Rewrites fill a page at a time, compaction alternates the pages */
+    for (uint32_t i = 0; i < REWRITES; i++) {
+        snprintf(ssid, sizeof(ssid), "Net%u", (unsigned)i);
+        CHECK(Config_Set(CONFIG_KEY_SSID, ssid, strlen(ssid)));
+    }
+    uint32_t erases0 = Sim_Flash_Erases(CONFIG_BASE);
+    uint32_t erases1 = Sim_Flash_Erases(CONFIG_BASE + CONFIG_PAGE_SIZE);
+    printf("%u rewrites: page erases %u and %u\n", REWRITES, erases0, erases1);
+    CHECK(erases0 >= 5 && erases1 >= 5);
+    CHECK(erases0 <= erases1 + 1 && erases1 <= erases0 + 1);
+    Reboot();
+    snprintf(ssid, sizeof(ssid), "Net%u", REWRITES - 1);
+    Check_String(CONFIG_KEY_SSID, ssid);
+    Check_String(CONFIG_KEY_PASSWORD, "secret");
+    Check_Port(5000);
+
+    /* Deleted keys stay deleted after a reboot and a compaction */
+    CHECK(Config_Delete(CONFIG_KEY_PASSWORD));
+    CHECK_EQ(Config_Get(CONFIG_KEY_PASSWORD, ssid, sizeof(ssid)), 0);
+    Reboot();
+    CHECK_EQ(Config_Get(CONFIG_KEY_PASSWORD, ssid, sizeof(ssid)), 0);
+    CHECK(Config_Set(CONFIG_KEY_PASSWORD, "secret", 6));
+
+    /* A cut at every halfword of a record: the old value or the new one,
+       never a mix */
+    for (int32_t cut = 0; cut <= 5; cut++) {
+        Reboot();
+        halfwords_left = cut;
+        uint8_t stored = Config_Set(CONFIG_KEY_SSID, "Office", 6);
+        Reboot();
+        CHECK_EQ(stored, cut == 5);   // tag, three halfwords of value, commit mark
+        Check_String(CONFIG_KEY_SSID, stored ? "Office" : ssid);
+        CHECK(Config_Set(CONFIG_KEY_SSID, ssid, strlen(ssid)));
+    }
+
+    /* Cuts during compaction: the page is filled until the next record does
+       not fit, then the write that compacts is cut at various points */
+    for (int32_t cut = 0; cut < 48; cut += 3) {
+        char server_ip[9];
+        uint16_t round = 0;
+        Reboot();
+        while (Config_Free() >= 2 + 8 + 2) {
+            snprintf(ssid, sizeof(ssid), "Fill%04u", round++);
+            CHECK(Config_Set(CONFIG_KEY_SSID, ssid, 8));
+        }
+        uint32_t erases = Sim_Flash_Erases(CONFIG_BASE) + Sim_Flash_Erases(CONFIG_BASE + CONFIG_PAGE_SIZE);
+        halfwords_left = cut;
+        snprintf(server_ip, sizeof(server_ip), "10.0.%03u", (unsigned)cut);
+        uint8_t stored = Config_Set(CONFIG_KEY_SERVER_IP, server_ip, 8);
+        Reboot();
+        CHECK(cut == 0 || Sim_Flash_Erases(CONFIG_BASE) + Sim_Flash_Erases(CONFIG_BASE + CONFIG_PAGE_SIZE) > erases);
+        Check_String(CONFIG_KEY_SSID, ssid);
+        Check_String(CONFIG_KEY_PASSWORD, "secret");
+        Check_Port(5000);
+        if (stored) {
+            Check_String(CONFIG_KEY_SERVER_IP, server_ip);
+        } else if (cut > 0) {
+            Check_String(CONFIG_KEY_SERVER_IP, "10.0.000");  // the first, uncut round stored it
+        }
+        if (cut == 0) {
+            halfwords_left = NO_CUT;
+            CHECK(Config_Set(CONFIG_KEY_SERVER_IP, server_ip, 8));
+        }
+    }
+    TEST_EXIT();
+}
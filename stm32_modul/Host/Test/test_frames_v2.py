@@ -0,0 +1,150 @@
+"""Round trip of the v2 sample frames: the firmware encodes, sensor_frames.py decodes.
+
+Runs frames_v2_encoder (the path of the built program is the only argument),
+which drains a fixed sample pattern through main.c in MODE_BINARY_CDC and
+saves what reached the USB host. Checks that
+- every frame decodes, its CRC holds and it fits one 64-byte CDC packet,
+- the samples, sequences and timestamps are the ones the encoder put in,
+  with the per-sensor sequences running across the 32-bit wrap,
+- the drain's batches are cut into frames of at most V2_MAX_SAMPLES,
+- sensor_frames.encode_v2() gives the same bytes as the firmware,
+- a flipped bit in any byte of a frame is rejected and the decoder finds
+  the next frame.
+Prints the decoder's throughput next to the frame rate of all sensors at
+their highest ODR. Exit status 1 if any check failed.
+"""
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import sensor_frames
+
+# Same pattern as frames_v2_encoder.c
+BATCHES = 120
+SEQUENCE_START = 0xFFFFFF00
+TIME_START = 0xFFFF0000
+DRAIN_BATCH = 16  # SAMPLE_DRAIN_BATCH of main.c
+HIGHEST_SAMPLES_PER_S = 760 + 1344 + 100
+
+failures = 0
+
+
+def check(condition, message):
+    global failures
+    if not condition:
+        print(f'FAIL: {message}', file=sys.stderr)
+        failures += 1
+
+
+def int16(value):
+    value &= 0xFFFF
+    return value - 0x10000 if value & 0x8000 else value
+
+
+def sample(sensor, k):
+    z = -0x8000 if k % 3 == 0 else 0x7FFF if k % 3 == 1 else int16(k)
+    return (int16(k * 37 + sensor * 1000), int16(-k * 101), z), (TIME_START + k * 1250) & 0xFFFFFFFF
+
+
+def expected_frames():
+    """The frames the drain has to produce: per batch, pops of DRAIN_BATCH
+    samples, each cut into frames of V2_MAX_SAMPLES"""
+    frames = []
+    next_k = [0, 0, 0]
+    sequence = [SEQUENCE_START + s for s in range(3)]
+    for batch in range(BATCHES):
+        sensor = batch % 3
+        left = batch % 40 + 1
+        while left:
+            popped = min(left, DRAIN_BATCH)
+            left -= popped
+            while popped:
+                count = min(popped, sensor_frames.V2_MAX_SAMPLES)
+                popped -= count
+                samples = [sample(sensor, next_k[sensor] + n) for n in range(count)]
+                frames.append({'sensor': sensor_frames.SENSORS[sensor], 'sequence': sequence[sensor],
+                               'timestamp_us': samples[0][1], 'samples': [s[0] for s in samples]})
+                next_k[sensor] += count
+                sequence[sensor] = (sequence[sensor] + count) & 0xFFFFFFFF
+    return frames
+
+
+def decode_all(data):
+    """Returns the frames in order and how many bytes were skipped"""
+    frames, offset, skipped = [], 0, 0
+    while offset < len(data):
+        frame, used = sensor_frames.decode_v2(data[offset:offset + 64])
+        if frame is None and used == 0:
+            break
+        if frame is None:
+            skipped += used
+        else:
+            frame['offset'], frame['size'] = offset, used
+            frames.append(frame)
+        offset += used
+    return frames, skipped
+
+
+def main():
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, 'frames.bin')
+        result = subprocess.run([sys.argv[1], path], capture_output=True, text=True)
+        print(result.stdout, end='')
+        check(result.returncode == 0, f'encoder exited with {result.returncode}: {result.stderr}')
+        with open(path, 'rb') as f:
+            data = f.read()
+
+    frames, skipped = decode_all(data)
+    expected = expected_frames()
+    check(skipped == 0, f'{skipped} bytes between frames')
+    check(len(frames) == len(expected), f'{len(frames)} frames, expected {len(expected)}')
+    check(sum(f['size'] for f in frames) == len(data), 'bytes after the last frame')
+    wraps = 0
+    for index, (frame, want) in enumerate(zip(frames, expected)):
+        for key in ('sensor', 'sequence', 'timestamp_us', 'samples'):
+            check(frame[key] == want[key], f'frame {index} {key}: {frame[key]} != {want[key]}')
+        check(frame['size'] <= 64, f'frame {index} is {frame["size"]} bytes')
+        raw = data[frame['offset']:frame['offset'] + frame['size']]
+        reference = sensor_frames.encode_v2(sensor_frames.SENSORS.index(frame['sensor']), frame['sequence'],
+                                            frame['timestamp_us'], frame['samples'])
+        check(raw == reference, f'frame {index} differs from encode_v2()')
+        wraps += frame['sequence'] + len(frame['samples']) > 0xFFFFFFFF
+    check(wraps == 3, f'{wraps} sequences wrapped, expected one per sensor')
+    full = sum(len(f['samples']) == sensor_frames.V2_MAX_SAMPLES for f in frames)
+    print(f'{len(frames)} frames, {full} full ({sensor_frames.V2_HEADER_SIZE + 6 * sensor_frames.V2_MAX_SAMPLES + 2}'
+          f' bytes), {len(data)} bytes')
+
+    # Every single-bit error in a frame is caught, the next frame is found
+    corrupted = 0
+    for index in range(0, len(frames) - 1, 7):
+        frame = frames[index]
+        for position in range(frame['size']):
+            damaged = bytearray(data[frame['offset']:frames[index + 1]['offset'] + frames[index + 1]['size']])
+            damaged[position] ^= 1 << (position % 8)
+            decoded, _ = decode_all(bytes(damaged))
+            check(len(decoded) >= 1 and decoded[-1]['sequence'] == frames[index + 1]['sequence'],
+                  f'frame {index} byte {position}: next frame lost')
+            check(all(d['offset'] > 0 for d in decoded), f'frame {index} byte {position}: damaged frame accepted')
+            corrupted += 1
+    print(f'{corrupted} single-bit errors rejected')
+
+    # Decoder throughput against the device's worst case
+    rounds = 20
+    start = time.perf_counter()
+    for _ in range(rounds):
+        decode_all(data)
+    seconds = (time.perf_counter() - start) / rounds
+    frames_per_s = len(frames) / seconds
+    device_frames_per_s = HIGHEST_SAMPLES_PER_S / sensor_frames.V2_MAX_SAMPLES
+    print(f'decode_v2: {frames_per_s:.0f} frames/s, {frames_per_s / device_frames_per_s:.0f}x the '
+          f'{device_frames_per_s:.0f} frames/s of all sensors at their highest ODR')
+
+    if failures:
+        print(f'{failures} check(s) failed', file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
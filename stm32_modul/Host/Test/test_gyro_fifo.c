@@ -0,0 +1,117 @@
+/**
+  ******************************************************************************
+  * @file           : test_gyro_fifo.c
+  * @brief          : L3GD20 FIFO drain on the simulated part, which converts
+  *                   at 200 Hz instead of the configured 190 Hz. With the
+  *                   superloop stopped, each watermark interrupt has to bring
+  *                   in one burst of samples, stamped within a period of
+  *                   when the part converted them once the measured ODR has
+  *                   settled. A drain held off until the FIFO overruns is
+  *                   counted, and the gap it leaves is exactly the samples
+  *                   the part overwrote.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+
+#define GYRO_ODR_HZ 200.0f
+
+static uint64_t converted_at[1 << 16];   // conversion time of gyro sample n, by X
+
+static void Source(uint8_t sensor, uint32_t n, uint64_t time_us, int16_t data[3]) {
+    data[0] = (int16_t)n;
+    data[1] = (int16_t)-n;
+    data[2] = sensor;
+    if (sensor == SIM_SENSOR_GYR) {
+        converted_at[n & 0xFFFF] = time_us;
+    }
+}
+
+static uint8_t started = 0;
+static int16_t next_x;
+static uint32_t taken = 0;
+static uint32_t skipped = 0;
+static uint32_t stamp_error_us = 0;   // largest |stamp - conversion time|
+
+/* Pops what the drains queued and checks sequence and timestamps */
+static void Take(void) {
+    static Sample_TypeDef batch[SAMPLE_RING_SIZE];
+    uint16_t count = Sample_Ring_Pop(&sample_rings[SENSOR_GYR], batch, SAMPLE_RING_SIZE);
+
+    for (uint16_t n = 0; n < count; n++) {
+        CHECK_EQ(batch[n].data[2], SIM_SENSOR_GYR);
+        if (started) {
+            int16_t gap = (int16_t)(batch[n].data[0] - next_x);
+            CHECK(gap >= 0);
+            skipped += gap > 0 ? gap : 0;
+        }
+        started = 1;
+        next_x = (int16_t)(batch[n].data[0] + 1);
+        // the stamps wrap with the 32-bit microsecond clock, the conversion times do not
+        int32_t error = (int32_t)(batch[n].time - (uint32_t)converted_at[(uint16_t)batch[n].data[0]]);
+        uint32_t magnitude = error < 0 ? -error : error;
+        if (magnitude > stamp_error_us) {
+            stamp_error_us = magnitude;
+        }
+    }
+    taken += count;
+}
+
+static void Run_Isr_Only(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 50) {
+        Sim_Idle(50);
+        Take();
+    }
+}
+
+int main(void) {
+    Sim_Sensor_Set_Source(Source);
+    Sim_Sensor_Set_Odr(SIM_SENSOR_GYR, GYRO_ODR_HZ);
+    Sim_App_Run(2000);   // also lets the period estimate settle
+    CHECK(spi_async_enabled);
+    Sample_Ring_Discard(&sample_rings[SENSOR_GYR]);
+    printf("period estimate %u us, part %.0f us\n", (unsigned)sample_period_us[SENSOR_GYR], 1e6f / GYRO_ODR_HZ);
+    CHECK_NEAR(sample_period_us[SENSOR_GYR], 1e6f / GYRO_ODR_HZ, 50);
+
+    /* One interrupt and one burst per watermark worth of samples */
+    uint32_t edges = sensor_stats[SENSOR_GYR].edges;
+    uint32_t reads = sensor_stats[SENSOR_GYR].reads;
+    uint32_t read = Sim_Sensor_Stats(SIM_SENSOR_GYR)->read;
+    Run_Isr_Only(2000);
+    edges = sensor_stats[SENSOR_GYR].edges - edges;
+    reads = sensor_stats[SENSOR_GYR].reads - reads;
+    printf("2 s: %u samples in %u drains from %u interrupts, stamps within %u us\n", taken, reads, edges,
+           stamp_error_us);
+    CHECK_NEAR(taken, 2 * GYRO_ODR_HZ, GYRO_FIFO_WATERMARK + 1);
+    CHECK_EQ(taken, Sim_Sensor_Stats(SIM_SENSOR_GYR)->read - read);
+    CHECK_EQ(skipped, 0);
+    CHECK(reads <= taken / GYRO_FIFO_WATERMARK + 1);
+    CHECK(edges <= reads + 1);
+    CHECK(stamp_error_us < 1e6f / GYRO_ODR_HZ);
+
+    /* Drains held off for 300 ms: the stream FIFO overruns, the drain that
+       follows takes all 32 slots and counts the overrun */
+    uint32_t overruns = sensor_stats[SENSOR_GYR].overruns;
+    uint32_t overwritten = Sim_Sensor_Stats(SIM_SENSOR_GYR)->overwritten;
+    uint32_t period_us = sample_period_us[SENSOR_GYR];
+    spi_async_enabled = 0;
+    Run_Isr_Only(300);
+    CHECK_EQ(Sim_Sensor_Fifo_Level(SIM_SENSOR_GYR), FIFO_DEPTH);
+    spi_async_enabled = 1;
+    Gyro_Start_Read();   // the superloop's poll
+    Run_Isr_Only(500);
+    overwritten = Sim_Sensor_Stats(SIM_SENSOR_GYR)->overwritten - overwritten;
+    printf("held 300 ms: %u overwritten in the part, %u skipped, stamps within %u us\n", overwritten, skipped,
+           stamp_error_us);
+    CHECK(overwritten > 0);
+    CHECK_EQ(skipped, overwritten);
+    CHECK_EQ(sensor_stats[SENSOR_GYR].overruns, overruns + 1);
+    CHECK_NEAR(sample_period_us[SENSOR_GYR], period_us, 50);   // the long gap is not taken for the ODR
+    CHECK(stamp_error_us < 1e6f / GYRO_ODR_HZ);
+    TEST_EXIT();
+}
@@ -0,0 +1,246 @@
+/**
+  ******************************************************************************
+  * @file           : test_i2c_reads.c
+  * @brief          : DMA read engine of the LSM303 on the simulated I2C bus,
+  *                   with the superloop stopped: the EXTI callbacks start the
+  *                   reads and the completions queue the samples, so the
+  *                   rings fill from interrupt context alone. The test is
+  *                   the consumer and checks every sample arrives once, in
+  *                   order and stamped, across failed transfers and a bus
+  *                   held by a stuck read; what is missing must be what the
+  *                   part overwrote, never a sample the firmware dropped.
+  *                   The same holds when an EXTI comes in the middle of a
+  *                   request the superloop makes: a refused start it puts
+  *                   back on the pending mask, and Set_Acc_Rate() holding
+  *                   the reads for its blocking writes.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <stdlib.h>
+
+typedef struct {
+    uint8_t started;
+    int16_t next;           // X of the sample expected next, see the default sim source
+    uint32_t last_time;
+    uint32_t taken;
+    uint32_t skipped;       // samples missing from the sequence
+    uint32_t jitter_us;     // largest deviation of a step from the period
+} Stream_TypeDef;
+
+static Stream_TypeDef streams[SENSOR_COUNT];
+
+/* Pops everything the completions queued for the sensor and checks it
+   continues the part's sample sequence */
+static uint16_t Take(uint8_t sensor) {
+    static Sample_TypeDef batch[SAMPLE_RING_SIZE];
+    Stream_TypeDef *stream = &streams[sensor];
+    uint32_t period_us = (uint32_t)(1e6f / Sim_Sensor_Odr(sensor));
+    uint16_t count = Sample_Ring_Pop(&sample_rings[sensor], batch, SAMPLE_RING_SIZE);
+
+    for (uint16_t n = 0; n < count; n++) {
+        const Sample_TypeDef *sample = &batch[n];
+        CHECK_EQ(sample->data[2], sensor);
+        CHECK_EQ(sample->data[1], (int16_t)-sample->data[0]);
+        if (stream->started) {
+            int16_t gap = (int16_t)(sample->data[0] - stream->next);
+            uint32_t step_us = sample->time - stream->last_time;
+            CHECK(gap >= 0);
+            CHECK((int32_t)step_us > 0);
+            if (gap == 0 && (uint32_t)abs((int32_t)(step_us - period_us)) > stream->jitter_us) {
+                stream->jitter_us = abs((int32_t)(step_us - period_us));
+            }
+            stream->skipped += gap > 0 ? gap : 0;
+        }
+        stream->started = 1;
+        stream->next = (int16_t)(sample->data[0] + 1);
+        stream->last_time = sample->time;
+    }
+    stream->taken += count;
+    return count;
+}
+
+/* Lets the part and the interrupts run for ms, taking the samples as a
+   superloop that never gets to the bus would */
+static void Run_Isr_Only(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 100) {
+        Sim_Idle(ms - t < 100 ? ms - t : 100);
+        Take(SENSOR_MAG);
+        Take(SENSOR_ACC);
+    }
+}
+
+/* INT1 is already high; it drops and comes back, so an edge arrives
+   while the firmware is inside the refused start */
+static void Raise_Acc_Int(void) {
+    Sim_Gpio_Drive(SIM_PORT_E, 4, 0);
+    Sim_Gpio_Drive(SIM_PORT_E, 4, 1);
+}
+
+static void Release_Bus(void *context) {
+    (void)context;
+    Sim_I2C_Hold(0);
+}
+
+static uint32_t overwritten_before[SENSOR_COUNT];
+
+static void Mark(void) {
+    for (uint8_t sensor = SENSOR_MAG; sensor <= SENSOR_ACC; sensor++) {
+        overwritten_before[sensor] = Sim_Sensor_Stats(sensor)->overwritten;
+        streams[sensor].skipped = 0;
+    }
+}
+
+/* Every gap in the sequence since Mark() is a sample the part lost */
+static void Check_Gaps_Accounted(void) {
+    for (uint8_t sensor = SENSOR_MAG; sensor <= SENSOR_ACC; sensor++) {
+        CHECK_EQ(streams[sensor].skipped, Sim_Sensor_Stats(sensor)->overwritten - overwritten_before[sensor]);
+    }
+}
+
+int main(void) {
+    Sim_App_Run(1000);
+    CHECK(i2c_async_enabled);
+    /* From here on the superloop does not run and the test drains the rings */
+    Sample_Ring_Discard(&sample_rings[SENSOR_MAG]);
+    Sample_Ring_Discard(&sample_rings[SENSOR_ACC]);
+    uint32_t refusals = Sim_I2C_Busy_Refusals();
+    uint32_t errors = i2c_errors;
+
+    /* Reads started and completed from interrupt context only */
+    Mark();
+    uint32_t acc_read = Sim_Sensor_Stats(SENSOR_ACC)->read;
+    Run_Isr_Only(2000);
+    printf("2 s without the superloop: %u MAG, %u ACC samples, step jitter %u / %u us\n",
+           streams[SENSOR_MAG].taken, streams[SENSOR_ACC].taken, streams[SENSOR_MAG].jitter_us,
+           streams[SENSOR_ACC].jitter_us);
+    CHECK_NEAR(streams[SENSOR_MAG].taken, 2.0 * Sim_Sensor_Odr(SENSOR_MAG), 2);
+    CHECK_NEAR(streams[SENSOR_ACC].taken, 2.0 * Sim_Sensor_Odr(SENSOR_ACC), ACC_FIFO_WATERMARK + 1);
+    CHECK_EQ(streams[SENSOR_ACC].taken, Sim_Sensor_Stats(SENSOR_ACC)->read - acc_read);
+    CHECK_EQ(streams[SENSOR_MAG].skipped + streams[SENSOR_ACC].skipped, 0);
+    CHECK(streams[SENSOR_MAG].jitter_us < 1e6f / Sim_Sensor_Odr(SENSOR_MAG) / 4);
+    CHECK(streams[SENSOR_ACC].jitter_us < 1e6f / Sim_Sensor_Odr(SENSOR_ACC) / 4);
+    CHECK_EQ(i2c_errors, errors);
+    CHECK_EQ(Sim_I2C_Busy_Refusals(), refusals);   // the engine never calls into a busy bus
+
+    /* A failed transfer leaves the sensor pending for the superloop's poll;
+       a retry before the next conversion loses nothing */
+    Mark();
+    Sim_I2C_Fail_Next(1);
+    while (i2c_errors == errors) {
+        Sim_Idle(1);
+    }
+    CHECK_EQ(i2c_errors, errors + 1);
+    CHECK_EQ(i2c_stage, READ_STAGE_IDLE);
+    CHECK(i2c_pending_mask & (1 << SENSOR_MAG));
+    I2C_Start_Next_Read();
+    Run_Isr_Only(500);
+    CHECK_EQ(i2c_pending_mask, 0);
+    CHECK_EQ(streams[SENSOR_MAG].skipped, 0);
+    Check_Gaps_Accounted();
+
+    /* Failures in a row, each retried from a poll that comes late: the
+       part overwrites samples meanwhile, the firmware loses none */
+    Mark();
+    Sim_I2C_Fail_Next(3);
+    for (uint8_t i = 0; i < 20; i++) {
+        Run_Isr_Only(10);
+        I2C_Start_Next_Read();
+    }
+    Run_Isr_Only(500);
+    CHECK_EQ(i2c_errors, errors + 4);
+    CHECK(streams[SENSOR_MAG].skipped > 0);
+    Check_Gaps_Accounted();
+
+    /* A read stuck on the bus: the other requests wait for it without
+       touching the bus, and are served magnetometer first once it ends */
+    Mark();
+    Run_Isr_Only(10);
+    Sim_I2C_Hold(1);
+    Run_Isr_Only(300);
+    CHECK(i2c_stage != READ_STAGE_IDLE);
+    CHECK_EQ(i2c_pending_mask, (1 << SENSOR_MAG) | (1 << SENSOR_ACC));
+    CHECK_EQ(Sim_I2C_Busy_Refusals(), refusals);
+    uint32_t mag_before = streams[SENSOR_MAG].taken;
+    uint32_t acc_before = streams[SENSOR_ACC].taken;
+    Sim_I2C_Hold(0);
+    Sim_Idle(1);
+    Take(SENSOR_MAG);
+    Take(SENSOR_ACC);
+    CHECK(streams[SENSOR_MAG].taken > mag_before);
+    CHECK_EQ(streams[SENSOR_ACC].taken, acc_before);  // its FIFO burst is still on the bus
+    Run_Isr_Only(500);
+    CHECK(streams[SENSOR_ACC].taken > acc_before);
+    CHECK_EQ(i2c_pending_mask, 0);
+    Check_Gaps_Accounted();
+    CHECK_EQ(Sim_Sensor_Stats(SENSOR_ACC)->overwritten, overwritten_before[SENSOR_ACC]);  // 300 ms fit in the FIFO
+
+    /* Both wait while the reads are held, then the superloop's start of the
+       magnetometer is refused and INT1 fires in the middle of it. The EXTI
+       is taken as the requeue leaves its critical section, finds the
+       magnetometer back on the mask and starts it; no bit is lost */
+    Mark();
+    i2c_async_enabled = 0;
+    for (uint32_t ms = 0; ms < 500 && (i2c_stage != READ_STAGE_IDLE ||
+                                       i2c_pending_mask != ((1 << SENSOR_MAG) | (1 << SENSOR_ACC))); ms++) {
+        Sim_Idle(1);
+    }
+    CHECK_EQ(i2c_pending_mask, (1 << SENSOR_MAG) | (1 << SENSOR_ACC));
+    CHECK_EQ(HAL_GPIO_ReadPin(GPIOE, GPIO_PIN_4), GPIO_PIN_SET);
+    uint32_t acc_edges = sensor_stats[SENSOR_ACC].edges;
+    Sim_I2C_Refuse_Next(1, Raise_Acc_Int);
+    i2c_async_enabled = 1;
+    I2C_Start_Next_Read();
+    CHECK_EQ(sensor_stats[SENSOR_ACC].edges, acc_edges + 1);
+    CHECK(i2c_stage != READ_STAGE_IDLE);
+    CHECK_EQ(i2c_active_sensor, SENSOR_MAG);
+    CHECK_EQ(i2c_pending_mask, 1 << SENSOR_ACC);
+    Run_Isr_Only(500);
+    CHECK_EQ(i2c_pending_mask, 0);
+    Check_Gaps_Accounted();
+
+    /* A rate switch from the superloop waits out a stuck read while DRDY
+       fires, then requests the accelerometer itself: the magnetometer's
+       request from meanwhile is served too and both go on */
+    for (uint8_t i = 0; i < 2; i++) {
+        Mark();
+        Run_Isr_Only(10);
+        Sim_I2C_Hold(1);
+        while (i2c_stage == READ_STAGE_IDLE) {
+            Sim_Idle(1);
+        }
+        uint32_t mag_edges = sensor_stats[SENSOR_MAG].edges;
+        acc_edges = sensor_stats[SENSOR_ACC].edges;
+        Sim_At(Sim_Now_Us() + 2000, Release_Bus, NULL);   // leaves the switch time for an ACC burst
+        Sim_Sensor_Set_Odr(SIM_SENSOR_MAG, 1000);   // a DRDY edge within the wait
+        CHECK(Set_Acc_Rate(i == 0 ? SPECTRUM_ACC_CTRL1 : ACC_CTRL1_VALUE));
+        Sim_Sensor_Set_Odr(SIM_SENSOR_MAG, 0);
+        mag_edges = sensor_stats[SENSOR_MAG].edges - mag_edges;
+        acc_edges = sensor_stats[SENSOR_ACC].edges - acc_edges;
+        CHECK(mag_edges > 0);
+        streams[SENSOR_ACC].started = 0;    // the switch empties the FIFO
+        uint32_t mag_taken = streams[SENSOR_MAG].taken, acc_taken = streams[SENSOR_ACC].taken;
+        Run_Isr_Only(500);
+        printf("rate switch to %.0f Hz: %u MAG, %u ACC edges during it, then %u MAG, %u ACC samples in 0.5 s\n",
+               Sim_Sensor_Odr(SENSOR_ACC), mag_edges, acc_edges, streams[SENSOR_MAG].taken - mag_taken,
+               streams[SENSOR_ACC].taken - acc_taken);
+        CHECK_NEAR(streams[SENSOR_MAG].taken - mag_taken, 0.5 * Sim_Sensor_Odr(SENSOR_MAG), 2);
+        CHECK_NEAR(streams[SENSOR_ACC].taken - acc_taken, 0.5 * Sim_Sensor_Odr(SENSOR_ACC),
+                   0.05 * Sim_Sensor_Odr(SENSOR_ACC) + 2 * (ACC_FIFO_WATERMARK + 1));
+        CHECK_EQ(streams[SENSOR_MAG].skipped, Sim_Sensor_Stats(SENSOR_MAG)->overwritten -
+                                              overwritten_before[SENSOR_MAG]);
+    }
+    CHECK_EQ(Sim_I2C_Busy_Refusals(), refusals);
+
+    /* The superloop takes over again */
+    uint32_t delivered = sensor_stats[SENSOR_MAG].delivered;
+    Sim_App_Run(500);
+    CHECK(sensor_stats[SENSOR_MAG].delivered > delivered);
+    CHECK_EQ(Sim_I2C_Busy_Refusals(), refusals);
+    TEST_EXIT();
+}
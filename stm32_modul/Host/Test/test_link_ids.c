@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file           : test_link_ids.c
+  * @brief          : Browsers holding page server links while the send
+  *                   engine reconnects. CIPSERVER gives page clients the
+  *                   lowest free ids; if the engine opened one of those it
+  *                   would get "ALREADY CONNECTED" and take the browser's
+  *                   connection for its own, sending sensor data into it.
+  *                   The request links have to stay above the ids the
+  *                   server may hand out.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BROWSERS 3
+
+/* Number after prefix in a recorded command, -1 if it does not start with it */
+static int Command_Link(const Sim_Esp_Command_TypeDef *command, const char *prefix) {
+    size_t length = strlen(prefix);
+    return strncmp(command->text, prefix, length) == 0 ? atoi(&command->text[length]) : -1;
+}
+
+int main(void) {
+    int browsers[BROWSERS];
+
+    Sim_App_Run(1000);
+    CHECK(Sim_Esp_Count("AT+CIPSERVERMAXCONN=" ESP_STRINGIFY(ESP_SERVER_MAX_CONN)) > 0);
+    CHECK(Sim_Esp_Count("<") > 0);
+
+    /* Every link drops with the access point; the browsers on the soft AP
+       connect to the page server before the station is back */
+    Sim_Esp_Wifi_Lost();
+    Sim_App_Run(200);
+    uint32_t first_command = Sim_Esp_Command_Count();
+    uint8_t accepted = 0;
+    for (uint8_t i = 0; i < BROWSERS; i++) {
+        browsers[i] = Sim_Esp_Web_Request("GET /favicon.ico HTTP/1.1\r\nHost: 192.168.4.1\r\n\r\n");
+        accepted += browsers[i] >= 0;
+    }
+    CHECK_EQ(accepted, ESP_SERVER_MAX_CONN);
+    Sim_App_Run(200);
+    uint32_t payloads = Sim_Esp_Count("<");
+    Sim_Esp_Wifi_Back();
+    Sim_App_Run(3000);
+    CHECK(Sim_Esp_Count("<") > payloads);
+
+    /* The browsers still have their links, and the engine never touched them */
+    for (uint8_t i = 0; i < BROWSERS; i++) {
+        if (browsers[i] >= 0) {
+            CHECK_EQ(Sim_Esp_Link_Owner(browsers[i]), 2);
+        }
+    }
+    for (uint32_t i = first_command; i < Sim_Esp_Command_Count(); i++) {
+        const Sim_Esp_Command_TypeDef *command = Sim_Esp_Command(i);
+        int link = Command_Link(command, "AT+CIPSTART=");
+        if (link < 0) {
+            link = Command_Link(command, "AT+CIPSEND=");
+        }
+        if (link >= 0 && link < ESP_SERVER_MAX_CONN) {
+            fprintf(stderr, "%.3f s: %s on a page server id\n", command->time_us / 1e6, command->text);
+            CHECK(link >= ESP_SERVER_MAX_CONN);
+        }
+    }
+    for (uint8_t link = ESP_LINK_ID - ESP_LINK_COUNT + 1; link <= ESP_LINK_ID; link++) {
+        CHECK(Sim_Esp_Link_Owner(link) != 2);
+    }
+    TEST_EXIT();
+}
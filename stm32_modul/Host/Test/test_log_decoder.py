@@ -0,0 +1,86 @@
+"""Round trip of the deferred log frames: the firmware sends, log_decoder.py prints.
+
+Runs log_frames_encoder (the path of the built program is the only argument),
+which logs every entry of log_ids.h once through main.c's Drain_Log() and
+saves what reached the USB host next to the text the device would have
+printed for each record. Runs log_decoder.py on the capture as a user would
+and checks that
+- it prints one line per id of the firmware's table, no more, no less,
+- every line carries a tick and the message of its id with its arguments,
+  so the decoder's reading of log_ids.h matches the compiled one,
+- a flipped bit in any byte of a frame drops that frame only.
+Exit status 1 if any check failed.
+"""
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+import log_decoder
+
+LINE = re.compile(r'\[\s*\d+\.\d{3}\] (.*)')
+
+failures = 0
+
+
+def check(condition, message):
+    global failures
+    if not condition:
+        print(f'FAIL: {message}', file=sys.stderr)
+        failures += 1
+
+
+def decoded_lines(path):
+    """log_decoder.py's output for a capture file, without the ticks"""
+    result = subprocess.run([sys.executable, log_decoder.__file__, path], capture_output=True, text=True)
+    check(result.returncode == 0, f'log_decoder.py exited with {result.returncode}: {result.stderr}')
+    messages = []
+    for line in result.stdout.splitlines():
+        match = LINE.fullmatch(line)
+        check(match is not None, f'no tick in "{line}"')
+        messages.append(match.group(1) if match else line)
+    return messages
+
+
+def main():
+    with tempfile.TemporaryDirectory() as directory:
+        capture = os.path.join(directory, 'log.bin')
+        expected_path = os.path.join(directory, 'expected.txt')
+        result = subprocess.run([sys.argv[1], capture, expected_path], capture_output=True, text=True)
+        print(result.stdout, end='')
+        check(result.returncode == 0, f'encoder exited with {result.returncode}: {result.stderr}')
+        with open(expected_path, encoding='utf-8') as f:
+            expected = f.read().splitlines()
+        with open(capture, 'rb') as f:
+            data = f.read()
+
+        formats = log_decoder.load_formats()
+        check(len(formats) == len(expected), f'decoder knows {len(formats)} ids, firmware has {len(expected)}')
+        check(len(data) == len(expected) * log_decoder.LOG_FRAME_SIZE, f'{len(data)} bytes for {len(expected)} ids')
+
+        messages = decoded_lines(capture)
+        check(len(messages) == len(expected), f'{len(messages)} lines for {len(expected)} ids')
+        for log_id, (message, want) in enumerate(zip(messages, expected)):
+            name = formats[log_id][0] if log_id < len(formats) else '?'
+            check(message == want, f'id {log_id} ({name}): "{message}" != "{want}"')
+        print(f'{len(messages)} log ids decoded')
+
+        # A damaged frame is skipped, its neighbours still decode
+        size = log_decoder.LOG_FRAME_SIZE
+        damaged_path = os.path.join(directory, 'damaged.bin')
+        for position in range(size):
+            damaged = bytearray(data[:3 * size])
+            damaged[size + position] ^= 1 << (position % 8)
+            with open(damaged_path, 'wb') as f:
+                f.write(damaged)
+            check(decoded_lines(damaged_path) == [expected[0], expected[2]], f'byte {position} of id 1 flipped')
+        print(f'{size} single-bit errors rejected')
+
+    if failures:
+        print(f'{failures} check(s) failed', file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
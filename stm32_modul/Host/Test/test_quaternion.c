@@ -0,0 +1,136 @@
+/**
+  ******************************************************************************
+  * @file           : test_quaternion.c
+  * @brief          : MODE_QUATERNION_CDC with no ESP on the board, so no
+  *                   server connection ever comes up: the orientation stream
+  *                   goes to USB alone and must not wait for one. Every gyro
+  *                   sample has to give one frame with a good CRC, the next
+  *                   sequence number and a unit quaternion. The board lies
+  *                   still, then turns about its Z axis; the orientation has
+  *                   to hold, then follow the turn.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <math.h>
+
+#define STILL_MS 2000
+#define TURN_MS 1000
+#define TURN_DPS 45.0
+
+static uint64_t turn_start_us = 0;   // 0 = lying still
+
+/* Level and pointing north, then turning at TURN_DPS from turn_start_us:
+   the gyro sees the rate, the field turns the other way in the body frame */
+static void Board(uint8_t sensor, uint32_t n, uint64_t time_us, int16_t data[3]) {
+    uint8_t turning = turn_start_us && time_us > turn_start_us;
+    double angle = turning ? TURN_DPS * M_PI / 180.0 * (time_us - turn_start_us) * 1e-6 : 0;
+    (void)n;
+    switch (sensor) {
+        case SIM_SENSOR_MAG:   // 0.3 gauss north, 0.4 gauss down
+            data[0] = (int16_t)lrint(0.3 * cos(angle) * 32768.0 / 50.0);
+            data[1] = (int16_t)lrint(-0.3 * sin(angle) * 32768.0 / 50.0);
+            data[2] = (int16_t)lrint(-0.4 * 32768.0 / 50.0);
+            break;
+        case SIM_SENSOR_ACC:   // 1 g up
+            data[0] = 0;
+            data[1] = 0;
+            data[2] = 8192;
+            break;
+        default:
+            data[0] = 0;
+            data[1] = 0;
+            data[2] = turning ? (int16_t)lrint(TURN_DPS * 32768.0 / 500.0) : 0;
+            break;
+    }
+}
+
+typedef struct {
+    uint32_t frames;
+    uint32_t next_sequence;
+    uint32_t sequence_breaks;
+    double first[4];
+    double last[4];
+} Stream_TypeDef;
+
+/* Every quaternion frame in the USB capture */
+static void Read_Frames(Stream_TypeDef *stream) {
+    size_t length;
+    const uint8_t *usb = Sim_Usb_Captured(&length);
+
+    for (size_t i = 0; i + QUATERNION_FRAME_SIZE <= length; i++) {
+        const uint8_t *frame = &usb[i];
+        if ((frame[0] | frame[1] << 8) != HEADER_QUATERNION ||
+            (frame[QUATERNION_FRAME_SIZE - 2] | frame[QUATERNION_FRAME_SIZE - 1] << 8) !=
+                Crc16_Ccitt(frame, QUATERNION_FRAME_SIZE - 2)) {
+            continue;
+        }
+        uint32_t sequence = frame[2] | frame[3] << 8 | frame[4] << 16 | (uint32_t)frame[5] << 24;
+        double q[4], norm = 0;
+        for (uint8_t k = 0; k < 4; k++) {
+            q[k] = (int16_t)(frame[10 + 2 * k] | frame[11 + 2 * k] << 8) / 16384.0;
+            norm += q[k] * q[k];
+        }
+        CHECK_NEAR(sqrt(norm), 1.0, 0.002);
+        if (stream->frames > 0 && sequence != stream->next_sequence) {
+            stream->sequence_breaks++;
+        }
+        for (uint8_t k = 0; k < 4; k++) {
+            if (stream->frames == 0) {
+                stream->first[k] = q[k];
+            }
+            stream->last[k] = q[k];
+        }
+        stream->next_sequence = sequence + 1;
+        stream->frames++;
+        i += QUATERNION_FRAME_SIZE - 1;
+    }
+}
+
+/* Angle between two orientations in degrees */
+static double Angle_Deg(const double *a, const double *b) {
+    double dot = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+    return 2.0 * acos(dot > 1.0 ? 1.0 : dot) * 180.0 / M_PI;
+}
+
+static void Check_Stream(const char *phase, uint32_t ms, double turn_deg, double tolerance_deg) {
+    Stream_TypeDef stream = { 0 };
+    uint32_t delivered = sensor_stats[SENSOR_GYR].delivered;
+
+    Sim_Usb_Clear();
+    Sim_App_Run(ms);
+    Read_Frames(&stream);
+    double angle = Angle_Deg(stream.first, stream.last);
+    printf("%s: %u frames for %u gyro samples in %u ms, turned %.1f deg\n", phase, stream.frames,
+           sensor_stats[SENSOR_GYR].delivered - delivered, ms, angle);
+    CHECK_EQ(stream.frames, sensor_stats[SENSOR_GYR].delivered - delivered);
+    CHECK(stream.frames >= 0.9 * Sim_Sensor_Odr(SIM_SENSOR_GYR) * ms / 1000.0);
+    CHECK_EQ(stream.sequence_breaks, 0);
+    CHECK_NEAR(angle, turn_deg, tolerance_deg);
+}
+
+int main(void) {
+    sim_esp.present = 0;
+    Sim_Sensor_Set_Source(Board);
+    Sim_App_Run(1000);
+    CHECK(!connection_established);
+
+    /* Long press into the mode, as from the button */
+    transmission_mode = MODE_QUATERNION_CDC - 1;
+    button_action_type = 1;
+    button_action_pending = 1;
+    Sim_App_Run(1000);   // the filter settles on the still board
+    CHECK_EQ(transmission_mode, MODE_QUATERNION_CDC);
+
+    Check_Stream("still", STILL_MS, 0, 1);
+    turn_start_us = Sim_Now_Us();
+    Check_Stream("turning", TURN_MS, TURN_DPS * TURN_MS / 1000.0, 5);
+    CHECK(!connection_established);
+    CHECK_EQ(Sim_Esp_Command_Count(), 0);
+    TEST_EXIT();
+}
@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file           : test_reconnect.c
+  * @brief          : Link tracking of the send engine against the simulated
+  *                   ESP, from reset in MODE_ASCII_UART. With the server
+  *                   down, CIPSTART has to be retried after
+  *                   ESP_BACKOFF_MIN, doubling up to ESP_BACKOFF_MAX, and
+  *                   the link has to come up on the first attempt after
+  *                   the server does. A "busy p..." answer counts as a
+  *                   failed attempt. Closed links are only reopened once
+  *                   the module reported all of them closed, and after a
+  *                   Wi-Fi drop the next attempt follows WIFI GOT IP right
+  *                   away instead of waiting out the backoff. The link
+  *                   state comes from these notifications alone: no
+  *                   AT+CIPSTATUS after the warm start.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include "esp_script.h"
+
+#define CONNECT "AT+CIPSTART=" ESP_STRINGIFY(ESP_LINK_ID) ",*"
+#define OUTAGE_MS 100000      // long enough for two attempts at ESP_BACKOFF_MAX
+#define SLACK_MS 30           // the reply to CIPSTART and the next superloop pass
+
+/* Times of the connect attempts from command first on, in s */
+static uint32_t Attempts(uint32_t first, double *times, uint32_t size) {
+    uint32_t count = 0;
+    for (uint32_t i = Esp_Script_Find(first, CONNECT); i < Sim_Esp_Command_Count() && count < size;
+         i = Esp_Script_Find(i + 1, CONNECT)) {
+        times[count++] = Esp_Script_Time_S(i);
+    }
+    return count;
+}
+
+/* Attempts after a failed one come backoff ms after its answer, which
+   took up to answer_ms; the backoff doubles from ESP_BACKOFF_MIN. The
+   engine counts whole milliseconds. */
+static void Check_Backoff(const double *times, uint32_t count, uint32_t answer_ms) {
+    uint32_t backoff = ESP_BACKOFF_MIN;
+    for (uint32_t n = 1; n < count; n++) {
+        double gap_ms = (times[n] - times[n - 1]) * 1000;
+        if (gap_ms < backoff - 1 || gap_ms > backoff + answer_ms + SLACK_MS) {
+            fprintf(stderr, "attempt %u came %.0f ms after the last one, expected %u\n", n, gap_ms, backoff);
+            sim_test_failures++;
+        }
+        backoff = backoff * 2 > ESP_BACKOFF_MAX ? ESP_BACKOFF_MAX : backoff * 2;
+    }
+}
+
+static void Test_Server_Down(void) {
+    double times[32];
+
+    sim_esp.server_up = 0;
+    Sim_App_Run(OUTAGE_MS);
+    uint32_t failed = Attempts(0, times, 32);
+    printf("server down: %u attempts, the last %.1f s after the one before\n", failed,
+           times[failed - 1] - times[failed - 2]);
+    CHECK(failed >= 8);
+    Check_Backoff(times, failed, sim_esp.connect_ms);   // refused once the server was tried
+    CHECK_EQ(esp_transport_stats.connect_failures, failed);
+    CHECK(!connection_established);
+
+    /* The next attempt after the server is back gets through */
+    uint32_t mark = Sim_Esp_Command_Count();
+    sim_esp.server_up = 1;
+    Sim_App_Run(ESP_BACKOFF_MAX + 1000);
+    CHECK_EQ(Attempts(mark, times, 32), 1);
+    CHECK(connection_established);
+    CHECK_EQ(esp_transport_stats.connects, 1);
+    CHECK_EQ(esp_transport_stats.connect_failures, failed);
+    CHECK(Sim_Http_Request_Count() > 0);
+}
+
+/* The server closes the links; a busy module turns the first attempt down */
+static void Test_Busy(void) {
+    double times[4];
+    uint32_t failures = esp_transport_stats.connect_failures, connects = esp_transport_stats.connects;
+
+    Sim_App_Run(1000);
+    uint32_t mark = Sim_Esp_Command_Count();
+    Sim_Esp_Rule("AT+CIPSTART=", "busy p...\r\n", 0, 1);
+    double closed = Sim_Now_Us() / 1e6;
+    for (uint8_t link = ESP_LINK_ID - ESP_LINK_COUNT + 1; link < ESP_LINK_ID; link++) {
+        Sim_Esp_Close_Link(link);
+    }
+    Sim_App_Run(200);
+    CHECK_EQ(Attempts(mark, times, 4), 0);   // one link left, nothing to reconnect
+    CHECK(connection_established);
+    Sim_Esp_Close_Link(ESP_LINK_ID);
+    Sim_App_Run(2000);
+
+    uint32_t attempts = Attempts(mark, times, 4);
+    CHECK_EQ(attempts, 2);
+    CHECK(attempts > 0 && (times[0] - closed) * 1000 <= 200 + SLACK_MS);
+    Check_Backoff(times, attempts, 0);
+    CHECK_EQ(esp_transport_stats.connect_failures, failures + 1);
+    CHECK_EQ(esp_transport_stats.connects, connects + 1);
+    CHECK(connection_established);
+}
+
+/* No IP, so every attempt fails at once until WIFI GOT IP */
+static void Test_Wifi_Drop(void) {
+    double times[16];
+    uint32_t connects = esp_transport_stats.connects;
+
+    uint32_t mark = Sim_Esp_Command_Count();
+    Sim_Esp_Wifi_Lost();
+    Sim_App_Run(10000);
+    uint32_t failed = Attempts(mark, times, 16);
+    CHECK(failed >= 4);
+    Check_Backoff(times, failed, 0);
+    CHECK(!connection_established);
+
+    mark = Sim_Esp_Command_Count();
+    double back = Sim_Now_Us() / 1e6;
+    Sim_Esp_Wifi_Back();
+    Sim_App_Run(1000);
+    if (Attempts(mark, times, 16) != 1) {
+        fprintf(stderr, "%u attempts after WIFI GOT IP, expected 1\n", Attempts(mark, times, 16));
+        sim_test_failures++;
+        return;
+    }
+    printf("Wi-Fi back: attempt %.0f ms after WIFI GOT IP, %u attempts before\n", (times[0] - back) * 1000, failed);
+    CHECK((times[0] - back) * 1000 <= SLACK_MS);
+    CHECK(connection_established);
+    CHECK_EQ(esp_transport_stats.connects, connects + 1);
+}
+
+int main(void) {
+    Test_Server_Down();
+    Test_Busy();
+    Test_Wifi_Drop();
+    CHECK_EQ(Sim_Esp_Count("AT+CIPSTATUS"), 1);   // the warm start's query only
+    TEST_EXIT();
+}
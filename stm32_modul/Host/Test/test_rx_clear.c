@@ -0,0 +1,72 @@
+/**
+  ******************************************************************************
+  * @file           : test_rx_clear.c
+  * @brief          : A link closing while Handle_Client_Request() stores the
+  *                   posted network in flash. The "n,CLOSED" arrives after
+  *                   Check_Reception_Completion() took the request's events
+  *                   and before the response text is cleared; the clear must
+  *                   not take the queued event with it, or the send engine
+  *                   keeps using a link the module already dropped.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <string.h>
+
+static int closed_link = -1;
+static uint64_t closed_time = 0;
+
+static void Close_During_Write(uintptr_t address) {
+    (void)address;
+    for (uint8_t link = 0; link < SIM_ESP_LINKS; link++) {
+        if (Sim_Esp_Link_Owner(link) == 1) {
+            closed_link = link;
+            closed_time = Sim_Now_Us();
+            Sim_Esp_Close_Link(link);
+            break;
+        }
+    }
+    Sim_Flash_On_Program(NULL);
+}
+
+int main(void) {
+    char prefix[32];
+
+    Sim_App_Run(1000);
+    CHECK(Sim_Http_Request_Count() > 0);
+
+    Sim_Flash_On_Program(Close_During_Write);
+    CHECK(Sim_Esp_Web_Request("GET /?ssid=Lab&password=secret HTTP/1.1\r\nHost: 192.168.4.1\r\n\r\n") >= 0);
+    Sim_App_Run(6000);
+    CHECK(closed_link >= 0);
+    CHECK_EQ(strcmp(device_config.ssid, "Lab"), 0);
+
+    /* After the close the link is opened again before anything is sent on it */
+    uint8_t reopened = 0;
+    uint32_t sends_on_closed = 0;
+    snprintf(prefix, sizeof(prefix), "AT+CIPSTART=%d,", closed_link);
+    size_t start_length = strlen(prefix);
+    char send_prefix[32];
+    snprintf(send_prefix, sizeof(send_prefix), "AT+CIPSEND=%d,", closed_link);
+    for (uint32_t i = 0; i < Sim_Esp_Command_Count(); i++) {
+        const Sim_Esp_Command_TypeDef *command = Sim_Esp_Command(i);
+        if (command->time_us < closed_time || reopened) {
+            continue;
+        }
+        if (strncmp(command->text, prefix, start_length) == 0) {
+            reopened = 1;
+        } else if (strncmp(command->text, send_prefix, strlen(send_prefix)) == 0) {
+            sends_on_closed++;
+        }
+    }
+    CHECK_EQ(sends_on_closed, 0);
+    if (sim_test_failures) {
+        Sim_Esp_Print_Transcript(stderr);
+    }
+    TEST_EXIT();
+}
@@ -0,0 +1,198 @@
+/**
+  ******************************************************************************
+  * @file           : test_sample_ring.c
+  * @brief          : SPSC sample ring: order and timestamps kept across index
+  *                   wrap-around, the capacity of one slot less than the
+  *                   size, overruns counted per refused sample, partial pops
+  *                   and discard. Then a producer pushes bursts the way the
+  *                   read completions do, preempting a consumer that stalls
+  *                   now and then, first at each of the ring's barriers and
+  *                   then from a timer signal; every sample the ring
+  *                   accepted has to come out once, in order.
+  ******************************************************************************
+  */
+
+#include <stdint.h>
+
+/* The ring's barriers sit between the steps whose order matters; the test
+   can run the producer there, as an interrupt taken at that point would */
+static void Barrier(void);
+#define SAMPLE_RING_BARRIER() Barrier()
+
+#include "sample_ring.h"
+#include "sim_test.h"
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define STRESS_SAMPLES 1000000u
+#define DRAIN_BATCH 16     // SAMPLE_DRAIN_BATCH of main.c
+#define BURST_MAX 32       // a full FIFO drain
+
+static Sample_Ring_TypeDef ring;
+
+/* Sample n carries n in its data and time */
+static uint8_t Push_Number(uint32_t n) {
+    int16_t data[3] = { (int16_t)n, (int16_t)(n >> 16), (int16_t)~n };
+    return Sample_Ring_Push(&ring, data, n);
+}
+
+static uint32_t Number(const Sample_TypeDef *sample) {
+    uint32_t n = (uint16_t)sample->data[0] | (uint32_t)(uint16_t)sample->data[1] << 16;
+    CHECK_EQ(sample->data[2], (int16_t)~n);
+    CHECK_EQ(sample->time, n);
+    return n;
+}
+
+static void Test_Single_Thread(void) {
+    Sample_TypeDef out[SAMPLE_RING_SIZE];
+    uint32_t pushed = 0, popped = 0;
+
+    Sample_Ring_Init(&ring);
+    CHECK_EQ(Sample_Ring_Count(&ring), 0);
+    CHECK_EQ(Sample_Ring_Pop(&ring, out, SAMPLE_RING_SIZE), 0);
+
+    /* Full at SIZE - 1; each refused sample is one overrun and changes nothing */
+    while (Push_Number(pushed)) {
+        pushed++;
+    }
+    CHECK_EQ(pushed, SAMPLE_RING_SIZE - 1);
+    CHECK_EQ(Sample_Ring_Count(&ring), SAMPLE_RING_SIZE - 1);
+    CHECK(!Push_Number(pushed));
+    CHECK_EQ(ring.overruns, 2);
+
+    /* Partial pops take the oldest first */
+    CHECK_EQ(Sample_Ring_Pop(&ring, out, 10), 10);
+    for (uint16_t n = 0; n < 10; n++) {
+        CHECK_EQ(Number(&out[n]), popped++);
+    }
+    CHECK_EQ(Sample_Ring_Count(&ring), SAMPLE_RING_SIZE - 11);
+
+    /* Many rounds of uneven pushes and pops move the indices around the
+       ring hundreds of times */
+    for (uint32_t round = 0; round < 20000; round++) {
+        uint16_t pushes = (round * 7) % 23;
+        for (uint16_t i = 0; i < pushes && Sample_Ring_Count(&ring) < SAMPLE_RING_SIZE - 1; i++) {
+            CHECK(Push_Number(pushed));
+            pushed++;
+        }
+        uint16_t count = Sample_Ring_Pop(&ring, out, (round * 5) % 19 + 1);
+        for (uint16_t n = 0; n < count; n++) {
+            CHECK_EQ(Number(&out[n]), popped++);
+        }
+        CHECK_EQ(Sample_Ring_Count(&ring), pushed - popped);
+    }
+    CHECK(pushed > 50 * SAMPLE_RING_SIZE);
+    CHECK_EQ(ring.overruns, 2);
+
+    /* Discard drops what is stored, the ring stays usable */
+    CHECK(Push_Number(pushed));
+    Sample_Ring_Discard(&ring);
+    CHECK_EQ(Sample_Ring_Count(&ring), 0);
+    CHECK(Push_Number(pushed + 1));
+    CHECK_EQ(Sample_Ring_Pop(&ring, out, SAMPLE_RING_SIZE), 1);
+    CHECK_EQ(Number(&out[0]), pushed + 1);
+}
+
+/* The producer stands in for the read completion interrupt. It numbers
+   only the samples the ring accepts, so the consumer must see an unbroken
+   sequence whatever was refused. */
+static volatile uint32_t accepted = 0;
+static volatile uint32_t attempts = 0;
+static volatile uint32_t bursts = 0;
+static volatile uint8_t preempt_at_barriers = 0;
+static volatile uint8_t in_producer = 0;
+
+static void Producer(int signal_number) {
+    (void)signal_number;
+    uint16_t burst = bursts++ % BURST_MAX + 1;   // one sample up to a full FIFO drain
+    in_producer = 1;
+    for (uint16_t i = 0; i < burst && accepted < STRESS_SAMPLES; i++) {
+        attempts++;
+        if (Push_Number(accepted)) {
+            accepted++;
+        }
+    }
+    in_producer = 0;
+}
+
+static void Barrier(void) {
+    __asm volatile ("" ::: "memory");
+    if (preempt_at_barriers && !in_producer) {
+        Producer(0);
+    }
+}
+
+/* Pops until every sample the producer will accept came out; returns how
+   many were out of sequence */
+static uint32_t Consume(uint32_t *passes) {
+    Sample_TypeDef out[DRAIN_BATCH];
+    uint32_t expected = 0, bad = 0;
+
+    while (expected < STRESS_SAMPLES) {
+        uint16_t count = Sample_Ring_Pop(&ring, out, DRAIN_BATCH);
+        for (uint16_t n = 0; n < count; n++) {
+            uint32_t number = (uint16_t)out[n].data[0] | (uint32_t)(uint16_t)out[n].data[1] << 16;
+            if (number != expected || out[n].time != expected || out[n].data[2] != (int16_t)~expected) {
+                bad++;
+            }
+            expected = number + 1;
+        }
+        if (++*passes % 64 == 0) {
+            for (volatile uint32_t spin = 0; spin < 20000; spin++) {
+            }   // a superloop pass that takes long, the ring fills
+        }
+    }
+    return bad;
+}
+
+static void Reset_Producer(void) {
+    Sample_Ring_Init(&ring);
+    accepted = 0;
+    attempts = 0;
+    bursts = 0;
+}
+
+/* Deterministic: a burst lands at every barrier the consumer passes, with
+   the ring mostly full */
+static void Test_Preempted_At_Barriers(void) {
+    uint32_t passes = 0;
+
+    Reset_Producer();
+    preempt_at_barriers = 1;
+    uint32_t bad = Consume(&passes);
+    preempt_at_barriers = 0;
+    printf("preempted at the barriers: %u samples, %u refused while full, %u consumer passes\n",
+           (unsigned)accepted, (unsigned)ring.overruns, passes);
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(attempts - accepted, ring.overruns);
+    CHECK(ring.overruns > 0);
+    CHECK_EQ(Sample_Ring_Count(&ring), 0);
+}
+
+/* Random: a timer signal preempts the consumer at any instruction, as on
+   the single-core target */
+static void Test_Preempted_By_Signal(void) {
+    struct itimerval timer = { { 0, 20 }, { 0, 20 } };
+    uint32_t passes = 0;
+
+    Reset_Producer();
+    signal(SIGALRM, Producer);
+    setitimer(ITIMER_REAL, &timer, NULL);
+    uint32_t bad = Consume(&passes);
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+    signal(SIGALRM, SIG_DFL);
+    printf("preempted by a timer: %u samples in %u interrupts, %u refused while full, %u consumer passes\n",
+           (unsigned)accepted, (unsigned)bursts, (unsigned)ring.overruns, passes);
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(attempts - accepted, ring.overruns);
+    CHECK_EQ(Sample_Ring_Count(&ring), 0);
+}
+
+int main(void) {
+    Test_Single_Thread();
+    Test_Preempted_At_Barriers();
+    Test_Preempted_By_Signal();
+    TEST_EXIT();
+}
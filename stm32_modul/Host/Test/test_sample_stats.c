@@ -0,0 +1,48 @@
+/**
+  ******************************************************************************
+  * @file           : test_sample_stats.c
+  * @brief          : Report_Sample_Stats() with every counter at its widest:
+  *                   the line is longer than stats_msg and must be cut at
+  *                   the buffer instead of running past it, and still be
+  *                   sent as one line.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <string.h>
+
+int main(void) {
+    MX_USB_DEVICE_Init();
+    Sim_Idle(STATS_REPORT_INTERVAL + 10);
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        sensor_stats[i].edges = sensor_stats[i].delivered = sensor_stats[i].rejected = UINT32_MAX;
+        sensor_stats[i].coalesced = sensor_stats[i].overruns = UINT32_MAX;
+        sensor_stats[i].reads = 1;
+        sensor_stats[i].read_cycles = UINT32_MAX;
+        sample_rings[i].overruns = UINT32_MAX;
+    }
+    uart_rx_overflows = uart_rx_errors = UINT32_MAX;
+    memset(&esp_transport_stats, 0xFF, sizeof(esp_transport_stats));
+    spool_stats.peak = spool_stats.dropped = UINT32_MAX;
+    ahrs_updates = 1;
+    ahrs_cycles = UINT32_MAX;
+
+    Report_Sample_Stats();
+    Sim_Idle(10);
+
+    size_t length;
+    const uint8_t *sent = Sim_Usb_Captured(&length);
+    printf("%zu bytes: %.*s", length, (int)length, (const char *)sent);
+    CHECK_EQ(length, 511);
+    CHECK(length > 0 && sent[length - 1] == '\n');
+    CHECK(memchr(sent, '\n', length) == sent + length - 1);
+    CHECK(memchr(sent, '\0', length) == NULL);
+    CHECK(length > 24 && memcmp(sent, "MAG e=4294967295 ok=4294", 24) == 0);
+    TEST_EXIT();
+}
@@ -0,0 +1,144 @@
+/**
+  ******************************************************************************
+  * @file           : test_spectrum.c
+  * @brief          : Block spectra against known input. Spectrum_Real_Fft()
+  *                   has to match a double precision DFT of the same block,
+  *                   in the arm_rfft_fast_f32 packing, for noise, a tone,
+  *                   DC and Nyquist. Sines of two amplitudes, one on a bin
+  *                   and ones a half and a quarter bin off, fed through
+  *                   Spectrum_Add() at the gyro rate, have to be reported
+  *                   at their frequency and amplitude, in the right band,
+  *                   with nothing else of note in the spectrum. The second
+  *                   amplitude runs on the same state, so the report has to
+  *                   start each average from zero.
+  ******************************************************************************
+  */
+
+#include "spectrum.h"
+#include "sim_test.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define RATE_HZ 760.0f
+#define BIN_HZ (RATE_HZ / SPECTRUM_SIZE)
+#define FFT_TOLERANCE 2e-6       // of the largest |X|, single precision against double
+#define FREQUENCY_TOLERANCE 0.1  // bins
+#define AMPLITUDE_TOLERANCE 0.03 // of the amplitude, the window's scalloping across three bins
+#define LEAKAGE_TOLERANCE 0.02   // of the amplitude, in bands and peaks away from the tone
+
+static const double tone_bins[3] = { 20.0, 36.5, 92.25 };   // one per axis, main lobes inside a band
+static const double amplitudes[] = { 8000.0, 300.0 };
+
+/* Largest difference between the packed FFT of x and its DFT, relative to
+   the largest |X| */
+static double Fft_Error(const float *x) {
+    float packed[SPECTRUM_SIZE];
+    double error = 0, largest = 0;
+
+    for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+        packed[n] = x[n];
+    }
+    Spectrum_Real_Fft(packed);
+    for (uint16_t k = 0; k <= SPECTRUM_SIZE / 2; k++) {
+        double re = 0, im = 0;
+        for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+            double phase = 2.0 * M_PI * k * n / SPECTRUM_SIZE;
+            re += x[n] * cos(phase);
+            im -= x[n] * sin(phase);
+        }
+        double got_re, got_im;
+        if (k == 0 || k == SPECTRUM_SIZE / 2) {
+            got_re = packed[k == 0 ? 0 : 1];
+            got_im = 0;
+        } else {
+            got_re = packed[2 * k];
+            got_im = packed[2 * k + 1];
+        }
+        error = fmax(error, hypot(got_re - re, got_im - im));
+        largest = fmax(largest, hypot(re, im));
+    }
+    return error / largest;
+}
+
+static void Test_Fft(void) {
+    float x[SPECTRUM_SIZE];
+    double worst = 0;
+
+    srand(24);
+    for (uint8_t round = 0; round < 20; round++) {
+        for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+            x[n] = (float)(2.0 * rand() / RAND_MAX - 1.0);
+        }
+        worst = fmax(worst, Fft_Error(x));
+    }
+    CHECK(worst < FFT_TOLERANCE);
+    printf("FFT against the DFT, noise: largest error %.2g of the largest |X|\n", worst);
+
+    for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+        x[n] = (float)(cos(2.0 * M_PI * 13 * n / SPECTRUM_SIZE + 0.3));
+    }
+    CHECK(Fft_Error(x) < FFT_TOLERANCE);
+    for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+        x[n] = 1.0f;
+    }
+    CHECK(Fft_Error(x) < FFT_TOLERANCE);
+    for (uint16_t n = 0; n < SPECTRUM_SIZE; n++) {
+        x[n] = n % 2 ? -1.0f : 1.0f;
+    }
+    CHECK(Fft_Error(x) < FFT_TOLERANCE);
+}
+
+/* SPECTRUM_AVERAGE blocks of one sine per axis, starting at sample n */
+static void Feed(Spectrum_TypeDef *spectrum, double amplitude, uint32_t *n, Spectrum_Report_TypeDef *report) {
+    uint32_t first = *n;
+
+    for (uint32_t i = 0; i < SPECTRUM_AVERAGE * SPECTRUM_SIZE; i++, (*n)++) {
+        int16_t data[3];
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            double phase = 2.0 * M_PI * tone_bins[axis] * *n / SPECTRUM_SIZE + axis;
+            data[axis] = (int16_t)lrint(amplitude * sin(phase));
+        }
+        uint8_t full = Spectrum_Add(spectrum, data, *n * 1000);
+        CHECK_EQ(full, i == SPECTRUM_AVERAGE * SPECTRUM_SIZE - 1);
+    }
+    Spectrum_Report(spectrum, RATE_HZ, report);
+    CHECK_EQ(report->time, first * 1000);
+}
+
+static void Test_Tones(void) {
+    Spectrum_TypeDef spectrum;
+    Spectrum_Report_TypeDef report;
+    uint32_t n = 0;
+
+    Spectrum_Init(&spectrum);
+    for (uint8_t a = 0; a < sizeof(amplitudes) / sizeof(amplitudes[0]); a++) {
+        double amplitude = amplitudes[a];
+        Feed(&spectrum, amplitude, &n, &report);
+
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            const Spectrum_Peak_TypeDef *peaks = report.peaks[axis];
+            uint8_t band = (uint8_t)((tone_bins[axis] - 1) / (SPECTRUM_SIZE / 2 / SPECTRUM_BANDS));
+            printf("amplitude %.0f, tone at %.2f Hz (bin %.2f): peak %.2f Hz, %.1f, band %u %.1f\n", amplitude,
+                   tone_bins[axis] * BIN_HZ, tone_bins[axis], peaks[0].frequency, peaks[0].amplitude, band,
+                   report.bands[axis][band]);
+
+            CHECK_NEAR(peaks[0].frequency, tone_bins[axis] * BIN_HZ, FREQUENCY_TOLERANCE * BIN_HZ);
+            CHECK_NEAR(peaks[0].amplitude, amplitude, AMPLITUDE_TOLERANCE * amplitude);
+            CHECK_NEAR(report.bands[axis][band], amplitude, AMPLITUDE_TOLERANCE * amplitude);
+            for (uint8_t p = 1; p < SPECTRUM_PEAKS; p++) {
+                CHECK(peaks[p].amplitude < LEAKAGE_TOLERANCE * amplitude);
+            }
+            for (uint8_t b = 0; b < SPECTRUM_BANDS; b++) {
+                if (b != band) {
+                    CHECK(report.bands[axis][b] < LEAKAGE_TOLERANCE * amplitude);
+                }
+            }
+        }
+    }
+}
+
+int main(void) {
+    Test_Fft();
+    Test_Tones();
+    TEST_EXIT();
+}
@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file           : test_spi_dma.c
+  * @brief          : L3GD20 reads on the SPI DMA path at 190, 380 and 760 Hz.
+  *                   Once the sensors are set up, every INT2 edge has to
+  *                   start DMA transfers only, each with one CS low and one
+  *                   CS high, and publish one sample (GYRO_FIFO_MODE 0) or
+  *                   one watermark of samples (GYRO_FIFO_MODE 1) with none
+  *                   lost in the part. No blocking SPI call may run, so
+  *                   neither does pavza(), which only wraps those.
+  *                   Built once per GYRO_FIFO_MODE.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+
+#define RUN_MS 1000
+#define SAMPLES_PER_INT2 (GYRO_FIFO_MODE ? GYRO_FIFO_WATERMARK : 1)
+#define TRANSFERS_PER_INT2 (GYRO_FIFO_MODE ? 2 : 1)   // FIFO_SRC, then the samples
+
+static const float rates_hz[] = { 190.0f, 380.0f, 760.0f };
+
+int main(void) {
+    sim_esp.present = 0;
+    Sim_App_Run(1000);
+    uint32_t blocking = Sim_Spi_Blocking_Transfers();
+    CHECK(blocking > 0);   // the setup writes do use them
+
+    for (uint8_t r = 0; r < sizeof(rates_hz) / sizeof(rates_hz[0]); r++) {
+        Sim_Sensor_Set_Odr(SIM_SENSOR_GYR, rates_hz[r]);
+        Sim_App_Run(100);   // the part settles at the new rate
+
+        Sensor_Stats_TypeDef before = sensor_stats[SENSOR_GYR];
+        Sim_Sensor_Stats_TypeDef part = *Sim_Sensor_Stats(SIM_SENSOR_GYR);
+        uint32_t transfers = Sim_Spi_Dma_Transfers();
+        uint32_t selects = Sim_Spi_Selects();
+        blocking = Sim_Spi_Blocking_Transfers();
+
+        Sim_App_Run(RUN_MS);
+        uint32_t edges = sensor_stats[SENSOR_GYR].edges - before.edges;
+        uint32_t bursts = sensor_stats[SENSOR_GYR].reads - before.reads;
+        uint32_t samples = Sim_Sensor_Stats(SIM_SENSOR_GYR)->read - part.read;
+        transfers = Sim_Spi_Dma_Transfers() - transfers;
+        printf("%.0f Hz: %u INT2 edges, %u samples, %u DMA transfers, %u blocking\n", rates_hz[r], edges, samples,
+               transfers, Sim_Spi_Blocking_Transfers() - blocking);
+
+        CHECK(edges * SAMPLES_PER_INT2 >= 0.95 * rates_hz[r] * RUN_MS / 1000.0);
+        CHECK_EQ(samples, edges * SAMPLES_PER_INT2);
+        CHECK_EQ(transfers, edges * TRANSFERS_PER_INT2);
+        CHECK_EQ(bursts, edges);
+        CHECK_EQ(Sim_Spi_Selects() - selects, transfers);
+        CHECK_EQ(Sim_Spi_Blocking_Transfers(), blocking);
+        CHECK_EQ(sensor_stats[SENSOR_GYR].coalesced, before.coalesced);
+        CHECK_EQ(Sim_Sensor_Stats(SIM_SENSOR_GYR)->overwritten, part.overwritten);
+    }
+    TEST_EXIT();
+}
@@ -0,0 +1,127 @@
+/**
+  ******************************************************************************
+  * @file           : test_spool.c
+  * @brief          : Spool on the simulated flash of the SPOOL region: FIFO
+  *                   order across the RAM and flash rings, an upload that
+  *                   fails and is peeked again, and records written (and
+  *                   spilled to flash) while an upload is in flight.
+  ******************************************************************************
+  */
+
+#include "spool.h"
+#include "sim.h"
+#include "sim_test.h"
+#include "stm32f3xx_hal.h"
+#include <string.h>
+
+#define RECORD_LENGTH 100
+
+static uint8_t Erase(uintptr_t address) {
+    FLASH_EraseInitTypeDef erase = { FLASH_TYPEERASE_PAGES, (uint32_t)address, 1 };
+    uint32_t page_error = 0;
+    return HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK;
+}
+
+static uint8_t Program(uintptr_t address, uint16_t value) {
+    return HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, (uint32_t)address, value) == HAL_OK;
+}
+
+static const Spool_Port_TypeDef port = { Erase, Program };
+
+/* Record n holds n in its first bytes and a pattern after them */
+static void Make_Record(uint32_t n, uint8_t *record) {
+    memcpy(record, &n, sizeof(n));
+    for (uint16_t i = sizeof(n); i < RECORD_LENGTH; i++) {
+        record[i] = (uint8_t)(n * 7 + i);
+    }
+}
+
+static uint32_t written = 0;
+
+static uint8_t Write_Next(void) {
+    uint8_t record[RECORD_LENGTH];
+    Make_Record(written, record);
+    if (!Spool_Write(record, RECORD_LENGTH)) {
+        return 0;
+    }
+    written++;
+    return 1;
+}
+
+/* Checks that a peeked body holds records first, first+1, ...; returns how many */
+static uint32_t Check_Body(const uint8_t *body, uint16_t length, uint32_t first) {
+    uint8_t expected[RECORD_LENGTH];
+    CHECK_EQ(length % RECORD_LENGTH, 0);
+    for (uint16_t offset = 0; offset + RECORD_LENGTH <= length; offset += RECORD_LENGTH) {
+        Make_Record(first + offset / RECORD_LENGTH, expected);
+        if (memcmp(body + offset, expected, RECORD_LENGTH) != 0) {
+            fprintf(stderr, "record %u differs\n", first + offset / RECORD_LENGTH);
+            sim_test_failures++;
+            break;
+        }
+    }
+    return length / RECORD_LENGTH;
+}
+
+int main(void) {
+    static uint8_t body[1000];
+    uint32_t next = 0;     // oldest record not yet delivered
+
+    Spool_Init(&port, SIM_FLASH_BASE);
+
+    /* Fill past the RAM ring so the oldest records go to flash */
+    while (Spool_Ram_Bytes() + Spool_Flash_Bytes() < SPOOL_RAM_SIZE * 2) {
+        CHECK(Write_Next());
+    }
+    CHECK(Spool_Flash_Bytes() > 0);
+    CHECK_EQ(spool_stats.written, written);
+
+    /* An upload that fails leaves the records in place */
+    uint16_t length = Spool_Peek(body, sizeof(body));
+    CHECK(length > 0);
+    uint32_t count = Check_Body(body, length, next);
+    length = Spool_Peek(body, sizeof(body));
+    CHECK_EQ(Check_Body(body, length, next), count);
+    CHECK_EQ(spool_stats.consumed, 0);
+
+    /* Records written while it is in flight do not disturb it */
+    for (uint8_t i = 0; i < 20; i++) {
+        CHECK(Write_Next());
+    }
+    Spool_Consume();
+    next += count;
+    CHECK_EQ(spool_stats.consumed, count);
+
+    /* Drain the flash records, then an upload from RAM during which the RAM
+       ring fills and spills the peeked records to flash */
+    while (Spool_Flash_Bytes() > 0) {
+        length = Spool_Peek(body, sizeof(body));
+        next += Check_Body(body, length, next);
+        Spool_Consume();
+    }
+    length = Spool_Peek(body, sizeof(body));
+    count = Check_Body(body, length, next);
+    CHECK(count > 0);
+    uint32_t spilled = spool_stats.spilled;
+    while (spool_stats.spilled < spilled + (uint32_t)count * (RECORD_LENGTH + 2)) {
+        CHECK(Write_Next());
+    }
+    Spool_Consume();
+    next += count;
+
+    /* Everything that is left comes out in order, nothing twice or lost */
+    while (!Spool_Empty()) {
+        length = Spool_Peek(body, sizeof(body));
+        CHECK(length > 0);
+        if (length == 0) {
+            break;
+        }
+        next += Check_Body(body, length, next);
+        Spool_Consume();
+    }
+    CHECK_EQ(next, written);
+    CHECK_EQ(spool_stats.consumed, written);
+    CHECK_EQ(spool_stats.dropped, 0);
+    CHECK_EQ(spool_stats.flash_errors, 0);
+    TEST_EXIT();
+}
@@ -0,0 +1,78 @@
+/**
+  ******************************************************************************
+  * @file           : test_spool_upload.c
+  * @brief          : An uplink outage in MODE_ASCII_UART: the samples go to
+  *                   the spool as v2 frames, and when the network is back the
+  *                   first uploads are refused by the module. The server
+  *                   must still get every spooled frame of each sensor
+  *                   without gaps. An upload cut off between the module
+  *                   taking the data and its SEND OK is sent again, so a
+  *                   frame may arrive twice; the sequence tells.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <string.h>
+
+int main(void) {
+    Sim_App_Run(1000);
+    CHECK(connection_established);
+
+    Sim_Esp_Wifi_Lost();
+    Sim_App_Run(3000);
+    CHECK(!connection_established);
+    CHECK(!Spool_Empty());
+
+    /* Two payloads' worth of CIPSENDs are refused, three attempts each */
+    uint32_t failed = esp_transport_stats.failed;
+    Sim_Esp_Rule("AT+CIPSEND=", "\r\nERROR\r\n", 0, 2 * ESP_PROMPT_RETRIES);
+    Sim_Esp_Wifi_Back();
+    Sim_App_Run(10000);
+    CHECK(esp_transport_stats.failed > failed);
+    CHECK(Spool_Empty());
+    CHECK_EQ(spool_stats.dropped, 0);
+
+    /* The /spool bodies are frames back to back */
+    int64_t expected[SENSOR_COUNT] = { -1, -1, -1 };
+    uint32_t frames = 0, repeated = 0, gaps = 0, bad = 0;
+    for (uint32_t i = 0; i < Sim_Http_Request_Count(); i++) {
+        const Sim_Http_Request_TypeDef *request = Sim_Http_Request(i);
+        if (strcmp(request->path, "/spool") != 0) {
+            continue;
+        }
+        uint16_t offset = 0;
+        while (offset + FRAME_V2_HEADER_SIZE + 2 <= request->length) {
+            const uint8_t *frame = request->body + offset;
+            uint8_t sensor = frame[2] & 0x0F;
+            uint8_t count = frame[3];
+            uint32_t sequence = frame[4] | frame[5] << 8 | frame[6] << 16 | (uint32_t)frame[7] << 24;
+            uint16_t length = FRAME_V2_HEADER_SIZE + count * 6 + 2;
+            if (frame[0] != (HEADER_FRAME_V2 & 0xFF) || sensor >= SENSOR_COUNT || offset + length > request->length) {
+                bad++;
+                break;
+            }
+            if (expected[sensor] >= 0 && sequence > expected[sensor]) {
+                fprintf(stderr, "sensor %u: frame %u after %lld\n", sensor, sequence, (long long)expected[sensor]);
+                gaps++;
+            }
+            if (sequence + count > expected[sensor]) {
+                expected[sensor] = sequence + count;
+            } else {
+                repeated++;
+            }
+            frames++;
+            offset += length;
+        }
+    }
+    printf("%u spooled frames uploaded, %u of them again, %u failed payloads\n", frames, repeated,
+           esp_transport_stats.failed - failed);
+    CHECK(frames > 0);
+    CHECK_EQ(bad, 0);
+    CHECK_EQ(gaps, 0);
+    TEST_EXIT();
+}
@@ -0,0 +1,249 @@
+/**
+  ******************************************************************************
+  * @file           : test_summary.c
+  * @brief          : Window statistics. The Welford accumulators of
+  *                   summary.c against a two-pass reference in double: mean,
+  *                   variance and RMS of short and 60 s windows, full range
+  *                   noise and a small signal on a large offset (the
+  *                   accelerometer at rest), where a float sum of squares
+  *                   would have nothing left; min, max, count and times
+  *                   exact. Then the windows of Summarise_Samples() in
+  *                   MODE_BINARY_CDC across the 32-bit time wrap: each
+  *                   record holds the samples of one window length, the
+  *                   sample past it opens the next, a pause closes the
+  *                   window without empty records and a new length drops
+  *                   the open window.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <stdlib.h>
+
+#define TIME_START 0xFFFB6C20u    // 300 ms before the wrap
+#define PERIOD_US 1250            // 800 Hz
+#define GAP_US 1000000
+#define REGULAR 2000              // samples in 100 ms windows, 25 windows of 80
+#define AFTER_GAP 10              // dropped with the open window
+#define AFTER_CHANGE 600          // in 250 ms windows, 3 of 200, the last open
+#define TOTAL (REGULAR + AFTER_GAP + AFTER_CHANGE)
+#define RECORDS 27
+
+typedef struct {
+    double mean[3], variance[3], rms[3];
+    int16_t min[3], max[3];
+} Reference_TypeDef;
+
+/* Two passes in double: the mean first, then the deviations from it */
+static void Two_Pass(const Sample_TypeDef *samples, uint32_t count, Reference_TypeDef *ref) {
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        double sum = 0, deviations = 0, squares = 0;
+        ref->min[axis] = INT16_MAX;
+        ref->max[axis] = INT16_MIN;
+        for (uint32_t n = 0; n < count; n++) {
+            int16_t value = samples[n].data[axis];
+            sum += value;
+            squares += (double)value * value;
+            ref->min[axis] = value < ref->min[axis] ? value : ref->min[axis];
+            ref->max[axis] = value > ref->max[axis] ? value : ref->max[axis];
+        }
+        ref->mean[axis] = sum / count;
+        for (uint32_t n = 0; n < count; n++) {
+            double deviation = samples[n].data[axis] - ref->mean[axis];
+            deviations += deviation * deviation;
+        }
+        ref->variance[axis] = deviations / count;
+        ref->rms[axis] = sqrt(squares / count);
+    }
+}
+
+/* Float results against the reference, relative to the signal's size */
+static void Check_Stats(const Reference_TypeDef *ref, const int16_t min[3], const int16_t max[3],
+                        const float mean[3], const float variance[3], const float rms[3]) {
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        CHECK_EQ(min[axis], ref->min[axis]);
+        CHECK_EQ(max[axis], ref->max[axis]);
+        CHECK_NEAR(mean[axis], ref->mean[axis], 1e-5 * fabs(ref->mean[axis]) + 1e-3);
+        CHECK_NEAR(variance[axis], ref->variance[axis], 1e-4 * ref->variance[axis] + 1e-3);
+        CHECK_NEAR(rms[axis], ref->rms[axis], 1e-5 * ref->rms[axis] + 1e-3);
+    }
+}
+
+static Sample_TypeDef samples[80640];   // 60 s at the accelerometer's 1344 Hz
+
+static int16_t Random_Around(int32_t centre, int32_t spread) {
+    int32_t value = centre + (spread ? rand() % (2 * spread + 1) - spread : 0);
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : (int16_t)value;
+}
+
+static void Test_Against_Two_Pass(void) {
+    static const struct {
+        uint32_t count;
+        int32_t centre[3], spread[3];
+    } cases[] = {
+        { 1, { 100, -100, 0 }, { 0, 0, 0 } },
+        { 2, { 0, 0, 0 }, { 32767, 32767, 32767 } },
+        { 1000, { 0, 0, 0 }, { 32767, 32767, 32767 } },
+        { 5000, { 1234, -32768, 32767 }, { 0, 0, 0 } },          // constant, at the ends of the range
+        { 80640, { 0, 0, 8192 }, { 20, 20, 20 } },               // accelerometer at rest, 60 s
+        { 80640, { -16000, 3000, 25000 }, { 3000, 200, 5000 } },
+    };
+    Summary_TypeDef summary;
+
+    Summary_Reset(&summary);
+    CHECK_EQ(summary.count, 0);
+    CHECK_EQ(Summary_Variance(&summary, 0), 0);
+    CHECK_EQ(Summary_Rms(&summary, 0), 0);
+
+    srand(25);
+    for (uint8_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        uint32_t count = cases[c].count;
+        for (uint32_t n = 0; n < count; n++) {
+            for (uint8_t axis = 0; axis < 3; axis++) {
+                samples[n].data[axis] = Random_Around(cases[c].centre[axis], cases[c].spread[axis]);
+            }
+            samples[n].time = TIME_START + n * 744;   // wraps in the long windows
+        }
+        Summary_Reset(&summary);
+        for (uint32_t n = 0; n < count; n++) {
+            Summary_Add(&summary, &samples[n]);
+        }
+
+        Reference_TypeDef ref;
+        float variance[3], rms[3];
+        Two_Pass(samples, count, &ref);
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            variance[axis] = Summary_Variance(&summary, axis);
+            rms[axis] = Summary_Rms(&summary, axis);
+            CHECK(variance[axis] >= 0);
+        }
+        CHECK_EQ(summary.count, count);
+        CHECK_EQ(summary.start, samples[0].time);
+        CHECK_EQ(summary.end, samples[count - 1].time);
+        Check_Stats(&ref, summary.min, summary.max, summary.mean, variance, rms);
+
+        /* What a single precision sum and sum of squares would give */
+        float sum = 0, squares = 0;
+        for (uint32_t n = 0; n < count; n++) {
+            sum += samples[n].data[2];
+            squares += (float)samples[n].data[2] * samples[n].data[2];
+        }
+        float naive = squares / count - (sum / count) * (sum / count);
+        printf("%5u samples around %6d +- %5d: Z variance %.3f, Welford %.3f, float sums %.3f\n", count,
+               cases[c].centre[2], cases[c].spread[2], ref.variance[2], variance[2], naive);
+    }
+}
+
+/* The sample pattern of the windowed stream, the pause and the length
+   change included */
+static void Stream_Sample(uint32_t k, Sample_TypeDef *sample) {
+    sample->data[0] = (int16_t)(8192 + (k * 37) % 41 - 20);
+    sample->data[1] = (int16_t)(-300 + (k % 7) * 100);
+    sample->data[2] = (int16_t)((k * k) % 2000 - 1000);
+    sample->time = TIME_START + k * PERIOD_US;
+    if (k >= REGULAR) {
+        sample->time += GAP_US;
+    }
+}
+
+static uint32_t Get_Uint32(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static float Get_Float(const uint8_t *bytes) {
+    uint32_t bits = Get_Uint32(bytes);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void Test_Window_Rollover(void) {
+    static const struct {
+        uint32_t first, count;
+    } windows[RECORDS] = {
+        /* 25 windows of 100 ms, the last closed by the sample after the
+           pause; the 10 samples after it are dropped by the change; then
+           two of 250 ms */
+        { 0 * 80, 80 }, { 1 * 80, 80 }, { 2 * 80, 80 }, { 3 * 80, 80 }, { 4 * 80, 80 },
+        { 5 * 80, 80 }, { 6 * 80, 80 }, { 7 * 80, 80 }, { 8 * 80, 80 }, { 9 * 80, 80 },
+        { 10 * 80, 80 }, { 11 * 80, 80 }, { 12 * 80, 80 }, { 13 * 80, 80 }, { 14 * 80, 80 },
+        { 15 * 80, 80 }, { 16 * 80, 80 }, { 17 * 80, 80 }, { 18 * 80, 80 }, { 19 * 80, 80 },
+        { 20 * 80, 80 }, { 21 * 80, 80 }, { 22 * 80, 80 }, { 23 * 80, 80 }, { 24 * 80, 80 },
+        { REGULAR + AFTER_GAP, 200 }, { REGULAR + AFTER_GAP + 200, 200 },
+    };
+    Sample_TypeDef batch[16];
+    char change[] = "250";
+
+    MX_USB_DEVICE_Init();
+    Load_Device_Config();
+    transmission_mode = MODE_BINARY_CDC;
+    summary_window_ms = 100;
+    Summary_Reset(&summaries[SENSOR_ACC]);
+
+    for (uint32_t k = 0; k < TOTAL;) {
+        uint16_t count = 0;
+        if (k == REGULAR + AFTER_GAP) {
+            CHECK(Set_Summary_Window(change));
+        }
+        /* Batches as the drain pops them, none across the length change */
+        while (count < k % 16 + 1 && k < TOTAL && !(k == REGULAR + AFTER_GAP && count > 0)) {
+            Stream_Sample(k++, &batch[count++]);
+        }
+        Summarise_Samples(SENSOR_ACC, batch, count);
+        Sim_Idle(1);
+    }
+    Sim_Idle(10);
+
+    uint16_t window = 0;
+    CHECK_EQ(Config_Get(CONFIG_KEY_SUMMARY_WINDOW, &window, sizeof(window)), sizeof(window));
+    CHECK_EQ(window, 250);
+    CHECK_EQ(summary_records, RECORDS);
+    CHECK_EQ(summary_dropped, 0);
+    CHECK_EQ(summarised_samples, TOTAL);
+
+    size_t length;
+    const uint8_t *usb = Sim_Usb_Captured(&length);
+    CHECK_EQ(length, RECORDS * SUMMARY_FRAME_SIZE);
+    for (uint16_t r = 0; r < RECORDS && (r + 1) * SUMMARY_FRAME_SIZE <= length; r++) {
+        const uint8_t *frame = &usb[r * SUMMARY_FRAME_SIZE];
+        uint32_t first = windows[r].first, count = windows[r].count;
+        int16_t min[3], max[3];
+        float mean[3], variance[3], rms[3];
+
+        CHECK_EQ(frame[0] | frame[1] << 8, HEADER_SUMMARY);
+        CHECK_EQ(frame[2], SENSOR_ACC);
+        CHECK_EQ(frame[SUMMARY_FRAME_SIZE - 2] | frame[SUMMARY_FRAME_SIZE - 1] << 8,
+                 Crc16_Ccitt(frame, SUMMARY_FRAME_SIZE - 2));
+        CHECK_EQ(Get_Uint32(&frame[3]), r);
+
+        for (uint32_t n = 0; n < count; n++) {
+            Stream_Sample(first + n, &samples[n]);
+        }
+        CHECK_EQ(Get_Uint32(&frame[7]), samples[0].time);
+        CHECK_EQ(Get_Uint32(&frame[11]), samples[count - 1].time);
+        CHECK_EQ(Get_Uint32(&frame[15]), count);
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            const uint8_t *stats = &frame[19 + axis * 16];
+            min[axis] = (int16_t)(stats[0] | stats[1] << 8);
+            max[axis] = (int16_t)(stats[2] | stats[3] << 8);
+            mean[axis] = Get_Float(&stats[4]);
+            variance[axis] = Get_Float(&stats[8]);
+            rms[axis] = Get_Float(&stats[12]);
+        }
+        Reference_TypeDef ref;
+        Two_Pass(samples, count, &ref);
+        Check_Stats(&ref, min, max, mean, variance, rms);
+    }
+    printf("%u records of %u samples over the time wrap, a pause and a window change\n",
+           (unsigned)summary_records, (unsigned)summarised_samples);
+}
+
+int main(void) {
+    Test_Against_Two_Pass();
+    Test_Window_Rollover();
+    TEST_EXIT();
+}
@@ -0,0 +1,54 @@
+/**
+  ******************************************************************************
+  * @file           : test_superloop.c
+  * @brief          : Runs main() from reset against the simulated board:
+  *                   sensor setup, ESP warm start into the boot mode and the
+  *                   superloop for a few seconds of virtual time. Reports
+  *                   for each sensor the samples the part converted, the
+  *                   ones the firmware delivered and where the rest were
+  *                   lost.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+
+#define RUN_MS 5000
+
+static void Report(void) {
+    static const char *labels[SENSOR_COUNT] = { "MAG", "ACC", "GYR" };
+    printf("sensor   odr  produced  read  ovw(part)  edges  delivered  rejected  lost  full  ovr\n");
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        const Sim_Sensor_Stats_TypeDef *part = Sim_Sensor_Stats(i);
+        printf("%-6s %5.0f  %8u  %4u  %9u  %5u  %9u  %8u  %4u  %4u  %3u\n", labels[i], Sim_Sensor_Odr(i),
+               part->produced, part->read, part->overwritten, (unsigned)sensor_stats[i].edges,
+               (unsigned)sensor_stats[i].delivered, (unsigned)sensor_stats[i].rejected,
+               (unsigned)sensor_stats[i].coalesced, (unsigned)sample_rings[i].overruns,
+               (unsigned)sensor_stats[i].overruns);
+    }
+    size_t usb_length;
+    Sim_Usb_Captured(&usb_length);
+    printf("ESP commands %u, HTTP requests %u, USB bytes %zu\n", Sim_Esp_Command_Count(),
+           Sim_Http_Request_Count(), usb_length);
+}
+
+int main(void) {
+    Sim_App_Run(RUN_MS);
+    Report();
+
+    for (uint8_t i = 0; i < SENSOR_COUNT; i++) {
+        const Sim_Sensor_Stats_TypeDef *part = Sim_Sensor_Stats(i);
+        CHECK(Sim_Sensor_Odr(i) > 0);
+        CHECK(part->produced > 0);
+        CHECK(sensor_stats[i].delivered > 0);
+        // Everything the part converted was read or is still waiting in its FIFO
+        CHECK(part->read + part->overwritten + Sim_Sensor_Fifo_Level(i) + 1 >= part->produced);
+    }
+    CHECK(Sim_Esp_Count("AT+CIPSERVER=1") > 0);
+    CHECK(Sim_Http_Request_Count() > 0);
+    TEST_EXIT();
+}
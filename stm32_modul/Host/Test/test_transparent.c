@@ -0,0 +1,167 @@
+/**
+  ******************************************************************************
+  * @file           : test_transparent.c
+  * @brief          : MODE_BINARY_TCP against the simulated ESP, entered and
+  *                   left with long button presses as on the board. The
+  *                   module has to get the open script in order (server
+  *                   off, links closed, CIPMUX=0, CIPSTART to the stream
+  *                   port, CIPMODE=1, CIPSEND), then only v2 frames with
+  *                   unbroken sequences until "+++", which has to come
+  *                   after ESP_ESCAPE_GUARD of silence, and the restore
+  *                   script no sooner than the module takes commands
+  *                   again; the page server must be back. With "refused"
+  *                   the stream server turns the
+  *                   connection down and the firmware has to go straight
+  *                   to the restore script.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include "esp_script.h"
+#include <string.h>
+
+#define STREAM_MS 3000
+#define PAGE_REQUEST "GET / HTTP/1.1\r\nHost: 192.168.4.1\r\n\r\n"
+
+static const char *const open_script[] = {
+    "AT+CIPSERVER=0",
+    "AT+CIPCLOSE=5",
+    "AT+CIPMUX=0",
+    "AT+CIPSTART=\"TCP\",\"" SERVER_IP "\"," ESP_STRINGIFY(STREAM_PORT),
+    "AT+CIPMODE=1",
+    "AT+CIPSEND",
+};
+
+static const char *const restore_script[] = {
+    "AT+CIPMODE=0",
+    "AT+CIPCLOSE",
+    "AT+CIPMUX=1",
+    "AT+CIPSERVERMAXCONN=" ESP_STRINGIFY(ESP_SERVER_MAX_CONN),
+    "AT+CIPSERVER=1,80",
+};
+
+/* One long press, handled by the superloop */
+static void Next_Mode(void) {
+    Sim_Button_Press(600);
+    Sim_App_Run(700);
+}
+
+/* The bytes the stream server got: v2 frames back to back with good CRCs
+   and the sequence of each sensor going on from its last frame; returns
+   the samples */
+static uint32_t Check_Frames(const uint8_t *stream, size_t length) {
+    uint32_t sequence[SENSOR_COUNT], samples = 0, frames = 0;
+    uint8_t seen[SENSOR_COUNT] = { 0 };
+    size_t offset = 0;
+
+    while (offset + FRAME_V2_HEADER_SIZE + 2 <= length) {
+        const uint8_t *frame = &stream[offset];
+        uint8_t sensor = frame[2] & 0x0F, count = frame[3];
+        uint16_t size = FRAME_V2_HEADER_SIZE + count * 6 + 2;
+        uint32_t first = frame[4] | frame[5] << 8 | frame[6] << 16 | (uint32_t)frame[7] << 24;
+
+        if ((frame[0] | frame[1] << 8) != HEADER_FRAME_V2 || frame[2] >> 4 != 2 || sensor >= SENSOR_COUNT ||
+            count == 0 || count > FRAME_V2_MAX_SAMPLES || offset + size > length ||
+            (frame[size - 2] | frame[size - 1] << 8) != Crc16_Ccitt(frame, size - 2)) {
+            fprintf(stderr, "no v2 frame at byte %zu of the stream\n", offset);
+            sim_test_failures++;
+            return samples;
+        }
+        if (seen[sensor]) {
+            CHECK_EQ(first, sequence[sensor]);
+        }
+        seen[sensor] = 1;
+        sequence[sensor] = first + count;
+        samples += count;
+        frames++;
+        offset += size;
+    }
+    CHECK_EQ(offset, length);
+    printf("stream: %zu bytes, %u frames, %u samples\n", length, frames, samples);
+    return samples;
+}
+
+static void Test_Session(void) {
+    Next_Mode();   // MODE_BINARY_CDC
+    Next_Mode();   // MODE_ASCII_CDC
+    uint32_t first = Sim_Esp_Command_Count();
+    Next_Mode();
+    CHECK_EQ(transmission_mode, MODE_BINARY_TCP);
+    Sim_App_Run(STREAM_MS);
+
+    uint32_t opened = Esp_Script_Find(first, open_script[0]);
+    uint32_t streaming = Esp_Script_Expect(opened, open_script, ESP_SCRIPT_LINES(open_script));
+    CHECK_EQ(Sim_Esp_Command_Count(), streaming);   // nothing in command mode while streaming
+    CHECK(Sim_Esp_Transparent());
+    CHECK_EQ(esp_transport_stats.stream_opens, 1);
+    CHECK_EQ(esp_transport_stats.stream_full, 0);
+
+    /* Leaving the mode: the last bytes go out, then the escape after a
+       pause; the stream is watched in steps to see when it went quiet */
+    size_t length, last_length;
+    Sim_Esp_Stream(&last_length);
+    uint64_t quiet_since = Sim_Now_Us();
+    Sim_Button_Press(600);
+    for (uint32_t ms = 0; ms < 5000 && Sim_Esp_Count("+++") == 0; ms += 5) {
+        Sim_App_Run(5);
+        Sim_Esp_Stream(&length);
+        if (length != last_length) {
+            last_length = length;
+            quiet_since = Sim_Now_Us();
+        }
+    }
+    Sim_App_Run(4000);
+    CHECK_EQ(transmission_mode, MODE_QUATERNION_CDC);
+
+    uint32_t escape = Esp_Script_Find(streaming, "+++");
+    CHECK_EQ(escape, streaming);
+    CHECK(Esp_Script_Time_S(escape) - quiet_since / 1e6 >= ESP_ESCAPE_GUARD / 1000.0 - 0.005);
+    uint32_t restored = Esp_Script_Expect(escape + 1, restore_script, ESP_SCRIPT_LINES(restore_script));
+    CHECK(Esp_Script_Time_S(escape + 1) - Esp_Script_Time_S(escape) >= 1.0);
+    CHECK_EQ(Sim_Esp_Command_Count(), restored);
+    CHECK(!Sim_Esp_Transparent());
+    CHECK(Sim_Esp_Web_Request(PAGE_REQUEST) >= 0);
+
+    /* Everything queued reached the server, as whole frames */
+    const uint8_t *stream = Sim_Esp_Stream(&length);
+    CHECK_EQ(length, esp_transport_stats.stream_bytes);
+    CHECK(Check_Frames(stream, length) > 0);
+    printf("open %.3f s, streaming %.3f s, \"+++\" %.3f s after the last byte, restored %.3f s\n",
+           Esp_Script_Time_S(opened), Esp_Script_Time_S(streaming - 1), Esp_Script_Time_S(escape) - quiet_since / 1e6,
+           Esp_Script_Time_S(restored - 1));
+}
+
+/* The stream server turns the connection down: no CIPMODE=1, no "+++" */
+static void Test_Refused(void) {
+    Next_Mode();
+    Next_Mode();
+    Sim_Esp_Rule("AT+CIPSTART=\"TCP\"", "\r\nERROR\r\nCLOSED\r\n", 10, 1);
+    uint32_t first = Sim_Esp_Command_Count();
+    Next_Mode();
+    Sim_App_Run(STREAM_MS);
+
+    uint32_t opened = Esp_Script_Find(first, open_script[0]);
+    uint32_t failed = Esp_Script_Expect(opened, open_script, 4);
+    uint32_t restored = Esp_Script_Expect(failed, restore_script, ESP_SCRIPT_LINES(restore_script));
+    CHECK_EQ(Sim_Esp_Command_Count(), restored);
+    CHECK_EQ(Sim_Esp_Count("+++"), 0);
+    CHECK_EQ(esp_transport_stats.stream_opens, 0);
+    CHECK(!Sim_Esp_Transparent());
+    CHECK(Sim_Esp_Web_Request(PAGE_REQUEST) >= 0);
+}
+
+int main(int argc, char **argv) {
+    Sim_App_Run(2000);   // warm start into MODE_ASCII_UART
+    CHECK_EQ(transmission_mode, MODE_ASCII_UART);
+    if (argc > 1 && strcmp(argv[1], "refused") == 0) {
+        Test_Refused();
+    } else {
+        Test_Session();
+    }
+    TEST_EXIT();
+}
@@ -0,0 +1,85 @@
+/**
+  ******************************************************************************
+  * @file           : test_transport_block.c
+  * @brief          : A page request that arrives right behind the send
+  *                   engine's SEND OK. The DMA hands the bytes over in
+  *                   half-buffer chunks, so the superloop sees the SEND OK
+  *                   together with the first part of the request; that must
+  *                   not end the block, or the form is parsed half received
+  *                   and the rest is cleared away.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include <string.h>
+
+#define ROUNDS 8
+#define PASSWORD "correct-horse-battery-staple-0123456789"
+
+static char request[512];
+static uint8_t padding;
+static int web_link;
+
+/* Runs at the SEND OK's time, after it: the request follows it on the line */
+static void Send_Page_Request(void *context) {
+    static const char blank_lines[] = "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n"
+                                      "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n"
+                                      "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n"
+                                      "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n";
+    (void)context;
+    Sim_Esp_Inject(&blank_lines[sizeof(blank_lines) - 1 - padding]);
+    web_link = Sim_Esp_Web_Request(request);
+    CHECK(web_link >= 0);
+}
+
+int main(void) {
+    Sim_App_Run(1000);
+    CHECK(Sim_Http_Request_Count() > 0);
+
+    for (uint8_t round = 0; round < ROUNDS; round++) {
+        /* Wait until a payload went out, its SEND OK is due send_ms later */
+        uint32_t payloads = Sim_Esp_Count("<");
+        uint32_t joins = Sim_Esp_Count("AT+CWJAP=");
+        for (uint32_t ms = 0; ms < 5000 && Sim_Esp_Count("<") == payloads; ms++) {
+            Sim_App_Run(1);
+        }
+        CHECK(Sim_Esp_Count("<") > payloads);
+        const Sim_Esp_Command_TypeDef *payload = NULL;
+        for (uint32_t i = Sim_Esp_Command_Count(); i-- > 0 && payload == NULL;) {
+            if (Sim_Esp_Command(i)->text[0] == '<') {
+                payload = Sim_Esp_Command(i);
+            }
+        }
+
+        /* The padding moves the DMA chunk boundaries through the request */
+        padding = round * 16;
+        snprintf(request, sizeof(request),
+                 "GET /?ssid=Lab%u&password=" PASSWORD " HTTP/1.1\r\n"
+                 "Host: 192.168.4.1\r\n"
+                 "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+                 "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+                 "Accept-Language: sl,en-US;q=0.7,en;q=0.3\r\n\r\n", round);
+        Sim_At(payload->time_us + (uint64_t)sim_esp.send_ms * 1000, Send_Page_Request, NULL);
+        Sim_App_Run(5000);
+        if (web_link >= 0) {
+            Sim_Esp_Close_Link(web_link);  // the browser gives up on the page
+        }
+
+        char ssid[8];
+        snprintf(ssid, sizeof(ssid), "Lab%u", round);
+        CHECK_EQ(strcmp(device_config.ssid, ssid), 0);
+        CHECK_EQ(strcmp(device_config.password, PASSWORD), 0);
+        CHECK_EQ(Sim_Esp_Count("AT+CWJAP=") - joins, 1);
+        if (sim_test_failures) {
+            fprintf(stderr, "round %u: ssid \"%s\" password \"%s\"\n", round, device_config.ssid,
+                    device_config.password);
+            break;
+        }
+    }
+    TEST_EXIT();
+}
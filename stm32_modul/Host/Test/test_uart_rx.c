@@ -0,0 +1,191 @@
+/**
+  ******************************************************************************
+  * @file           : test_uart_rx.c
+  * @brief          : Circular DMA reception of the ESP8266 link. First the
+  *                   DMA is played by the test: bursts of every length are
+  *                   written around the 256-byte area with the half, full
+  *                   and idle line events the peripheral raises, repeated
+  *                   ones included and late ones whose events the idle
+  *                   one took, and rx_buffer and the AT tokenizer have
+  *                   to get the stream exactly, across every wrap. A stream
+  *                   longer than rx_buffer is cut and counted, not wrapped.
+  *                   Then the same through the simulated USART2, counting
+  *                   the interrupts per byte at 115200 and 921600 baud.
+  ******************************************************************************
+  */
+
+#define HAL_UARTEx_RxEventCallback Firmware_Rx_Event_Callback
+#define main App_Main
+#include "main.c"
+#undef main
+#undef HAL_UARTEx_RxEventCallback
+
+#include "sim.h"
+#include "sim_test.h"
+#include <string.h>
+
+#define STREAM_SIZE 6000
+
+static uint32_t rx_events = 0;
+
+/* Counts the events the peripheral raises, then hands them to the firmware */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size) {
+    rx_events++;
+    Firmware_Rx_Event_Callback(huart, Size);
+}
+
+/* Stands in for the DMA channel and USART2 */
+static uint16_t dma_position = 0;
+static uint32_t late_wraps = 0;
+
+static void Dma_Event(uint16_t size) {
+    HAL_UARTEx_RxEventCallback(&huart2, size);
+}
+
+/* Writes a burst into the circular area as the DMA would: an event when
+   the half and the end are reached, then an idle line event where the
+   burst stopped (none at 0, the HAL leaves that out); repeat adds an idle
+   event at a position already reported, as after a half event. A late
+   burst has its half and end events taken by the idle one, as when the
+   interrupts were held off while it came in, so a burst that wraps is
+   reported by a position below the last one. */
+static void Dma_Burst(const uint8_t *data, uint16_t length, uint8_t repeat, uint8_t late) {
+    for (uint16_t i = 0; i < length; i++) {
+        uart_dma_buffer[dma_position++] = data[i];
+        if (dma_position == UART_DMA_BUFFER_SIZE / 2 && !late) {
+            Dma_Event(dma_position);
+        } else if (dma_position == UART_DMA_BUFFER_SIZE) {
+            if (!late) {
+                Dma_Event(UART_DMA_BUFFER_SIZE);
+            } else if (i + 1 < length) {
+                late_wraps++;
+            }
+            dma_position = 0;
+        }
+    }
+    if (dma_position != 0) {
+        Dma_Event(dma_position);
+        if (repeat) {
+            Dma_Event(dma_position);
+        }
+    }
+}
+
+static uint32_t Count_Ok_Events(void) {
+    At_Event_TypeDef event;
+    uint32_t ok = 0;
+    while (At_Parser_Next(&event)) {
+        ok += event.type == AT_EVENT_OK;
+    }
+    return ok;
+}
+
+static char stream[STREAM_SIZE + 1];
+
+/* Reply-like text: numbered lines, every third one an OK */
+static uint32_t Build_Stream(size_t size) {
+    size_t length = 0;
+    uint32_t ok = 0;
+    for (uint32_t line = 0; length + 48 < size; line++) {
+        if (line % 3 == 2) {
+            length += sprintf(&stream[length], "OK\r\n");
+            ok++;
+        } else {
+            length += sprintf(&stream[length], "+CIFSR:STAIP,\"192.168.%u.%u\"\r\n", line % 256, line / 7 % 256);
+        }
+    }
+    stream[length] = '\0';
+    return ok;
+}
+
+static void Check_Rx_Buffer(const char *expected, size_t length) {
+    CHECK_EQ(rx_index, length);
+    if (memcmp((const char *)rx_buffer, expected, length) != 0) {
+        fprintf(stderr, "rx_buffer differs from the bytes sent\n");
+        sim_test_failures++;
+    }
+    CHECK_EQ(rx_buffer[length], '\0');
+}
+
+static void Test_Dma_Played(void) {
+    uint32_t ok = Build_Stream(STREAM_SIZE);
+    size_t length = strlen(stream);
+
+    /* Bursts of 1 to 300 bytes, so every start and end offset in the area
+       and every wrap case comes up; every third one shorter than the area
+       is late */
+    for (uint8_t pass = 0; pass < 3; pass++) {
+        size_t offset = 0;
+        uint16_t burst = 1 + pass;
+        Clear_RX_Text();
+        At_Parser_Reset();
+        uint32_t ok_seen = 0, bursts = 0;
+        while (offset < length) {
+            uint16_t chunk = length - offset < burst ? length - offset : burst;
+            Dma_Burst((const uint8_t *)&stream[offset], chunk, offset % 5 == 0,
+                      chunk < UART_DMA_BUFFER_SIZE && bursts++ % 3 == 1);
+            offset += chunk;
+            burst = burst % 300 + 7 + pass;
+            ok_seen += Count_Ok_Events();
+        }
+        Check_Rx_Buffer(stream, length);
+        CHECK_EQ(ok_seen, ok);
+    }
+    CHECK(late_wraps > 10);
+    CHECK_EQ(uart_rx_overflows, 0);
+
+    /* More than rx_buffer holds without a clear: the start is kept, the
+       excess is counted */
+    Clear_RX_Text();
+    uint32_t sent = 0;
+    while (sent < RX_BUFFER_SIZE + 500) {
+        Dma_Burst((const uint8_t *)stream, 200, 0, 0);
+        sent += 200;
+    }
+    CHECK_EQ(rx_index, RX_BUFFER_SIZE - 1);
+    CHECK_EQ(uart_rx_overflows, sent - (RX_BUFFER_SIZE - 1));
+    CHECK_EQ(rx_buffer[RX_BUFFER_SIZE - 1], '\0');
+    CHECK_EQ(memcmp((const char *)rx_buffer, stream, 200), 0);
+    uart_rx_overflows = 0;
+}
+
+/* The ESP model sends replies at the given rate; one event per half area
+   plus one per reply instead of one per byte */
+static void Test_Simulated_Uart(uint32_t baud) {
+    static char expected[RX_BUFFER_SIZE];
+    char reply[400];
+    size_t total = 0;
+    uint32_t replies = 0;
+
+    HAL_UART_AbortReceive(&huart2);
+    huart2.Init.BaudRate = baud;
+    HAL_UART_Init(&huart2);
+    sim_esp.baud = baud;
+    Uart_Rx_Start();
+    Clear_RX_Text();
+    rx_events = 0;
+    for (size_t offset = 0; offset + sizeof(reply) < strlen(stream) && total + sizeof(reply) < RX_BUFFER_SIZE;
+         offset += 97) {
+        size_t length = 40 + offset % 300;
+        memcpy(reply, &stream[offset], length);
+        reply[length] = '\0';
+        Sim_Esp_Inject(reply);
+        Sim_Idle(length * 10000 / baud + 5);
+        memcpy(&expected[total], reply, length);
+        total += length;
+        replies++;
+    }
+    Check_Rx_Buffer(expected, total);
+    CHECK_EQ(uart_rx_overflows, 0);
+    printf("%7u baud: %zu bytes in %u replies, %u DMA events (%.1f bytes per interrupt)\n", baud, total, replies,
+           rx_events, (double)total / rx_events);
+    CHECK(rx_events <= replies + 2 * total / UART_DMA_BUFFER_SIZE + 2);
+}
+
+int main(void) {
+    MX_USART2_UART_Init();
+    Test_Dma_Played();
+    Test_Simulated_Uart(115200);
+    Test_Simulated_Uart(921600);
+    TEST_EXIT();
+}
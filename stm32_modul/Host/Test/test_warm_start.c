@@ -0,0 +1,141 @@
+/**
+  ******************************************************************************
+  * @file           : test_warm_start.c
+  * @brief          : ESP bring-up at boot against the simulated module, one
+  *                   module state per run, named on the command line. After
+  *                   the baud negotiation the module has to get the three
+  *                   state queries, then only the setup commands that state
+  *                   is missing and the first CIPSTART, nothing else: a
+  *                   module that kept CIPMUX:1 gets no setup at all, one
+  *                   in station mode CWMODE=3, one off its access point
+  *                   the stored network, and without a stored one no
+  *                   connect. The first sample has to reach the server
+  *                   within a second of reset (plus the join). A module
+  *                   that does not answer leaves the firmware booting cold.
+  ******************************************************************************
+  */
+
+#define main App_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+#include "sim_test.h"
+#include "esp_script.h"
+#include <string.h>
+
+#define RUN_MS 3000
+#define SETUP_MS 20             // queries and setup at the negotiated rate
+#define FIRST_DELIVERY_MS 1000
+#define JOIN_MS 1500
+#define STORED_SSID "Lab"
+#define STORED_PASSWORD "secret"
+
+#define QUERIES "AT+CWMODE?", "AT+CIPMUX?", "AT+CIPSTATUS"
+#define SERVER_SETUP "AT+CIPMUX=1", "AT+CIPSERVERMAXCONN=" ESP_STRINGIFY(ESP_SERVER_MAX_CONN), "AT+CIPSERVER=1,80"
+#define CONNECT "AT+CIPSTART=" ESP_STRINGIFY(ESP_LINK_ID) ",\"TCP\",\"" SERVER_IP "\"," ESP_STRINGIFY(SERVER_PORT)
+
+static const char *const after_reset[] = { QUERIES, SERVER_SETUP, CONNECT };
+static const char *const kept_mux[] = { QUERIES, CONNECT };
+static const char *const station_mode[] = { QUERIES, "AT+CWMODE=3", SERVER_SETUP, CONNECT };
+static const char *const stored_network[] = {
+    QUERIES, SERVER_SETUP, "AT+CWJAP=\"" STORED_SSID "\",\"" STORED_PASSWORD "\"", CONNECT
+};
+static const char *const no_network[] = { QUERIES, SERVER_SETUP };
+
+typedef struct {
+    const char *name;
+    const char *const *script;
+    uint32_t lines;
+    uint8_t connects;         // the script ends in CIPSTART and data flows
+    uint32_t extra_ms;        // the join, on top of SETUP_MS and FIRST_DELIVERY_MS
+} Scenario_TypeDef;
+
+static const Scenario_TypeDef scenarios[] = {
+    { "reset", after_reset, ESP_SCRIPT_LINES(after_reset), 1, 0 },
+    { "warm", kept_mux, ESP_SCRIPT_LINES(kept_mux), 1, 0 },
+    { "station", station_mode, ESP_SCRIPT_LINES(station_mode), 1, 0 },
+    { "stored", stored_network, ESP_SCRIPT_LINES(stored_network), 1, JOIN_MS },
+    { "no_network", no_network, ESP_SCRIPT_LINES(no_network), 0, 0 },
+};
+
+/* The module state each run starts from */
+static void Prepare(const char *name) {
+    if (strcmp(name, "warm") == 0) {
+        sim_esp.mux = 1;
+    } else if (strcmp(name, "station") == 0) {
+        sim_esp.wifi_mode = 1;
+    } else if (strcmp(name, "stored") == 0 || strcmp(name, "no_network") == 0) {
+        sim_esp.station_status = 5;
+        sim_esp.join_ms = JOIN_MS;
+    }
+    if (strcmp(name, "stored") == 0) {   // provisioned over the web page before
+        Load_Device_Config();
+        CHECK(Save_Setting(CONFIG_KEY_SSID, STORED_SSID, strlen(STORED_SSID)));
+        CHECK(Save_Setting(CONFIG_KEY_PASSWORD, STORED_PASSWORD, strlen(STORED_PASSWORD)));
+    }
+}
+
+static void Test_Scenario(const Scenario_TypeDef *scenario) {
+    Prepare(scenario->name);
+    Sim_App_Run(RUN_MS);
+
+    /* Only the baud negotiation comes before the queries */
+    uint32_t first = Esp_Script_Find(0, "AT+CWMODE?");
+    for (uint32_t i = 0; i < first; i++) {
+        const char *text = Sim_Esp_Command(i)->text;
+        CHECK(strcmp(text, "AT") == 0 || strncmp(text, "AT+UART_CUR=", 12) == 0);
+    }
+    uint32_t end = Esp_Script_Expect(first, scenario->script, scenario->lines);
+    double setup_ms = (Esp_Script_Time_S(end - 1) - Esp_Script_Time_S(first)) * 1000;
+    CHECK(setup_ms <= SETUP_MS + scenario->extra_ms);
+
+    if (!scenario->connects) {
+        CHECK_EQ(Sim_Esp_Count("AT+CIPSTART"), 0);
+        CHECK_EQ(Sim_Http_Request_Count(), 0);
+        CHECK(transmission_mode != WARM_START_MODE);
+        printf("%s: %u commands from the first query, %.1f ms, no connect\n", scenario->name, end - first,
+               setup_ms);
+        return;
+    }
+    CHECK_EQ(transmission_mode, WARM_START_MODE);
+    CHECK(connection_established);
+    CHECK(Sim_Http_Request_Count() > 0);
+    if (Sim_Http_Request_Count() > 0) {
+        double first_delivery_ms = Sim_Http_Request(0)->time_us / 1000.0;
+        printf("%s: %u commands from the first query, %.1f ms, first request at the server %.0f ms after reset\n",
+               scenario->name, end - first, setup_ms, first_delivery_ms);
+        CHECK(first_delivery_ms <= FIRST_DELIVERY_MS + scenario->extra_ms);
+    }
+    CHECK(esp_transport_stats.payload_bytes > 0);
+}
+
+/* No answer to anything: the firmware gives up on the ESP and boots */
+static void Test_Absent(void) {
+    sim_esp.present = 0;
+    Sim_App_Run(RUN_MS);
+    CHECK_EQ(Sim_Esp_Command_Count(), 0);
+    CHECK(transmission_mode != WARM_START_MODE);
+    CHECK(!connection_established);
+    for (uint8_t sensor = 0; sensor < SENSOR_COUNT; sensor++) {
+        CHECK(sensor_stats[sensor].edges + Sim_Sensor_Stats(sensor)->read > 0);   // the superloop runs
+    }
+    printf("absent: cold start, superloop running\n");
+}
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "reset";
+
+    if (strcmp(name, "absent") == 0) {
+        Test_Absent();
+        TEST_EXIT();
+    }
+    for (uint8_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (strcmp(name, scenarios[i].name) == 0) {
+            Test_Scenario(&scenarios[i]);
+            TEST_EXIT();
+        }
+    }
+    fprintf(stderr, "usage: %s [reset|warm|station|stored|no_network|absent]\n", argv[0]);
+    return 2;
+}
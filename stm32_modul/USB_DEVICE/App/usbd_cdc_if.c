@@ -62,6 +62,13 @@
   */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+/* UserTxBufferFS is used as a ring, the index math needs a power of two */
+#if (APP_TX_DATA_SIZE & (APP_TX_DATA_SIZE - 1)) != 0
+#error "APP_TX_DATA_SIZE must be a power of two"
+#endif
+#if (CDC_RX_RING_SIZE & (CDC_RX_RING_SIZE - 1)) != 0
+#error "CDC_RX_RING_SIZE must be a power of two"
+#endif
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -94,6 +101,18 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+/* Transmit ring on UserTxBufferFS: CDC_Transmit_FS() appends at tx_head, the
+   transfer in flight covers tx_inflight bytes from tx_tail and its completion
+   starts the next one. */
+static volatile uint16_t tx_head = 0;
+static volatile uint16_t tx_tail = 0;
+static volatile uint16_t tx_inflight = 0;
+
+/* Receive ring: CDC_Receive_FS() copies each OUT packet in at rx_head, the
+   superloop takes the bytes from rx_tail with CDC_Read_FS(). */
+static uint8_t rx_ring[CDC_RX_RING_SIZE];
+static volatile uint16_t rx_head = 0;
+static volatile uint16_t rx_tail = 0;
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -109,6 +128,8 @@ uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 extern USBD_HandleTypeDef hUsbDeviceFS;
 
 /* USER CODE BEGIN EXPORTED_VARIABLES */
+volatile CDC_Tx_Stats_TypeDef cdc_tx_stats;
+volatile uint32_t cdc_rx_dropped = 0;  /* received bytes that found the ring full */
 
 /* USER CODE END EXPORTED_VARIABLES */
 
@@ -125,8 +146,10 @@ static int8_t CDC_Init_FS(void);
 static int8_t CDC_DeInit_FS(void);
 static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
+static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void CDC_Tx_Start_FS(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -139,7 +162,8 @@ USBD_CDC_ItfTypeDef USBD_Interface_fops_FS =
   CDC_Init_FS,
   CDC_DeInit_FS,
   CDC_Control_FS,
-  CDC_Receive_FS
+  CDC_Receive_FS,
+  CDC_TransmitCplt_FS
 };
 
 /* Private functions ---------------------------------------------------------*/
@@ -153,6 +177,10 @@ static int8_t CDC_Init_FS(void)
   /* Set Application Buffers */
   USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+  /* Whatever was queued or in flight before a re-enumeration is gone */
+  cdc_tx_stats.dropped += (uint16_t)(tx_head - tx_tail) & (APP_TX_DATA_SIZE - 1);
+  tx_tail = tx_head;
+  tx_inflight = 0;
   return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -259,6 +287,17 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length)
 static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
+  uint16_t head = rx_head;
+  for (uint32_t i = 0; i < *Len; i++) {
+    uint16_t next = (head + 1) & (CDC_RX_RING_SIZE - 1);
+    if (next == rx_tail) {
+      cdc_rx_dropped += *Len - i;
+      break;
+    }
+    rx_ring[head] = Buf[i];
+    head = next;
+  }
+  rx_head = head;
   USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
   USBD_CDC_ReceivePacket(&hUsbDeviceFS);
   return (USBD_OK);
@@ -270,27 +309,112 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
   *         Data to send over USB IN endpoint are sent over CDC interface
   *         through this function.
   *         @note
-  *
+  *         The data is copied into the transmit ring and sent from there, Buf
+  *         can be reused as soon as the function returns. Call from thread
+  *         context only (single producer).
   *
   * @param  Buf: Buffer of data to be sent
   * @param  Len: Number of data to be sent (in bytes)
-  * @retval USBD_OK if all operations are OK else USBD_FAIL or USBD_BUSY
+  * @retval USBD_OK if the data was queued, USBD_BUSY if the ring had no room
+  *         for all of it (nothing is queued then)
   */
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 {
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
-  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
-  if (hcdc->TxState != 0){
+  if (Len > CDC_Tx_Free_FS()) {
+    cdc_tx_stats.dropped += Len;
     return USBD_BUSY;
   }
-  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, Buf, Len);
-  result = USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+  uint16_t head = tx_head;
+  for (uint16_t i = 0; i < Len; i++) {
+    UserTxBufferFS[(head + i) & (APP_TX_DATA_SIZE - 1)] = Buf[i];
+  }
+  tx_head = (head + Len) & (APP_TX_DATA_SIZE - 1);
+  cdc_tx_stats.queued += Len;
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  CDC_Tx_Start_FS();
+  __set_PRIMASK(primask);
   /* USER CODE END 7 */
   return result;
 }
 
+/**
+  * @brief  CDC_TransmitCplt_FS
+  *         Data transmitted callback, releases the sent bytes and chains
+  *         the next transfer from the ring.
+  *
+  * @param  Buf: Buffer of data that was sent
+  * @param  Len: Number of data sent (in bytes)
+  * @param  epnum: Endpoint number
+  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+  */
+static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum)
+{
+  uint8_t result = USBD_OK;
+  /* USER CODE BEGIN 13 */
+  UNUSED(Buf);
+  UNUSED(Len);
+  UNUSED(epnum);
+  tx_tail = (tx_tail + tx_inflight) & (APP_TX_DATA_SIZE - 1);
+  cdc_tx_stats.sent += tx_inflight;
+  tx_inflight = 0;
+  CDC_Tx_Start_FS();
+  /* USER CODE END 13 */
+  return result;
+}
+
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+  * @brief  Bytes that CDC_Transmit_FS() can still queue. One slot stays empty
+  *         so a full ring is not mistaken for an empty one.
+  */
+uint16_t CDC_Tx_Free_FS(void)
+{
+  return (APP_TX_DATA_SIZE - 1) - ((uint16_t)(tx_head - tx_tail) & (APP_TX_DATA_SIZE - 1));
+}
+
+/**
+  * @brief  Takes up to Len received bytes out of the receive ring. Call from
+  *         thread context only (single consumer).
+  * @retval Number of bytes copied to Buf
+  */
+uint16_t CDC_Read_FS(uint8_t* Buf, uint16_t Len)
+{
+  uint16_t tail = rx_tail;
+  uint16_t count = 0;
+  while (count < Len && tail != rx_head) {
+    Buf[count++] = rx_ring[tail];
+    tail = (tail + 1) & (CDC_RX_RING_SIZE - 1);
+  }
+  rx_tail = tail;
+  return count;
+}
+
+/**
+  * @brief  Starts a transfer of the contiguous queued bytes at tx_tail when
+  *         the IN endpoint is idle. Runs with the USB interrupt excluded.
+  */
+static void CDC_Tx_Start_FS(void)
+{
+  USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+  if (hcdc == NULL || hcdc->TxState != 0 || tx_inflight != 0) {
+    return;
+  }
+  uint16_t tail = tx_tail;
+  uint16_t head = tx_head;
+  if (head == tail) {
+    return;
+  }
+  uint16_t length = (head > tail) ? head - tail : APP_TX_DATA_SIZE - tail;
+
+  USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &UserTxBufferFS[tail], length);
+  if (USBD_CDC_TransmitPacket(&hUsbDeviceFS) == USBD_OK) {
+    tx_inflight = length;
+  }
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
@@ -51,7 +51,7 @@
 #define APP_RX_DATA_SIZE  1024
 #define APP_TX_DATA_SIZE  1024
 /* USER CODE BEGIN EXPORTED_DEFINES */
-
+#define CDC_RX_RING_SIZE  256   /* received bytes waiting for CDC_Read_FS(), power of two */
 /* USER CODE END EXPORTED_DEFINES */
 
 /**
@@ -64,6 +64,13 @@
   */
 
 /* USER CODE BEGIN EXPORTED_TYPES */
+/* Byte counters of the transmit ring, every byte passed to CDC_Transmit_FS()
+   ends up either queued (and later sent) or dropped */
+typedef struct {
+  uint32_t queued;
+  uint32_t sent;
+  uint32_t dropped;
+} CDC_Tx_Stats_TypeDef;
 
 /* USER CODE END EXPORTED_TYPES */
 
@@ -93,6 +100,8 @@
 extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 
 /* USER CODE BEGIN EXPORTED_VARIABLES */
+extern volatile CDC_Tx_Stats_TypeDef cdc_tx_stats;
+extern volatile uint32_t cdc_rx_dropped;
 
 /* USER CODE END EXPORTED_VARIABLES */
 
@@ -108,6 +117,8 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+uint16_t CDC_Tx_Free_FS(void);
+uint16_t CDC_Read_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 
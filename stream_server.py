@@ -0,0 +1,105 @@
+"""TCP listener for the STM32 transparent streaming mode (MODE_BINARY_TCP in main.c).
+
+The ESP8266 opens one connection to STREAM_PORT and forwards v2 sample frames
+(see sensor_frames.py) without any HTTP framing; with a summary window set it
+forwards summary frames instead, which are printed as they arrive. Once per second the listener
+prints the received throughput, samples per sensor, sequence gaps and the
+bytes skipped while resynchronising, so the uplink can be benchmarked locally.
+
+Usage: python stream_server.py [port]   (default 5001)
+"""
+import socket
+import sys
+import time
+
+import sensor_frames
+
+STREAM_PORT = 5001
+REPORT_INTERVAL = 1.0
+
+
+class StreamStats:
+    def __init__(self):
+        self.bytes = 0
+        self.frames = 0
+        self.skipped = 0
+        self.samples = {name: 0 for name in sensor_frames.SENSORS}
+        self.gaps = {name: 0 for name in sensor_frames.SENSORS}
+        self.next_sequence = {}
+
+    def count_frame(self, frame):
+        sensor = frame['sensor']
+        expected = self.next_sequence.get(sensor)
+        if expected is not None:
+            gap = (frame['sequence'] - expected) & 0xFFFFFFFF
+            if gap < 0x80000000:  # a step back means the board restarted its counters
+                self.gaps[sensor] += gap
+        self.next_sequence[sensor] = (frame['sequence'] + len(frame['samples'])) & 0xFFFFFFFF
+        self.samples[sensor] += len(frame['samples'])
+        self.frames += 1
+
+    def report(self, elapsed):
+        rates = ' '.join(f"{name}={count / elapsed:.0f}/s" for name, count in self.samples.items())
+        gaps = ' '.join(f"{name}={count}" for name, count in self.gaps.items())
+        print(f"{self.bytes / elapsed / 1024:7.2f} KiB/s  {self.frames / elapsed:6.0f} frames/s  "
+              f"{rates}  lost {gaps}  skipped {self.skipped} B")
+        self.bytes = self.frames = self.skipped = 0
+        self.samples = dict.fromkeys(self.samples, 0)
+        self.gaps = dict.fromkeys(self.gaps, 0)
+
+
+def serve_connection(connection):
+    stats = StreamStats()
+    buffer = b''
+    last_report = time.monotonic()
+    connection.settimeout(REPORT_INTERVAL)
+    while True:
+        try:
+            data = connection.recv(4096)
+            if not data:
+                break
+            stats.bytes += len(data)
+            buffer += data
+        except socket.timeout:
+            pass
+
+        while buffer:
+            if buffer[:2] == b'\x52\xa5':
+                summary, consumed = sensor_frames.decode_summary(buffer)
+                if summary is not None:
+                    print(sensor_frames.format_summary(summary))
+                    buffer = buffer[consumed:]
+                    continue
+                if consumed == 0:
+                    break
+            frame, consumed = sensor_frames.decode_v2(buffer)
+            if consumed == 0:
+                break
+            if frame is None:
+                stats.skipped += consumed
+            else:
+                stats.count_frame(frame)
+            buffer = buffer[consumed:]
+
+        now = time.monotonic()
+        if now - last_report >= REPORT_INTERVAL:
+            stats.report(now - last_report)
+            last_report = now
+
+
+def main(port):
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as server:
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server.bind(('0.0.0.0', port))
+        server.listen(1)
+        print(f"Listening for the sample stream on port {port}")
+        while True:
+            connection, address = server.accept()
+            print(f"Stream connected from {address[0]}:{address[1]}")
+            with connection:
+                serve_connection(connection)
+            print("Stream closed")
+
+
+if __name__ == '__main__':
+    main(int(sys.argv[1]) if len(sys.argv) > 1 else STREAM_PORT)